@@ -0,0 +1,95 @@
+#ifndef _ARENA_H_
+#define _ARENA_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <vector>
+
+/*
+* Monotonic allocator for load-time temporaries. Allocations bump a pointer through
+* large blocks, nothing is freed on its own and release() drops every block at once.
+* Not thread-safe, parallel tasks each get their own arena.
+*/
+class MonotonicArena
+{
+public:
+	explicit MonotonicArena(size_t blockSize = 1 << 20)
+		:blockSize(blockSize), cursor(NULL), blockEnd(NULL), reserved(0) {}
+	~MonotonicArena()
+	{
+		this->release();
+	}
+	MonotonicArena(const MonotonicArena&) = delete;
+	MonotonicArena& operator=(const MonotonicArena&) = delete;
+
+	void* allocate(size_t size, size_t alignment)
+	{
+		uintptr_t aligned = ((uintptr_t)this->cursor + alignment - 1) & ~(uintptr_t)(alignment - 1);
+		if (this->cursor == NULL || aligned + size > (uintptr_t)this->blockEnd)
+		{
+			// Oversized requests get a block of their own so the current block stays usable
+			const size_t newSize = size + alignment > this->blockSize / 4 ? size + alignment : this->blockSize;
+			unsigned char* block = (unsigned char*)::operator new(newSize);
+			this->blocks.push_back(block);
+			this->reserved += newSize;
+			aligned = ((uintptr_t)block + alignment - 1) & ~(uintptr_t)(alignment - 1);
+			if (newSize != this->blockSize)
+			{
+				return (void*)aligned;
+			}
+			this->blockEnd = block + newSize;
+		}
+		this->cursor = (unsigned char*)(aligned + size);
+		return (void*)aligned;
+	}
+	/*
+	* Free everything at once, pointers from this arena are invalid afterwards
+	*/
+	void release()
+	{
+		for (size_t i = 0; i < this->blocks.size(); ++i)
+		{
+			::operator delete(this->blocks[i]);
+		}
+		this->blocks.clear();
+		this->cursor = this->blockEnd = NULL;
+		this->reserved = 0;
+	}
+	size_t bytesReserved() const { return this->reserved; }
+private:
+	std::vector<unsigned char*> blocks;
+	size_t blockSize;
+	unsigned char* cursor;
+	unsigned char* blockEnd;
+	size_t reserved;
+};
+
+/*
+* Standard allocator over a MonotonicArena, deallocate is a no-op
+*/
+template <typename T>
+class ArenaAllocator
+{
+public:
+	typedef T value_type;
+	explicit ArenaAllocator(MonotonicArena& arena) :arena(&arena) {}
+	template <typename U>
+	ArenaAllocator(const ArenaAllocator<U>& other) :arena(other.arena) {}
+	T* allocate(size_t count)
+	{
+		return (T*)this->arena->allocate(count * sizeof(T), alignof(T));
+	}
+	void deallocate(T*, size_t) {}
+	template <typename U>
+	bool operator==(const ArenaAllocator<U>& other) const { return this->arena == other.arena; }
+	template <typename U>
+	bool operator!=(const ArenaAllocator<U>& other) const { return this->arena != other.arena; }
+
+	MonotonicArena* arena;
+};
+
+template <typename T>
+using ArenaVector = std::vector<T, ArenaAllocator<T> >;
+
+#endif
@@ -0,0 +1,39 @@
+#version 330
+
+// Same interface block as scene.frag, only the texture coordinate is read
+in VS_OUT
+{
+	in vec3 FragPos;
+	in vec2 TextCoord;
+	in vec3 FragNormal;
+	vec3 TangentLightPos;
+    vec3 TangentViewPos;
+    vec3 TangentFragPos;
+}fs_in;
+
+// Set by VirtualTextureSystem::bind, as for scene.frag
+uniform bool virtualDiffuse;
+uniform vec2 virtualSize; // Level 0 texels
+uniform int virtualMaxLevel;
+uniform int virtualTextureId;
+uniform float feedbackLodBias; // The feedback target is smaller than the screen
+const float PAGE_SIZE = 128.0;
+
+out vec4 color;
+
+// Records the page sampleVirtual in scene.frag would want here: column, row, level, texture.
+// Each is stored in 8 bits, VirtualTextureSystem keeps textures within 255 pages per side
+void main()
+{
+	if (!virtualDiffuse)
+	{
+		color = vec4(0.0);
+		return;
+	}
+	vec2 texel = fs_in.TextCoord * virtualSize;
+	vec2 dx = dFdx(texel), dy = dFdy(texel);
+	float lod = 0.5 * log2(max(dot(dx, dx), dot(dy, dy))) + feedbackLodBias;
+	int level = int(clamp(lod, 0.0, float(virtualMaxLevel)));
+	vec2 page = floor(fract(fs_in.TextCoord) * virtualSize / exp2(float(level)) / PAGE_SIZE);
+	color = vec4(page, float(level), float(virtualTextureId)) / 255.0;
+}
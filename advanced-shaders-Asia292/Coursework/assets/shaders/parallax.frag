@@ -57,8 +57,9 @@ void main()
 
 	// Diffuse reflected light component
 	vec3    lightDir = normalize(fs_in.TangentLightPos - fs_in.TangentFragPos);
-	vec3	normal = texture(normalMap, textCoord).rgb;
-	normal = normalize(normal * 2.0 - 1.0);
+	// Normal maps store X/Y only, Z is rebuilt from the unit length
+	vec2	xy = texture(normalMap, textCoord).rg * 2.0 - 1.0;
+	vec3	normal = vec3(xy, sqrt(max(1.0 - dot(xy, xy), 0.0)));
 	float	diffFactor = max(dot(lightDir, normal), 0.0);
 	vec3	diffuse = diffFactor * light.diffuse;
 
@@ -10,6 +10,7 @@ in VS_OUT
     vec3 TangentViewPos;
     vec3 TangentFragPos;
 }fs_in;
+flat in vec3 TextureLayers; // Diffuse, specular and normal layer, negative for none
 
 // Light source attribute structure
 struct LightAttr
@@ -27,29 +28,90 @@ uniform sampler2D texture_diffuse0;
 uniform sampler2D texture_specular0;
 uniform sampler2D texture_normal0;
 
+// Packed textures in place of the three above, see TextureArraySet
+uniform bool textureArrays;
+uniform sampler2DArray diffuseArray;
+uniform sampler2DArray specularArray;
+uniform sampler2DArray normalArray;
+
+// Virtual diffuse texture in place of texture_diffuse0, see VirtualTextureSystem
+uniform bool virtualDiffuse;
+uniform usampler2D pageTable; // Per page: cache column, row, level found
+uniform sampler2D pageCache;
+uniform vec2 virtualSize; // Level 0 texels
+uniform int virtualMaxLevel; // Held by a single page, always resident
+uniform float pageCacheScale; // 1 / cache texels
+const float PAGE_SIZE = 128.0;
+const float PAGE_BORDER = 4.0;
+const float PHYSICAL_PAGE_SIZE = 136.0;
+
 out vec4 color;
 
+// Pages are placed by level 0 texels scaled down, see VirtualPageTable
+vec4 sampleVirtualLevel(vec2 uv, int level)
+{
+	vec2 texel = fract(uv) * virtualSize / exp2(float(level));
+	uvec4 entry = texelFetch(pageTable, ivec2(texel / PAGE_SIZE), level);
+	int resident = int(entry.b);
+	if (resident != level)
+	{
+		// Missing page, the table points at the nearest coarser one
+		texel = fract(uv) * virtualSize / exp2(float(resident));
+	}
+	vec2 inPage = texel - floor(texel / PAGE_SIZE) * PAGE_SIZE;
+	vec2 physical = vec2(entry.rg) * PHYSICAL_PAGE_SIZE + PAGE_BORDER + inPage;
+	return textureLod(pageCache, physical * pageCacheScale, 0.0);
+}
+
+// Trilinear between the two levels around the footprint
+vec4 sampleVirtual(vec2 uv)
+{
+	vec2 texel = uv * virtualSize;
+	vec2 dx = dFdx(texel), dy = dFdy(texel);
+	float lod = clamp(0.5 * log2(max(dot(dx, dx), dot(dy, dy))), 0.0, float(virtualMaxLevel));
+	int level = int(lod);
+	vec4 fine = sampleVirtualLevel(uv, level);
+	if (level >= virtualMaxLevel)
+	{
+		return fine;
+	}
+	return mix(fine, sampleVirtualLevel(uv, level + 1), fract(lod));
+}
+
+// A material texture, from its array layer when packed
+vec4 sampleMaterial(sampler2D plainTexture, sampler2DArray arrayTexture, float layer)
+{
+	if (!textureArrays)
+	{
+		return texture(plainTexture, fs_in.TextCoord);
+	}
+	return layer < 0.0 ? vec4(0.0) : texture(arrayTexture, vec3(fs_in.TextCoord, layer));
+}
+
 void main()
 {   
+	vec3	albedo = virtualDiffuse ? sampleVirtual(fs_in.TextCoord).rgb
+		: sampleMaterial(texture_diffuse0, diffuseArray, TextureLayers.x).rgb;
 	// Ambient light component
-	vec3	ambient = light.ambient * vec3(texture(texture_diffuse0, fs_in.TextCoord));
+	vec3	ambient = light.ambient * albedo;
 	vec3    viewDir = normalize(fs_in.TangentViewPos - fs_in.TangentFragPos);
 	// Diffuse reflected light component
 	vec3    lightDir = normalize(fs_in.TangentLightPos - fs_in.TangentFragPos);
 	vec3	normal = normalize(fs_in.FragNormal);
 
-	if(normalMapping)
+	if(normalMapping && !(textureArrays && TextureLayers.z < 0.0))
 	{
-		normal = texture(texture_normal0, fs_in.TextCoord).rgb;
-		normal = normalize(normal * 2.0 - 1.0);
+		// Normal maps store X/Y only, Z is rebuilt from the unit length
+		vec2	xy = sampleMaterial(texture_normal0, normalArray, TextureLayers.z).rg * 2.0 - 1.0;
+		normal = vec3(xy, sqrt(max(1.0 - dot(xy, xy), 0.0)));
 	}
 
 	float	diffFactor = max(dot(lightDir, normal), 0.0);
-	vec3	diffuse = diffFactor * light.diffuse * vec3(texture(texture_diffuse0, fs_in.TextCoord));
+	vec3	diffuse = diffFactor * light.diffuse * albedo;
 	float	specFactor = 0.0;
 	vec3	halfDir = normalize(lightDir + viewDir);
 	specFactor = pow(max(dot(halfDir, normal), 0.0), 64.0);
-	vec3	specular = specFactor * light.specular * vec3(texture(texture_specular0, fs_in.TextCoord));;
+	vec3	specular = specFactor * light.specular * sampleMaterial(texture_specular0, specularArray, TextureLayers.y).rgb;
 
 	vec3	result = (ambient + diffuse + specular );
 	color	= vec4(result , 1.0f);
@@ -0,0 +1,111 @@
+#ifndef _CONCURRENT_QUEUE_H_
+#define _CONCURRENT_QUEUE_H_
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+
+/*
+* Bounded lock-free multi-producer multi-consumer queue (Dmitry Vyukov's design).
+* Each cell carries a sequence number saying whether it is ready for a push or a pop,
+* so producers and consumers only contend on their own position counter.
+*/
+template <typename T>
+class ConcurrentQueue
+{
+public:
+	/*
+	* Capacity is rounded up to a power of two
+	*/
+	explicit ConcurrentQueue(size_t capacity)
+	{
+		size_t size = 2;
+		while (size < capacity)
+		{
+			size <<= 1;
+		}
+		this->mask = size - 1;
+		this->cells.reset(new Cell[size]);
+		for (size_t i = 0; i < size; ++i)
+		{
+			this->cells[i].sequence.store(i, std::memory_order_relaxed);
+		}
+		this->enqueuePos.store(0, std::memory_order_relaxed);
+		this->dequeuePos.store(0, std::memory_order_relaxed);
+	}
+	ConcurrentQueue(const ConcurrentQueue&) = delete;
+	ConcurrentQueue& operator=(const ConcurrentQueue&) = delete;
+	/*
+	* False when the queue is full
+	*/
+	bool tryPush(const T& value)
+	{
+		size_t pos = this->enqueuePos.load(std::memory_order_relaxed);
+		for (;;)
+		{
+			Cell& cell = this->cells[pos & this->mask];
+			const size_t sequence = cell.sequence.load(std::memory_order_acquire);
+			const ptrdiff_t diff = (ptrdiff_t)sequence - (ptrdiff_t)pos;
+			if (diff == 0)
+			{
+				if (this->enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+				{
+					cell.value = value;
+					cell.sequence.store(pos + 1, std::memory_order_release);
+					return true;
+				}
+			}
+			else if (diff < 0)
+			{
+				return false;
+			}
+			else
+			{
+				pos = this->enqueuePos.load(std::memory_order_relaxed);
+			}
+		}
+	}
+	/*
+	* False when the queue is empty
+	*/
+	bool tryPop(T& value)
+	{
+		size_t pos = this->dequeuePos.load(std::memory_order_relaxed);
+		for (;;)
+		{
+			Cell& cell = this->cells[pos & this->mask];
+			const size_t sequence = cell.sequence.load(std::memory_order_acquire);
+			const ptrdiff_t diff = (ptrdiff_t)sequence - (ptrdiff_t)(pos + 1);
+			if (diff == 0)
+			{
+				if (this->dequeuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+				{
+					value = cell.value;
+					cell.sequence.store(pos + this->mask + 1, std::memory_order_release);
+					return true;
+				}
+			}
+			else if (diff < 0)
+			{
+				return false;
+			}
+			else
+			{
+				pos = this->dequeuePos.load(std::memory_order_relaxed);
+			}
+		}
+	}
+private:
+	struct Cell
+	{
+		std::atomic<size_t> sequence;
+		T value;
+	};
+	std::unique_ptr<Cell[]> cells;
+	size_t mask;
+	// Kept on separate cache lines so producers and consumers do not false share
+	alignas(64) std::atomic<size_t> enqueuePos;
+	alignas(64) std::atomic<size_t> dequeuePos;
+};
+
+#endif
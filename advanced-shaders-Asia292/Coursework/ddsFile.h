@@ -0,0 +1,638 @@
+#ifndef _DDS_FILE_H_
+#define _DDS_FILE_H_
+
+#include <GLEW/glew.h>
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+#include "mappedFile.h"
+#include "texture.h"
+#include "textureMips.h"
+
+// DDS_PIXELFORMAT
+struct DdsPixelFormat
+{
+	uint32_t size;
+	uint32_t flags;
+	uint32_t fourCC;
+	uint32_t rgbBitCount;
+	uint32_t rBitMask, gBitMask, bBitMask, aBitMask;
+};
+
+// DDS_HEADER, follows the "DDS " magic
+struct DdsHeader
+{
+	uint32_t size;
+	uint32_t flags;
+	uint32_t height;
+	uint32_t width;
+	uint32_t pitchOrLinearSize;
+	uint32_t depth;
+	uint32_t mipMapCount;
+	uint32_t reserved1[11]; // Free for tools, our cache files keep their key here
+	DdsPixelFormat pixelFormat;
+	uint32_t caps, caps2, caps3, caps4;
+	uint32_t reserved2;
+};
+
+// DDS_HEADER_DXT10, follows DdsHeader when the FourCC is "DX10"
+struct DdsHeaderDx10
+{
+	uint32_t dxgiFormat;
+	uint32_t resourceDimension;
+	uint32_t miscFlag;
+	uint32_t arraySize;
+	uint32_t miscFlags2;
+};
+
+static_assert(sizeof(DdsPixelFormat) == 32 && sizeof(DdsHeader) == 124 && sizeof(DdsHeaderDx10) == 20,
+	"DDS headers must match the file layout");
+
+// How a DDS format maps to GL: block compressed formats take blockBytes per 4x4 block,
+// the rest texelBytes per texel uploaded as picFormat/type
+struct DdsFormat
+{
+	GLenum internalFormat;
+	GLenum picFormat;
+	GLenum type;
+	uint32_t blockBytes;
+	uint32_t texelBytes;
+	DdsFormat() :internalFormat(0), picFormat(0), type(0), blockBytes(0), texelBytes(0) {}
+	DdsFormat(GLenum internalFormat, uint32_t blockBytes) :internalFormat(internalFormat), picFormat(0), type(0),
+		blockBytes(blockBytes), texelBytes(0) {}
+	DdsFormat(GLenum internalFormat, GLenum picFormat, GLenum type, uint32_t texelBytes) :internalFormat(internalFormat),
+		picFormat(picFormat), type(type), blockBytes(0), texelBytes(texelBytes) {}
+	bool isValid() const { return this->internalFormat != 0; }
+	bool isCompressed() const { return this->blockBytes != 0; }
+	uint64_t levelSize(uint32_t width, uint32_t height) const
+	{
+		if (this->isCompressed())
+		{
+			return (uint64_t)std::max(1u, (width + 3) / 4) * std::max(1u, (height + 3) / 4) * this->blockBytes;
+		}
+		return (uint64_t)width * height * this->texelBytes;
+	}
+};
+
+/*
+* Reads DDS files as mip chains and writes the block compressed ones this app produces.
+* Reading maps the file and the chain's levels point straight into it, so textures are
+* uploaded from the mapping without an intermediate copy. Every header field is checked
+* against the file size before a level is handed out.
+*/
+class DdsFile
+{
+public:
+	static const uint32_t DDS_FOURCC_DXT1 = 0x31545844; // "DXT1"
+	static const uint32_t DDS_FOURCC_DXT2 = 0x32545844; // "DXT2", premultiplied DXT3
+	static const uint32_t DDS_FOURCC_DXT3 = 0x33545844; // "DXT3"
+	static const uint32_t DDS_FOURCC_DXT4 = 0x34545844; // "DXT4", premultiplied DXT5
+	static const uint32_t DDS_FOURCC_DXT5 = 0x35545844; // "DXT5"
+	static const uint32_t DDS_FOURCC_DX10 = 0x30315844; // "DX10"
+	static const uint32_t DDS_FOURCC_ATI1 = 0x31495441; // "ATI1", legacy BC4
+	static const uint32_t DDS_FOURCC_BC4U = 0x55344342; // "BC4U"
+	static const uint32_t DDS_FOURCC_BC4S = 0x53344342; // "BC4S"
+	static const uint32_t DDS_FOURCC_ATI2 = 0x32495441; // "ATI2", legacy BC5
+	static const uint32_t DDS_FOURCC_BC5U = 0x55354342; // "BC5U"
+	static const uint32_t DDS_FOURCC_BC5S = 0x53354342; // "BC5S"
+	static const uint32_t MAX_DIMENSION = 1 << 16;
+
+	/*
+	* Validate a DDS image in memory: a single 2D texture with a supported format whose
+	* levels all fit inside size bytes. Levels are offsets from dataOffset. On failure
+	* reason says why. Touches no GL state, any thread.
+	*/
+	static bool parse(const unsigned char* data, uint64_t size, DdsFormat& format,
+		std::vector<MipLevel>& levels, uint64_t& dataOffset, const char*& reason)
+	{
+		format = DdsFormat();
+		levels.clear();
+		dataOffset = 4 + sizeof(DdsHeader);
+		if (data == NULL || size < dataOffset)
+		{
+			reason = "truncated header";
+			return false;
+		}
+		if (memcmp(data, "DDS ", 4) != 0)
+		{
+			reason = "not a DDS file";
+			return false;
+		}
+		DdsHeader header;
+		memcpy(&header, data + 4, sizeof(header));
+		if (header.size != sizeof(DdsHeader) || header.pixelFormat.size != sizeof(DdsPixelFormat))
+		{
+			reason = "bad header size";
+			return false;
+		}
+		if ((header.caps2 & (DDSCAPS2_CUBEMAP | DDSCAPS2_VOLUME)) != 0
+			|| ((header.flags & DDSD_DEPTH) != 0 && header.depth > 1))
+		{
+			reason = "not a 2D texture";
+			return false;
+		}
+		if ((header.pixelFormat.flags & DDPF_FOURCC) != 0 && header.pixelFormat.fourCC == DDS_FOURCC_DX10)
+		{
+			if (size < dataOffset + sizeof(DdsHeaderDx10))
+			{
+				reason = "truncated DX10 header";
+				return false;
+			}
+			DdsHeaderDx10 extended;
+			memcpy(&extended, data + dataOffset, sizeof(extended));
+			dataOffset += sizeof(DdsHeaderDx10);
+			if (extended.resourceDimension != D3D10_RESOURCE_DIMENSION_TEXTURE2D || extended.arraySize != 1
+				|| (extended.miscFlag & D3D10_RESOURCE_MISC_TEXTURECUBE) != 0)
+			{
+				reason = "not a 2D texture";
+				return false;
+			}
+			format = dxgiFormat(extended.dxgiFormat);
+		}
+		else
+		{
+			format = pixelFormat(header.pixelFormat);
+		}
+		if (!format.isValid())
+		{
+			reason = "unsupported format";
+			return false;
+		}
+		if (header.width == 0 || header.height == 0 || header.width > MAX_DIMENSION || header.height > MAX_DIMENSION)
+		{
+			reason = "bad size";
+			return false;
+		}
+		uint32_t fullChain = 1;
+		for (uint32_t extent = std::max(header.width, header.height); extent > 1; extent /= 2)
+		{
+			++fullChain;
+		}
+		const uint32_t levelCount = std::max(1u, header.mipMapCount);
+		if (levelCount > fullChain)
+		{
+			reason = "more mip levels than the size allows";
+			return false;
+		}
+		uint32_t width = header.width, height = header.height;
+		uint64_t offset = 0;
+		for (uint32_t i = 0; i < levelCount; ++i)
+		{
+			MipLevel level;
+			level.width = width;
+			level.height = height;
+			level.offset = offset;
+			level.size = format.levelSize(width, height);
+			levels.push_back(level);
+			offset += level.size;
+			width = std::max(1u, width / 2);
+			height = std::max(1u, height / 2);
+		}
+		if (offset > size - dataOffset)
+		{
+			levels.clear();
+			reason = "truncated level data";
+			return false;
+		}
+		reason = NULL;
+		return true;
+	}
+	/*
+	* Map a DDS file as a mip chain. Uncompressed chains get texelBytes channels and format 0,
+	* format says how to upload them. Files written by write() also return the key and pixel
+	* hash they were stored with, other files leave both 0. Any thread.
+	*/
+	static bool open(const std::string& path, MipChain& chain, DdsFormat& format,
+		uint64_t& contentKey, uint64_t& pixelHash)
+	{
+		chain.release();
+		contentKey = 0;
+		pixelHash = 0;
+		std::unique_ptr<MappedFile> file(new MappedFile());
+		if (!file->open(path))
+		{
+			return false;
+		}
+		const char* reason = NULL;
+		uint64_t dataOffset = 0;
+		if (!parse(file->data(), file->size(), format, chain.levels, dataOffset, reason))
+		{
+			return reject(path, reason);
+		}
+		const DdsHeader* header = (const DdsHeader*)(file->data() + 4);
+		const MipLevel& last = chain.levels.back();
+		chain.format = format.isCompressed() ? format.internalFormat : 0;
+		chain.channels = format.isCompressed() ? 4 : (int)format.texelBytes;
+		chain.base = file->data() + dataOffset;
+		chain.byteCount = (size_t)(last.offset + last.size);
+		if (header->reserved1[0] == CACHE_TAG && header->reserved1[1] == MIP_CACHE_VERSION)
+		{
+			contentKey = ((uint64_t)header->reserved1[3] << 32) | header->reserved1[2];
+			pixelHash = ((uint64_t)header->reserved1[5] << 32) | header->reserved1[4];
+		}
+		chain.file = std::move(file);
+		return true;
+	}
+	/*
+	* Map a chain this cache stored for contentKey, see MipCache. Any thread.
+	*/
+	static bool openCached(uint64_t contentKey, MipChain& chain, uint64_t& pixelHash)
+	{
+		const std::string path = MipCache::cachePath(contentKey, ".dds");
+		DdsFormat format;
+		uint64_t storedKey = 0;
+		if (!open(path, chain, format, storedKey, pixelHash))
+		{
+			return false;
+		}
+		if (storedKey != contentKey || !format.isCompressed())
+		{
+			chain.release();
+			return reject(path, "not written for this texture");
+		}
+		return true;
+	}
+	static bool isDdsFile(const std::string& path)
+	{
+		const size_t dot = path.find_last_of('.');
+		if (dot == std::string::npos)
+		{
+			return false;
+		}
+		std::string extension = path.substr(dot + 1);
+		std::transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
+		return extension == "dds";
+	}
+	/*
+	* Create an immutable texture from a DDS file, levels are uploaded from the mapping in the
+	* file's own format. Replaces the old TextureHelper::loadDDS, TextureRegistry::acquire
+	* loads .dds material textures through it. GL thread only.
+	*/
+	static GLuint loadTexture(const std::string& path, GLboolean alpha, int& width, int& height)
+	{
+		MipChain chain;
+		DdsFormat format;
+		uint64_t contentKey = 0, pixelHash = 0;
+		if (!open(path, chain, format, contentKey, pixelHash))
+		{
+			std::cerr << "Error:DdsFile::loadTexture, could not load: " << path << std::endl;
+			return 0;
+		}
+		std::vector<const GLvoid*> levels;
+		MipGenerator::levelPointers(chain, chain.data(), levels);
+		const MipLevel& top = chain.getLevels()[0];
+		width = (int)top.width;
+		height = (int)top.height;
+		if (!format.isCompressed())
+		{
+			return TextureHelper::create2DTextureLevels(top.width, top.height, levels,
+				format.internalFormat, format.picFormat, alpha, format.type);
+		}
+		std::vector<GLsizei> sizes;
+		for (std::vector<MipLevel>::const_iterator it = chain.getLevels().begin(); chain.getLevels().end() != it; ++it)
+		{
+			sizes.push_back((GLsizei)it->size);
+		}
+		return TextureHelper::createCompressed2DTextureLevels(top.width, top.height, format.internalFormat,
+			levels, sizes, alpha);
+	}
+	/*
+	* Store a compressed chain in the cache under contentKey, any thread
+	*/
+	static bool writeCached(uint64_t contentKey, const MipChain& chain, uint64_t pixelHash)
+	{
+		if (!MipCache::makeDirectory(MIP_CACHE_DIRECTORY))
+		{
+			return false;
+		}
+		return write(MipCache::cachePath(contentKey, ".dds"), chain, contentKey, pixelHash);
+	}
+	/*
+	* Write a compressed chain. BC1 and BC3 use the legacy FourCC header every tool reads,
+	* BC5 and BC7 the DX10 header.
+	*/
+	static bool write(const std::string& path, const MipChain& chain, uint64_t contentKey = 0, uint64_t pixelHash = 0)
+	{
+		const uint32_t fourCC = formatFourCC(chain.getFormat());
+		if (chain.empty() || fourCC == 0)
+		{
+			return false;
+		}
+		const MipLevel& top = chain.getLevels()[0];
+		DdsHeader header;
+		memset(&header, 0, sizeof(header));
+		header.size = sizeof(DdsHeader);
+		header.flags = DDSD_CAPS | DDSD_HEIGHT | DDSD_WIDTH | DDSD_PIXELFORMAT | DDSD_MIPMAPCOUNT | DDSD_LINEARSIZE;
+		header.height = top.height;
+		header.width = top.width;
+		header.pitchOrLinearSize = (uint32_t)top.size;
+		header.mipMapCount = (uint32_t)chain.getLevels().size();
+		header.reserved1[0] = CACHE_TAG;
+		header.reserved1[1] = MIP_CACHE_VERSION;
+		header.reserved1[2] = (uint32_t)contentKey;
+		header.reserved1[3] = (uint32_t)(contentKey >> 32);
+		header.reserved1[4] = (uint32_t)pixelHash;
+		header.reserved1[5] = (uint32_t)(pixelHash >> 32);
+		header.pixelFormat.size = sizeof(DdsPixelFormat);
+		header.pixelFormat.flags = DDPF_FOURCC;
+		header.pixelFormat.fourCC = fourCC;
+		header.caps = 0x1000 | 0x8 | 0x400000; // Texture, complex, mipmap
+		const std::string tempPath = MipCache::temporaryPath(path);
+		std::ofstream out(tempPath.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+		if (!out)
+		{
+			return false;
+		}
+		out.write("DDS ", 4);
+		out.write((const char*)&header, sizeof(header));
+		if (fourCC == DDS_FOURCC_DX10)
+		{
+			DdsHeaderDx10 extended;
+			memset(&extended, 0, sizeof(extended));
+			extended.dxgiFormat = formatDxgi(chain.getFormat());
+			extended.resourceDimension = D3D10_RESOURCE_DIMENSION_TEXTURE2D;
+			extended.arraySize = 1;
+			out.write((const char*)&extended, sizeof(extended));
+		}
+		out.write((const char*)chain.data(), (std::streamsize)chain.size());
+		out.close();
+		if (!out)
+		{
+			std::remove(tempPath.c_str());
+			return false;
+		}
+		std::remove(path.c_str());
+		return std::rename(tempPath.c_str(), path.c_str()) == 0;
+	}
+private:
+	static const uint32_t CACHE_TAG = 0x43504d54; // "TMPC", marks files written by this cache
+	// Header flags
+	static const uint32_t DDSD_CAPS = 0x1;
+	static const uint32_t DDSD_HEIGHT = 0x2;
+	static const uint32_t DDSD_WIDTH = 0x4;
+	static const uint32_t DDSD_PIXELFORMAT = 0x1000;
+	static const uint32_t DDSD_MIPMAPCOUNT = 0x20000;
+	static const uint32_t DDSD_LINEARSIZE = 0x80000;
+	static const uint32_t DDSD_DEPTH = 0x800000;
+	static const uint32_t DDSCAPS2_CUBEMAP = 0x200;
+	static const uint32_t DDSCAPS2_VOLUME = 0x200000;
+	// Pixel format flags
+	static const uint32_t DDPF_ALPHAPIXELS = 0x1;
+	static const uint32_t DDPF_ALPHA = 0x2;
+	static const uint32_t DDPF_FOURCC = 0x4;
+	static const uint32_t DDPF_RGB = 0x40;
+	static const uint32_t DDPF_LUMINANCE = 0x20000;
+	static const uint32_t D3D10_RESOURCE_DIMENSION_TEXTURE2D = 3;
+	static const uint32_t D3D10_RESOURCE_MISC_TEXTURECUBE = 0x4;
+	// D3DFORMAT values some writers store in the FourCC field
+	static const uint32_t D3DFMT_A16B16G16R16 = 36;
+	static const uint32_t D3DFMT_R16F = 111;
+	static const uint32_t D3DFMT_G16R16F = 112;
+	static const uint32_t D3DFMT_A16B16G16R16F = 113;
+	static const uint32_t D3DFMT_R32F = 114;
+	static const uint32_t D3DFMT_G32R32F = 115;
+	static const uint32_t D3DFMT_A32B32G32R32F = 116;
+	// DXGI_FORMAT values of the DX10 header
+	static const uint32_t DXGI_FORMAT_R32G32B32A32_FLOAT = 2;
+	static const uint32_t DXGI_FORMAT_R16G16B16A16_FLOAT = 10;
+	static const uint32_t DXGI_FORMAT_R16G16B16A16_UNORM = 11;
+	static const uint32_t DXGI_FORMAT_R32G32_FLOAT = 16;
+	static const uint32_t DXGI_FORMAT_R10G10B10A2_UNORM = 24;
+	static const uint32_t DXGI_FORMAT_R8G8B8A8_UNORM = 28;
+	static const uint32_t DXGI_FORMAT_R8G8B8A8_UNORM_SRGB = 29;
+	static const uint32_t DXGI_FORMAT_R16G16_FLOAT = 34;
+	static const uint32_t DXGI_FORMAT_R32_FLOAT = 41;
+	static const uint32_t DXGI_FORMAT_R8G8_UNORM = 49;
+	static const uint32_t DXGI_FORMAT_R16_FLOAT = 54;
+	static const uint32_t DXGI_FORMAT_R8_UNORM = 61;
+	static const uint32_t DXGI_FORMAT_BC1_TYPELESS = 70;
+	static const uint32_t DXGI_FORMAT_BC1_UNORM = 71;
+	static const uint32_t DXGI_FORMAT_BC1_UNORM_SRGB = 72;
+	static const uint32_t DXGI_FORMAT_BC2_TYPELESS = 73;
+	static const uint32_t DXGI_FORMAT_BC2_UNORM = 74;
+	static const uint32_t DXGI_FORMAT_BC2_UNORM_SRGB = 75;
+	static const uint32_t DXGI_FORMAT_BC3_TYPELESS = 76;
+	static const uint32_t DXGI_FORMAT_BC3_UNORM = 77;
+	static const uint32_t DXGI_FORMAT_BC3_UNORM_SRGB = 78;
+	static const uint32_t DXGI_FORMAT_BC4_TYPELESS = 79;
+	static const uint32_t DXGI_FORMAT_BC4_UNORM = 80;
+	static const uint32_t DXGI_FORMAT_BC4_SNORM = 81;
+	static const uint32_t DXGI_FORMAT_BC5_TYPELESS = 82;
+	static const uint32_t DXGI_FORMAT_BC5_UNORM = 83;
+	static const uint32_t DXGI_FORMAT_BC5_SNORM = 84;
+	static const uint32_t DXGI_FORMAT_B8G8R8A8_UNORM = 87;
+	static const uint32_t DXGI_FORMAT_B8G8R8X8_UNORM = 88;
+	static const uint32_t DXGI_FORMAT_B8G8R8A8_UNORM_SRGB = 91;
+	static const uint32_t DXGI_FORMAT_BC6H_TYPELESS = 94;
+	static const uint32_t DXGI_FORMAT_BC6H_UF16 = 95;
+	static const uint32_t DXGI_FORMAT_BC6H_SF16 = 96;
+	static const uint32_t DXGI_FORMAT_BC7_TYPELESS = 97;
+	static const uint32_t DXGI_FORMAT_BC7_UNORM = 98;
+	static const uint32_t DXGI_FORMAT_BC7_UNORM_SRGB = 99;
+
+	/*
+	* Legacy header: a FourCC or D3DFORMAT code, or uncompressed channel masks
+	*/
+	static DdsFormat pixelFormat(const DdsPixelFormat& pf)
+	{
+		if ((pf.flags & DDPF_FOURCC) != 0)
+		{
+			switch (pf.fourCC)
+			{
+				case DDS_FOURCC_DXT1:
+					return DdsFormat(GL_COMPRESSED_RGBA_S3TC_DXT1_EXT, 8);
+				case DDS_FOURCC_DXT2:
+				case DDS_FOURCC_DXT3:
+					return DdsFormat(GL_COMPRESSED_RGBA_S3TC_DXT3_EXT, 16);
+				case DDS_FOURCC_DXT4:
+				case DDS_FOURCC_DXT5:
+					return DdsFormat(GL_COMPRESSED_RGBA_S3TC_DXT5_EXT, 16);
+				case DDS_FOURCC_ATI1:
+				case DDS_FOURCC_BC4U:
+					return DdsFormat(GL_COMPRESSED_RED_RGTC1, 8);
+				case DDS_FOURCC_BC4S:
+					return DdsFormat(GL_COMPRESSED_SIGNED_RED_RGTC1, 8);
+				case DDS_FOURCC_ATI2:
+				case DDS_FOURCC_BC5U:
+					return DdsFormat(GL_COMPRESSED_RG_RGTC2, 16);
+				case DDS_FOURCC_BC5S:
+					return DdsFormat(GL_COMPRESSED_SIGNED_RG_RGTC2, 16);
+				case D3DFMT_A16B16G16R16:
+					return DdsFormat(GL_RGBA16, GL_RGBA, GL_UNSIGNED_SHORT, 8);
+				case D3DFMT_R16F:
+					return DdsFormat(GL_R16F, GL_RED, GL_HALF_FLOAT, 2);
+				case D3DFMT_G16R16F:
+					return DdsFormat(GL_RG16F, GL_RG, GL_HALF_FLOAT, 4);
+				case D3DFMT_A16B16G16R16F:
+					return DdsFormat(GL_RGBA16F, GL_RGBA, GL_HALF_FLOAT, 8);
+				case D3DFMT_R32F:
+					return DdsFormat(GL_R32F, GL_RED, GL_FLOAT, 4);
+				case D3DFMT_G32R32F:
+					return DdsFormat(GL_RG32F, GL_RG, GL_FLOAT, 8);
+				case D3DFMT_A32B32G32R32F:
+					return DdsFormat(GL_RGBA32F, GL_RGBA, GL_FLOAT, 16);
+				default:
+					return DdsFormat();
+			}
+		}
+		const uint32_t alphaMask = (pf.flags & DDPF_ALPHAPIXELS) != 0 ? pf.aBitMask : 0;
+		if ((pf.flags & DDPF_RGB) != 0)
+		{
+			if (pf.rgbBitCount == 32 && pf.gBitMask == 0x0000ff00)
+			{
+				if (pf.rBitMask == 0x000000ff && pf.bBitMask == 0x00ff0000)
+				{
+					return DdsFormat(alphaMask ? GL_RGBA8 : GL_RGB8, GL_RGBA, GL_UNSIGNED_BYTE, 4);
+				}
+				if (pf.rBitMask == 0x00ff0000 && pf.bBitMask == 0x000000ff)
+				{
+					return DdsFormat(alphaMask ? GL_RGBA8 : GL_RGB8, GL_BGRA, GL_UNSIGNED_BYTE, 4);
+				}
+			}
+			if (pf.rgbBitCount == 24 && pf.gBitMask == 0x00ff00)
+			{
+				if (pf.rBitMask == 0x0000ff && pf.bBitMask == 0xff0000)
+				{
+					return DdsFormat(GL_RGB8, GL_RGB, GL_UNSIGNED_BYTE, 3);
+				}
+				if (pf.rBitMask == 0xff0000 && pf.bBitMask == 0x0000ff)
+				{
+					return DdsFormat(GL_RGB8, GL_BGR, GL_UNSIGNED_BYTE, 3);
+				}
+			}
+			if (pf.rgbBitCount == 16 && pf.rBitMask == 0xf800 && pf.gBitMask == 0x07e0 && pf.bBitMask == 0x001f)
+			{
+				return DdsFormat(GL_RGB8, GL_RGB, GL_UNSIGNED_SHORT_5_6_5, 2);
+			}
+			return DdsFormat();
+		}
+		if ((pf.flags & DDPF_LUMINANCE) != 0)
+		{
+			if (pf.rgbBitCount == 8 && pf.rBitMask == 0xff)
+			{
+				return DdsFormat(GL_R8, GL_RED, GL_UNSIGNED_BYTE, 1);
+			}
+			if (pf.rgbBitCount == 16 && pf.rBitMask == 0xff && alphaMask == 0xff00)
+			{
+				return DdsFormat(GL_RG8, GL_RG, GL_UNSIGNED_BYTE, 2);
+			}
+			return DdsFormat();
+		}
+		if ((pf.flags & DDPF_ALPHA) != 0 && pf.rgbBitCount == 8)
+		{
+			return DdsFormat(GL_R8, GL_RED, GL_UNSIGNED_BYTE, 1);
+		}
+		return DdsFormat();
+	}
+	/*
+	* DX10 header, typeless block formats are read as UNORM
+	*/
+	static DdsFormat dxgiFormat(uint32_t dxgi)
+	{
+		switch (dxgi)
+		{
+			case DXGI_FORMAT_R32G32B32A32_FLOAT:
+				return DdsFormat(GL_RGBA32F, GL_RGBA, GL_FLOAT, 16);
+			case DXGI_FORMAT_R16G16B16A16_FLOAT:
+				return DdsFormat(GL_RGBA16F, GL_RGBA, GL_HALF_FLOAT, 8);
+			case DXGI_FORMAT_R16G16B16A16_UNORM:
+				return DdsFormat(GL_RGBA16, GL_RGBA, GL_UNSIGNED_SHORT, 8);
+			case DXGI_FORMAT_R32G32_FLOAT:
+				return DdsFormat(GL_RG32F, GL_RG, GL_FLOAT, 8);
+			case DXGI_FORMAT_R10G10B10A2_UNORM:
+				return DdsFormat(GL_RGB10_A2, GL_RGBA, GL_UNSIGNED_INT_2_10_10_10_REV, 4);
+			case DXGI_FORMAT_R8G8B8A8_UNORM:
+				return DdsFormat(GL_RGBA8, GL_RGBA, GL_UNSIGNED_BYTE, 4);
+			case DXGI_FORMAT_R8G8B8A8_UNORM_SRGB:
+				return DdsFormat(GL_SRGB8_ALPHA8, GL_RGBA, GL_UNSIGNED_BYTE, 4);
+			case DXGI_FORMAT_R16G16_FLOAT:
+				return DdsFormat(GL_RG16F, GL_RG, GL_HALF_FLOAT, 4);
+			case DXGI_FORMAT_R32_FLOAT:
+				return DdsFormat(GL_R32F, GL_RED, GL_FLOAT, 4);
+			case DXGI_FORMAT_R8G8_UNORM:
+				return DdsFormat(GL_RG8, GL_RG, GL_UNSIGNED_BYTE, 2);
+			case DXGI_FORMAT_R16_FLOAT:
+				return DdsFormat(GL_R16F, GL_RED, GL_HALF_FLOAT, 2);
+			case DXGI_FORMAT_R8_UNORM:
+				return DdsFormat(GL_R8, GL_RED, GL_UNSIGNED_BYTE, 1);
+			case DXGI_FORMAT_B8G8R8A8_UNORM:
+				return DdsFormat(GL_RGBA8, GL_BGRA, GL_UNSIGNED_BYTE, 4);
+			case DXGI_FORMAT_B8G8R8X8_UNORM:
+				return DdsFormat(GL_RGB8, GL_BGRA, GL_UNSIGNED_BYTE, 4);
+			case DXGI_FORMAT_B8G8R8A8_UNORM_SRGB:
+				return DdsFormat(GL_SRGB8_ALPHA8, GL_BGRA, GL_UNSIGNED_BYTE, 4);
+			case DXGI_FORMAT_BC1_TYPELESS:
+			case DXGI_FORMAT_BC1_UNORM:
+				return DdsFormat(GL_COMPRESSED_RGBA_S3TC_DXT1_EXT, 8);
+			case DXGI_FORMAT_BC1_UNORM_SRGB:
+				return DdsFormat(GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT1_EXT, 8);
+			case DXGI_FORMAT_BC2_TYPELESS:
+			case DXGI_FORMAT_BC2_UNORM:
+				return DdsFormat(GL_COMPRESSED_RGBA_S3TC_DXT3_EXT, 16);
+			case DXGI_FORMAT_BC2_UNORM_SRGB:
+				return DdsFormat(GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT3_EXT, 16);
+			case DXGI_FORMAT_BC3_TYPELESS:
+			case DXGI_FORMAT_BC3_UNORM:
+				return DdsFormat(GL_COMPRESSED_RGBA_S3TC_DXT5_EXT, 16);
+			case DXGI_FORMAT_BC3_UNORM_SRGB:
+				return DdsFormat(GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT, 16);
+			case DXGI_FORMAT_BC4_TYPELESS:
+			case DXGI_FORMAT_BC4_UNORM:
+				return DdsFormat(GL_COMPRESSED_RED_RGTC1, 8);
+			case DXGI_FORMAT_BC4_SNORM:
+				return DdsFormat(GL_COMPRESSED_SIGNED_RED_RGTC1, 8);
+			case DXGI_FORMAT_BC5_TYPELESS:
+			case DXGI_FORMAT_BC5_UNORM:
+				return DdsFormat(GL_COMPRESSED_RG_RGTC2, 16);
+			case DXGI_FORMAT_BC5_SNORM:
+				return DdsFormat(GL_COMPRESSED_SIGNED_RG_RGTC2, 16);
+			case DXGI_FORMAT_BC6H_TYPELESS:
+			case DXGI_FORMAT_BC6H_UF16:
+				return DdsFormat(GL_COMPRESSED_RGB_BPTC_UNSIGNED_FLOAT_ARB, 16);
+			case DXGI_FORMAT_BC6H_SF16:
+				return DdsFormat(GL_COMPRESSED_RGB_BPTC_SIGNED_FLOAT_ARB, 16);
+			case DXGI_FORMAT_BC7_TYPELESS:
+			case DXGI_FORMAT_BC7_UNORM:
+				return DdsFormat(GL_COMPRESSED_RGBA_BPTC_UNORM_ARB, 16);
+			case DXGI_FORMAT_BC7_UNORM_SRGB:
+				return DdsFormat(GL_COMPRESSED_SRGB_ALPHA_BPTC_UNORM_ARB, 16);
+			default:
+				return DdsFormat();
+		}
+	}
+	static uint32_t formatFourCC(GLenum format)
+	{
+		switch (format)
+		{
+			case GL_COMPRESSED_RGBA_S3TC_DXT1_EXT:
+				return DDS_FOURCC_DXT1;
+			case GL_COMPRESSED_RGBA_S3TC_DXT3_EXT:
+				return DDS_FOURCC_DXT3;
+			case GL_COMPRESSED_RGBA_S3TC_DXT5_EXT:
+				return DDS_FOURCC_DXT5;
+			case GL_COMPRESSED_RG_RGTC2:
+			case GL_COMPRESSED_RGBA_BPTC_UNORM_ARB:
+				return DDS_FOURCC_DX10;
+			default:
+				return 0;
+		}
+	}
+	static uint32_t formatDxgi(GLenum format)
+	{
+		return format == GL_COMPRESSED_RG_RGTC2 ? DXGI_FORMAT_BC5_UNORM : DXGI_FORMAT_BC7_UNORM;
+	}
+	static bool reject(const std::string& path, const char* reason)
+	{
+		std::cout << "Info:DdsFile::open, skipping " << path << ": " << reason << std::endl;
+		return false;
+	}
+};
+
+#endif
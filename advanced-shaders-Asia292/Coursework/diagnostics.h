@@ -0,0 +1,851 @@
+#ifndef _DIAGNOSTICS_H_
+#define _DIAGNOSTICS_H_
+
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <random>
+#include <string>
+#include <vector>
+#include <assimp/Importer.hpp>
+#include <assimp/scene.h>
+#include <assimp/postprocess.h>
+#include <GLEW/glew.h>
+#include <GLFW/glfw3.h>
+#include "ddsFile.h"
+#include "mappedFile.h"
+#include "mesh.h"
+#include "meshConvert.h"
+#include "meshTangents.h"
+#include "model.h"
+#include "objParser.h"
+#include "textureCompress.h"
+#include "textureMips.h"
+#include "textureRegistry.h"
+#include "virtualTexture.h"
+
+/*
+* Developer benchmarks, run from the command line with: -bench <name> [args]
+*/
+class Diagnostics
+{
+public:
+	/*
+	* Returns true if the command line asked for a diagnostic, the app should then exit
+	*/
+	static bool run(int argc, char** argv)
+	{
+		if (argc < 3 || std::string(argv[1]) != "-bench")
+		{
+			return false;
+		}
+		const std::string name = argv[2];
+		if (name == "convert")
+		{
+			benchConvert(argc > 3 ? (size_t)std::atol(argv[3]) : 4000000);
+		}
+		else if (name == "handoff")
+		{
+			benchHandoff(argc > 3 ? argv[3] : "assets/models/Cat2/Cat2.obj");
+		}
+		else if (name == "obj")
+		{
+			benchObj(argc > 3 ? argv[3] : "assets/models/Cat2/Cat2.obj");
+		}
+		else if (name == "tangents")
+		{
+			benchTangents(argc > 3 ? argv[3] : "assets/models/Cat2/Cat2.obj");
+		}
+		else if (name == "mips")
+		{
+			benchMips(argc > 3 ? argv[3] : "assets/textures/bricks2.jpg");
+		}
+		else if (name == "dds")
+		{
+			benchDds(argc > 3 ? (size_t)std::atol(argv[3]) : 100000);
+		}
+		else if (name == "vt")
+		{
+			benchVirtual(argc > 3 ? (size_t)std::atol(argv[3]) : 2000);
+		}
+		else
+		{
+			std::cerr << "Error:Diagnostics::run, unknown benchmark: " << name << std::endl;
+		}
+		return true;
+	}
+private:
+	typedef std::chrono::high_resolution_clock Clock;
+
+	static double elapsedMs(const Clock::time_point& start)
+	{
+		return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+	}
+	/*
+	* aiMesh to Vertex conversion: per-vertex push_back loop against MeshConvert
+	*/
+	static void benchConvert(size_t vertexCount)
+	{
+		aiMesh mesh;
+		mesh.mNumVertices = (unsigned int)vertexCount;
+		mesh.mVertices = new aiVector3D[vertexCount];
+		mesh.mNormals = new aiVector3D[vertexCount];
+		mesh.mTangents = new aiVector3D[vertexCount];
+		mesh.mBitangents = new aiVector3D[vertexCount];
+		mesh.mTextureCoords[0] = new aiVector3D[vertexCount];
+		mesh.mNumUVComponents[0] = 2;
+		for (size_t i = 0; i < vertexCount; ++i)
+		{
+			const float f = (float)i;
+			mesh.mVertices[i] = aiVector3D(f, f + 0.25f, f + 0.5f);
+			mesh.mNormals[i] = aiVector3D(0.0f, 1.0f, f);
+			mesh.mTangents[i] = aiVector3D(1.0f, 0.0f, f);
+			mesh.mTextureCoords[0][i] = aiVector3D(f * 0.5f, f * 0.25f, 0.0f);
+		}
+		mesh.mNumFaces = (unsigned int)(vertexCount / 3);
+		mesh.mFaces = new aiFace[mesh.mNumFaces];
+		for (unsigned int i = 0; i < mesh.mNumFaces; ++i)
+		{
+			mesh.mFaces[i].mNumIndices = 3;
+			mesh.mFaces[i].mIndices = new unsigned int[3];
+			for (unsigned int j = 0; j < 3; ++j)
+			{
+				mesh.mFaces[i].mIndices[j] = i * 3 + j;
+			}
+		}
+
+		double legacyMs = 1e30, bulkMs = 1e30;
+		std::vector<Vertex> legacyVerts, bulkVerts;
+		std::vector<GLuint> legacyIndices, bulkIndices;
+		for (int run = 0; run < 3; ++run)
+		{
+			legacyVerts.clear();
+			legacyVerts.shrink_to_fit();
+			legacyIndices.clear();
+			legacyIndices.shrink_to_fit();
+			Clock::time_point start = Clock::now();
+			legacyConvert(&mesh, legacyVerts, legacyIndices);
+			legacyMs = std::min(legacyMs, elapsedMs(start));
+
+			bulkVerts.clear();
+			bulkVerts.shrink_to_fit();
+			bulkIndices.clear();
+			bulkIndices.shrink_to_fit();
+			start = Clock::now();
+			MeshConvert::convertVertices(&mesh, bulkVerts);
+			MeshConvert::convertIndices(&mesh, bulkIndices);
+			bulkMs = std::min(bulkMs, elapsedMs(start));
+		}
+		// MeshConvert leaves tangents to TangentGenerator, so they are not compared
+		bool match = legacyVerts.size() == bulkVerts.size() && legacyIndices == bulkIndices;
+		for (size_t i = 0; match && i < legacyVerts.size(); ++i)
+		{
+			match = legacyVerts[i].position == bulkVerts[i].position
+				&& legacyVerts[i].texCoords == bulkVerts[i].texCoords
+				&& legacyVerts[i].normal == bulkVerts[i].normal;
+		}
+		std::cout << "convert: " << vertexCount << " vertices, " << mesh.mNumFaces << " faces" << std::endl
+			<< "  push_back loop: " << legacyMs << " ms" << std::endl
+			<< "  MeshConvert:    " << bulkMs << " ms (" << legacyMs / bulkMs << "x)" << std::endl
+			<< "  outputs " << (match ? "match" : "DIFFER") << std::endl;
+	}
+	/*
+	* The load path Model::loadModel takes on a cache miss, stage by stage: read the source,
+	* processSourceMesh on the workers, then the hand-off into Mesh with its GL upload and
+	* texture loads. A mesh whose buffers reach Mesh at a new address was copied on the way.
+	* The upload needs a GL context, so a hidden window is opened for the run.
+	*/
+	static void benchHandoff(const std::string& filePath)
+	{
+		if (!glfwInit())
+		{
+			std::cerr << "Error:Diagnostics::benchHandoff, could not initialize GLFW." << std::endl;
+			return;
+		}
+		glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+		glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+		glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+		glfwWindowHint(GLFW_VISIBLE, GL_FALSE);
+		GLFWwindow* window = glfwCreateWindow(64, 64, "handoff", NULL, NULL);
+		if (!window)
+		{
+			std::cerr << "Error:Diagnostics::benchHandoff, could not create a GL context." << std::endl;
+			glfwTerminate();
+			return;
+		}
+		glfwMakeContextCurrent(window);
+		glewExperimental = GL_TRUE;
+		if (glewInit() != GLEW_OK)
+		{
+			std::cerr << "Error:Diagnostics::benchHandoff, could not initialize GLEW." << std::endl;
+			glfwDestroyWindow(window);
+			glfwTerminate();
+			return;
+		}
+
+		double readMs = 1e30, processMs = 1e30, handoffMs = 1e30;
+		size_t meshCount = 0, payload = 0, copiedMeshes = 0, copiedBytes = 0;
+		for (int run = 0; run < 3; ++run)
+		{
+			// Destroyed at the end of each run, while the context is still current
+			Model model;
+			model.modelFileDir = filePath.substr(0, filePath.find_last_of('/'));
+			ModelSource source;
+			Clock::time_point start = Clock::now();
+			if (!model.readSource(filePath, source))
+			{
+				break;
+			}
+			readMs = std::min(readMs, elapsedMs(start));
+
+			std::vector<MeshData> meshData(source.meshCount());
+			start = Clock::now();
+			ParallelHelper::parallelFor(meshData.size(), [&](size_t i)
+			{
+				MonotonicArena arena;
+				meshData[i].valid = model.processSourceMesh(source, i, meshData[i], arena);
+			});
+			processMs = std::min(processMs, elapsedMs(start));
+
+			// uploadMeshes appends valid meshes only, in order
+			std::vector<const Vertex*> vertexPtrs;
+			std::vector<const GLuint*> indexPtrs;
+			payload = 0;
+			for (size_t i = 0; i < meshData.size(); ++i)
+			{
+				if (meshData[i].valid)
+				{
+					vertexPtrs.push_back(meshData[i].vertices.data());
+					indexPtrs.push_back(meshData[i].indices.data());
+					payload += meshData[i].vertices.size() * sizeof(Vertex) + meshData[i].indices.size() * sizeof(GLuint);
+				}
+			}
+			start = Clock::now();
+			model.uploadMeshes(meshData);
+			handoffMs = std::min(handoffMs, elapsedMs(start));
+
+			meshCount = model.meshes.size();
+			copiedMeshes = 0;
+			copiedBytes = 0;
+			for (size_t i = 0; i < meshCount && i < vertexPtrs.size(); ++i)
+			{
+				const std::vector<Vertex>& vertices = model.meshes[i].getVertices();
+				const std::vector<GLuint>& indices = model.meshes[i].getIndices();
+				const bool vertexCopy = !vertices.empty() && vertices.data() != vertexPtrs[i];
+				const bool indexCopy = !indices.empty() && indices.data() != indexPtrs[i];
+				copiedMeshes += vertexCopy || indexCopy ? 1 : 0;
+				copiedBytes += (vertexCopy ? vertices.size() * sizeof(Vertex) : 0)
+					+ (indexCopy ? indices.size() * sizeof(GLuint) : 0);
+			}
+		}
+		glfwDestroyWindow(window);
+		glfwTerminate();
+		if (readMs == 1e30)
+		{
+			std::cerr << "Error:Diagnostics::benchHandoff, could not read: " << filePath << std::endl;
+			return;
+		}
+		std::cout << "handoff: " << filePath << ", " << meshCount << " meshes, "
+			<< payload / 1024 << " KB of mesh data" << std::endl
+			<< "  read source:         " << readMs << " ms" << std::endl
+			<< "  processSourceMesh:   " << processMs << " ms" << std::endl
+			<< "  hand-off and upload: " << handoffMs << " ms" << std::endl
+			<< "  " << copiedMeshes << " meshes copied on the way to Mesh, "
+			<< copiedBytes / 1024 << " KB" << std::endl;
+	}
+	/*
+	* OBJ read throughput: Assimp with the model import flags plus MeshConvert against ObjParser
+	*/
+	static void benchObj(const std::string& filePath)
+	{
+		size_t fileSize = 0;
+		{
+			MappedFile file;
+			if (!file.open(filePath))
+			{
+				std::cerr << "Error:Diagnostics::benchObj, could not open: " << filePath << std::endl;
+				return;
+			}
+			fileSize = file.size();
+		}
+		double assimpMs = 1e30, parserMs = 1e30;
+		size_t assimpVerts = 0, assimpTris = 0, parserVerts = 0, parserTris = 0;
+		size_t assimpMeshes = 0, parserMeshes = 0;
+		for (int run = 0; run < 3; ++run)
+		{
+			Clock::time_point start = Clock::now();
+			{
+				Assimp::Importer importer;
+				const aiScene* scene = importer.ReadFile(filePath, MODEL_IMPORT_FLAGS);
+				if (!scene)
+				{
+					std::cerr << "Error:Diagnostics::benchObj, " << importer.GetErrorString() << std::endl;
+					return;
+				}
+				assimpVerts = assimpTris = 0;
+				assimpMeshes = scene->mNumMeshes;
+				for (unsigned int i = 0; i < scene->mNumMeshes; ++i)
+				{
+					std::vector<Vertex> vertices;
+					std::vector<GLuint> indices;
+					MeshConvert::convertVertices(scene->mMeshes[i], vertices);
+					MeshConvert::convertIndices(scene->mMeshes[i], indices);
+					assimpVerts += vertices.size();
+					assimpTris += indices.size() / 3;
+				}
+			}
+			assimpMs = std::min(assimpMs, elapsedMs(start));
+
+			start = Clock::now();
+			{
+				std::vector<MeshData> meshes;
+				if (!ObjParser::parse(filePath, meshes))
+				{
+					std::cerr << "Error:Diagnostics::benchObj, ObjParser could not read: " << filePath << std::endl;
+					return;
+				}
+				parserVerts = parserTris = 0;
+				parserMeshes = meshes.size();
+				for (size_t i = 0; i < meshes.size(); ++i)
+				{
+					parserVerts += meshes[i].vertices.size();
+					parserTris += meshes[i].indices.size() / 3;
+				}
+			}
+			parserMs = std::min(parserMs, elapsedMs(start));
+		}
+		const double megabytes = fileSize / (1024.0 * 1024.0);
+		std::cout << "obj: " << filePath << ", " << megabytes << " MB, "
+			<< ParallelHelper::workerCount() << " threads" << std::endl
+			<< "  Assimp:    " << assimpMs << " ms, " << megabytes * 1000.0 / assimpMs << " MB/s, "
+			<< assimpMeshes << " meshes, " << assimpVerts << " vertices, " << assimpTris << " triangles" << std::endl
+			<< "  ObjParser: " << parserMs << " ms, " << megabytes * 1000.0 / parserMs << " MB/s, "
+			<< parserMeshes << " meshes, " << parserVerts << " vertices, " << parserTris << " triangles ("
+			<< assimpMs / parserMs << "x)" << std::endl;
+	}
+	/*
+	* Normal and tangent generation: Assimp's post-processing steps against TangentGenerator
+	* on the same imported meshes. Also reports how far apart the two sets of tangents are.
+	*/
+	static void benchTangents(const std::string& filePath)
+	{
+		const unsigned int assimpFlags = aiProcess_GenSmoothNormals | aiProcess_CalcTangentSpace;
+		double assimpMs = 1e30, generatorMs = 1e30;
+		std::vector<MeshData> converted, generated;
+		std::vector<std::vector<aiVector3D> > assimpTangents;
+		bool hadNormals = true;
+		for (int run = 0; run < 3; ++run)
+		{
+			Assimp::Importer importer;
+			const aiScene* scene = importer.ReadFile(filePath, MODEL_IMPORT_FLAGS);
+			if (!scene)
+			{
+				std::cerr << "Error:Diagnostics::benchTangents, " << importer.GetErrorString() << std::endl;
+				return;
+			}
+			if (converted.empty())
+			{
+				converted.resize(scene->mNumMeshes);
+				for (unsigned int i = 0; i < scene->mNumMeshes; ++i)
+				{
+					MeshConvert::convertVertices(scene->mMeshes[i], converted[i].vertices);
+					MeshConvert::convertIndices(scene->mMeshes[i], converted[i].indices);
+					hadNormals = hadNormals && scene->mMeshes[i]->HasNormals();
+				}
+			}
+			// Single threaded, as Assimp runs its steps
+			Clock::time_point start = Clock::now();
+			scene = importer.ApplyPostProcessing(assimpFlags);
+			assimpMs = std::min(assimpMs, elapsedMs(start));
+			if (!scene)
+			{
+				std::cerr << "Error:Diagnostics::benchTangents, " << importer.GetErrorString() << std::endl;
+				return;
+			}
+			assimpTangents.assign(scene->mNumMeshes, std::vector<aiVector3D>());
+			for (unsigned int i = 0; i < scene->mNumMeshes; ++i)
+			{
+				const aiMesh* meshPtr = scene->mMeshes[i];
+				if (meshPtr->HasTangentsAndBitangents())
+				{
+					assimpTangents[i].assign(meshPtr->mTangents, meshPtr->mTangents + meshPtr->mNumVertices);
+				}
+			}
+
+			generated = converted;
+			start = Clock::now();
+			ParallelHelper::parallelFor(generated.size(), [&](size_t i)
+			{
+				std::vector<Vertex>& vertices = generated[i].vertices;
+				MonotonicArena arena;
+				if (!hadNormals)
+				{
+					ArenaVector<GLuint> positionIds((ArenaAllocator<GLuint>(arena)));
+					TangentGenerator::positionIds(vertices, positionIds);
+					TangentGenerator::generateNormals(vertices, generated[i].indices, positionIds.data(), arena);
+				}
+				TangentGenerator::generateTangents(vertices, generated[i].indices, arena);
+			});
+			generatorMs = std::min(generatorMs, elapsedMs(start));
+		}
+		// Generated vertices keep their index, split copies are appended
+		size_t vertexCount = 0, splitCount = 0, compared = 0;
+		double angleSum = 0.0;
+		for (size_t i = 0; i < generated.size(); ++i)
+		{
+			vertexCount += converted[i].vertices.size();
+			splitCount += generated[i].vertices.size() - converted[i].vertices.size();
+			for (size_t v = 0; v < assimpTangents[i].size() && v < converted[i].vertices.size(); ++v)
+			{
+				const glm::vec3 a(assimpTangents[i][v].x, assimpTangents[i][v].y, assimpTangents[i][v].z);
+				const glm::vec3 b(generated[i].vertices[v].tangent);
+				const float lengths = glm::length(a) * glm::length(b);
+				if (lengths > 0.0f)
+				{
+					angleSum += std::acos(glm::clamp(glm::dot(a, b) / lengths, -1.0f, 1.0f));
+					++compared;
+				}
+			}
+		}
+		std::cout << "tangents: " << filePath << ", " << generated.size() << " meshes, " << vertexCount
+			<< " vertices, " << ParallelHelper::workerCount() << " threads"
+			<< (hadNormals ? "" : ", normals generated") << std::endl
+			<< "  Assimp post-processing: " << assimpMs << " ms" << std::endl
+			<< "  TangentGenerator:       " << generatorMs << " ms (" << assimpMs / generatorMs << "x), "
+			<< splitCount << " vertices split at mirrored UVs" << std::endl
+			<< "  mean tangent difference " << (compared ? angleSum / compared * 57.2957795 : 0.0)
+			<< " degrees over " << compared << " vertices" << std::endl;
+	}
+	/*
+	* Texture loading on the CPU: a cold load (decode and mip generation with each filter)
+	* against a warm load mapped from the MipCache
+	*/
+	static void benchMips(const std::string& filePath)
+	{
+		uint64_t fileHash = 0;
+		if (!TextureRegistry::hashFile(filePath, fileHash))
+		{
+			std::cerr << "Error:Diagnostics::benchMips, could not open: " << filePath << std::endl;
+			return;
+		}
+		double decodeMs = 1e30, boxMs = 1e30, kaiserMs = 1e30, warmMs = 1e30;
+		size_t levelCount = 0, chainBytes = 0;
+		const TextureParams params(MIP_MODE_SRGB);
+		for (int run = 0; run < 3; ++run)
+		{
+			TextureImage image;
+			Clock::time_point start = Clock::now();
+			if (!TextureHelper::decode2DImage(filePath.c_str(), image, params.loadChannels))
+			{
+				return;
+			}
+			decodeMs = std::min(decodeMs, elapsedMs(start));
+			MipChain mips;
+			start = Clock::now();
+			MipGenerator::generate(image, params.mipMode, MIP_FILTER_BOX, true, mips);
+			boxMs = std::min(boxMs, elapsedMs(start));
+			start = Clock::now();
+			MipGenerator::generate(image, params.mipMode, MIP_FILTER_KAISER, true, mips);
+			kaiserMs = std::min(kaiserMs, elapsedMs(start));
+			image.release();
+			levelCount = mips.getLevels().size();
+			chainBytes = mips.size();
+			// Fills the cache on the first run, the timing is for the warm path only
+			uint64_t pixelHash = 0;
+			TextureRegistry::loadMips(filePath, fileHash, params, mips, pixelHash);
+			start = Clock::now();
+			TextureRegistry::loadMips(filePath, fileHash, params, mips, pixelHash);
+			warmMs = std::min(warmMs, elapsedMs(start));
+		}
+		std::cout << "mips: " << filePath << ", " << levelCount << " levels, " << chainBytes / 1024 << " KB, "
+			<< ParallelHelper::workerCount() << " threads" << std::endl
+			<< "  decode:                   " << decodeMs << " ms" << std::endl
+			<< "  generate, box filter:     " << boxMs << " ms" << std::endl
+			<< "  generate, Kaiser filter:  " << kaiserMs << " ms" << std::endl
+			<< "  warm load from MipCache:  " << warmMs << " ms (" << (decodeMs + kaiserMs) / warmMs
+			<< "x)" << std::endl;
+	}
+	/*
+	* DDS parser validation: written chains read back unchanged, known bad headers and every
+	* truncation are rejected, and randomly corrupted headers never yield a level outside the
+	* file. Prints the number of failed checks.
+	*/
+	static void benchDds(size_t mutations)
+	{
+		size_t failures = 0;
+		TextureImage image;
+		image.width = 72;
+		image.height = 40;
+		image.channels = 3;
+		image.pixels = new GLubyte[image.width * image.height * 3];
+		for (int i = 0; i < image.width * image.height * 3; ++i)
+		{
+			image.pixels[i] = (GLubyte)((i * 7) ^ (i / 213));
+		}
+		MipChain source;
+		MipGenerator::generate(image, MIP_MODE_LINEAR, MIP_FILTER_BOX, true, source);
+		delete[] image.pixels;
+		image.pixels = NULL;
+
+		// Round trip through every format the compressor writes
+		const char* path = "ddsbench.dds";
+		std::vector<unsigned char> sample;
+		const TextureCompression formats[] = { TEXTURE_COMPRESSION_BC1, TEXTURE_COMPRESSION_BC3,
+			TEXTURE_COMPRESSION_BC5, TEXTURE_COMPRESSION_BC7 };
+		for (size_t i = 0; i < sizeof(formats) / sizeof(formats[0]); ++i)
+		{
+			MipChain compressed, loaded;
+			DdsFormat format;
+			uint64_t contentKey = 0, pixelHash = 0;
+			BlockCompressor::compress(source, formats[i], COMPRESSION_QUALITY_FAST, compressed);
+			const bool same = DdsFile::write(path, compressed, 1234, 5678)
+				&& DdsFile::open(path, loaded, format, contentKey, pixelHash)
+				&& format.internalFormat == compressed.getFormat() && contentKey == 1234 && pixelHash == 5678
+				&& loaded.getLevels().size() == compressed.getLevels().size()
+				&& loaded.size() == compressed.size() && memcmp(loaded.data(), compressed.data(), loaded.size()) == 0;
+			failures += checkDds(same, "round trip", formats[i]);
+			if (formats[i] == TEXTURE_COMPRESSION_BC5)
+			{
+				std::ifstream in(path, std::ios::binary);
+				sample.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+			}
+		}
+		std::remove(path);
+
+		// Hand-written uncompressed headers and known bad ones
+		DdsFormat format;
+		std::vector<MipLevel> levels;
+		uint64_t dataOffset = 0;
+		const char* reason = NULL;
+		std::vector<unsigned char> bytes = makeDds(5, 3, 3, 0x40 | 0x1, 32, 0x00ff0000, 0x0000ff00, 0x000000ff, 0xff000000,
+			(5 * 3 + 2 * 1 + 1 * 1) * 4);
+		failures += checkDds(DdsFile::parse(&bytes[0], bytes.size(), format, levels, dataOffset, reason)
+			&& format.picFormat == GL_BGRA && levels.size() == 3 && levels[2].offset == 68 && levels[2].size == 4,
+			"BGRA8 exact level sizes", 0);
+		bytes = makeDds(4, 4, 1, 0x20000, 8, 0xff, 0, 0, 0, 16);
+		failures += checkDds(DdsFile::parse(&bytes[0], bytes.size(), format, levels, dataOffset, reason)
+			&& format.internalFormat == GL_R8, "L8", 0);
+		const struct
+		{
+			uint32_t offset;
+			uint32_t value;
+			const char* name;
+		} corruptions[] = {
+			{ 4, 0, "header size" }, { 12, 0, "zero height" }, { 16, 0x7fffffff, "huge width" },
+			{ 28, 40, "mip count" }, { 112, 0x200, "cube map" }, { 84, 0x31313131, "unknown FourCC" },
+			{ 128, 999, "unknown DXGI format" }, { 132, 4, "3D resource" }, { 140, 6, "array" } };
+		for (size_t i = 0; i < sizeof(corruptions) / sizeof(corruptions[0]); ++i)
+		{
+			bytes = sample;
+			memcpy(&bytes[corruptions[i].offset], &corruptions[i].value, 4);
+			failures += checkDds(!DdsFile::parse(&bytes[0], bytes.size(), format, levels, dataOffset, reason),
+				corruptions[i].name, 0);
+		}
+		bool truncationsRejected = true;
+		for (size_t size = 0; size < sample.size(); ++size)
+		{
+			truncationsRejected &= !DdsFile::parse(&sample[0], size, format, levels, dataOffset, reason);
+		}
+		failures += checkDds(truncationsRejected, "every truncation", 0);
+
+		// Random header corruption: accepted files must still describe levels inside the data
+		std::mt19937 random(12345);
+		size_t accepted = 0, escaped = 0;
+		const Clock::time_point start = Clock::now();
+		for (size_t i = 0; i < mutations; ++i)
+		{
+			bytes = sample;
+			const int edits = 1 + (int)(random() % 4);
+			for (int e = 0; e < edits; ++e)
+			{
+				const size_t offset = random() % (4 + sizeof(DdsHeader) + sizeof(DdsHeaderDx10));
+				bytes[offset] = random() % 3 == 0 ? (unsigned char)random() : (unsigned char)(bytes[offset] ^ (1 << (random() % 8)));
+			}
+			bytes.resize(bytes.size() - (random() % 2 ? random() % bytes.size() : 0));
+			if (!DdsFile::parse(bytes.empty() ? NULL : &bytes[0], bytes.size(), format, levels, dataOffset, reason))
+			{
+				continue;
+			}
+			++accepted;
+			if (levels.empty() || dataOffset > bytes.size()
+				|| levels.back().offset + levels.back().size > bytes.size() - dataOffset
+				|| levels.back().size != format.levelSize(levels.back().width, levels.back().height))
+			{
+				++escaped;
+			}
+		}
+		failures += checkDds(escaped == 0, "mutated headers stay in bounds", 0);
+		std::cout << "dds: " << mutations << " mutated headers in " << elapsedMs(start) << " ms, "
+			<< accepted << " accepted, " << escaped << " out of bounds" << std::endl
+			<< "  " << failures << " failed checks" << std::endl;
+	}
+	static size_t checkDds(bool passed, const char* name, int format)
+	{
+		if (!passed)
+		{
+			std::cerr << "Error:Diagnostics::benchDds, failed: " << name;
+			if (format != 0)
+			{
+				std::cerr << " (compression " << format << ")";
+			}
+			std::cerr << std::endl;
+		}
+		return passed ? 0 : 1;
+	}
+	/*
+	* Legacy header around dataBytes of zeroed texels
+	*/
+	static std::vector<unsigned char> makeDds(uint32_t width, uint32_t height, uint32_t mipCount, uint32_t pixelFlags,
+		uint32_t bitCount, uint32_t rMask, uint32_t gMask, uint32_t bMask, uint32_t aMask, size_t dataBytes)
+	{
+		DdsHeader header;
+		memset(&header, 0, sizeof(header));
+		header.size = sizeof(DdsHeader);
+		header.flags = 0x1 | 0x2 | 0x4 | 0x1000 | 0x20000;
+		header.width = width;
+		header.height = height;
+		header.mipMapCount = mipCount;
+		header.pixelFormat.size = sizeof(DdsPixelFormat);
+		header.pixelFormat.flags = pixelFlags;
+		header.pixelFormat.rgbBitCount = bitCount;
+		header.pixelFormat.rBitMask = rMask;
+		header.pixelFormat.gBitMask = gMask;
+		header.pixelFormat.bBitMask = bMask;
+		header.pixelFormat.aBitMask = aMask;
+		std::vector<unsigned char> bytes(4 + sizeof(header) + dataBytes, 0);
+		memcpy(&bytes[0], "DDS ", 4);
+		memcpy(&bytes[4], &header, sizeof(header));
+		return bytes;
+	}
+	/*
+	* Virtual texturing without GL, so it runs anywhere: pages match the chain with wrapped
+	* borders, and over frames of random requests through a small LRU cache the page
+	* tables agree with the cache and always resolve to the nearest resident ancestor.
+	* Prints the number of failed checks.
+	*/
+	static void benchVirtual(size_t frames)
+	{
+		size_t failures = 0;
+		TextureImage image;
+		image.width = 1000;
+		image.height = 700;
+		image.channels = 3;
+		image.pixels = new GLubyte[image.width * image.height * 3];
+		for (int y = 0; y < image.height; ++y)
+		{
+			for (int x = 0; x < image.width; ++x)
+			{
+				GLubyte* texel = image.pixels + (y * image.width + x) * 3;
+				texel[0] = (GLubyte)x;
+				texel[1] = (GLubyte)y;
+				texel[2] = (GLubyte)((x >> 8) | ((y >> 8) << 4));
+			}
+		}
+		MipChain mips;
+		MipGenerator::generate(image, MIP_MODE_LINEAR, MIP_FILTER_BOX, true, mips);
+		delete[] image.pixels;
+		image.pixels = NULL;
+		VirtualPageTable table;
+		table.reset(image.width, image.height);
+		const uint32_t root = table.getRootLevel();
+		failures += checkVirtual(root == 3 && table.pagesX(0) == 8 && table.pagesY(0) == 6 && table.pagesX(2) == 2
+			&& table.getTableWidth(0) == 8 && table.getTableHeight(3) == 1, "page counts");
+
+		// Every page of every level against the chain, borders wrapped
+		std::vector<GLubyte> texels((size_t)VIRTUAL_PHYSICAL_PAGE_SIZE * VIRTUAL_PHYSICAL_PAGE_SIZE * 4);
+		bool pagesMatch = true;
+		size_t pageCount = 0;
+		for (uint32_t level = 0; level <= root; ++level)
+		{
+			const MipLevel& source = mips.getLevels()[level];
+			for (uint32_t y = 0; y < table.pagesY(level); ++y)
+			{
+				for (uint32_t x = 0; x < table.pagesX(level); ++x)
+				{
+					pagesMatch &= VirtualPageTable::buildPage(mips, VirtualPage(1, level, x, y), &texels[0]);
+					++pageCount;
+					for (uint32_t ty = 0; ty < VIRTUAL_PHYSICAL_PAGE_SIZE; ++ty)
+					{
+						const int64_t sy = ((int64_t)(y * VIRTUAL_PAGE_SIZE + ty) - VIRTUAL_PAGE_BORDER + source.height) % source.height;
+						for (uint32_t tx = 0; tx < VIRTUAL_PHYSICAL_PAGE_SIZE; ++tx)
+						{
+							const int64_t sx = ((int64_t)(x * VIRTUAL_PAGE_SIZE + tx) - VIRTUAL_PAGE_BORDER + source.width) % source.width;
+							const GLubyte* expected = mips.data() + source.offset + (sy * source.width + sx) * 3;
+							const GLubyte* actual = &texels[((size_t)ty * VIRTUAL_PHYSICAL_PAGE_SIZE + tx) * 4];
+							pagesMatch &= memcmp(expected, actual, 3) == 0 && actual[3] == 255;
+						}
+					}
+				}
+			}
+		}
+		failures += checkVirtual(pagesMatch, "page texels and borders");
+		Clock::time_point start = Clock::now();
+		for (int run = 0; run < 10; ++run)
+		{
+			VirtualPageTable::buildPage(mips, VirtualPage(1, 0, run % 8, run % 6), &texels[0]);
+		}
+		const double pageMs = elapsedMs(start) / 10.0;
+
+		// Frames of random requests, the root pinned in a 16 slot cache
+		const uint32_t slotsPerRow = 4;
+		VirtualPageCache cache;
+		cache.reset(slotsPerRow * slotsPerRow);
+		VirtualPage evicted;
+		const int32_t rootSlot = cache.allocate(1, evicted);
+		cache.assign(rootSlot, VirtualPage(1, root, 0, 0), 1, true);
+		table.setSlot(root, 0, 0, rootSlot);
+		std::mt19937 random(4321);
+		bool kept = true, consistent = true, resolved = true;
+		size_t uploads = 0;
+		start = Clock::now();
+		for (uint64_t frame = 2; frame < frames + 2; ++frame)
+		{
+			std::vector<VirtualPage> wanted;
+			const int count = 1 + (int)(random() % 12);
+			for (int i = 0; i < count; ++i)
+			{
+				const uint32_t level = (uint32_t)(random() % (root + 1));
+				wanted.push_back(VirtualPage(1, level, (uint32_t)(random() % table.pagesX(level)),
+					(uint32_t)(random() % table.pagesY(level))));
+			}
+			for (size_t i = 0; i < wanted.size(); ++i)
+			{
+				const int32_t slot = table.getSlot(wanted[i].level, wanted[i].x, wanted[i].y);
+				if (slot >= 0)
+				{
+					cache.touch(slot, frame);
+				}
+			}
+			for (size_t i = 0; i < wanted.size(); ++i)
+			{
+				if (table.getSlot(wanted[i].level, wanted[i].x, wanted[i].y) >= 0)
+				{
+					continue;
+				}
+				const int32_t slot = cache.allocate(frame, evicted);
+				if (slot < 0)
+				{
+					continue;
+				}
+				if (evicted.texture != 0)
+				{
+					kept &= evicted.level != root;
+					for (size_t j = 0; j < wanted.size(); ++j)
+					{
+						kept &= evicted.key() != wanted[j].key();
+					}
+					table.setSlot(evicted.level, evicted.x, evicted.y, -1);
+				}
+				cache.assign(slot, wanted[i], frame, false);
+				table.setSlot(wanted[i].level, wanted[i].x, wanted[i].y, slot);
+				++uploads;
+			}
+			table.build(slotsPerRow);
+			size_t resident = 0;
+			for (uint32_t level = 0; level <= root; ++level)
+			{
+				for (uint32_t y = 0; y < table.pagesY(level); ++y)
+				{
+					for (uint32_t x = 0; x < table.pagesX(level); ++x)
+					{
+						const int32_t slot = table.getSlot(level, x, y);
+						if (slot >= 0)
+						{
+							++resident;
+							consistent &= cache.find(VirtualPage(1, level, x, y)) == slot;
+						}
+						const GLubyte* entry = &table.getEntries(level)[((size_t)y * table.getTableWidth(level) + x) * 4];
+						const uint32_t found = entry[2];
+						resolved &= entry[3] == 255 && found >= level && found <= root;
+						if (!resolved)
+						{
+							continue;
+						}
+						// Nothing resident between the page and the one it resolved to
+						for (uint32_t between = level; between < found; ++between)
+						{
+							resolved &= table.getSlot(between, x >> (between - level), y >> (between - level)) < 0;
+						}
+						const int32_t foundSlot = table.getSlot(found, x >> (found - level), y >> (found - level));
+						resolved &= foundSlot >= 0 && (uint32_t)foundSlot == entry[1] * slotsPerRow + entry[0];
+					}
+				}
+			}
+			consistent &= resident == cache.getResidentCount();
+		}
+		const double framesMs = elapsedMs(start);
+		failures += checkVirtual(kept, "pinned and needed pages never evicted");
+		failures += checkVirtual(consistent, "tables agree with the cache");
+		failures += checkVirtual(resolved, "entries resolve to the nearest resident page");
+
+		// Feedback: distinct pages, coarsest first, texel counts kept
+		const GLubyte feedback[] = { 0, 0, 0, 0, 3, 2, 0, 1, 3, 2, 0, 1, 1, 0, 2, 1, 3, 2, 0, 1, 0, 0, 1, 2 };
+		std::vector<VirtualPageRequest> requests;
+		VirtualFeedback::parse(feedback, sizeof(feedback) / 4, requests);
+		failures += checkVirtual(requests.size() == 3 && requests[0].page.level == 2 && requests[1].page.level == 1
+			&& requests[2].page.x == 3 && requests[2].texels == 3, "feedback parse");
+		std::cout << "vt: " << image.width << "x" << image.height << ", " << pageCount << " pages checked, "
+			<< pageMs << " ms per page copy" << std::endl
+			<< "  " << frames << " frames, " << uploads << " page uploads in " << framesMs << " ms" << std::endl
+			<< "  " << failures << " failed checks" << std::endl;
+	}
+	static size_t checkVirtual(bool passed, const char* name)
+	{
+		if (!passed)
+		{
+			std::cerr << "Error:Diagnostics::benchVirtual, failed: " << name << std::endl;
+		}
+		return passed ? 0 : 1;
+	}
+	/*
+	* The original per-vertex loop from Model::processMesh, kept as the baseline
+	*/
+	static void legacyConvert(const aiMesh* meshPtr, std::vector<Vertex>& vertData, std::vector<GLuint>& indices)
+	{
+		for (size_t i = 0; i < meshPtr->mNumVertices; ++i)
+		{
+			Vertex vertex;
+			if (meshPtr->HasPositions())
+			{
+				vertex.position.x = meshPtr->mVertices[i].x;
+				vertex.position.y = meshPtr->mVertices[i].y;
+				vertex.position.z = meshPtr->mVertices[i].z;
+			}
+			if (meshPtr->HasTextureCoords(0))
+			{
+				vertex.texCoords.x = meshPtr->mTextureCoords[0][i].x;
+				vertex.texCoords.y = meshPtr->mTextureCoords[0][i].y;
+			}
+			else
+			{
+				vertex.texCoords = glm::vec2(0.0f, 0.0f);
+			}
+			if (meshPtr->HasNormals())
+			{
+				vertex.normal.x = meshPtr->mNormals[i].x;
+				vertex.normal.y = meshPtr->mNormals[i].y;
+				vertex.normal.z = meshPtr->mNormals[i].z;
+			}
+			if (meshPtr->HasTangentsAndBitangents())
+			{
+				vertex.tangent.x = meshPtr->mTangents[i].x;
+				vertex.tangent.y = meshPtr->mTangents[i].y;
+				vertex.tangent.z = meshPtr->mTangents[i].z;
+			}
+			vertData.push_back(vertex);
+		}
+		for (size_t i = 0; i < meshPtr->mNumFaces; ++i)
+		{
+			aiFace face = meshPtr->mFaces[i];
+			for (size_t j = 0; j < face.mNumIndices; ++j)
+			{
+				indices.push_back(face.mIndices[j]);
+			}
+		}
+	}
+};
+
+#endif
@@ -0,0 +1,92 @@
+#ifndef _GL_HANDLE_H_
+#define _GL_HANDLE_H_
+
+#include <GLEW/glew.h>
+
+// How each kind of GL object name is created and deleted
+struct GLBufferTraits
+{
+	static void create(GLuint& id) { glGenBuffers(1, &id); }
+	static void destroy(GLuint& id) { glDeleteBuffers(1, &id); }
+};
+struct GLVertexArrayTraits
+{
+	static void create(GLuint& id) { glGenVertexArrays(1, &id); }
+	static void destroy(GLuint& id) { glDeleteVertexArrays(1, &id); }
+};
+struct GLTextureTraits
+{
+	static void create(GLuint& id) { glGenTextures(1, &id); }
+	static void destroy(GLuint& id) { glDeleteTextures(1, &id); }
+};
+struct GLFramebufferTraits
+{
+	static void create(GLuint& id) { glGenFramebuffers(1, &id); }
+	static void destroy(GLuint& id) { glDeleteFramebuffers(1, &id); }
+};
+struct GLRenderbufferTraits
+{
+	static void create(GLuint& id) { glGenRenderbuffers(1, &id); }
+	static void destroy(GLuint& id) { glDeleteRenderbuffers(1, &id); }
+};
+
+/*
+* Move-only owner of one GL object name, the name is deleted with its owner
+*/
+template <typename Traits>
+class GLHandle
+{
+public:
+	GLHandle() :id(0) {}
+	/*
+	* Take ownership of a name created elsewhere, e.g. by TextureHelper
+	*/
+	explicit GLHandle(GLuint id) :id(id) {}
+	~GLHandle()
+	{
+		this->reset();
+	}
+	GLHandle(const GLHandle&) = delete;
+	GLHandle& operator=(const GLHandle&) = delete;
+	GLHandle(GLHandle&& other) noexcept :id(other.id)
+	{
+		other.id = 0;
+	}
+	GLHandle& operator=(GLHandle&& other) noexcept
+	{
+		if (this != &other)
+		{
+			this->reset();
+			this->id = other.id;
+			other.id = 0;
+		}
+		return *this;
+	}
+	/*
+	* Replace the owned name with a new one
+	*/
+	void create()
+	{
+		this->reset();
+		Traits::create(this->id);
+	}
+	void reset()
+	{
+		if (this->id != 0)
+		{
+			Traits::destroy(this->id);
+			this->id = 0;
+		}
+	}
+	GLuint get() const { return this->id; }
+private:
+	GLuint id;
+};
+
+typedef GLHandle<GLBufferTraits> GLBuffer;
+typedef GLHandle<GLVertexArrayTraits> GLVertexArray;
+typedef GLHandle<GLTextureTraits> GLTexture;
+typedef GLHandle<GLFramebufferTraits> GLFramebuffer;
+typedef GLHandle<GLRenderbufferTraits> GLRenderbuffer;
+
+#endif
@@ -0,0 +1,52 @@
+#ifndef _HASH_HELPER_H_
+#define _HASH_HELPER_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+class HashHelper
+{
+public:
+	/*
+	* 64-bit content hash, eight bytes per step so large assets hash at memory speed
+	*/
+	static uint64_t hash64(const void* data, size_t size, uint64_t seed = 0)
+	{
+		const uint64_t prime = 0x100000001b3ULL;
+		const unsigned char* bytes = (const unsigned char*)data;
+		uint64_t h = 0xcbf29ce484222325ULL ^ seed ^ ((uint64_t)size * prime);
+		size_t i = 0;
+		for (; i + 8 <= size; i += 8)
+		{
+			uint64_t word;
+			memcpy(&word, bytes + i, 8);
+			h = (h ^ mix(word)) * prime;
+			h ^= h >> 29;
+		}
+		for (; i < size; ++i)
+		{
+			h = (h ^ bytes[i]) * prime;
+		}
+		return mix(h);
+	}
+	/*
+	* Combine a hash with another value
+	*/
+	static uint64_t combine(uint64_t h, uint64_t value)
+	{
+		return mix(h ^ (value + 0x9e3779b97f4a7c15ULL + (h << 6) + (h >> 2)));
+	}
+private:
+	static uint64_t mix(uint64_t x)
+	{
+		x ^= x >> 33;
+		x *= 0xff51afd7ed558ccdULL;
+		x ^= x >> 33;
+		x *= 0xc4ceb9fe1a85ec53ULL;
+		x ^= x >> 33;
+		return x;
+	}
+};
+
+#endif
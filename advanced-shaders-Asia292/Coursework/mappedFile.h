@@ -0,0 +1,128 @@
+#ifndef _MAPPED_FILE_H_
+#define _MAPPED_FILE_H_
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+#include <cstddef>
+#include <string>
+
+/*
+* Read-only memory mapping of a whole file
+*/
+class MappedFile
+{
+public:
+	MappedFile() :dataPtr(NULL), dataSize(0)
+#ifdef _WIN32
+		, fileHandle(INVALID_HANDLE_VALUE), mappingHandle(NULL)
+#endif
+	{}
+	~MappedFile()
+	{
+		this->close();
+	}
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	bool open(const std::string& filePath)
+	{
+		this->close();
+#ifdef _WIN32
+		this->fileHandle = CreateFileA(filePath.c_str(), GENERIC_READ, FILE_SHARE_READ,
+			NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+		if (this->fileHandle == INVALID_HANDLE_VALUE)
+		{
+			return false;
+		}
+		LARGE_INTEGER fileSize;
+		if (!GetFileSizeEx(this->fileHandle, &fileSize) || fileSize.QuadPart == 0)
+		{
+			this->close();
+			return false;
+		}
+		this->dataSize = (size_t)fileSize.QuadPart;
+		this->mappingHandle = CreateFileMappingA(this->fileHandle, NULL, PAGE_READONLY, 0, 0, NULL);
+		if (this->mappingHandle == NULL)
+		{
+			this->close();
+			return false;
+		}
+		this->dataPtr = (const unsigned char*)MapViewOfFile(this->mappingHandle, FILE_MAP_READ, 0, 0, 0);
+		if (this->dataPtr == NULL)
+		{
+			this->close();
+			return false;
+		}
+#else
+		int fd = ::open(filePath.c_str(), O_RDONLY);
+		if (fd < 0)
+		{
+			return false;
+		}
+		struct stat fileStat;
+		if (fstat(fd, &fileStat) != 0 || fileStat.st_size == 0)
+		{
+			::close(fd);
+			return false;
+		}
+		void* mapped = mmap(NULL, (size_t)fileStat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		::close(fd); // The mapping keeps its own reference to the file
+		if (mapped == MAP_FAILED)
+		{
+			return false;
+		}
+		this->dataPtr = (const unsigned char*)mapped;
+		this->dataSize = (size_t)fileStat.st_size;
+#endif
+		return true;
+	}
+	void close()
+	{
+#ifdef _WIN32
+		if (this->dataPtr)
+		{
+			UnmapViewOfFile(this->dataPtr);
+		}
+		if (this->mappingHandle)
+		{
+			CloseHandle(this->mappingHandle);
+		}
+		if (this->fileHandle != INVALID_HANDLE_VALUE)
+		{
+			CloseHandle(this->fileHandle);
+		}
+		this->mappingHandle = NULL;
+		this->fileHandle = INVALID_HANDLE_VALUE;
+#else
+		if (this->dataPtr)
+		{
+			munmap((void*)this->dataPtr, this->dataSize);
+		}
+#endif
+		this->dataPtr = NULL;
+		this->dataSize = 0;
+	}
+	bool isOpen() const { return this->dataPtr != NULL; }
+	const unsigned char* data() const { return this->dataPtr; }
+	size_t size() const { return this->dataSize; }
+private:
+	const unsigned char* dataPtr;
+	size_t dataSize;
+#ifdef _WIN32
+	HANDLE fileHandle, mappingHandle;
+#endif
+};
+
+#endif
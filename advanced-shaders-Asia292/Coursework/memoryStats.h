@@ -0,0 +1,84 @@
+#ifndef _MEMORY_STATS_H_
+#define _MEMORY_STATS_H_
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#include <psapi.h>
+#ifdef _MSC_VER
+#pragma comment(lib, "psapi.lib")
+#endif
+#else
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#endif
+#include <cstddef>
+
+/*
+* Resident set size of this process, 0 where the platform does not report it
+*/
+class MemoryStats
+{
+public:
+	static size_t residentBytes()
+	{
+#ifdef _WIN32
+		PROCESS_MEMORY_COUNTERS counters;
+		if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+		{
+			return counters.WorkingSetSize;
+		}
+		return 0;
+#else
+		return readStatus("VmRSS:");
+#endif
+	}
+	/*
+	* Highest resident set size since the process started
+	*/
+	static size_t peakResidentBytes()
+	{
+#ifdef _WIN32
+		PROCESS_MEMORY_COUNTERS counters;
+		if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+		{
+			return counters.PeakWorkingSetSize;
+		}
+		return 0;
+#else
+		return readStatus("VmHWM:");
+#endif
+	}
+private:
+#ifndef _WIN32
+	static size_t readStatus(const char* field)
+	{
+		FILE* file = fopen("/proc/self/status", "r");
+		if (!file)
+		{
+			return 0;
+		}
+		char line[256];
+		size_t kilobytes = 0;
+		const size_t fieldLength = strlen(field);
+		while (fgets(line, sizeof(line), file))
+		{
+			if (strncmp(line, field, fieldLength) == 0)
+			{
+				kilobytes = (size_t)strtoull(line + fieldLength, NULL, 10);
+				break;
+			}
+		}
+		fclose(file);
+		return kilobytes * 1024;
+	}
+#endif
+};
+
+#endif
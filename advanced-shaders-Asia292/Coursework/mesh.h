@@ -10,68 +10,159 @@
 #include <fstream>
 #include <sstream>
 #include <algorithm>
+#include <cstddef>
+#include <cmath>
+#include <utility>
 #include <assimp/Importer.hpp>
 #include <assimp/scene.h>
 #include <assimp/postprocess.h>
+#include "glHandle.h"
 #include "shader.h"
-
-// Vertex attributes
-struct Vertex
-{
-	glm::vec3 position;
-	glm::vec2 texCoords;
-	glm::vec3 normal;
-	glm::vec3 tangent;
-};
+#include "vertex.h"
+#include "meshBufferPool.h"
+#include "meshLod.h"
+#include "meshlet.h"
+#include "textureArray.h"
+#include "textureRegistry.h"
+#include "textureResidency.h"
+#include "virtualTextureSystem.h"
 
 // Texture attributes
 struct Texture
 {
 	GLuint id;
+	aiTextureType type;
+	TextureHandle handle; // Registry entry, the owning model holds the reference
+	uint32_t source; // Index into the owning model's texture paths
+	uint32_t virtualId; // VirtualTextureSystem id sampled instead once ready, 0 for none
+	TextureArraySlot arraySlot; // Packed copy in the owning model's TextureArraySet, if any
+};
+
+// Texture file named by a material, resolved to a Texture on the GL thread
+struct TextureSource
+{
 	aiTextureType type;
 	std::string path;
 };
 
+// Texture bound in place of a mesh's own, set per ModelInstance
+struct TextureOverride
+{
+	aiTextureType type;
+	TextureHandle original; // Texture replaced, INVALID_TEXTURE_HANDLE replaces every texture of the type
+	GLuint id;
+};
+
+// System memory a mesh keeps once its data is on the GPU
+enum MeshResidency
+{
+	MESH_RESIDENCY_KEEP, // Full vertex and index data
+	MESH_RESIDENCY_DROP, // Nothing but bounds, meshlets and LOD ranges
+	MESH_RESIDENCY_POSITIONS // Positions and indices, for picking and CPU-side tests
+};
+
+// CPU side mesh data produced by the import stage, before any GL upload
+struct MeshData
+{
+	std::vector<Vertex> vertices;
+	std::vector<GLuint> indices;
+	std::vector<TextureSource> textures; // Loaded through the texture registry on the GL thread
+	std::vector<Meshlet> meshlets; // Empty unless ModelOptions::buildMeshlets is set
+	std::vector<MeshLod> lods; // Empty unless ModelOptions::lodLevels is above 1, indices hold every level
+	std::string report; // Results of the optimization passes, printed on the GL thread
+	bool valid;
+	MeshData() :valid(false) {}
+};
+
 class Mesh
 {
 public:
-	void draw(const Shader& shader) const// Draw mesh
+	void draw(const Shader& shader, const std::vector<TextureOverride>* overrides = NULL) const// Draw mesh
+	{
+		const DrawElementsIndirectCommand command = this->lodCommand(0);
+		this->drawCommands(shader, &command, 1, overrides);
+	}
+	/*
+	* Draw only the meshlets that pass the culler, or a whole coarser LOD
+	*/
+	void draw(const Shader& shader, MeshletCuller& culler, size_t lodLevel = 0,
+		const std::vector<TextureOverride>* overrides = NULL) const
+	{
+		std::vector<DrawElementsIndirectCommand> commands;
+		this->appendVisibleRanges(culler, lodLevel, commands);
+		if (!commands.empty())
+		{
+			this->drawCommands(shader, &commands[0], commands.size(), overrides);
+		}
+	}
+	/*
+	* Append draw commands for the visible meshlets, neighbouring ranges are merged.
+	* Meshlets cover LOD 0 only, coarser levels are culled as a whole.
+	* Commands address the pool's buffers for pooled meshes and the mesh's own otherwise.
+	*/
+	void appendVisibleRanges(MeshletCuller& culler, size_t lodLevel,
+		std::vector<DrawElementsIndirectCommand>& commands) const
 	{
-		if (VAOId == 0 
-			||VBOId == 0 
-			|| EBOId == 0)
+		const DrawElementsIndirectCommand whole = this->lodCommand(lodLevel);
+		if (lodLevel > 0 || this->meshlets.empty())
 		{
+			const glm::vec3 center = (this->boundsMin + this->boundsMax) * 0.5f;
+			if (culler.isSphereVisible(center, glm::length(this->boundsMax - center)))
+			{
+				commands.push_back(whole);
+			}
 			return;
 		}
-		glBindVertexArray(this->VAOId);
-		int texUnitCnt = this->bindTextures(shader);
-		glDrawElements(GL_TRIANGLES, this->indices.size(), GL_UNSIGNED_INT, 0);
-		glBindVertexArray(0);
-		// Remove texture binding
-		this->unBindTextures(texUnitCnt);
+		const size_t start = commands.size();
+		for (std::vector<Meshlet>::const_iterator it = this->meshlets.begin(); this->meshlets.end() != it; ++it)
+		{
+			if (!culler.isVisible(*it))
+			{
+				continue;
+			}
+			const GLuint firstIndex = whole.firstIndex + it->firstIndex;
+			if (commands.size() > start
+				&& commands.back().firstIndex + commands.back().count == firstIndex)
+			{
+				commands.back().count += it->indexCount;
+				continue;
+			}
+			DrawElementsIndirectCommand command = whole;
+			command.firstIndex = firstIndex;
+			command.count = it->indexCount;
+			commands.push_back(command);
+		}
 	}
-	int bindTextures(const Shader& shader) const
+	int bindTextures(const Shader& shader, const std::vector<TextureOverride>* overrides = NULL) const
 	{
 		int diffuseCnt = 0, specularCnt = 0, texUnitCnt = 0,normalCnt = 0;
+		bool virtualDiffuse = false;
 		for (std::vector<Texture>::const_iterator it = this->textures.begin();
 			this->textures.end() != it; ++it)
 		{
+			const GLuint textureId = overrides ? overrideId(*it, *overrides) : it->id;
 			switch (it->type)
 			{
 				case aiTextureType_DIFFUSE:
 				{
 						glActiveTexture(GL_TEXTURE0 + texUnitCnt);
-						glBindTexture(GL_TEXTURE_2D, it->id);
+						glBindTexture(GL_TEXTURE_2D, textureId);
 						std::stringstream samplerNameStr;
 						samplerNameStr << "texture_diffuse" << diffuseCnt++;
 						glUniform1i(glGetUniformLocation(shader.programId,
 							samplerNameStr.str().c_str()), texUnitCnt++);
+						// The ordinary texture stays bound, it is sampled until the virtual one is ready
+						// and in place of it when an override replaces it
+						if (diffuseCnt == 1 && it->virtualId != 0 && textureId == it->id)
+						{
+							virtualDiffuse = VirtualTextureSystem::instance().bind(shader, it->virtualId);
+						}
 				}
 				break;
 				case aiTextureType_SPECULAR:
 				{
 					glActiveTexture(GL_TEXTURE0 + texUnitCnt);
-					glBindTexture(GL_TEXTURE_2D, it->id);
+					glBindTexture(GL_TEXTURE_2D, textureId);
 					std::stringstream samplerNameStr;
 					samplerNameStr << "texture_specular" << specularCnt++;
 					glUniform1i(glGetUniformLocation(shader.programId,
@@ -81,7 +172,7 @@ public:
 				case aiTextureType_HEIGHT:
 				{
 					glActiveTexture(GL_TEXTURE0 + texUnitCnt);
-					glBindTexture(GL_TEXTURE_2D, it->id);
+					glBindTexture(GL_TEXTURE_2D, textureId);
 					std::stringstream samplerNameStr;
 					samplerNameStr << "texture_normal" << normalCnt++;
 					glUniform1i(glGetUniformLocation(shader.programId,
@@ -94,8 +185,46 @@ public:
 				break;
 			}
 		}
+		VirtualTextureSystem::bindSamplers(shader, virtualDiffuse);
+		TextureArraySet::bindSamplers(shader, false);
 		return texUnitCnt;
 	}
+	/*
+	* Report how finely this mesh samples its textures this frame, see TextureResidency
+	*/
+	void requestTextures(const TextureDemand& demand) const
+	{
+		const float uvPerPixel = demand.uvPerPixel(this->boundsMin, this->boundsMax, this->uvDensity);
+		TextureResidency& residency = TextureResidency::instance();
+		const VirtualTextureSystem& virtualTextures = VirtualTextureSystem::instance();
+		for (std::vector<Texture>::const_iterator it = this->textures.begin(); this->textures.end() != it; ++it)
+		{
+			// Virtual textures stream their own pages, packed ones are resident in their array
+			if (!virtualTextures.isReady(it->virtualId) && it->arraySlot.array < 0)
+			{
+				residency.request(it->handle, uvPerPixel);
+			}
+		}
+	}
+	/*
+	* Tell the vertex shader how to decode this mesh's vertex format
+	*/
+	void bindVertexDecode(const Shader& shader) const
+	{
+		const bool compact = this->vertexFormat == VERTEX_FORMAT_COMPACT;
+		glUniform1i(glGetUniformLocation(shader.programId, "compactVertex"), compact);
+		glUniform1i(glGetUniformLocation(shader.programId, "pooledDraw"), GL_FALSE);
+		// Keep the unused buffer sampler off the material units, mixed sampler types may not share a unit
+		glUniform1i(glGetUniformLocation(shader.programId, "drawData"), MESH_POOL_DRAW_DATA_UNIT);
+		if (compact)
+		{
+			const glm::vec3 extent = this->boundsMax - this->boundsMin;
+			glUniform3f(glGetUniformLocation(shader.programId, "positionOffset"),
+				this->boundsMin.x, this->boundsMin.y, this->boundsMin.z);
+			glUniform3f(glGetUniformLocation(shader.programId, "positionScale"),
+				extent.x, extent.y, extent.z);
+		}
+	}
 	void unBindTextures(const int texUnitCnt) const
 	{
 		for (int i = 0; i < texUnitCnt; ++i)
@@ -104,75 +233,490 @@ public:
 			glBindTexture(GL_TEXTURE_2D, 0);
 		}
 	}
-	Mesh():VAOId(0), VBOId(0), EBOId(0){}
-	Mesh(const std::vector<Vertex>& vertData, 
-		const std::vector<Texture> & textures,
-		const std::vector<GLuint>& indices):VAOId(0), VBOId(0), EBOId(0) // Construct a mesh
+	Mesh():uvDensity(0.0f), vertexFormat(VERTEX_FORMAT_FULL), indexType(GL_UNSIGNED_INT), indexCount(0), pool(NULL){}
+	Mesh(std::vector<Vertex> vertData,
+		std::vector<Texture> textures,
+		std::vector<GLuint> indices):uvDensity(0.0f), vertexFormat(VERTEX_FORMAT_FULL),
+		indexType(GL_UNSIGNED_INT), indexCount(0), pool(NULL) // Construct a mesh
 	{
-		setData(vertData, textures, indices);
+		setData(std::move(vertData), std::move(textures), std::move(indices));
 	}
-	void setData(const std::vector<Vertex>& vertData,
-		const std::vector<Texture> & textures,
-		const std::vector<GLuint>& indices)
+	// Meshes own GL objects or a pool allocation, so they move but never copy
+	Mesh(const Mesh&) = delete;
+	Mesh& operator=(const Mesh&) = delete;
+	Mesh(Mesh&& other) noexcept :uvDensity(0.0f), vertexFormat(VERTEX_FORMAT_FULL),
+		indexType(GL_UNSIGNED_INT), indexCount(0), pool(NULL)
 	{
-		this->vertData = vertData;
-		this->indices = indices;
+		*this = std::move(other);
+	}
+	Mesh& operator=(Mesh&& other) noexcept
+	{
+		if (this == &other)
+		{
+			return *this;
+		}
+		this->releasePoolAllocation();
+		this->vertData = std::move(other.vertData);
+		this->indices = std::move(other.indices);
+		this->textures = std::move(other.textures);
+		this->meshlets = std::move(other.meshlets);
+		this->lods = std::move(other.lods);
+		this->positions = std::move(other.positions);
+		this->boundsMin = other.boundsMin;
+		this->boundsMax = other.boundsMax;
+		this->uvDensity = other.uvDensity;
+		this->vertexFormat = other.vertexFormat;
+		this->indexType = other.indexType;
+		this->indexCount = other.indexCount;
+		this->vertexArray = std::move(other.vertexArray);
+		this->vertexBuffer = std::move(other.vertexBuffer);
+		this->indexBuffer = std::move(other.indexBuffer);
+		this->pool = other.pool;
+		this->poolAllocation = other.poolAllocation;
+		other.pool = NULL;
+		return *this;
+	}
+	/*
+	* GPU layout used by the next setData
+	*/
+	void setVertexFormat(VertexFormat format)
+	{
+		this->vertexFormat = format;
+	}
+	/*
+	* Pool the next setData allocates from, a mesh the pool can not take gets its own buffers
+	*/
+	void setBufferPool(MeshBufferPool* bufferPool)
+	{
+		this->pool = bufferPool;
+	}
+	/*
+	* Pass the vectors with std::move to hand them over without copying
+	*/
+	void setData(std::vector<Vertex> vertData,
+		std::vector<Texture> textures,
+		std::vector<GLuint> indices)
+	{
+		this->vertData = std::move(vertData);
+		this->indices = std::move(indices);
+		this->textures = std::move(textures);
+		this->computeBounds();
+		this->uvDensity = 0.0f;
+		if (!this->vertData.empty() && !this->indices.empty())
+		{
+			this->uvDensity = computeUvDensity(&this->vertData[0], &this->indices[0], this->indices.size());
+			this->upload(&this->vertData[0], this->vertData.size(),
+				&this->indices[0], this->indices.size());
+		}
+	}
+	/*
+	* Set data from external memory (e.g. a mapped mesh cache), uploaded straight from that memory.
+	* System memory copies are only made of what the residency keeps.
+	*/
+	void setData(const Vertex* vertPtr, size_t vertCount,
+		const GLuint* indexPtr, size_t indexCount,
+		const std::vector<Texture>& textures,
+		const glm::vec3& boundsMin, const glm::vec3& boundsMax,
+		MeshResidency residency)
+	{
+		std::vector<Vertex>().swap(this->vertData);
+		std::vector<GLuint>().swap(this->indices);
+		std::vector<glm::vec3>().swap(this->positions);
+		if (residency == MESH_RESIDENCY_KEEP)
+		{
+			this->vertData.assign(vertPtr, vertPtr + vertCount);
+		}
+		else if (residency == MESH_RESIDENCY_POSITIONS)
+		{
+			this->positions.resize(vertCount);
+			for (size_t i = 0; i < vertCount; ++i)
+			{
+				this->positions[i] = vertPtr[i].position;
+			}
+		}
+		if (residency != MESH_RESIDENCY_DROP)
+		{
+			this->indices.assign(indexPtr, indexPtr + indexCount);
+		}
 		this->textures = textures;
-		if (!vertData.empty() && !indices.empty())
+		this->boundsMin = boundsMin;
+		this->boundsMax = boundsMax;
+		this->uvDensity = 0.0f;
+		if (vertCount > 0 && indexCount > 0)
+		{
+			this->uvDensity = computeUvDensity(vertPtr, indexPtr, indexCount);
+			this->upload(vertPtr, vertCount, indexPtr, indexCount);
+		}
+	}
+	/*
+	* Sample diffuse textures virtually, virtualIds is indexed by Texture::source
+	*/
+	void setVirtualTextures(const std::vector<uint32_t>& virtualIds)
+	{
+		for (std::vector<Texture>::iterator it = this->textures.begin(); this->textures.end() != it; ++it)
+		{
+			if (it->type == aiTextureType_DIFFUSE && it->source < virtualIds.size())
+			{
+				it->virtualId = virtualIds[it->source];
+			}
+		}
+	}
+	/*
+	* Sample textures from the owning model's arrays, slots is indexed by
+	* Texture::source * TEXTURE_ARRAY_ROLES + role. A pooled mesh passes its layers
+	* to the pool's per-draw data.
+	*/
+	void setArraySlots(const std::vector<TextureArraySlot>& slots)
+	{
+		for (std::vector<Texture>::iterator it = this->textures.begin(); this->textures.end() != it; ++it)
+		{
+			const size_t slot = (size_t)it->source * TEXTURE_ARRAY_ROLES + textureArrayRole(it->type);
+			it->arraySlot = textureArrayRole(it->type) < TEXTURE_ARRAY_ROLES && slot < slots.size()
+				? slots[slot] : TextureArraySlot();
+		}
+		if (this->pool)
+		{
+			this->pool->setDrawLayers(this->poolAllocation.drawId, this->getTextureLayers());
+		}
+	}
+	/*
+	* True when every texture is packed, so the mesh can draw from arrays alone
+	*/
+	bool hasArraySlots() const
+	{
+		for (std::vector<Texture>::const_iterator it = this->textures.begin(); this->textures.end() != it; ++it)
+		{
+			if (it->arraySlot.array < 0)
+			{
+				return false;
+			}
+		}
+		return true;
+	}
+	/*
+	* Array of the first texture of each role, as bindTextures samples only those, -1 for none
+	*/
+	glm::ivec3 getTextureArrays() const
+	{
+		glm::ivec3 arrays(-1);
+		for (std::vector<Texture>::const_reverse_iterator it = this->textures.rbegin(); this->textures.rend() != it; ++it)
+		{
+			const int role = textureArrayRole(it->type);
+			if (role < TEXTURE_ARRAY_ROLES)
+			{
+				arrays[role] = it->arraySlot.array;
+			}
+		}
+		return arrays;
+	}
+	/*
+	* Layers in those arrays, -1 for none
+	*/
+	glm::vec3 getTextureLayers() const
+	{
+		glm::vec3 layers(-1.0f);
+		for (std::vector<Texture>::const_reverse_iterator it = this->textures.rbegin(); this->textures.rend() != it; ++it)
+		{
+			const int role = textureArrayRole(it->type);
+			if (role < TEXTURE_ARRAY_ROLES)
+			{
+				layers[role] = (float)it->arraySlot.layer;
+			}
+		}
+		return layers;
+	}
+	/*
+	* TextureArrayRole of a material texture type, TEXTURE_ARRAY_ROLES for types never packed
+	*/
+	static int textureArrayRole(aiTextureType type)
+	{
+		switch (type)
+		{
+			case aiTextureType_DIFFUSE:
+				return TEXTURE_ARRAY_DIFFUSE;
+			case aiTextureType_SPECULAR:
+				return TEXTURE_ARRAY_SPECULAR;
+			case aiTextureType_HEIGHT:
+				return TEXTURE_ARRAY_NORMAL;
+			default:
+				return TEXTURE_ARRAY_ROLES;
+		}
+	}
+	/*
+	* Meshlets over this mesh's index buffer, set alongside setData
+	*/
+	void setMeshlets(const Meshlet* meshletPtr, size_t meshletCount)
+	{
+		this->meshlets.assign(meshletPtr, meshletPtr + meshletCount);
+	}
+	void setMeshlets(std::vector<Meshlet> meshlets)
+	{
+		this->meshlets = std::move(meshlets);
+	}
+	/*
+	* Index ranges of each level of detail, set alongside setData
+	*/
+	void setLods(const MeshLod* lodPtr, size_t lodCount)
+	{
+		this->lods.assign(lodPtr, lodPtr + lodCount);
+	}
+	void setLods(std::vector<MeshLod> lods)
+	{
+		this->lods = std::move(lods);
+	}
+	/*
+	* Free system memory copies of uploaded data, call once nothing else needs them
+	* (the mesh cache is written from them)
+	*/
+	void applyResidency(MeshResidency residency)
+	{
+		if (residency == MESH_RESIDENCY_KEEP)
 		{
-			this->setupMesh();
+			return;
+		}
+		if (residency == MESH_RESIDENCY_POSITIONS)
+		{
+			if (this->vertData.empty())
+			{
+				return; // Set from external memory, the positions were kept then
+			}
+			std::vector<glm::vec3> kept(this->vertData.size());
+			for (size_t i = 0; i < this->vertData.size(); ++i)
+			{
+				kept[i] = this->vertData[i].position;
+			}
+			this->positions.swap(kept);
+		}
+		else
+		{
+			std::vector<glm::vec3>().swap(this->positions);
+			std::vector<GLuint>().swap(this->indices);
 		}
+		std::vector<Vertex>().swap(this->vertData);
 	}
-	void final() const
+	/*
+	* Bytes of vertex, index and meshlet data held in system memory
+	*/
+	size_t getCpuBytes() const
 	{
-		glDeleteVertexArrays(1, &this->VAOId);
-		glDeleteBuffers(1, &this->VBOId);
-		glDeleteBuffers(1, &this->EBOId);
+		return this->vertData.capacity() * sizeof(Vertex) + this->indices.capacity() * sizeof(GLuint)
+			+ this->positions.capacity() * sizeof(glm::vec3) + this->meshlets.capacity() * sizeof(Meshlet)
+			+ this->lods.capacity() * sizeof(MeshLod);
 	}
+	size_t selectLod(const LodSelector& selector) const
+	{
+		return selector.select(this->lods, this->boundsMin, this->boundsMax);
+	}
+	/*
+	* GL objects are deleted by their handles, a pooled mesh gives its ranges back.
+	* The pool must outlive its meshes.
+	*/
 	~Mesh()
 	{
-		
+		this->releasePoolAllocation();
 	}
-	GLuint getVAOId() const { return this->VAOId; }
+	/*
+	* Draw command of one level of detail. The index buffer holds every level after
+	* LOD 0, so a whole-mesh draw must come from here rather than the pool allocation.
+	*/
+	DrawElementsIndirectCommand lodCommand(size_t lodLevel) const
+	{
+		DrawElementsIndirectCommand command = { (GLuint)this->indexCount, 1, 0, 0, 0 };
+		if (this->pool)
+		{
+			command = this->poolAllocation.command();
+		}
+		if (!this->lods.empty())
+		{
+			const MeshLod& lod = this->lods[std::min(lodLevel, this->lods.size() - 1)];
+			command.firstIndex += lod.firstIndex;
+			command.count = lod.indexCount;
+		}
+		return command;
+	}
+	GLuint getVAOId() const { return this->vertexArray.get(); }
 	const std::vector<Vertex>& getVertices() const { return this->vertData; }
 	const std::vector<GLuint>& getIndices() const { return this->indices; }
+	const std::vector<Texture>& getTextures() const { return this->textures; }
+	const std::vector<glm::vec3>& getPositions() const { return this->positions; } // Only under MESH_RESIDENCY_POSITIONS
+	const std::vector<Meshlet>& getMeshlets() const { return this->meshlets; }
+	const std::vector<MeshLod>& getLods() const { return this->lods; }
+	const glm::vec3& getBoundsMin() const { return this->boundsMin; }
+	const glm::vec3& getBoundsMax() const { return this->boundsMax; }
+	float getUvDensity() const { return this->uvDensity; }
+	VertexFormat getVertexFormat() const { return this->vertexFormat; }
+	MeshBufferPool* getBufferPool() const { return this->pool; }
+	const MeshPoolAllocation& getPoolAllocation() const { return this->poolAllocation; }
 private:
 	std::vector<Vertex> vertData;
 	std::vector<GLuint> indices;
 	std::vector<Texture> textures;
-	GLuint VAOId, VBOId, EBOId;
+	std::vector<Meshlet> meshlets;
+	std::vector<MeshLod> lods; // Empty when the mesh has a single level
+	std::vector<glm::vec3> positions; // Kept instead of vertData under MESH_RESIDENCY_POSITIONS
+	glm::vec3 boundsMin, boundsMax; // Axis aligned bounding box of the vertex positions
+	float uvDensity; // UV units per unit of surface, averaged over the mesh
+	VertexFormat vertexFormat;
+	GLenum indexType; // GL_UNSIGNED_INT or GL_UNSIGNED_SHORT
+	GLsizei indexCount;
+	GLVertexArray vertexArray;
+	GLBuffer vertexBuffer, indexBuffer;
+	MeshBufferPool* pool; // Set while the mesh lives in a shared pool instead of its own buffers
+	MeshPoolAllocation poolAllocation;
+
+	void releasePoolAllocation()
+	{
+		if (this->pool)
+		{
+			this->pool->release(this->poolAllocation);
+			this->pool = NULL;
+		}
+	}
+	void computeBounds()
+	{
+		this->boundsMin = this->boundsMax = glm::vec3(0.0f);
+		if (this->vertData.empty())
+		{
+			return;
+		}
+		this->boundsMin = this->boundsMax = this->vertData[0].position;
+		for (std::vector<Vertex>::const_iterator it = this->vertData.begin();
+			this->vertData.end() != it; ++it)
+		{
+			this->boundsMin = glm::min(this->boundsMin, it->position);
+			this->boundsMax = glm::max(this->boundsMax, it->position);
+		}
+	}
+	/*
+	* Square root of the UV area over the surface area
+	*/
+	static float computeUvDensity(const Vertex* vertPtr, const GLuint* indexPtr, size_t indexCount)
+	{
+		double surfaceArea = 0.0, uvArea = 0.0;
+		for (size_t i = 0; i + 2 < indexCount; i += 3)
+		{
+			const Vertex& a = vertPtr[indexPtr[i]];
+			const Vertex& b = vertPtr[indexPtr[i + 1]];
+			const Vertex& c = vertPtr[indexPtr[i + 2]];
+			surfaceArea += glm::length(glm::cross(b.position - a.position, c.position - a.position));
+			const glm::vec2 uvB = b.texCoords - a.texCoords, uvC = c.texCoords - a.texCoords;
+			uvArea += std::fabs(uvB.x * uvC.y - uvB.y * uvC.x);
+		}
+		return surfaceArea > 0.0 ? (float)std::sqrt(uvArea / surfaceArea) : 0.0f;
+	}
+	/*
+	* Texture to bind for one of this mesh's textures, the first matching override wins
+	*/
+	static GLuint overrideId(const Texture& text, const std::vector<TextureOverride>& overrides)
+	{
+		for (std::vector<TextureOverride>::const_iterator it = overrides.begin(); overrides.end() != it; ++it)
+		{
+			if (it->type == text.type
+				&& (it->original == INVALID_TEXTURE_HANDLE || it->original == text.handle))
+			{
+				return it->id;
+			}
+		}
+		return text.id;
+	}
+	/*
+	* Draw index ranges of this mesh
+	*/
+	void drawCommands(const Shader& shader, const DrawElementsIndirectCommand* commands, size_t commandCount,
+		const std::vector<TextureOverride>* overrides) const
+	{
+		if (this->pool)
+		{
+			this->pool->bind(shader);
+			int texUnitCnt = this->bindTextures(shader, overrides);
+			this->pool->draw(commands, commandCount);
+			this->pool->unbind(shader);
+			this->unBindTextures(texUnitCnt);
+			return;
+		}
+		if (this->vertexArray.get() == 0
+			|| this->vertexBuffer.get() == 0
+			|| this->indexBuffer.get() == 0)
+		{
+			return;
+		}
+		glBindVertexArray(this->vertexArray.get());
+		int texUnitCnt = this->bindTextures(shader, overrides);
+		this->bindVertexDecode(shader);
+		const size_t indexSize = this->indexType == GL_UNSIGNED_SHORT ? sizeof(GLushort) : sizeof(GLuint);
+		if (commandCount == 1)
+		{
+			glDrawElements(GL_TRIANGLES, (GLsizei)commands[0].count, this->indexType,
+				(GLvoid*)(commands[0].firstIndex * indexSize));
+		}
+		else
+		{
+			std::vector<GLsizei> counts(commandCount);
+			std::vector<const GLvoid*> offsets(commandCount);
+			for (size_t i = 0; i < commandCount; ++i)
+			{
+				counts[i] = (GLsizei)commands[i].count;
+				offsets[i] = (const GLvoid*)(commands[i].firstIndex * indexSize);
+			}
+			glMultiDrawElements(GL_TRIANGLES, &counts[0], this->indexType, &offsets[0], (GLsizei)commandCount);
+		}
+		glBindVertexArray(0);
+		// Remove texture binding
+		this->unBindTextures(texUnitCnt);
+	}
 
 	//// BUFFER SETUP ////
-	void setupMesh()
+	void upload(const Vertex* vertPtr, size_t vertCount,
+		const GLuint* indexPtr, size_t indexCount)
 	{
-		glGenVertexArrays(1, &this->VAOId);
-		glGenBuffers(1, &this->VBOId);
-		glGenBuffers(1, &this->EBOId);
+		if (this->pool
+			&& this->pool->getFormat() == this->vertexFormat
+			&& this->pool->allocate(vertPtr, vertCount, indexPtr, indexCount,
+				this->boundsMin, this->boundsMax, this->poolAllocation))
+		{
+			return;
+		}
+		this->pool = NULL;
+		this->setupMesh(vertPtr, vertCount, indexPtr, indexCount);
+	}
+	void setupMesh(const Vertex* vertPtr, size_t vertCount,
+		const GLuint* indexPtr, size_t indexCount)
+	{
+		this->vertexArray.create();
+		this->vertexBuffer.create();
+		this->indexBuffer.create();
 
-		glBindVertexArray(this->VAOId);
-		glBindBuffer(GL_ARRAY_BUFFER, this->VBOId);
-		glBufferData(GL_ARRAY_BUFFER, sizeof(Vertex) * this->vertData.size(),
-			&this->vertData[0], GL_STATIC_DRAW);
-		// Vertex position attributes
-		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE,
-			sizeof(Vertex), (GLvoid*)0);
-		glEnableVertexAttribArray(0);
-		// Vertex texture coords
-		glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE,
-			sizeof(Vertex), (GLvoid*)(3 * sizeof(GL_FLOAT)));
-		glEnableVertexAttribArray(1);
-		// Vertex normal vector
-		glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE,
-			sizeof(Vertex), (GLvoid*)(5 * sizeof(GL_FLOAT)));
-		glEnableVertexAttribArray(2);
-		// Vertex tangent vector
-		glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE,
-			sizeof(Vertex), (GLvoid*)(8 * sizeof(GL_FLOAT)));
-		glEnableVertexAttribArray(3);
-		// Index data
-		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, this->EBOId);
-		glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(GLuint)* this->indices.size(),
-			&this->indices[0], GL_STATIC_DRAW);
+		glBindVertexArray(this->vertexArray.get());
+		glBindBuffer(GL_ARRAY_BUFFER, this->vertexBuffer.get());
+		if (this->vertexFormat == VERTEX_FORMAT_COMPACT)
+		{
+			std::vector<CompactVertex> compactData(vertCount);
+			VertexLayout::packVertices(vertPtr, vertCount, this->boundsMin, this->boundsMax, &compactData[0]);
+			glBufferData(GL_ARRAY_BUFFER, sizeof(CompactVertex) * vertCount,
+				&compactData[0], GL_STATIC_DRAW);
+		}
+		else
+		{
+			glBufferData(GL_ARRAY_BUFFER, sizeof(Vertex) * vertCount,
+				vertPtr, GL_STATIC_DRAW);
+		}
+		VertexLayout::setupAttributes(this->vertexFormat);
+		// Index data, 16-bit for compact meshes that fit
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, this->indexBuffer.get());
+		this->indexCount = (GLsizei)indexCount;
+		if (this->vertexFormat == VERTEX_FORMAT_COMPACT && vertCount <= 65536)
+		{
+			std::vector<GLushort> shortIndices(indexPtr, indexPtr + indexCount);
+			this->indexType = GL_UNSIGNED_SHORT;
+			glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(GLushort)* indexCount,
+				&shortIndices[0], GL_STATIC_DRAW);
+		}
+		else
+		{
+			this->indexType = GL_UNSIGNED_INT;
+			glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(GLuint)* indexCount,
+				indexPtr, GL_STATIC_DRAW);
+		}
 		glBindBuffer(GL_ARRAY_BUFFER, 0);
 		glBindVertexArray(0);
 	}
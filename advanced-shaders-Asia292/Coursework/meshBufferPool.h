@@ -0,0 +1,403 @@
+#ifndef _MESH_BUFFER_POOL_H_
+#define _MESH_BUFFER_POOL_H_
+
+#include <GLEW/glew.h>
+#include <glm/glm.hpp>
+#include <algorithm>
+#include <iostream>
+#include <iterator>
+#include <map>
+#include <vector>
+#include "shader.h"
+#include "vertex.h"
+
+// Texture unit of the per-draw data buffer, kept clear of the material texture units
+const GLint MESH_POOL_DRAW_DATA_UNIT = 15;
+
+// Texels per draw id: position offset, position scale, texture array layers
+const GLuint MESH_POOL_DRAW_DATA_TEXELS = 3;
+
+// Per-draw command as read by glMultiDrawElementsIndirect
+struct DrawElementsIndirectCommand
+{
+	GLuint count;
+	GLuint instanceCount;
+	GLuint firstIndex;
+	GLint baseVertex;
+	GLuint baseInstance; // Draw id, selects the per-draw data in the vertex shader
+};
+
+// Location of one mesh inside a MeshBufferPool
+struct MeshPoolAllocation
+{
+	GLuint drawId;
+	GLuint firstVertex, vertexCount;
+	GLuint firstIndex, indexCount;
+	MeshPoolAllocation() :drawId(0), firstVertex(0), vertexCount(0), firstIndex(0), indexCount(0) {}
+	DrawElementsIndirectCommand command() const
+	{
+		DrawElementsIndirectCommand cmd = { this->indexCount, 1, this->firstIndex,
+			(GLint)this->firstVertex, this->drawId };
+		return cmd;
+	}
+};
+
+/*
+* First-fit allocator of element ranges, freed neighbours are merged
+*/
+class RangeAllocator
+{
+public:
+	RangeAllocator() :capacity(0) {}
+	bool allocate(GLuint count, GLuint& offset)
+	{
+		for (FreeMap::iterator it = this->freeRanges.begin(); this->freeRanges.end() != it; ++it)
+		{
+			if (it->second >= count)
+			{
+				offset = it->first;
+				const GLuint remaining = it->second - count;
+				this->freeRanges.erase(it);
+				if (remaining > 0)
+				{
+					this->freeRanges[offset + count] = remaining;
+				}
+				return true;
+			}
+		}
+		return false;
+	}
+	void release(GLuint offset, GLuint count)
+	{
+		if (count == 0)
+		{
+			return;
+		}
+		FreeMap::iterator next = this->freeRanges.lower_bound(offset);
+		if (next != this->freeRanges.begin())
+		{
+			FreeMap::iterator prev = std::prev(next);
+			if (prev->first + prev->second == offset)
+			{
+				offset = prev->first;
+				count += prev->second;
+				this->freeRanges.erase(prev);
+			}
+		}
+		if (next != this->freeRanges.end() && offset + count == next->first)
+		{
+			count += next->second;
+			this->freeRanges.erase(next);
+		}
+		this->freeRanges[offset] = count;
+	}
+	/*
+	* Add free space at the end
+	*/
+	void grow(GLuint newCapacity)
+	{
+		if (newCapacity > this->capacity)
+		{
+			this->release(this->capacity, newCapacity - this->capacity);
+			this->capacity = newCapacity;
+		}
+	}
+	GLuint getCapacity() const { return this->capacity; }
+private:
+	typedef std::map<GLuint, GLuint> FreeMap; // offset -> count
+	FreeMap freeRanges;
+	GLuint capacity;
+};
+
+/*
+* One vertex buffer, index buffer and VAO shared by many meshes of the same vertex format.
+* Meshes are sub-allocated ranges drawn with a base vertex, so a whole batch needs no
+* VAO or buffer rebinds and can go out as one glMultiDrawElementsIndirect call.
+* The per-draw decode data (positionOffset/positionScale) lives in a texture buffer
+* indexed by the draw id, which reaches the shader through the base instance.
+*/
+class MeshBufferPool
+{
+public:
+	MeshBufferPool(VertexFormat format, GLuint vertexCapacity = 1 << 18, GLuint indexCapacity = 1 << 20)
+		:format(format), indexType(format == VERTEX_FORMAT_COMPACT ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT),
+		VAOId(0), VBOId(0), EBOId(0), drawIdBufferId(0), indirectBufferId(0),
+		drawDataBufferId(0), drawDataTextId(0), drawDataDirty(false), drawIdCapacity(0)
+	{
+		// Without indirect draws and base instance the draw id is set per draw as a constant attribute
+		this->multiDrawIndirect = GLEW_ARB_multi_draw_indirect && GLEW_ARB_base_instance;
+		glGenVertexArrays(1, &this->VAOId);
+		glGenBuffers(1, &this->VBOId);
+		glGenBuffers(1, &this->EBOId);
+		glGenBuffers(1, &this->drawIdBufferId);
+		glGenBuffers(1, &this->indirectBufferId);
+		glGenBuffers(1, &this->drawDataBufferId);
+		glGenTextures(1, &this->drawDataTextId);
+		glBindBuffer(GL_TEXTURE_BUFFER, this->drawDataBufferId);
+		glBindBuffer(GL_TEXTURE_BUFFER, 0);
+		glBindTexture(GL_TEXTURE_BUFFER, this->drawDataTextId);
+		glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, this->drawDataBufferId);
+		glBindTexture(GL_TEXTURE_BUFFER, 0);
+		glBindBuffer(GL_ARRAY_BUFFER, this->VBOId);
+		glBufferData(GL_ARRAY_BUFFER, (GLsizeiptr)vertexCapacity * VertexLayout::vertexSize(format),
+			NULL, GL_STATIC_DRAW);
+		glBindBuffer(GL_ARRAY_BUFFER, this->EBOId);
+		glBufferData(GL_ARRAY_BUFFER, (GLsizeiptr)indexCapacity * this->indexSize(), NULL, GL_STATIC_DRAW);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+		this->vertexRanges.grow(vertexCapacity);
+		this->indexRanges.grow(indexCapacity);
+		this->setupVertexArray();
+	}
+	~MeshBufferPool()
+	{
+		glDeleteVertexArrays(1, &this->VAOId);
+		glDeleteBuffers(1, &this->VBOId);
+		glDeleteBuffers(1, &this->EBOId);
+		glDeleteBuffers(1, &this->drawIdBufferId);
+		glDeleteBuffers(1, &this->indirectBufferId);
+		glDeleteBuffers(1, &this->drawDataBufferId);
+		glDeleteTextures(1, &this->drawDataTextId);
+	}
+	MeshBufferPool(const MeshBufferPool&) = delete;
+	MeshBufferPool& operator=(const MeshBufferPool&) = delete;
+	/*
+	* Upload a mesh into free ranges, growing the buffers when needed.
+	* False if the mesh can not use this pool's index type.
+	*/
+	bool allocate(const Vertex* vertPtr, size_t vertCount, const GLuint* indexPtr, size_t indexCount,
+		const glm::vec3& boundsMin, const glm::vec3& boundsMax, MeshPoolAllocation& allocation)
+	{
+		if (vertCount == 0 || indexCount == 0)
+		{
+			return false;
+		}
+		if (this->indexType == GL_UNSIGNED_SHORT && vertCount > 65536)
+		{
+			return false;
+		}
+		MeshPoolAllocation result;
+		result.vertexCount = (GLuint)vertCount;
+		result.indexCount = (GLuint)indexCount;
+		if (!this->vertexRanges.allocate(result.vertexCount, result.firstVertex))
+		{
+			this->growVertices(result.vertexCount);
+			this->vertexRanges.allocate(result.vertexCount, result.firstVertex);
+		}
+		if (!this->indexRanges.allocate(result.indexCount, result.firstIndex))
+		{
+			this->growIndices(result.indexCount);
+			this->indexRanges.allocate(result.indexCount, result.firstIndex);
+		}
+		result.drawId = this->allocateDrawId();
+
+		// Indices stay local to the mesh, the base vertex offsets them at draw time
+		glBindBuffer(GL_ARRAY_BUFFER, this->VBOId);
+		const size_t vertexSize = VertexLayout::vertexSize(this->format);
+		if (this->format == VERTEX_FORMAT_COMPACT)
+		{
+			std::vector<CompactVertex> compactData(vertCount);
+			VertexLayout::packVertices(vertPtr, vertCount, boundsMin, boundsMax, &compactData[0]);
+			glBufferSubData(GL_ARRAY_BUFFER, (GLintptr)result.firstVertex * vertexSize,
+				vertCount * vertexSize, &compactData[0]);
+		}
+		else
+		{
+			glBufferSubData(GL_ARRAY_BUFFER, (GLintptr)result.firstVertex * vertexSize,
+				vertCount * vertexSize, vertPtr);
+		}
+		glBindBuffer(GL_ARRAY_BUFFER, this->EBOId);
+		if (this->indexType == GL_UNSIGNED_SHORT)
+		{
+			std::vector<GLushort> shortIndices(indexPtr, indexPtr + indexCount);
+			glBufferSubData(GL_ARRAY_BUFFER, (GLintptr)result.firstIndex * sizeof(GLushort),
+				indexCount * sizeof(GLushort), &shortIndices[0]);
+		}
+		else
+		{
+			glBufferSubData(GL_ARRAY_BUFFER, (GLintptr)result.firstIndex * sizeof(GLuint),
+				indexCount * sizeof(GLuint), indexPtr);
+		}
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+		// Decode data, one texel for the offset and one for the scale, no texture layers yet
+		const glm::vec3 extent = boundsMax - boundsMin;
+		const GLuint first = result.drawId * MESH_POOL_DRAW_DATA_TEXELS;
+		this->drawData[first] = glm::vec4(boundsMin, 0.0f);
+		this->drawData[first + 1] = glm::vec4(extent, 0.0f);
+		this->drawData[first + 2] = glm::vec4(-1.0f);
+		this->drawDataDirty = true;
+		allocation = result;
+		return true;
+	}
+	/*
+	* Diffuse, specular and normal layer sampled by a draw from its TextureArraySet, -1 for none
+	*/
+	void setDrawLayers(GLuint drawId, const glm::vec3& layers)
+	{
+		this->drawData[drawId * MESH_POOL_DRAW_DATA_TEXELS + 2] = glm::vec4(layers, 0.0f);
+		this->drawDataDirty = true;
+	}
+	/*
+	* Return a mesh's ranges and draw id to the pool
+	*/
+	void release(const MeshPoolAllocation& allocation)
+	{
+		this->vertexRanges.release(allocation.firstVertex, allocation.vertexCount);
+		this->indexRanges.release(allocation.firstIndex, allocation.indexCount);
+		this->freeDrawIds.push_back(allocation.drawId);
+	}
+	/*
+	* Bind the shared VAO and per-draw data, tells the shader to read decode data by draw id
+	*/
+	void bind(const Shader& shader)
+	{
+		if (this->drawDataDirty)
+		{
+			glBindBuffer(GL_TEXTURE_BUFFER, this->drawDataBufferId);
+			glBufferData(GL_TEXTURE_BUFFER, this->drawData.size() * sizeof(glm::vec4),
+				&this->drawData[0], GL_STATIC_DRAW);
+			glBindBuffer(GL_TEXTURE_BUFFER, 0);
+			this->drawDataDirty = false;
+		}
+		glBindVertexArray(this->VAOId);
+		glActiveTexture(GL_TEXTURE0 + MESH_POOL_DRAW_DATA_UNIT);
+		glBindTexture(GL_TEXTURE_BUFFER, this->drawDataTextId);
+		glUniform1i(glGetUniformLocation(shader.programId, "drawData"), MESH_POOL_DRAW_DATA_UNIT);
+		glUniform1i(glGetUniformLocation(shader.programId, "pooledDraw"), GL_TRUE);
+		glUniform1i(glGetUniformLocation(shader.programId, "compactVertex"),
+			this->format == VERTEX_FORMAT_COMPACT);
+	}
+	void unbind(const Shader& shader) const
+	{
+		glUniform1i(glGetUniformLocation(shader.programId, "pooledDraw"), GL_FALSE);
+		glActiveTexture(GL_TEXTURE0 + MESH_POOL_DRAW_DATA_UNIT);
+		glBindTexture(GL_TEXTURE_BUFFER, 0);
+		glBindVertexArray(0);
+	}
+	/*
+	* Issue a batch of commands, one indirect call when supported, otherwise one
+	* glDrawElementsBaseVertex per command. The pool must be bound.
+	*/
+	void draw(const DrawElementsIndirectCommand* commands, size_t commandCount) const
+	{
+		if (commandCount == 0)
+		{
+			return;
+		}
+		if (this->multiDrawIndirect)
+		{
+			glBindBuffer(GL_DRAW_INDIRECT_BUFFER, this->indirectBufferId);
+			glBufferData(GL_DRAW_INDIRECT_BUFFER, commandCount * sizeof(DrawElementsIndirectCommand),
+				commands, GL_STREAM_DRAW);
+			glMultiDrawElementsIndirect(GL_TRIANGLES, this->indexType, 0, (GLsizei)commandCount, 0);
+			glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+			return;
+		}
+		for (size_t i = 0; i < commandCount; ++i)
+		{
+			const DrawElementsIndirectCommand& cmd = commands[i];
+			glVertexAttribI1ui(4, cmd.baseInstance);
+			glDrawElementsBaseVertex(GL_TRIANGLES, (GLsizei)cmd.count, this->indexType,
+				(GLvoid*)((size_t)cmd.firstIndex * this->indexSize()), cmd.baseVertex);
+		}
+	}
+	VertexFormat getFormat() const { return this->format; }
+	GLenum getIndexType() const { return this->indexType; }
+	bool hasMultiDrawIndirect() const { return this->multiDrawIndirect; }
+private:
+	VertexFormat format;
+	GLenum indexType; // GL_UNSIGNED_SHORT for compact pools, meshes above 65536 vertices stay out
+	GLuint VAOId, VBOId, EBOId;
+	GLuint drawIdBufferId; // 0..n-1, read per instance so the base instance becomes the draw id
+	GLuint indirectBufferId;
+	GLuint drawDataBufferId, drawDataTextId;
+	std::vector<glm::vec4> drawData; // MESH_POOL_DRAW_DATA_TEXELS per draw id
+	bool drawDataDirty;
+	GLuint drawIdCapacity;
+	std::vector<GLuint> freeDrawIds;
+	bool multiDrawIndirect;
+	RangeAllocator vertexRanges, indexRanges;
+
+	size_t indexSize() const
+	{
+		return this->indexType == GL_UNSIGNED_SHORT ? sizeof(GLushort) : sizeof(GLuint);
+	}
+	void setupVertexArray()
+	{
+		glBindVertexArray(this->VAOId);
+		glBindBuffer(GL_ARRAY_BUFFER, this->VBOId);
+		VertexLayout::setupAttributes(this->format);
+		glBindBuffer(GL_ARRAY_BUFFER, this->drawIdBufferId);
+		glVertexAttribIPointer(4, 1, GL_UNSIGNED_INT, sizeof(GLuint), (GLvoid*)0);
+		glVertexAttribDivisor(4, 1);
+		if (this->multiDrawIndirect)
+		{
+			glEnableVertexAttribArray(4);
+		}
+		else
+		{
+			glDisableVertexAttribArray(4);
+		}
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, this->EBOId);
+		glBindVertexArray(0);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+	}
+	GLuint allocateDrawId()
+	{
+		if (!this->freeDrawIds.empty())
+		{
+			const GLuint drawId = this->freeDrawIds.back();
+			this->freeDrawIds.pop_back();
+			return drawId;
+		}
+		const GLuint drawId = (GLuint)(this->drawData.size() / MESH_POOL_DRAW_DATA_TEXELS);
+		this->drawData.resize(this->drawData.size() + MESH_POOL_DRAW_DATA_TEXELS);
+		if (drawId >= this->drawIdCapacity)
+		{
+			// Identity table, grown in steps so the upload is rare
+			this->drawIdCapacity = std::max<GLuint>(64, this->drawIdCapacity * 2);
+			std::vector<GLuint> ids(this->drawIdCapacity);
+			for (GLuint i = 0; i < this->drawIdCapacity; ++i)
+			{
+				ids[i] = i;
+			}
+			glBindBuffer(GL_ARRAY_BUFFER, this->drawIdBufferId);
+			glBufferData(GL_ARRAY_BUFFER, ids.size() * sizeof(GLuint), &ids[0], GL_STATIC_DRAW);
+			glBindBuffer(GL_ARRAY_BUFFER, 0);
+		}
+		return drawId;
+	}
+	/*
+	* Reallocate a buffer with room for at least extra more elements, existing data is copied on the GPU
+	*/
+	GLuint growBuffer(GLuint bufferId, RangeAllocator& ranges, GLuint extra, size_t elementSize)
+	{
+		const GLuint oldCapacity = ranges.getCapacity();
+		const GLuint newCapacity = std::max(oldCapacity * 2, oldCapacity + extra);
+		GLuint newBufferId = 0;
+		glGenBuffers(1, &newBufferId);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, newBufferId);
+		glBufferData(GL_COPY_WRITE_BUFFER, (GLsizeiptr)newCapacity * elementSize, NULL, GL_STATIC_DRAW);
+		glBindBuffer(GL_COPY_READ_BUFFER, bufferId);
+		glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0,
+			(GLsizeiptr)oldCapacity * elementSize);
+		glBindBuffer(GL_COPY_READ_BUFFER, 0);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+		glDeleteBuffers(1, &bufferId);
+		ranges.grow(newCapacity);
+		return newBufferId;
+	}
+	void growVertices(GLuint extra)
+	{
+		this->VBOId = this->growBuffer(this->VBOId, this->vertexRanges, extra,
+			VertexLayout::vertexSize(this->format));
+		this->setupVertexArray();
+	}
+	void growIndices(GLuint extra)
+	{
+		this->EBOId = this->growBuffer(this->EBOId, this->indexRanges, extra, this->indexSize());
+		this->setupVertexArray();
+	}
+};
+
+#endif
@@ -0,0 +1,348 @@
+#ifndef _MESH_CACHE_H_
+#define _MESH_CACHE_H_
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+#include "mesh.h"
+#include "mappedFile.h"
+
+// Bump whenever Vertex or the file layout below changes
+const uint32_t MESH_CACHE_VERSION = 5;
+
+// File header, followed by one MeshCacheEntry per mesh
+struct MeshCacheHeader
+{
+	char magic[4];
+	uint32_t version;
+	uint64_t sourceHash;
+	uint64_t importKey; // Import flags and processing options the meshes were built with
+	uint32_t vertexSize;
+	uint32_t meshCount;
+};
+
+// Location of one mesh's data inside the cache file
+struct MeshCacheEntry
+{
+	uint32_t vertexCount;
+	uint32_t indexCount;
+	uint32_t textureCount;
+	uint32_t meshletCount;
+	uint32_t lodCount;
+	uint32_t reserved;
+	float boundsMin[3];
+	float boundsMax[3];
+	uint64_t vertexOffset;
+	uint64_t indexOffset;
+	uint64_t meshletOffset;
+	uint64_t lodOffset;
+	uint64_t textureOffset; // Records of (type, path length, path relative to the model folder)
+};
+
+// A mesh as read from the cache, pointing into the mapped file
+struct CachedMesh
+{
+	const Vertex* vertices;
+	size_t vertexCount;
+	const GLuint* indices;
+	size_t indexCount;
+	const Meshlet* meshlets;
+	size_t meshletCount;
+	const MeshLod* lods;
+	size_t lodCount;
+	std::vector<std::pair<aiTextureType, std::string> > textures;
+	glm::vec3 boundsMin, boundsMax;
+};
+
+/*
+* Binary cache of processed meshes kept beside the source model file
+*/
+class MeshCache
+{
+public:
+	static std::string cachePath(const std::string& modelPath)
+	{
+		return modelPath + ".meshcache";
+	}
+	/*
+	* Map the cache and check it matches the source hash and import key
+	*/
+	bool open(const std::string& path, uint64_t sourceHash, uint64_t importKey)
+	{
+		this->entries = NULL;
+		this->meshNum = 0;
+		if (!this->file.open(path))
+		{
+			return false;
+		}
+		const unsigned char* base = this->file.data();
+		const size_t fileSize = this->file.size();
+		if (fileSize < sizeof(MeshCacheHeader))
+		{
+			return this->reject(path, "truncated header");
+		}
+		const MeshCacheHeader* header = (const MeshCacheHeader*)base;
+		if (memcmp(header->magic, "MSHC", 4) != 0
+			|| header->version != MESH_CACHE_VERSION
+			|| header->vertexSize != sizeof(Vertex))
+		{
+			return this->reject(path, "unknown format version");
+		}
+		if (header->sourceHash != sourceHash
+			|| header->importKey != importKey)
+		{
+			return this->reject(path, "source model or import flags changed");
+		}
+		const uint64_t tableEnd = sizeof(MeshCacheHeader)
+			+ (uint64_t)header->meshCount * sizeof(MeshCacheEntry);
+		if (tableEnd > fileSize)
+		{
+			return this->reject(path, "truncated mesh table");
+		}
+		const MeshCacheEntry* table = (const MeshCacheEntry*)(base + sizeof(MeshCacheHeader));
+		// Validate every range up front so a bad file never reaches the GPU
+		for (uint32_t i = 0; i < header->meshCount; ++i)
+		{
+			const MeshCacheEntry& entry = table[i];
+			if (entry.vertexOffset % sizeof(float) != 0
+				|| entry.indexOffset % sizeof(GLuint) != 0
+				|| !inRange(entry.vertexOffset, (uint64_t)entry.vertexCount * sizeof(Vertex), fileSize)
+				|| !inRange(entry.indexOffset, (uint64_t)entry.indexCount * sizeof(GLuint), fileSize)
+				|| entry.meshletOffset % sizeof(float) != 0
+				|| !inRange(entry.meshletOffset, (uint64_t)entry.meshletCount * sizeof(Meshlet), fileSize)
+				|| entry.lodOffset % sizeof(float) != 0
+				|| !inRange(entry.lodOffset, (uint64_t)entry.lodCount * sizeof(MeshLod), fileSize)
+				|| entry.indexCount % 3 != 0)
+			{
+				return this->reject(path, "mesh data out of range");
+			}
+			const Meshlet* meshlets = (const Meshlet*)(base + entry.meshletOffset);
+			for (uint32_t j = 0; j < entry.meshletCount; ++j)
+			{
+				if (meshlets[j].firstIndex > entry.indexCount
+					|| meshlets[j].indexCount > entry.indexCount - meshlets[j].firstIndex)
+				{
+					return this->reject(path, "meshlet out of range");
+				}
+			}
+			const MeshLod* lods = (const MeshLod*)(base + entry.lodOffset);
+			for (uint32_t j = 0; j < entry.lodCount; ++j)
+			{
+				if (lods[j].firstIndex > entry.indexCount
+					|| lods[j].indexCount > entry.indexCount - lods[j].firstIndex)
+				{
+					return this->reject(path, "LOD out of range");
+				}
+			}
+			const GLuint* indices = (const GLuint*)(base + entry.indexOffset);
+			for (uint32_t j = 0; j < entry.indexCount; ++j)
+			{
+				if (indices[j] >= entry.vertexCount)
+				{
+					return this->reject(path, "index out of range");
+				}
+			}
+			uint64_t offset = entry.textureOffset;
+			for (uint32_t j = 0; j < entry.textureCount; ++j)
+			{
+				uint32_t record[2];
+				if (!inRange(offset, sizeof(record), fileSize))
+				{
+					return this->reject(path, "texture record out of range");
+				}
+				memcpy(record, base + offset, sizeof(record));
+				offset += sizeof(record);
+				if (!inRange(offset, record[1], fileSize))
+				{
+					return this->reject(path, "texture path out of range");
+				}
+				offset += record[1];
+			}
+		}
+		this->entries = table;
+		this->meshNum = header->meshCount;
+		return true;
+	}
+	size_t meshCount() const { return this->meshNum; }
+	/*
+	* Get mesh data, vertex and index pointers stay valid while the cache is open
+	*/
+	void getMesh(size_t index, CachedMesh& mesh) const
+	{
+		const unsigned char* base = this->file.data();
+		const MeshCacheEntry& entry = this->entries[index];
+		mesh.vertices = (const Vertex*)(base + entry.vertexOffset);
+		mesh.vertexCount = entry.vertexCount;
+		mesh.indices = (const GLuint*)(base + entry.indexOffset);
+		mesh.indexCount = entry.indexCount;
+		mesh.meshlets = (const Meshlet*)(base + entry.meshletOffset);
+		mesh.meshletCount = entry.meshletCount;
+		mesh.lods = (const MeshLod*)(base + entry.lodOffset);
+		mesh.lodCount = entry.lodCount;
+		mesh.boundsMin = glm::vec3(entry.boundsMin[0], entry.boundsMin[1], entry.boundsMin[2]);
+		mesh.boundsMax = glm::vec3(entry.boundsMax[0], entry.boundsMax[1], entry.boundsMax[2]);
+		mesh.textures.clear();
+		uint64_t offset = entry.textureOffset;
+		for (uint32_t i = 0; i < entry.textureCount; ++i)
+		{
+			uint32_t record[2];
+			memcpy(record, base + offset, sizeof(record));
+			offset += sizeof(record);
+			mesh.textures.push_back(std::make_pair((aiTextureType)record[0],
+				std::string((const char*)base + offset, record[1])));
+			offset += record[1];
+		}
+	}
+	/*
+	* Write the meshes of a loaded model, texturePaths is the model's table that
+	* Texture::source indexes. Paths are stored relative to modelDir.
+	*/
+	static bool write(const std::string& path, uint64_t sourceHash, uint64_t importKey,
+		const std::vector<Mesh>& meshes, const std::string& modelDir, const std::vector<std::string>& texturePaths)
+	{
+		for (size_t i = 0; i < meshes.size(); ++i)
+		{
+			// Meshes whose system memory copy was dropped can not be cached
+			if (meshes[i].getVertices().empty())
+			{
+				return false;
+			}
+		}
+		// Lay out the file: header, mesh table, then 16-byte aligned data blocks
+		std::vector<MeshCacheEntry> table(meshes.size());
+		std::vector<std::string> textureBlocks(meshes.size());
+		uint64_t offset = sizeof(MeshCacheHeader) + table.size() * sizeof(MeshCacheEntry);
+		for (size_t i = 0; i < meshes.size(); ++i)
+		{
+			const Mesh& mesh = meshes[i];
+			MeshCacheEntry& entry = table[i];
+			memset(&entry, 0, sizeof(entry));
+			entry.vertexCount = (uint32_t)mesh.getVertices().size();
+			entry.indexCount = (uint32_t)mesh.getIndices().size();
+			entry.textureCount = (uint32_t)mesh.getTextures().size();
+			entry.meshletCount = (uint32_t)mesh.getMeshlets().size();
+			entry.lodCount = (uint32_t)mesh.getLods().size();
+			for (int k = 0; k < 3; ++k)
+			{
+				entry.boundsMin[k] = mesh.getBoundsMin()[k];
+				entry.boundsMax[k] = mesh.getBoundsMax()[k];
+			}
+			offset = align(offset);
+			entry.vertexOffset = offset;
+			offset += (uint64_t)entry.vertexCount * sizeof(Vertex);
+			offset = align(offset);
+			entry.indexOffset = offset;
+			offset += (uint64_t)entry.indexCount * sizeof(GLuint);
+			offset = align(offset);
+			entry.meshletOffset = offset;
+			offset += (uint64_t)entry.meshletCount * sizeof(Meshlet);
+			offset = align(offset);
+			entry.lodOffset = offset;
+			offset += (uint64_t)entry.lodCount * sizeof(MeshLod);
+			entry.textureOffset = offset;
+			for (std::vector<Texture>::const_iterator it = mesh.getTextures().begin();
+				mesh.getTextures().end() != it; ++it)
+			{
+				std::string relativePath = texturePaths[it->source];
+				if (relativePath.compare(0, modelDir.size() + 1, modelDir + "/") == 0)
+				{
+					relativePath = relativePath.substr(modelDir.size() + 1);
+				}
+				uint32_t record[2] = { (uint32_t)it->type, (uint32_t)relativePath.size() };
+				textureBlocks[i].append((const char*)record, sizeof(record));
+				textureBlocks[i].append(relativePath);
+			}
+			offset += textureBlocks[i].size();
+		}
+
+		// Write to a temporary file first so a crash never leaves a half-written cache
+		const std::string tempPath = path + ".tmp";
+		std::ofstream out(tempPath.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+		if (!out)
+		{
+			return false;
+		}
+		MeshCacheHeader header;
+		memset(&header, 0, sizeof(header));
+		memcpy(header.magic, "MSHC", 4);
+		header.version = MESH_CACHE_VERSION;
+		header.sourceHash = sourceHash;
+		header.importKey = importKey;
+		header.vertexSize = sizeof(Vertex);
+		header.meshCount = (uint32_t)meshes.size();
+		out.write((const char*)&header, sizeof(header));
+		if (!table.empty())
+		{
+			out.write((const char*)&table[0], table.size() * sizeof(MeshCacheEntry));
+		}
+		for (size_t i = 0; i < meshes.size(); ++i)
+		{
+			const std::vector<Vertex>& vertices = meshes[i].getVertices();
+			const std::vector<GLuint>& indices = meshes[i].getIndices();
+			pad(out, table[i].vertexOffset);
+			if (!vertices.empty())
+			{
+				out.write((const char*)&vertices[0], vertices.size() * sizeof(Vertex));
+			}
+			pad(out, table[i].indexOffset);
+			if (!indices.empty())
+			{
+				out.write((const char*)&indices[0], indices.size() * sizeof(GLuint));
+			}
+			const std::vector<Meshlet>& meshlets = meshes[i].getMeshlets();
+			pad(out, table[i].meshletOffset);
+			if (!meshlets.empty())
+			{
+				out.write((const char*)&meshlets[0], meshlets.size() * sizeof(Meshlet));
+			}
+			const std::vector<MeshLod>& lods = meshes[i].getLods();
+			pad(out, table[i].lodOffset);
+			if (!lods.empty())
+			{
+				out.write((const char*)&lods[0], lods.size() * sizeof(MeshLod));
+			}
+			out.write(textureBlocks[i].data(), textureBlocks[i].size());
+		}
+		out.close();
+		if (!out)
+		{
+			std::remove(tempPath.c_str());
+			return false;
+		}
+		std::remove(path.c_str());
+		return std::rename(tempPath.c_str(), path.c_str()) == 0;
+	}
+private:
+	MappedFile file;
+	const MeshCacheEntry* entries;
+	size_t meshNum;
+
+	bool reject(const std::string& path, const char* reason)
+	{
+		std::cout << "Info:MeshCache::open, rebuilding " << path << ": " << reason << std::endl;
+		this->file.close();
+		return false;
+	}
+	static bool inRange(uint64_t offset, uint64_t length, uint64_t fileSize)
+	{
+		return offset <= fileSize && length <= fileSize - offset;
+	}
+	static uint64_t align(uint64_t offset)
+	{
+		return (offset + 15) & ~(uint64_t)15;
+	}
+	static void pad(std::ofstream& out, uint64_t offset)
+	{
+		static const char zeros[16] = { 0 };
+		uint64_t current = (uint64_t)out.tellp();
+		if (current < offset)
+		{
+			out.write(zeros, (std::streamsize)(offset - current));
+		}
+	}
+};
+
+#endif
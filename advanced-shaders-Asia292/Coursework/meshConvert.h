@@ -0,0 +1,116 @@
+#ifndef _MESH_CONVERT_H_
+#define _MESH_CONVERT_H_
+
+#include <cstddef>
+#include <cstring>
+#include <vector>
+#include <assimp/scene.h>
+#include "mesh.h"
+
+#if defined(_M_X64) || defined(__SSE2__) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define MESH_CONVERT_SSE2 1
+#include <emmintrin.h>
+#endif
+
+/*
+* Bulk conversion of Assimp's per-attribute arrays into interleaved Vertex data
+*/
+class MeshConvert
+{
+public:
+	/*
+	* Convert positions, UV0 and normals, the output is sized once. Tangents are left
+	* zero for TangentGenerator.
+	*/
+	static void convertVertices(const aiMesh* meshPtr, std::vector<Vertex>& vertData)
+	{
+		vertData.resize(meshPtr->mNumVertices);
+		if (vertData.empty() || !meshPtr->HasPositions())
+		{
+			return;
+		}
+		// Attribute checks are resolved once, not per vertex
+		const int layout = (meshPtr->HasTextureCoords(0) ? 1 : 0)
+			| (meshPtr->HasNormals() ? 2 : 0);
+		switch (layout)
+		{
+		case 0: convertRange<false, false>(meshPtr, &vertData[0]); break;
+		case 1: convertRange<true, false>(meshPtr, &vertData[0]); break;
+		case 2: convertRange<false, true>(meshPtr, &vertData[0]); break;
+		default: convertRange<true, true>(meshPtr, &vertData[0]); break;
+		}
+	}
+	/*
+	* Flatten triangle faces into an index array, false if a face is not a triangle
+	*/
+	static bool convertIndices(const aiMesh* meshPtr, std::vector<GLuint>& indices)
+	{
+		indices.resize((size_t)meshPtr->mNumFaces * 3);
+		GLuint* out = indices.empty() ? NULL : &indices[0];
+		for (unsigned int i = 0; i < meshPtr->mNumFaces; ++i)
+		{
+			const aiFace& face = meshPtr->mFaces[i];
+			if (face.mNumIndices != 3)
+			{
+				indices.clear();
+				return false;
+			}
+			out[0] = face.mIndices[0];
+			out[1] = face.mIndices[1];
+			out[2] = face.mIndices[2];
+			out += 3;
+		}
+		return true;
+	}
+private:
+	template <bool hasUV, bool hasNormals>
+	static void convertRange(const aiMesh* meshPtr, Vertex* out)
+	{
+		const size_t count = meshPtr->mNumVertices;
+		static_assert(sizeof(aiVector3D) == 3 * sizeof(float), "aiVector3D must be three packed floats");
+		const float* positions = (const float*)meshPtr->mVertices;
+		const float* uvs = hasUV ? (const float*)meshPtr->mTextureCoords[0] : NULL;
+		const float* normals = hasNormals ? (const float*)meshPtr->mNormals : NULL;
+		size_t i = 0;
+#ifdef MESH_CONVERT_SSE2
+		// Each 16 byte load/store moves a whole 3-float attribute plus one spare lane.
+		// Stores go in ascending address order so every spare lane is overwritten by the
+		// next attribute, the normal's by the zeroed 4-float tangent.
+		// The last vertex is done in scalar code so nothing is read past the source arrays.
+		static_assert(offsetof(Vertex, position) == 0
+			&& offsetof(Vertex, texCoords) == 12
+			&& offsetof(Vertex, normal) == 20
+			&& offsetof(Vertex, tangent) == 32
+			&& sizeof(Vertex) == 48, "MeshConvert expects the interleaved Vertex layout");
+		const __m128 zero = _mm_setzero_ps();
+		for (; i + 1 < count; ++i)
+		{
+			float* dst = (float*)(out + i);
+			const size_t src = i * 3;
+			_mm_storeu_ps(dst, _mm_loadu_ps(positions + src));
+			if (hasUV)
+			{
+				_mm_storel_pi((__m64*)(dst + 3), _mm_loadu_ps(uvs + src));
+			}
+			else
+			{
+				_mm_storel_pi((__m64*)(dst + 3), zero);
+			}
+			_mm_storeu_ps(dst + 5, hasNormals ? _mm_loadu_ps(normals + src) : zero);
+			_mm_storeu_ps(dst + 8, zero);
+		}
+#endif
+		for (; i < count; ++i)
+		{
+			Vertex& vertex = out[i];
+			const size_t src = i * 3;
+			vertex.position = glm::vec3(positions[src], positions[src + 1], positions[src + 2]);
+			vertex.texCoords = hasUV ? glm::vec2(uvs[src], uvs[src + 1]) : glm::vec2(0.0f);
+			vertex.normal = hasNormals
+				? glm::vec3(normals[src], normals[src + 1], normals[src + 2]) : glm::vec3(0.0f);
+			vertex.tangent = glm::vec4(0.0f);
+		}
+	}
+};
+
+#endif
@@ -0,0 +1,478 @@
+#ifndef _MESH_LOD_H_
+#define _MESH_LOD_H_
+
+#include <GLEW/glew.h>
+#include <glm/glm.hpp>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <functional>
+#include <queue>
+#include <vector>
+#include "arena.h"
+#include "meshOptimize.h"
+#include "vertex.h"
+
+// One level of detail, a range of the mesh's index buffer over the shared vertices
+struct MeshLod
+{
+	GLuint firstIndex;
+	GLuint indexCount;
+	float error; // Object space deviation from LOD 0
+};
+
+/*
+* Quadric error metric edge collapse simplifier (Garland and Heckbert).
+* Vertices are only ever collapsed onto existing vertices, so every LOD shares the
+* original vertex buffer. Exact duplicate vertices are welded onto one representative
+* first; vertices on UV, normal or tangent seams (distinct vertices at one position) and
+* on open borders are locked, which keeps those discontinuities intact. Collapses come
+* from a priority queue whose stale entries are skipped when popped. Scratch buffers
+* come from the caller's arena.
+*/
+class MeshSimplifier
+{
+public:
+	/*
+	* Append LOD 1..levels-1 to indices, each reduced by the given ratio from the previous one.
+	* Generation stops early once a level no longer gets noticeably smaller.
+	*/
+	static void buildLodChain(const std::vector<Vertex>& vertices, std::vector<GLuint>& indices,
+		size_t levels, float reduction, std::vector<MeshLod>& lods, MonotonicArena& arena)
+	{
+		lods.clear();
+		MeshLod base = { 0, (GLuint)indices.size(), 0.0f };
+		lods.push_back(base);
+		std::vector<size_t> targets;
+		size_t target = indices.size();
+		for (size_t level = 1; level < levels; ++level)
+		{
+			target = (size_t)(target / 3 * reduction) * 3;
+			targets.push_back(target);
+		}
+		// One collapse sequence, each level is a snapshot so the error is always
+		// measured against the original surface
+		std::vector<std::vector<GLuint> > simplified;
+		std::vector<float> errors;
+		const std::vector<GLuint> lod0(indices);
+		simplifyChain(vertices, lod0, targets, simplified, errors, arena);
+		for (size_t level = 0; level < simplified.size(); ++level)
+		{
+			const size_t previous = lods.back().indexCount;
+			if (simplified[level].empty() || simplified[level].size() > previous * 9 / 10)
+			{
+				break;
+			}
+			MeshOptimizer::optimizeVertexCache(simplified[level], vertices.size(), arena);
+			MeshLod lod = { (GLuint)indices.size(), (GLuint)simplified[level].size(), errors[level] };
+			indices.insert(indices.end(), simplified[level].begin(), simplified[level].end());
+			lods.push_back(lod);
+		}
+	}
+	/*
+	* Simplify towards targetIndexCount, returns the largest collapse error (object space distance)
+	*/
+	static float simplify(const std::vector<Vertex>& vertices, const std::vector<GLuint>& indices,
+		size_t targetIndexCount, std::vector<GLuint>& result, MonotonicArena& arena)
+	{
+		std::vector<std::vector<GLuint> > results;
+		std::vector<float> errors;
+		simplifyChain(vertices, indices, std::vector<size_t>(1, targetIndexCount), results, errors, arena);
+		result.swap(results[0]);
+		return errors[0];
+	}
+	/*
+	* Collapse towards each target index count in turn (decreasing), recording the
+	* index buffer and error reached at every target
+	*/
+	static void simplifyChain(const std::vector<Vertex>& vertices, const std::vector<GLuint>& indices,
+		const std::vector<size_t>& targets, std::vector<std::vector<GLuint> >& results, std::vector<float>& errors,
+		MonotonicArena& arena)
+	{
+		results.clear();
+		errors.clear();
+		const size_t vertexCount = vertices.size();
+		if (vertexCount == 0)
+		{
+			results.assign(targets.size(), indices);
+			errors.assign(targets.size(), 0.0f);
+			return;
+		}
+		const ArenaAllocator<GLuint> uintAlloc(arena);
+		ArenaVector<GLuint> positionId(uintAlloc), canonical(uintAlloc), groupStart(uintAlloc), groupMembers(uintAlloc);
+		buildPositionGroups(vertices, positionId, canonical, groupStart, groupMembers);
+		// Only distinct vertices sharing a position are seams, exact duplicates were welded away
+		const ArenaAllocator<char> charAlloc(arena);
+		ArenaVector<char> locked(vertexCount, 0, charAlloc);
+		for (size_t g = 0; g + 1 < groupStart.size(); ++g)
+		{
+			const bool seam = groupStart[g + 1] - groupStart[g] > 1;
+			for (GLuint j = groupStart[g]; j < groupStart[g + 1]; ++j)
+			{
+				locked[groupMembers[j]] = seam;
+			}
+		}
+		ArenaVector<GLuint> triangles(uintAlloc);
+		triangles.reserve(indices.size());
+		for (size_t t = 0; t + 2 < indices.size(); t += 3)
+		{
+			const GLuint a = canonical[indices[t]], b = canonical[indices[t + 1]], c = canonical[indices[t + 2]];
+			if (positionId[a] == positionId[b] || positionId[b] == positionId[c] || positionId[a] == positionId[c])
+			{
+				continue;
+			}
+			triangles.push_back(a);
+			triangles.push_back(b);
+			triangles.push_back(c);
+		}
+		lockBorders(triangles, positionId, locked);
+
+		// Plane quadrics accumulated per position, weighted by triangle area
+		const size_t groupCount = groupStart.size() - 1;
+		ArenaVector<Quadric> quadrics(groupCount, ArenaAllocator<Quadric>(arena));
+		for (size_t t = 0; t + 2 < triangles.size(); t += 3)
+		{
+			const glm::vec3& p0 = vertices[triangles[t]].position;
+			const glm::vec3 normal = glm::cross(vertices[triangles[t + 1]].position - p0,
+				vertices[triangles[t + 2]].position - p0);
+			const float length = glm::length(normal);
+			if (length <= 0.0f)
+			{
+				continue;
+			}
+			Quadric plane(normal / length, p0, length * 0.5f);
+			for (int k = 0; k < 3; ++k)
+			{
+				quadrics[positionId[triangles[t + k]]].add(plane);
+			}
+		}
+
+		const size_t triangleCount = triangles.size() / 3;
+		ArenaVector<char> alive(triangleCount, 1, charAlloc);
+		size_t liveTriangles = triangleCount;
+		ArenaVector<ArenaVector<GLuint> > vertexTriangles(vertexCount, ArenaVector<GLuint>(uintAlloc),
+			ArenaAllocator<ArenaVector<GLuint> >(arena));
+		for (size_t i = 0; i < triangles.size(); ++i)
+		{
+			vertexTriangles[triangles[i]].push_back((GLuint)(i / 3));
+		}
+		// Candidate collapses u -> v along every edge, cheapest first. A position's version
+		// changes whenever its quadric grows or it is collapsed away, which invalidates
+		// every queued entry that still refers to the old state.
+		ArenaVector<GLuint> version(groupCount, 0, uintAlloc);
+		const ArenaVector<Collapse> queueStorage((ArenaAllocator<Collapse>(arena)));
+		CollapseQueue queue(std::greater<Collapse>(), queueStorage);
+		for (size_t t = 0; t + 2 < triangles.size(); t += 3)
+		{
+			for (int k = 0; k < 3; ++k)
+			{
+				pushEdge(queue, quadrics, vertices, positionId, version, locked, triangles[t + k], triangles[t + (k + 1) % 3]);
+			}
+		}
+
+		float resultError = 0.0f;
+		for (size_t level = 0; level < targets.size(); ++level)
+		{
+			while (liveTriangles * 3 > targets[level] && !queue.empty())
+			{
+				const Collapse collapse = queue.top();
+				queue.pop();
+				const GLuint u = collapse.from, v = collapse.to;
+				const GLuint pu = positionId[u], pv = positionId[v];
+				if (collapse.fromVersion != version[pu] || collapse.toVersion != version[pv]
+					|| flipsTriangle(vertices, triangles, alive, vertexTriangles[u], positionId, u, v))
+				{
+					continue;
+				}
+				// Move u's triangles onto v and drop the ones that became degenerate
+				ArenaVector<GLuint>& around = vertexTriangles[v];
+				for (size_t j = 0; j < vertexTriangles[u].size(); ++j)
+				{
+					const GLuint t = vertexTriangles[u][j];
+					if (!alive[t])
+					{
+						continue;
+					}
+					GLuint* corners = &triangles[t * 3];
+					for (int k = 0; k < 3; ++k)
+					{
+						corners[k] = corners[k] == u ? v : corners[k];
+					}
+					const GLuint pa = positionId[corners[0]], pb = positionId[corners[1]], pc = positionId[corners[2]];
+					if (pa == pb || pb == pc || pa == pc)
+					{
+						alive[t] = 0;
+						--liveTriangles;
+						continue;
+					}
+					around.push_back(t);
+				}
+				ArenaVector<GLuint>(uintAlloc).swap(vertexTriangles[u]);
+				around.erase(std::remove_if(around.begin(), around.end(),
+					[&](GLuint t) { return !alive[t]; }), around.end());
+				quadrics[pv].add(quadrics[pu]);
+				++version[pu];
+				++version[pv];
+				resultError = std::max(resultError, collapse.cost);
+				// Requeue every edge whose cost depends on the grown quadric, seam twins of v included
+				for (GLuint j = groupStart[pv]; j < groupStart[pv + 1]; ++j)
+				{
+					const GLuint w = groupMembers[j];
+					for (size_t n = 0; n < vertexTriangles[w].size(); ++n)
+					{
+						const GLuint t = vertexTriangles[w][n];
+						if (!alive[t])
+						{
+							continue;
+						}
+						for (int k = 0; k < 3; ++k)
+						{
+							if (triangles[t * 3 + k] != w)
+							{
+								pushEdge(queue, quadrics, vertices, positionId, version, locked, w, triangles[t * 3 + k]);
+							}
+						}
+					}
+				}
+			}
+			std::vector<GLuint> result;
+			result.reserve(liveTriangles * 3);
+			for (size_t t = 0; t < triangleCount; ++t)
+			{
+				if (alive[t])
+				{
+					result.insert(result.end(), triangles.begin() + t * 3, triangles.begin() + t * 3 + 3);
+				}
+			}
+			results.push_back(result);
+			errors.push_back(std::sqrt(resultError));
+		}
+	}
+private:
+	// Symmetric 4x4 error quadric, squared distance to a set of planes
+	struct Quadric
+	{
+		double a2, ab, ac, ad, b2, bc, bd, c2, cd, d2, area;
+		Quadric() :a2(0), ab(0), ac(0), ad(0), b2(0), bc(0), bd(0), c2(0), cd(0), d2(0), area(0) {}
+		Quadric(const glm::vec3& n, const glm::vec3& p, float weight)
+		{
+			const double a = n.x, b = n.y, c = n.z, d = -glm::dot(n, p);
+			a2 = a * a * weight; ab = a * b * weight; ac = a * c * weight; ad = a * d * weight;
+			b2 = b * b * weight; bc = b * c * weight; bd = b * d * weight;
+			c2 = c * c * weight; cd = c * d * weight; d2 = d * d * weight;
+			area = weight;
+		}
+		void add(const Quadric& q)
+		{
+			a2 += q.a2; ab += q.ab; ac += q.ac; ad += q.ad; b2 += q.b2;
+			bc += q.bc; bd += q.bd; c2 += q.c2; cd += q.cd; d2 += q.d2; area += q.area;
+		}
+		double evaluate(const glm::vec3& p) const
+		{
+			const double x = p.x, y = p.y, z = p.z;
+			return a2 * x * x + 2 * ab * x * y + 2 * ac * x * z + 2 * ad * x
+				+ b2 * y * y + 2 * bc * y * z + 2 * bd * y
+				+ c2 * z * z + 2 * cd * z + d2;
+		}
+	};
+	struct Collapse
+	{
+		GLuint from, to;
+		GLuint fromVersion, toVersion; // Position versions when queued
+		float cost; // Area weighted mean squared distance
+		Collapse(GLuint from, GLuint to, GLuint fromVersion, GLuint toVersion, float cost)
+			:from(from), to(to), fromVersion(fromVersion), toVersion(toVersion), cost(cost) {}
+		bool operator>(const Collapse& other) const { return this->cost > other.cost; }
+	};
+	typedef std::priority_queue<Collapse, ArenaVector<Collapse>, std::greater<Collapse> > CollapseQueue;
+
+	static float collapseCost(const ArenaVector<Quadric>& quadrics, const std::vector<Vertex>& vertices,
+		const ArenaVector<GLuint>& positionId, GLuint from, GLuint to)
+	{
+		const Quadric& qu = quadrics[positionId[from]];
+		const Quadric& qv = quadrics[positionId[to]];
+		const double area = qu.area + qv.area;
+		const glm::vec3& target = vertices[to].position;
+		const double error = (qu.evaluate(target) + qv.evaluate(target)) / (area > 0.0 ? area : 1.0);
+		return (float)std::max(error, 0.0);
+	}
+	/*
+	* Queue both directions of an edge, locked vertices only ever act as targets
+	*/
+	static void pushEdge(CollapseQueue& queue, const ArenaVector<Quadric>& quadrics, const std::vector<Vertex>& vertices,
+		const ArenaVector<GLuint>& positionId, const ArenaVector<GLuint>& version, const ArenaVector<char>& locked,
+		GLuint a, GLuint b)
+	{
+		const GLuint pa = positionId[a], pb = positionId[b];
+		if (!locked[a])
+		{
+			queue.push(Collapse(a, b, version[pa], version[pb], collapseCost(quadrics, vertices, positionId, a, b)));
+		}
+		if (!locked[b])
+		{
+			queue.push(Collapse(b, a, version[pb], version[pa], collapseCost(quadrics, vertices, positionId, b, a)));
+		}
+	}
+	/*
+	* Vertices with bit-identical positions share a group id, and vertices that also match in
+	* every other attribute map to one canonical vertex. groupMembers lists the canonical
+	* vertices of each group from groupStart[g] to groupStart[g + 1].
+	*/
+	static void buildPositionGroups(const std::vector<Vertex>& vertices, ArenaVector<GLuint>& positionId,
+		ArenaVector<GLuint>& canonical, ArenaVector<GLuint>& groupStart, ArenaVector<GLuint>& groupMembers)
+	{
+		ArenaVector<GLuint> order(vertices.size(), positionId.get_allocator());
+		for (size_t i = 0; i < order.size(); ++i)
+		{
+			order[i] = (GLuint)i;
+		}
+		std::sort(order.begin(), order.end(), [&](GLuint a, GLuint b)
+		{
+			return vertexLess(vertices[a], vertices[b]);
+		});
+		positionId.resize(vertices.size());
+		canonical.resize(vertices.size());
+		groupStart.clear();
+		groupMembers.clear();
+		for (size_t i = 0; i < order.size(); ++i)
+		{
+			const Vertex& vertex = vertices[order[i]];
+			const bool newGroup = i == 0 || vertex.position != vertices[order[i - 1]].position;
+			if (newGroup)
+			{
+				groupStart.push_back((GLuint)groupMembers.size());
+			}
+			if (newGroup || !sameAttributes(vertex, vertices[order[i - 1]]))
+			{
+				groupMembers.push_back(order[i]);
+			}
+			positionId[order[i]] = (GLuint)(groupStart.size() - 1);
+			canonical[order[i]] = groupMembers.back();
+		}
+		groupStart.push_back((GLuint)groupMembers.size());
+	}
+	// Orders by position first so every position group is one contiguous run
+	static bool vertexLess(const Vertex& a, const Vertex& b)
+	{
+		const float ka[12] = { a.position.x, a.position.y, a.position.z, a.texCoords.x, a.texCoords.y,
+			a.normal.x, a.normal.y, a.normal.z, a.tangent.x, a.tangent.y, a.tangent.z, a.tangent.w };
+		const float kb[12] = { b.position.x, b.position.y, b.position.z, b.texCoords.x, b.texCoords.y,
+			b.normal.x, b.normal.y, b.normal.z, b.tangent.x, b.tangent.y, b.tangent.z, b.tangent.w };
+		return std::lexicographical_compare(ka, ka + 12, kb, kb + 12);
+	}
+	static bool sameAttributes(const Vertex& a, const Vertex& b)
+	{
+		return a.texCoords == b.texCoords && a.normal == b.normal && a.tangent == b.tangent;
+	}
+	/*
+	* Lock both ends of every edge without a twin in the opposite direction
+	*/
+	static void lockBorders(const ArenaVector<GLuint>& indices, const ArenaVector<GLuint>& positionId,
+		ArenaVector<char>& locked)
+	{
+		ArenaVector<uint64_t> edges((ArenaAllocator<uint64_t>(locked.get_allocator())));
+		edges.reserve(indices.size());
+		for (size_t t = 0; t + 2 < indices.size(); t += 3)
+		{
+			for (int k = 0; k < 3; ++k)
+			{
+				edges.push_back(edgeKey(positionId[indices[t + k]], positionId[indices[t + (k + 1) % 3]]));
+			}
+		}
+		std::sort(edges.begin(), edges.end());
+		for (size_t t = 0; t + 2 < indices.size(); t += 3)
+		{
+			for (int k = 0; k < 3; ++k)
+			{
+				const GLuint a = indices[t + k], b = indices[t + (k + 1) % 3];
+				if (!std::binary_search(edges.begin(), edges.end(), edgeKey(positionId[b], positionId[a])))
+				{
+					locked[a] = locked[b] = 1;
+				}
+			}
+		}
+	}
+	static uint64_t edgeKey(GLuint from, GLuint to)
+	{
+		return ((uint64_t)from << 32) | to;
+	}
+	/*
+	* True if moving from onto to would turn any surviving triangle around from over
+	*/
+	static bool flipsTriangle(const std::vector<Vertex>& vertices, const ArenaVector<GLuint>& indices,
+		const ArenaVector<char>& alive, const ArenaVector<GLuint>& around,
+		const ArenaVector<GLuint>& positionId, GLuint from, GLuint to)
+	{
+		const glm::vec3& target = vertices[to].position;
+		for (size_t j = 0; j < around.size(); ++j)
+		{
+			if (!alive[around[j]])
+			{
+				continue;
+			}
+			const size_t t = around[j] * 3;
+			glm::vec3 before[3], after[3];
+			bool collapses = false;
+			for (int k = 0; k < 3; ++k)
+			{
+				const GLuint v = indices[t + k];
+				collapses = collapses || positionId[v] == positionId[to];
+				before[k] = vertices[v].position;
+				after[k] = v == from ? target : before[k];
+			}
+			if (collapses)
+			{
+				continue;
+			}
+			const glm::vec3 n0 = glm::cross(before[1] - before[0], before[2] - before[0]);
+			const glm::vec3 n1 = glm::cross(after[1] - after[0], after[2] - after[0]);
+			if (glm::dot(n0, n1) <= 0.0f)
+			{
+				return true;
+			}
+		}
+		return false;
+	}
+};
+
+/*
+* Picks the coarsest LOD whose error projects below a pixel threshold
+*/
+class LodSelector
+{
+public:
+	/*
+	* The projection's [1][1] is 1 / tan(fovy / 2), taken from the matrix so it always
+	* matches the field of view the frame is rendered with
+	*/
+	LodSelector(const glm::mat4& projection, float viewportHeight, const glm::mat4& model,
+		const glm::vec3& cameraPos, float pixelThreshold = 1.0f)
+		:pixelThreshold(pixelThreshold)
+	{
+		this->pixelScale = projection[1][1] * viewportHeight * 0.5f;
+		// Object space error and distance scale alike under a uniform model scale
+		this->cameraPos = glm::vec3(glm::inverse(model) * glm::vec4(cameraPos, 1.0f));
+	}
+	size_t select(const std::vector<MeshLod>& lods, const glm::vec3& boundsMin, const glm::vec3& boundsMax) const
+	{
+		// Distance to the nearest point of the bounds, LOD 0 when the camera is inside
+		const glm::vec3 closest = glm::clamp(this->cameraPos, boundsMin, boundsMax);
+		const float distance = glm::length(this->cameraPos - closest);
+		size_t level = 0;
+		for (size_t i = 1; i < lods.size() && distance > 0.0f; ++i)
+		{
+			if (lods[i].error * this->pixelScale / distance > this->pixelThreshold)
+			{
+				break;
+			}
+			level = i;
+		}
+		return level;
+	}
+private:
+	glm::vec3 cameraPos;
+	float pixelScale; // Pixels covered by one unit of error at distance 1
+	float pixelThreshold;
+};
+
+#endif
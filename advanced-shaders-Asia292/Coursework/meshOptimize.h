@@ -0,0 +1,662 @@
+#ifndef _MESH_OPTIMIZE_H_
+#define _MESH_OPTIMIZE_H_
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <vector>
+#include "arena.h"
+#include "parallel.h"
+#include "vertex.h"
+
+// Fragment overdraw statistics from an orthographic rasterization along each axis
+struct OverdrawStats
+{
+	size_t pixelsCovered; // Pixels covered by the mesh
+	size_t pixelsShaded; // Fragments that passed the depth test
+	float overdraw; // Shaded per covered, 1 is no overdraw
+	OverdrawStats() :pixelsCovered(0), pixelsShaded(0), overdraw(0.0f) {}
+};
+
+// Largest per-component difference for two vertices to be welded
+struct WeldEpsilons
+{
+	float position, texCoords, normal, tangent;
+	WeldEpsilons() :position(1e-5f), texCoords(1e-5f), normal(1e-3f), tangent(1e-3f) {}
+};
+
+// Result of vertex welding
+struct WeldStats
+{
+	size_t verticesBefore, verticesAfter;
+	size_t bytesSaved;
+	WeldStats() :verticesBefore(0), verticesAfter(0), bytesSaved(0) {}
+};
+
+// Post-transform vertex cache statistics
+struct VertexCacheStats
+{
+	float acmr; // Average cache miss ratio, transformed vertices per triangle
+	float atvr; // Average transformed vertex ratio, transformed vertices per vertex
+	VertexCacheStats() :acmr(0.0f), atvr(0.0f) {}
+};
+
+/*
+* Index and vertex buffer reordering for GPU efficiency. Scratch buffers come from the
+* caller's arena, only results that become part of the mesh use the heap.
+*/
+class MeshOptimizer
+{
+public:
+	/*
+	* Simulate a FIFO post-transform cache of the given size
+	*/
+	static VertexCacheStats analyzeVertexCache(const std::vector<GLuint>& indices,
+		size_t vertexCount, MonotonicArena& arena, unsigned int cacheSize = 16)
+	{
+		VertexCacheStats stats;
+		if (indices.empty() || vertexCount == 0)
+		{
+			return stats;
+		}
+		// A vertex is in the cache while fewer than cacheSize misses happened since it was loaded
+		ArenaVector<size_t> loadedAt(vertexCount, 0, ArenaAllocator<size_t>(arena));
+		size_t misses = 0;
+		for (size_t i = 0; i < indices.size(); ++i)
+		{
+			const GLuint v = indices[i];
+			if (loadedAt[v] == 0 || misses - loadedAt[v] >= cacheSize)
+			{
+				++misses;
+				loadedAt[v] = misses;
+			}
+		}
+		stats.acmr = (float)misses / (float)(indices.size() / 3);
+		stats.atvr = (float)misses / (float)vertexCount;
+		return stats;
+	}
+	/*
+	* Reorder triangles for post-transform cache hits (Forsyth's linear-speed algorithm)
+	*/
+	static void optimizeVertexCache(std::vector<GLuint>& indices, size_t vertexCount, MonotonicArena& arena)
+	{
+		const size_t triCount = indices.size() / 3;
+		if (triCount == 0 || vertexCount == 0)
+		{
+			return;
+		}
+		// Triangles adjacent to each vertex, compact (CSR) layout
+		const ArenaAllocator<unsigned int> uintAlloc(arena);
+		ArenaVector<unsigned int> liveTris(vertexCount, 0, uintAlloc);
+		for (size_t i = 0; i < indices.size(); ++i)
+		{
+			++liveTris[indices[i]];
+		}
+		ArenaVector<unsigned int> adjOffset(vertexCount + 1, 0, uintAlloc);
+		for (size_t v = 0; v < vertexCount; ++v)
+		{
+			adjOffset[v + 1] = adjOffset[v] + liveTris[v];
+		}
+		ArenaVector<unsigned int> adjTris(indices.size(), uintAlloc);
+		{
+			ArenaVector<unsigned int> fill(adjOffset.begin(), adjOffset.end() - 1, uintAlloc);
+			for (size_t i = 0; i < indices.size(); ++i)
+			{
+				adjTris[fill[indices[i]]++] = (unsigned int)(i / 3);
+			}
+		}
+
+		ArenaVector<int> cachePos(vertexCount, -1, ArenaAllocator<int>(arena));
+		ArenaVector<float> vertScore(vertexCount, ArenaAllocator<float>(arena));
+		for (size_t v = 0; v < vertexCount; ++v)
+		{
+			vertScore[v] = vertexScore(-1, liveTris[v]);
+		}
+		ArenaVector<char> triAdded(triCount, 0, ArenaAllocator<char>(arena));
+		int bestTri = -1;
+		float bestScore = -1.0f;
+		for (size_t t = 0; t < triCount; ++t)
+		{
+			const float score = vertScore[indices[t * 3]] + vertScore[indices[t * 3 + 1]]
+				+ vertScore[indices[t * 3 + 2]];
+			if (score > bestScore)
+			{
+				bestScore = score;
+				bestTri = (int)t;
+			}
+		}
+
+		std::vector<GLuint> output;
+		output.reserve(indices.size());
+		ArenaVector<GLuint> cache((ArenaAllocator<GLuint>(arena))), newCache((ArenaAllocator<GLuint>(arena)));
+		cache.reserve(FORSYTH_CACHE_SIZE + 3);
+		newCache.reserve(FORSYTH_CACHE_SIZE + 3);
+		size_t scanCursor = 0;
+		for (size_t emitted = 0; emitted < triCount; ++emitted)
+		{
+			if (bestTri < 0)
+			{
+				// Nothing in the cache has live triangles left, continue with the next unused one
+				while (triAdded[scanCursor])
+				{
+					++scanCursor;
+				}
+				bestTri = (int)scanCursor;
+			}
+			const GLuint* tri = &indices[(size_t)bestTri * 3];
+			triAdded[bestTri] = 1;
+			output.insert(output.end(), tri, tri + 3);
+			// Remove the triangle from its vertices' live lists
+			for (int k = 0; k < 3; ++k)
+			{
+				const GLuint v = tri[k];
+				unsigned int* begin = &adjTris[adjOffset[v]];
+				unsigned int* end = begin + liveTris[v];
+				unsigned int* found = std::find(begin, end, (unsigned int)bestTri);
+				std::swap(*found, *(end - 1));
+				--liveTris[v];
+			}
+			// New triangle's vertices go to the front of the LRU cache
+			newCache.assign(tri, tri + 3);
+			for (size_t c = 0; c < cache.size(); ++c)
+			{
+				const GLuint v = cache[c];
+				if (v != tri[0] && v != tri[1] && v != tri[2])
+				{
+					newCache.push_back(v);
+				}
+			}
+			cache.swap(newCache);
+			// Update scores of everything that moved in or out of the cache
+			for (size_t c = 0; c < cache.size(); ++c)
+			{
+				const GLuint v = cache[c];
+				cachePos[v] = c < FORSYTH_CACHE_SIZE ? (int)c : -1;
+				vertScore[v] = vertexScore(cachePos[v], liveTris[v]);
+			}
+			if (cache.size() > FORSYTH_CACHE_SIZE)
+			{
+				cache.resize(FORSYTH_CACHE_SIZE);
+			}
+			// Best next triangle is one touching the cache
+			bestTri = -1;
+			bestScore = -1.0f;
+			for (size_t c = 0; c < cache.size(); ++c)
+			{
+				const GLuint v = cache[c];
+				for (unsigned int a = adjOffset[v]; a < adjOffset[v] + liveTris[v]; ++a)
+				{
+					const unsigned int t = adjTris[a];
+					const float score = vertScore[indices[t * 3]] + vertScore[indices[t * 3 + 1]]
+						+ vertScore[indices[t * 3 + 2]];
+					if (score > bestScore)
+					{
+						bestScore = score;
+						bestTri = (int)t;
+					}
+				}
+			}
+		}
+		indices.swap(output);
+	}
+	/*
+	* Reorder clusters of a cache optimized index buffer so triangles likely to occlude the
+	* rest of the mesh are drawn first, independent of the view direction (Sander et al.).
+	* Clusters are split while their ACMR stays within threshold times the unsplit ACMR,
+	* which bounds the vertex cache penalty.
+	*/
+	static void optimizeOverdraw(std::vector<GLuint>& indices, const std::vector<Vertex>& vertices,
+		MonotonicArena& arena, float threshold = 1.05f)
+	{
+		const size_t triCount = indices.size() / 3;
+		if (triCount == 0 || vertices.empty())
+		{
+			return;
+		}
+		// Hard boundaries: a triangle with three cache misses starts a disjoint patch
+		ArenaVector<unsigned int> cacheTime(vertices.size(), 0, ArenaAllocator<unsigned int>(arena));
+		unsigned int time = OVERDRAW_CACHE_SIZE + 1;
+		const ArenaAllocator<size_t> sizeAlloc(arena);
+		ArenaVector<size_t> hardBounds(sizeAlloc);
+		for (size_t t = 0; t < triCount; ++t)
+		{
+			if (updateCache(&indices[t * 3], cacheTime, time) == 3 || t == 0)
+			{
+				hardBounds.push_back(t);
+			}
+		}
+		hardBounds.push_back(triCount);
+		// Soft boundaries: cut a cluster as soon as its running ACMR is good enough
+		ArenaVector<size_t> clusters(sizeAlloc);
+		for (size_t c = 0; c + 1 < hardBounds.size(); ++c)
+		{
+			const size_t begin = hardBounds[c], end = hardBounds[c + 1];
+			time += OVERDRAW_CACHE_SIZE + 1; // Flush the cache
+			size_t misses = 0;
+			for (size_t t = begin; t < end; ++t)
+			{
+				misses += updateCache(&indices[t * 3], cacheTime, time);
+			}
+			const float clusterThreshold = threshold * (float)misses / (float)(end - begin);
+			clusters.push_back(begin);
+			time += OVERDRAW_CACHE_SIZE + 1;
+			size_t runningMisses = 0, runningTris = 0;
+			for (size_t t = begin; t < end; ++t)
+			{
+				runningMisses += updateCache(&indices[t * 3], cacheTime, time);
+				++runningTris;
+				if ((float)runningMisses / (float)runningTris <= clusterThreshold && t + 1 < end)
+				{
+					clusters.push_back(t + 1);
+					time += OVERDRAW_CACHE_SIZE + 1;
+					runningMisses = runningTris = 0;
+				}
+			}
+		}
+		clusters.push_back(triCount);
+		// Sort key: how far the cluster faces away from the mesh centroid
+		glm::vec3 meshCentroid(0.0f);
+		for (size_t i = 0; i < indices.size(); ++i)
+		{
+			meshCentroid += vertices[indices[i]].position;
+		}
+		meshCentroid /= (float)indices.size();
+		const size_t clusterCount = clusters.size() - 1;
+		ArenaVector<float> sortKey(clusterCount, ArenaAllocator<float>(arena));
+		ArenaVector<size_t> order(clusterCount, sizeAlloc);
+		for (size_t c = 0; c < clusterCount; ++c)
+		{
+			glm::vec3 centroid(0.0f), normal(0.0f);
+			float area = 0.0f;
+			for (size_t t = clusters[c]; t < clusters[c + 1]; ++t)
+			{
+				const glm::vec3& p0 = vertices[indices[t * 3]].position;
+				const glm::vec3& p1 = vertices[indices[t * 3 + 1]].position;
+				const glm::vec3& p2 = vertices[indices[t * 3 + 2]].position;
+				const glm::vec3 n = glm::cross(p1 - p0, p2 - p0); // Length is twice the area
+				const float triArea = glm::length(n);
+				centroid += (p0 + p1 + p2) * (triArea / 3.0f);
+				normal += n;
+				area += triArea;
+			}
+			centroid = area > 0.0f ? centroid / area : vertices[indices[clusters[c] * 3]].position;
+			const float normalLength = glm::length(normal);
+			normal = normalLength > 0.0f ? normal / normalLength : glm::vec3(0.0f);
+			sortKey[c] = glm::dot(centroid - meshCentroid, normal);
+			order[c] = c;
+		}
+		std::stable_sort(order.begin(), order.end(),
+			[&sortKey](size_t a, size_t b) { return sortKey[a] > sortKey[b]; });
+		std::vector<GLuint> output;
+		output.reserve(indices.size());
+		for (size_t i = 0; i < clusterCount; ++i)
+		{
+			const size_t c = order[i];
+			output.insert(output.end(), indices.begin() + clusters[c] * 3, indices.begin() + clusters[c + 1] * 3);
+		}
+		indices.swap(output);
+	}
+	/*
+	* Measure overdraw by rasterizing the mesh with depth test and backface culling
+	* along +X, -X, +Y, -Y, +Z and -Z
+	*/
+	static OverdrawStats analyzeOverdraw(const std::vector<GLuint>& indices, const std::vector<Vertex>& vertices,
+		MonotonicArena& arena)
+	{
+		OverdrawStats stats;
+		if (indices.size() < 3 || vertices.empty())
+		{
+			return stats;
+		}
+		glm::vec3 boundsMin = vertices[0].position, boundsMax = vertices[0].position;
+		for (size_t i = 0; i < vertices.size(); ++i)
+		{
+			boundsMin = glm::min(boundsMin, vertices[i].position);
+			boundsMax = glm::max(boundsMax, vertices[i].position);
+		}
+		const glm::vec3 extent = boundsMax - boundsMin;
+		const float scale = (float)OVERDRAW_GRID / std::max(std::max(extent.x, extent.y), std::max(extent.z, 1e-20f));
+		ArenaVector<float> depth(OVERDRAW_GRID * OVERDRAW_GRID, ArenaAllocator<float>(arena));
+		for (int axis = 0; axis < 3; ++axis)
+		{
+			for (int flip = 0; flip < 2; ++flip)
+			{
+				std::fill(depth.begin(), depth.end(), 1.0f);
+				for (size_t t = 0; t + 2 < indices.size(); t += 3)
+				{
+					glm::vec3 p[3];
+					for (int k = 0; k < 3; ++k)
+					{
+						const glm::vec3 local = (vertices[indices[t + k]].position - boundsMin) * scale;
+						// View looks down -axis, the flipped view mirrors x so its front faces wind the same way
+						glm::vec3 q(local[(axis + 1) % 3], local[(axis + 2) % 3], 1.0f - local[axis] / OVERDRAW_GRID);
+						if (flip)
+						{
+							q.x = OVERDRAW_GRID - q.x;
+							q.z = 1.0f - q.z;
+						}
+						p[k] = q;
+					}
+					stats.pixelsShaded += rasterize(p, depth);
+				}
+				for (size_t i = 0; i < depth.size(); ++i)
+				{
+					stats.pixelsCovered += depth[i] < 1.0f ? 1 : 0;
+				}
+			}
+		}
+		stats.overdraw = stats.pixelsCovered ? (float)stats.pixelsShaded / (float)stats.pixelsCovered : 0.0f;
+		return stats;
+	}
+	/*
+	* Merge vertices whose attributes all match within the epsilons and remap the indices.
+	* Positions are bucketed in a spatial hash with cells twice the position epsilon, so
+	* candidates only need to be searched in the 8 cells around the nearest cell corner.
+	* A position epsilon that is not a positive normal float buckets exact positions instead.
+	*/
+	static WeldStats weldVertices(std::vector<Vertex>& vertices, std::vector<GLuint>& indices,
+		MonotonicArena& arena, const WeldEpsilons& eps = WeldEpsilons())
+	{
+		WeldStats stats;
+		stats.verticesBefore = stats.verticesAfter = vertices.size();
+		const size_t count = vertices.size();
+		if (count < 2)
+		{
+			return stats;
+		}
+		const bool exact = !(eps.position >= std::numeric_limits<float>::min());
+		WeldEpsilons matchEps = eps;
+		if (exact)
+		{
+			matchEps.position = 0.0f;
+		}
+		const double cellSize = 2.0 * eps.position;
+		const size_t grain = 16384;
+		// Cell of every vertex and the (cell hash, vertex) list sorted by hash
+		ArenaVector<WeldCell> cells(count, ArenaAllocator<WeldCell>(arena));
+		ArenaVector<glm::ivec3> nearSide(count, ArenaAllocator<glm::ivec3>(arena));
+		ArenaVector<std::pair<uint64_t, GLuint> > buckets(count, ArenaAllocator<std::pair<uint64_t, GLuint> >(arena));
+		ParallelHelper::parallelRanges(count, grain, [&](size_t begin, size_t end)
+		{
+			for (size_t i = begin; i < end; ++i)
+			{
+				const glm::vec3& position = vertices[i].position;
+				if (exact)
+				{
+					// The bits of each coordinate, with -0 folded into 0
+					cells[i] = WeldCell(floatBits(position.x), floatBits(position.y), floatBits(position.z));
+					nearSide[i] = glm::ivec3(0);
+				}
+				else
+				{
+					glm::ivec3 side;
+					cells[i] = WeldCell(cellOf(position.x, cellSize, side.x), cellOf(position.y, cellSize, side.y),
+						cellOf(position.z, cellSize, side.z));
+					nearSide[i] = side;
+				}
+				buckets[i] = std::make_pair(cellHash(cells[i]), (GLuint)i);
+			}
+		});
+		std::sort(buckets.begin(), buckets.end());
+		// Open addressing table from cell hash to its range in the sorted list
+		size_t tableSize = 16;
+		while (tableSize < count * 2)
+		{
+			tableSize *= 2;
+		}
+		const size_t tableMask = tableSize - 1;
+		ArenaVector<CellRange> table(tableSize, ArenaAllocator<CellRange>(arena));
+		for (size_t i = 0; i < count;)
+		{
+			size_t end = i + 1;
+			while (end < count && buckets[end].first == buckets[i].first)
+			{
+				++end;
+			}
+			size_t slot = (size_t)buckets[i].first & tableMask;
+			while (table[slot].end != 0)
+			{
+				slot = (slot + 1) & tableMask;
+			}
+			table[slot].hash = buckets[i].first;
+			table[slot].begin = (GLuint)i;
+			table[slot].end = (GLuint)end;
+			i = end;
+		}
+		// Each vertex points at the lowest matching vertex in its neighbourhood
+		ArenaVector<GLuint> remap(count, ArenaAllocator<GLuint>(arena));
+		ParallelHelper::parallelRanges(count, grain, [&](size_t begin, size_t end)
+		{
+			for (size_t i = begin; i < end; ++i)
+			{
+				GLuint target = (GLuint)i;
+				for (int dz = 0; dz < 2; ++dz)
+				{
+					for (int dy = 0; dy < 2; ++dy)
+					{
+						for (int dx = 0; dx < 2; ++dx)
+						{
+							const WeldCell& cell = cells[i];
+							const uint64_t hash = cellHash(WeldCell(cell.x + dx * nearSide[i].x,
+								cell.y + dy * nearSide[i].y, cell.z + dz * nearSide[i].z));
+							size_t slot = (size_t)hash & tableMask;
+							while (table[slot].end != 0 && table[slot].hash != hash)
+							{
+								slot = (slot + 1) & tableMask;
+							}
+							// Bucket entries are sorted by vertex, stop once past the current best
+							for (GLuint b = table[slot].begin; b < table[slot].end && buckets[b].second < target; ++b)
+							{
+								if (verticesMatch(vertices[buckets[b].second], vertices[i], matchEps))
+								{
+									target = buckets[b].second;
+									break;
+								}
+							}
+						}
+					}
+				}
+				remap[i] = target;
+			}
+		});
+		// Resolve chains so every vertex maps to a representative, in order so targets are final
+		ArenaVector<GLuint> newIndex(count, ArenaAllocator<GLuint>(arena));
+		size_t kept = 0;
+		for (size_t i = 0; i < count; ++i)
+		{
+			if (remap[i] == i)
+			{
+				newIndex[i] = (GLuint)kept;
+				vertices[kept++] = vertices[i];
+			}
+			else
+			{
+				newIndex[i] = newIndex[remap[i]];
+			}
+		}
+		vertices.resize(kept);
+		ParallelHelper::parallelRanges(indices.size(), grain, [&](size_t begin, size_t end)
+		{
+			for (size_t i = begin; i < end; ++i)
+			{
+				indices[i] = newIndex[indices[i]];
+			}
+		});
+		stats.verticesAfter = kept;
+		stats.bytesSaved = (count - kept) * sizeof(Vertex);
+		return stats;
+	}
+	/*
+	* Reorder vertices in first-use order and renumber the indices, unused vertices are dropped
+	*/
+	static void optimizeVertexFetch(std::vector<Vertex>& vertices, std::vector<GLuint>& indices, MonotonicArena& arena)
+	{
+		const GLuint unused = ~0u;
+		ArenaVector<GLuint> remap(vertices.size(), unused, ArenaAllocator<GLuint>(arena));
+		std::vector<Vertex> reordered;
+		reordered.reserve(vertices.size());
+		for (size_t i = 0; i < indices.size(); ++i)
+		{
+			GLuint& newIndex = remap[indices[i]];
+			if (newIndex == unused)
+			{
+				newIndex = (GLuint)reordered.size();
+				reordered.push_back(vertices[indices[i]]);
+			}
+			indices[i] = newIndex;
+		}
+		vertices.swap(reordered);
+	}
+private:
+	static const size_t FORSYTH_CACHE_SIZE = 32;
+
+	// Slot of the weld spatial hash, end == 0 marks an empty slot
+	struct CellRange
+	{
+		uint64_t hash;
+		GLuint begin, end;
+		CellRange() :hash(0), begin(0), end(0) {}
+	};
+
+	// Spatial hash cell, 64-bit so far coordinates and tiny epsilons can not overflow
+	struct WeldCell
+	{
+		int64_t x, y, z;
+		WeldCell() :x(0), y(0), z(0) {}
+		WeldCell(int64_t x, int64_t y, int64_t z) :x(x), y(y), z(z) {}
+	};
+
+	static uint64_t cellHash(const WeldCell& cell)
+	{
+		uint64_t h = (uint64_t)cell.x * 0x9e3779b97f4a7c15ULL;
+		h ^= ((uint64_t)cell.y + (h >> 29)) * 0xc2b2ae3d27d4eb4fULL;
+		h ^= ((uint64_t)cell.z + (h >> 31)) * 0x165667b19e3779f9ULL;
+		return h ^ (h >> 32);
+	}
+	/*
+	* Cell index along one axis, clamped so the conversion is defined for any input.
+	* side is the neighbour within one epsilon: -1 below the cell centre, 1 above.
+	*/
+	static int64_t cellOf(float coordinate, double cellSize, int& side)
+	{
+		const double limit = 4611686018427387904.0; // 2^62, room for the neighbour offset
+		double scaled = (double)coordinate / cellSize;
+		scaled = scaled == scaled ? std::min(std::max(scaled, -limit), limit) : 0.0;
+		const double cell = std::floor(scaled);
+		side = scaled - cell < 0.5 ? -1 : 1;
+		return (int64_t)cell;
+	}
+	static int64_t floatBits(float coordinate)
+	{
+		const float folded = coordinate + 0.0f;
+		uint32_t bits = 0;
+		memcpy(&bits, &folded, sizeof(bits));
+		return (int64_t)bits;
+	}
+	static bool withinEps(const float* a, const float* b, int n, float eps)
+	{
+		for (int k = 0; k < n; ++k)
+		{
+			if (std::fabs(a[k] - b[k]) > eps)
+			{
+				return false;
+			}
+		}
+		return true;
+	}
+	static bool verticesMatch(const Vertex& a, const Vertex& b, const WeldEpsilons& eps)
+	{
+		return withinEps(&a.position.x, &b.position.x, 3, eps.position)
+			&& withinEps(&a.texCoords.x, &b.texCoords.x, 2, eps.texCoords)
+			&& withinEps(&a.normal.x, &b.normal.x, 3, eps.normal)
+			&& withinEps(&a.tangent.x, &b.tangent.x, 4, eps.tangent);
+	}
+	static const unsigned int OVERDRAW_CACHE_SIZE = 16;
+	static const int OVERDRAW_GRID = 256;
+
+	/*
+	* FIFO cache step for one triangle, returns the number of misses.
+	* A vertex is cached while fewer than OVERDRAW_CACHE_SIZE loads happened since its own.
+	*/
+	static unsigned int updateCache(const GLuint* tri, ArenaVector<unsigned int>& cacheTime, unsigned int& time)
+	{
+		unsigned int misses = 0;
+		for (int k = 0; k < 3; ++k)
+		{
+			if (time - cacheTime[tri[k]] > OVERDRAW_CACHE_SIZE)
+			{
+				cacheTime[tri[k]] = time++;
+				++misses;
+			}
+		}
+		return misses;
+	}
+	/*
+	* Rasterize one front facing triangle into the depth grid, returns fragments passing the depth test
+	*/
+	static size_t rasterize(const glm::vec3 p[3], ArenaVector<float>& depth)
+	{
+		const float area = (p[1].x - p[0].x) * (p[2].y - p[0].y) - (p[1].y - p[0].y) * (p[2].x - p[0].x);
+		if (area <= 0.0f)
+		{
+			return 0; // Back facing or degenerate
+		}
+		const int minX = std::max(0, (int)std::floor(std::min(std::min(p[0].x, p[1].x), p[2].x)));
+		const int maxX = std::min(OVERDRAW_GRID - 1, (int)std::ceil(std::max(std::max(p[0].x, p[1].x), p[2].x)));
+		const int minY = std::max(0, (int)std::floor(std::min(std::min(p[0].y, p[1].y), p[2].y)));
+		const int maxY = std::min(OVERDRAW_GRID - 1, (int)std::ceil(std::max(std::max(p[0].y, p[1].y), p[2].y)));
+		size_t shaded = 0;
+		for (int y = minY; y <= maxY; ++y)
+		{
+			const float py = y + 0.5f;
+			for (int x = minX; x <= maxX; ++x)
+			{
+				const float px = x + 0.5f;
+				const float w0 = (p[2].x - p[1].x) * (py - p[1].y) - (p[2].y - p[1].y) * (px - p[1].x);
+				const float w1 = (p[0].x - p[2].x) * (py - p[2].y) - (p[0].y - p[2].y) * (px - p[2].x);
+				const float w2 = (p[1].x - p[0].x) * (py - p[0].y) - (p[1].y - p[0].y) * (px - p[0].x);
+				if (w0 < 0.0f || w1 < 0.0f || w2 < 0.0f)
+				{
+					continue;
+				}
+				const float z = (w0 * p[0].z + w1 * p[1].z + w2 * p[2].z) / area;
+				float& stored = depth[y * OVERDRAW_GRID + x];
+				if (z < stored)
+				{
+					stored = z;
+					++shaded;
+				}
+			}
+		}
+		return shaded;
+	}
+
+	static float vertexScore(int cachePosition, unsigned int liveTriCount)
+	{
+		if (liveTriCount == 0)
+		{
+			return -1.0f; // No triangles left, never pick
+		}
+		float score = 0.0f;
+		if (cachePosition >= 0)
+		{
+			if (cachePosition < 3)
+			{
+				score = 0.75f; // Used by the last triangle, fixed score to avoid strip-like ordering
+			}
+			else
+			{
+				const float scaler = 1.0f / (FORSYTH_CACHE_SIZE - 3);
+				score = std::pow(1.0f - (cachePosition - 3) * scaler, 1.5f);
+			}
+		}
+		// Boost vertices with few triangles left so they get finished off
+		score += 2.0f / std::sqrt((float)liveTriCount);
+		return score;
+	}
+};
+
+#endif
@@ -0,0 +1,271 @@
+#ifndef _MESH_TANGENTS_H_
+#define _MESH_TANGENTS_H_
+
+#include <GLEW/glew.h>
+#include <glm/glm.hpp>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <unordered_map>
+#include <vector>
+#include "arena.h"
+#include "parallel.h"
+#include "vertex.h"
+
+/*
+* Normal and tangent generation, used in place of Assimp's aiProcess_GenSmoothNormals and
+* aiProcess_CalcTangentSpace. Tangents follow MikkTSpace, the convention normal map bakers
+* use: per-corner tangents projected into the corner's tangent plane and weighted by the
+* corner angle, vertices split where triangles of opposite UV winding meet, and the
+* bitangent sign stored in tangent.w so shaders rebuild B = sign * cross(N, T).
+* Work is spread over triangle and vertex ranges, nested inside a per-mesh parallelFor
+* it runs inline on that mesh's thread. Scratch buffers come from the caller's arena.
+*/
+class TangentGenerator
+{
+public:
+	/*
+	* Group vertices at exactly the same position, for meshes imported without shared positions.
+	* The lookup table comes from the same arena as ids.
+	*/
+	static void positionIds(const std::vector<Vertex>& vertices, ArenaVector<GLuint>& ids)
+	{
+		struct PositionKey
+		{
+			uint32_t bits[3];
+			bool operator==(const PositionKey& other) const
+			{
+				return memcmp(this->bits, other.bits, sizeof(this->bits)) == 0;
+			}
+		};
+		struct PositionKeyHash
+		{
+			size_t operator()(const PositionKey& key) const
+			{
+				return (size_t)(key.bits[0] * 73856093u ^ key.bits[1] * 19349663u ^ key.bits[2] * 83492791u);
+			}
+		};
+		typedef std::pair<const PositionKey, GLuint> PositionEntry;
+		std::unordered_map<PositionKey, GLuint, PositionKeyHash, std::equal_to<PositionKey>, ArenaAllocator<PositionEntry> >
+			idMap(vertices.size(), PositionKeyHash(), std::equal_to<PositionKey>(), ArenaAllocator<PositionEntry>(ids.get_allocator()));
+		ids.resize(vertices.size());
+		for (size_t i = 0; i < vertices.size(); ++i)
+		{
+			PositionKey key;
+			memcpy(key.bits, &vertices[i].position.x, sizeof(key.bits));
+			ids[i] = idMap.insert(std::make_pair(key, (GLuint)idMap.size())).first->second;
+		}
+	}
+	/*
+	* Area weighted face normals summed per vertex, for vertices whose normal is zero
+	*/
+	static void generateNormals(std::vector<Vertex>& vertices, const std::vector<GLuint>& indices,
+		const GLuint* positionIds, MonotonicArena& arena)
+	{
+		// Vertices split by UV seams share a position id so the normal stays smooth across the seam
+		GLuint idCount = 0;
+		for (size_t i = 0; i < vertices.size(); ++i)
+		{
+			idCount = std::max(idCount, positionIds[i] + 1);
+		}
+		const size_t triangleCount = indices.size() / 3;
+		const ArenaAllocator<glm::vec3> vec3Alloc(arena);
+		ArenaVector<glm::vec3> faceNormals(triangleCount, vec3Alloc);
+		ParallelHelper::parallelRanges(triangleCount, TRIANGLE_GRAIN, [&](size_t begin, size_t end)
+		{
+			for (size_t t = begin; t < end; ++t)
+			{
+				const glm::vec3& a = vertices[indices[t * 3]].position;
+				faceNormals[t] = glm::cross(vertices[indices[t * 3 + 1]].position - a,
+					vertices[indices[t * 3 + 2]].position - a);
+			}
+		});
+		ArenaVector<glm::vec3> sums(idCount, glm::vec3(0.0f), vec3Alloc);
+		for (size_t t = 0; t < triangleCount; ++t)
+		{
+			for (int k = 0; k < 3; ++k)
+			{
+				sums[positionIds[indices[t * 3 + k]]] += faceNormals[t];
+			}
+		}
+		ParallelHelper::parallelRanges(vertices.size(), VERTEX_GRAIN, [&](size_t begin, size_t end)
+		{
+			for (size_t i = begin; i < end; ++i)
+			{
+				if (vertices[i].normal != glm::vec3(0.0f))
+				{
+					continue;
+				}
+				const glm::vec3& sum = sums[positionIds[i]];
+				const float length = glm::length(sum);
+				vertices[i].normal = length > 0.0f ? sum / length : glm::vec3(0.0f, 1.0f, 0.0f);
+			}
+		});
+	}
+	/*
+	* MikkTSpace style tangents with the bitangent sign in w. A vertex used by triangles of
+	* both UV windings (mirrored UVs) is duplicated and the indices of one side remapped,
+	* so vertices can be appended and indices rewritten.
+	*/
+	static void generateTangents(std::vector<Vertex>& vertices, std::vector<GLuint>& indices, MonotonicArena& arena)
+	{
+		const size_t triangleCount = indices.size() / 3;
+		const size_t vertexCount = vertices.size();
+		// Per corner tangents, already projected and angle weighted
+		ArenaVector<glm::vec3> cornerTangents(triangleCount * 3, ArenaAllocator<glm::vec3>(arena));
+		ArenaVector<signed char> orientations(triangleCount, ArenaAllocator<signed char>(arena)); // 1, -1, 0 for a degenerate UV mapping
+		ParallelHelper::parallelRanges(triangleCount, TRIANGLE_GRAIN, [&](size_t begin, size_t end)
+		{
+			for (size_t t = begin; t < end; ++t)
+			{
+				orientations[t] = triangleTangents(vertices, &indices[t * 3], &cornerTangents[t * 3]);
+			}
+		});
+		// Corners grouped by vertex, in index order so sums do not depend on the thread count
+		const ArenaAllocator<GLuint> uintAlloc(arena);
+		ArenaVector<GLuint> cornerOffsets(vertexCount + 1, 0, uintAlloc);
+		for (size_t c = 0; c < triangleCount * 3; ++c)
+		{
+			++cornerOffsets[indices[c] + 1];
+		}
+		for (size_t v = 0; v < vertexCount; ++v)
+		{
+			cornerOffsets[v + 1] += cornerOffsets[v];
+		}
+		ArenaVector<GLuint> corners(triangleCount * 3, uintAlloc);
+		{
+			ArenaVector<GLuint> cursor(cornerOffsets.begin(), cornerOffsets.end() - 1, uintAlloc);
+			for (size_t c = 0; c < triangleCount * 3; ++c)
+			{
+				corners[cursor[indices[c]]++] = (GLuint)c;
+			}
+		}
+		// Vertices whose triangles disagree on the UV winding keep the positive side,
+		// the negative side goes to a copy made below
+		ArenaVector<glm::vec4> mirroredTangents(vertexCount, ArenaAllocator<glm::vec4>(arena));
+		ArenaVector<char> mirrored(vertexCount, 0, ArenaAllocator<char>(arena));
+		ParallelHelper::parallelRanges(vertexCount, VERTEX_GRAIN, [&](size_t begin, size_t end)
+		{
+			for (size_t v = begin; v < end; ++v)
+			{
+				glm::vec3 sums[2] = { glm::vec3(0.0f), glm::vec3(0.0f) };
+				bool used[2] = { false, false };
+				for (GLuint i = cornerOffsets[v]; i < cornerOffsets[v + 1]; ++i)
+				{
+					const GLuint c = corners[i];
+					const signed char orientation = orientations[c / 3];
+					if (orientation == 0)
+					{
+						continue;
+					}
+					const int side = orientation > 0 ? 0 : 1;
+					sums[side] += cornerTangents[c];
+					used[side] = true;
+				}
+				const glm::vec3& n = vertices[v].normal;
+				const int side = used[0] || !used[1] ? 0 : 1;
+				vertices[v].tangent = finalTangent(n, sums[side], side == 0 ? 1.0f : -1.0f);
+				if (used[0] && used[1])
+				{
+					mirrored[v] = 1;
+					mirroredTangents[v] = finalTangent(n, sums[1], -1.0f);
+				}
+			}
+		});
+		ArenaVector<GLuint> copies(vertexCount, 0, uintAlloc);
+		for (size_t v = 0; v < vertexCount; ++v)
+		{
+			if (mirrored[v])
+			{
+				copies[v] = (GLuint)vertices.size();
+				Vertex copy = vertices[v];
+				copy.tangent = mirroredTangents[v];
+				vertices.push_back(copy);
+			}
+		}
+		if (vertices.size() == vertexCount)
+		{
+			return;
+		}
+		for (size_t t = 0; t < triangleCount; ++t)
+		{
+			if (orientations[t] >= 0)
+			{
+				continue;
+			}
+			for (int k = 0; k < 3; ++k)
+			{
+				GLuint& index = indices[t * 3 + k];
+				if (mirrored[index])
+				{
+					index = copies[index];
+				}
+			}
+		}
+	}
+private:
+	static const size_t TRIANGLE_GRAIN = 16384;
+	static const size_t VERTEX_GRAIN = 16384;
+
+	/*
+	* Corner tangents of one triangle, returns its UV winding
+	*/
+	static signed char triangleTangents(const std::vector<Vertex>& vertices, const GLuint* triangle,
+		glm::vec3* tangents)
+	{
+		const Vertex& v0 = vertices[triangle[0]];
+		const Vertex& v1 = vertices[triangle[1]];
+		const Vertex& v2 = vertices[triangle[2]];
+		const glm::vec3 d1 = v1.position - v0.position, d2 = v2.position - v0.position;
+		const glm::vec2 st1 = v1.texCoords - v0.texCoords, st2 = v2.texCoords - v0.texCoords;
+		const float signedAreaSTx2 = st1.x * st2.y - st1.y * st2.x;
+		if (std::fabs(signedAreaSTx2) < 1e-20f)
+		{
+			return 0;
+		}
+		const float sign = signedAreaSTx2 > 0.0f ? 1.0f : -1.0f;
+		// Direction of increasing s only, the UV scale of the triangle does not weigh in
+		glm::vec3 os = st2.y * d1 - st1.y * d2;
+		const float osLength = glm::length(os);
+		os = osLength > 0.0f ? os * (sign / osLength) : os;
+		const Vertex* corner[3] = { &v0, &v1, &v2 };
+		for (int k = 0; k < 3; ++k)
+		{
+			const glm::vec3& n = corner[k]->normal;
+			const glm::vec3& p = corner[k]->position;
+			// Corner angle measured in the vertex's tangent plane
+			glm::vec3 e1 = corner[(k + 1) % 3]->position - p;
+			glm::vec3 e2 = corner[(k + 2) % 3]->position - p;
+			e1 = normalizeOrZero(e1 - n * glm::dot(n, e1));
+			e2 = normalizeOrZero(e2 - n * glm::dot(n, e2));
+			const float angle = std::acos(glm::clamp(glm::dot(e1, e2), -1.0f, 1.0f));
+			tangents[k] = normalizeOrZero(os - n * glm::dot(n, os)) * angle;
+		}
+		return sign > 0.0f ? 1 : -1;
+	}
+	/*
+	* Orthonormal tangent with the bitangent sign in w, any tangent plane direction if the sum vanishes
+	*/
+	static glm::vec4 finalTangent(const glm::vec3& n, const glm::vec3& tangentSum, float sign)
+	{
+		glm::vec3 t = tangentSum - n * glm::dot(n, tangentSum);
+		float length = glm::length(t);
+		if (length <= 1e-12f)
+		{
+			t = std::fabs(n.x) < 0.9f ? glm::vec3(1.0f, 0.0f, 0.0f) : glm::vec3(0.0f, 1.0f, 0.0f);
+			t -= n * glm::dot(n, t);
+			length = glm::length(t);
+		}
+		t = length > 0.0f ? t / length : glm::vec3(1.0f, 0.0f, 0.0f);
+		return glm::vec4(t, sign);
+	}
+	static glm::vec3 normalizeOrZero(const glm::vec3& v)
+	{
+		const float length = glm::length(v);
+		return length > 0.0f ? v / length : glm::vec3(0.0f);
+	}
+};
+
+#endif
@@ -0,0 +1,259 @@
+#ifndef _MESHLET_H_
+#define _MESHLET_H_
+
+#include <GLEW/glew.h>
+#include <glm/glm.hpp>
+#include <algorithm>
+#include <cmath>
+#include <vector>
+#include "arena.h"
+#include "vertex.h"
+
+// Cluster limits, small enough for tight bounds and large enough to keep per-cluster work low
+const size_t MESHLET_MAX_VERTICES = 64;
+const size_t MESHLET_MAX_TRIANGLES = 124;
+
+// A contiguous run of triangles in a mesh's index buffer with its culling bounds
+struct Meshlet
+{
+	GLuint firstIndex;
+	GLuint indexCount;
+	glm::vec3 center; // Bounding sphere
+	float radius;
+	glm::vec3 coneAxis; // Average facing direction of the triangles
+	float coneCutoff; // Sine of the normal cone's half angle, 1 when the cluster can not be backface culled
+};
+
+/*
+* Splits a mesh's triangles into meshlets with bounding spheres and normal cones
+*/
+class MeshletBuilder
+{
+public:
+	/*
+	* Triangles are taken in index order so every meshlet is one index range that can be
+	* submitted on its own, the vertex cache order keeps consecutive triangles close together.
+	* Scratch buffers come from arena.
+	*/
+	static void build(const std::vector<Vertex>& vertices, const std::vector<GLuint>& indices,
+		std::vector<Meshlet>& meshlets, MonotonicArena& arena,
+		size_t maxVertices = MESHLET_MAX_VERTICES, size_t maxTriangles = MESHLET_MAX_TRIANGLES)
+	{
+		meshlets.clear();
+		const size_t triangleCount = indices.size() / 3;
+		if (triangleCount == 0)
+		{
+			return;
+		}
+		meshlets.reserve(triangleCount / maxTriangles + 1);
+		ArenaVector<GLuint> lastMeshlet(vertices.size(), ~0u, ArenaAllocator<GLuint>(arena)); // Meshlet that last counted each vertex
+		ArenaVector<glm::vec3> normals((ArenaAllocator<glm::vec3>(arena))); // Reused by every meshlet
+		normals.reserve(maxTriangles);
+		GLuint current = 0;
+		size_t firstTriangle = 0, uniqueVertices = 0;
+		for (size_t tri = 0; tri < triangleCount; ++tri)
+		{
+			const GLuint* corner = &indices[tri * 3];
+			size_t newVertices = countNew(corner, lastMeshlet, current);
+			if (tri - firstTriangle >= maxTriangles || uniqueVertices + newVertices > maxVertices)
+			{
+				meshlets.push_back(computeBounds(vertices, indices, firstTriangle, tri, normals));
+				++current;
+				firstTriangle = tri;
+				uniqueVertices = 0;
+				newVertices = countNew(corner, lastMeshlet, current);
+			}
+			for (int k = 0; k < 3; ++k)
+			{
+				lastMeshlet[corner[k]] = current;
+			}
+			uniqueVertices += newVertices;
+		}
+		meshlets.push_back(computeBounds(vertices, indices, firstTriangle, triangleCount, normals));
+	}
+private:
+	static size_t countNew(const GLuint* corner, const ArenaVector<GLuint>& lastMeshlet, GLuint current)
+	{
+		size_t count = 0;
+		for (int k = 0; k < 3; ++k)
+		{
+			const bool repeated = (k > 0 && corner[k] == corner[0]) || (k > 1 && corner[k] == corner[1]);
+			if (!repeated && lastMeshlet[corner[k]] != current)
+			{
+				++count;
+			}
+		}
+		return count;
+	}
+	/*
+	* Ritter bounding sphere and the cone containing every face normal
+	*/
+	static Meshlet computeBounds(const std::vector<Vertex>& vertices, const std::vector<GLuint>& indices,
+		size_t firstTriangle, size_t endTriangle, ArenaVector<glm::vec3>& normals)
+	{
+		Meshlet meshlet;
+		meshlet.firstIndex = (GLuint)(firstTriangle * 3);
+		meshlet.indexCount = (GLuint)((endTriangle - firstTriangle) * 3);
+		const GLuint* first = &indices[meshlet.firstIndex];
+		const GLuint* last = first + meshlet.indexCount;
+
+		// Start from the most distant pair among the axis extremes
+		size_t minIdx[3] = { 0, 0, 0 }, maxIdx[3] = { 0, 0, 0 };
+		for (const GLuint* it = first; it != last; ++it)
+		{
+			const glm::vec3& p = vertices[*it].position;
+			for (int k = 0; k < 3; ++k)
+			{
+				if (p[k] < vertices[first[minIdx[k]]].position[k])
+				{
+					minIdx[k] = it - first;
+				}
+				if (p[k] > vertices[first[maxIdx[k]]].position[k])
+				{
+					maxIdx[k] = it - first;
+				}
+			}
+		}
+		int axis = 0;
+		float bestDist = -1.0f;
+		for (int k = 0; k < 3; ++k)
+		{
+			const glm::vec3 d = vertices[first[maxIdx[k]]].position - vertices[first[minIdx[k]]].position;
+			if (glm::dot(d, d) > bestDist)
+			{
+				bestDist = glm::dot(d, d);
+				axis = k;
+			}
+		}
+		const glm::vec3& pMin = vertices[first[minIdx[axis]]].position;
+		const glm::vec3& pMax = vertices[first[maxIdx[axis]]].position;
+		glm::vec3 center = (pMin + pMax) * 0.5f;
+		float radius = glm::length(pMax - pMin) * 0.5f;
+		// Grow to cover the remaining points
+		for (const GLuint* it = first; it != last; ++it)
+		{
+			const glm::vec3& p = vertices[*it].position;
+			const float dist = glm::length(p - center);
+			if (dist > radius)
+			{
+				const float newRadius = (radius + dist) * 0.5f;
+				center += (p - center) * ((newRadius - radius) / dist);
+				radius = newRadius;
+			}
+		}
+		meshlet.center = center;
+		meshlet.radius = radius;
+
+		// Normal cone from the face normals, degenerate triangles are ignored
+		normals.clear();
+		glm::vec3 sum(0.0f);
+		for (const GLuint* it = first; it != last; it += 3)
+		{
+			const glm::vec3& a = vertices[it[0]].position;
+			const glm::vec3 n = glm::cross(vertices[it[1]].position - a, vertices[it[2]].position - a);
+			const float length = glm::length(n);
+			if (length > 0.0f)
+			{
+				normals.push_back(n / length);
+				sum += normals.back();
+			}
+		}
+		meshlet.coneAxis = glm::vec3(0.0f, 0.0f, 1.0f);
+		meshlet.coneCutoff = 1.0f;
+		const float sumLength = glm::length(sum);
+		if (normals.empty() || sumLength <= 0.0f)
+		{
+			return meshlet;
+		}
+		meshlet.coneAxis = sum / sumLength;
+		float minDot = 1.0f;
+		for (size_t i = 0; i < normals.size(); ++i)
+		{
+			minDot = std::min(minDot, glm::dot(meshlet.coneAxis, normals[i]));
+		}
+		// Normals spread over more than a hemisphere, the cluster is never fully backfacing
+		if (minDot > 0.0f)
+		{
+			meshlet.coneCutoff = std::sqrt(1.0f - minDot * minDot);
+		}
+		return meshlet;
+	}
+};
+
+/*
+* Per-frame meshlet visibility for one model matrix, tests run in model space
+*/
+class MeshletCuller
+{
+public:
+	/*
+	* Backface culling should only be requested when GL_CULL_FACE is on, otherwise
+	* back faces of open meshes would disappear
+	*/
+	MeshletCuller(const glm::mat4& projection, const glm::mat4& view, const glm::mat4& model,
+		const glm::vec3& cameraPos, bool cullBackfaces)
+		:cullBackfaces(cullBackfaces), tested(0), visible(0)
+	{
+		// Frustum planes from the rows of the combined matrix, normalized so the
+		// plane distance is in model units
+		const glm::mat4 clip = projection * view * model;
+		for (int i = 0; i < 3; ++i)
+		{
+			for (int side = 0; side < 2; ++side)
+			{
+				glm::vec4 plane;
+				for (int col = 0; col < 4; ++col)
+				{
+					plane[col] = clip[col][3] + (side == 0 ? clip[col][i] : -clip[col][i]);
+				}
+				const float length = glm::length(glm::vec3(plane));
+				this->planes[i * 2 + side] = length > 0.0f ? plane / length : plane;
+			}
+		}
+		// Cone tests assume the model matrix has no non-uniform scale
+		this->cameraPos = glm::vec3(glm::inverse(model) * glm::vec4(cameraPos, 1.0f));
+	}
+	bool isVisible(const Meshlet& meshlet)
+	{
+		++this->tested;
+		if (!this->isSphereVisible(meshlet.center, meshlet.radius))
+		{
+			return false;
+		}
+		if (this->cullBackfaces && meshlet.coneCutoff < 1.0f)
+		{
+			// Every triangle faces away when the camera is behind the cone around the sphere
+			const glm::vec3 toCenter = meshlet.center - this->cameraPos;
+			if (glm::dot(toCenter, meshlet.coneAxis)
+				>= meshlet.coneCutoff * glm::length(toCenter) + meshlet.radius)
+			{
+				return false;
+			}
+		}
+		++this->visible;
+		return true;
+	}
+	/*
+	* Frustum test only, for whole meshes drawn without meshlets
+	*/
+	bool isSphereVisible(const glm::vec3& center, float radius) const
+	{
+		for (int i = 0; i < 6; ++i)
+		{
+			if (glm::dot(glm::vec3(this->planes[i]), center) + this->planes[i].w < -radius)
+			{
+				return false;
+			}
+		}
+		return true;
+	}
+	size_t getTested() const { return this->tested; }
+	size_t getVisible() const { return this->visible; }
+private:
+	glm::vec4 planes[6];
+	glm::vec3 cameraPos;
+	bool cullBackfaces;
+	size_t tested, visible;
+};
+
+#endif
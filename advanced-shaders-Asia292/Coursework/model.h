@@ -1,68 +1,971 @@
 #ifndef _MODEL_H_
 #define _MODEL_H_
 
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <future>
+#include <limits>
 #include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <thread>
 #include <assimp/Importer.hpp>
 #include <assimp/scene.h>
 #include <assimp/postprocess.h>
+#include "arena.h"
+#include "concurrentQueue.h"
 #include "mesh.h"
+#include "meshCache.h"
+#include "objParser.h"
+#include "meshConvert.h"
+#include "meshOptimize.h"
+#include "meshTangents.h"
+#include "mappedFile.h"
+#include "memoryStats.h"
+#include "hashHelper.h"
+#include "parallel.h"
 #include "texture.h"
+#include "textureArray.h"
+#include "textureRegistry.h"
+#include "textureStreamer.h"
+#include "virtualTextureSystem.h"
+
+// Assimp post-processing applied on import, also part of the mesh cache key.
+// Normals and tangents come from TangentGenerator instead.
+const unsigned int MODEL_IMPORT_FLAGS = aiProcess_Triangulate
+	| aiProcess_FlipUVs;
+
+/*
+* Optional processing applied to every mesh on import
+*/
+struct ModelOptions
+{
+	bool optimizeVertexCache; // Reorder triangles and vertices for vertex cache and fetch locality
+	bool optimizeOverdraw; // Order triangle clusters to reduce overdraw, implies optimizeVertexCache
+	float overdrawThreshold; // Allowed vertex cache ACMR increase for overdraw, e.g. 1.05 = 5%
+	bool weldVertices; // Merge duplicate vertices and remap the indices
+	WeldEpsilons weldEpsilons; // Per-attribute tolerances for weldVertices
+	bool compactVertices; // Upload quantized CompactVertex data and 16-bit indices where they fit
+	bool sharedBuffers; // Sub-allocate meshes from one MeshBufferPool and draw them with multi-draw indirect
+	bool buildMeshlets; // Split meshes into clusters for per-frame frustum and backface culling
+	size_t lodLevels; // Levels of detail per mesh including the original, 1 disables simplification
+	float lodReduction; // Triangle ratio between consecutive levels
+	bool fastObjParser; // Read .obj files with ObjParser, Assimp remains the fallback
+	MeshResidency residency; // System memory meshes keep after upload, applied once the load completes
+	bool virtualTextures; // Sample diffuse textures through VirtualTextureSystem once the load completes
+	bool textureArrays; // Pack pooled meshes' textures into a TextureArraySet once the load completes, needs sharedBuffers
+	bool streamTextures; // Upload material textures' mip tails first and stream finer levels on demand
+	bool compressTextures; // Block compress material textures where the driver supports the format
+	ModelOptions() :optimizeVertexCache(false), optimizeOverdraw(false), overdrawThreshold(1.05f),
+		weldVertices(false), compactVertices(false), sharedBuffers(false), buildMeshlets(false),
+		lodLevels(1), lodReduction(0.5f), fastObjParser(false), residency(MESH_RESIDENCY_KEEP),
+		virtualTextures(false), textureArrays(false), streamTextures(false), compressTextures(false) {}
+	VertexFormat vertexFormat() const
+	{
+		return this->compactVertices ? VERTEX_FORMAT_COMPACT : VERTEX_FORMAT_FULL;
+	}
+	// Everything that changes the processed meshes, used as the mesh cache key
+	uint64_t cacheKey() const
+	{
+		uint64_t key = HashHelper::combine(0, MODEL_IMPORT_FLAGS);
+		key = HashHelper::combine(key, this->optimizeVertexCache ? 1 : 0);
+		key = HashHelper::combine(key, this->optimizeOverdraw ? (uint64_t)(this->overdrawThreshold * 1000.0f) : 0);
+		if (this->weldVertices)
+		{
+			key = HashHelper::combine(key, HashHelper::hash64(&this->weldEpsilons, sizeof(WeldEpsilons)));
+		}
+		key = HashHelper::combine(key, this->buildMeshlets ? (MESHLET_MAX_VERTICES << 16) | MESHLET_MAX_TRIANGLES : 0);
+		if (this->lodLevels > 1)
+		{
+			key = HashHelper::combine(key, this->lodLevels);
+			key = HashHelper::combine(key, (uint64_t)(this->lodReduction * 1000.0f));
+		}
+		// The parsers split meshes differently, so their caches are kept apart
+		key = HashHelper::combine(key, this->fastObjParser ? 1 : 0);
+		return key;
+	}
+};
+
+// Meshes read from a model file, parsed OBJ data or an Assimp scene
+struct ModelSource
+{
+	Assimp::Importer importer;
+	const aiScene* sceneObjPtr;
+	std::vector<const aiMesh*> meshPtrs;
+	std::vector<MeshData> objMeshes; // Unprocessed, used when ObjParser read the file
+	ModelSource() :sceneObjPtr(NULL) {}
+	size_t meshCount() const
+	{
+		return this->objMeshes.empty() ? this->meshPtrs.size() : this->objMeshes.size();
+	}
+	size_t triangleCount(size_t meshIndex) const
+	{
+		return this->objMeshes.empty() ? this->meshPtrs[meshIndex]->mNumFaces
+			: this->objMeshes[meshIndex].indices.size() / 3;
+	}
+};
+
+// Work handed from an asynchronous load to the GL thread, either a texture request or a mesh
+struct ModelLoadItem
+{
+	bool isTexture;
+	std::string texturePath;
+	std::shared_ptr<PendingTexture> texture; // Decoded and uploaded by TextureStreamer
+	MeshData mesh;
+	size_t meshIndex; // Position in the source file, also the mesh's slot in Model::meshes
+	ModelLoadItem() :isTexture(false), meshIndex(0) {}
+};
+
+/*
+* State shared by the load thread and the GL thread during Model::loadModelAsync
+*/
+struct ModelLoadState
+{
+	ConcurrentQueue<ModelLoadItem*> queue;
+	std::atomic<bool> cancelled;
+	std::atomic<bool> workerDone; // Set after the last item is queued
+	std::atomic<bool> succeeded;
+	std::atomic<bool> fromCache;
+	uint64_t sourceHash;
+	std::promise<bool> finished;
+	ModelLoadState() :queue(64), cancelled(false), workerDone(false), succeeded(false),
+		fromCache(false), sourceHash(0), meshCount(0), meshesCancelled(false), meshesFailed(false) {}
+	/*
+	* Called by the load thread once the mesh list is known
+	*/
+	void initMeshes(const std::vector<float>& defaultPriorities)
+	{
+		std::lock_guard<std::mutex> lock(this->mutex);
+		this->meshCount = defaultPriorities.size();
+		this->priorities = defaultPriorities;
+		this->claimed.assign(defaultPriorities.size(), 0);
+		for (std::map<size_t, float>::const_iterator it = this->earlyPriorities.begin();
+			this->earlyPriorities.end() != it; ++it)
+		{
+			if (it->first < this->priorities.size())
+			{
+				this->priorities[it->first] = it->second;
+			}
+		}
+		for (std::set<size_t>::const_iterator it = this->earlyCancels.begin(); this->earlyCancels.end() != it; ++it)
+		{
+			if (*it < this->claimed.size())
+			{
+				this->claimed[*it] = 1;
+			}
+		}
+	}
+	void setPriority(size_t meshIndex, float priority)
+	{
+		std::lock_guard<std::mutex> lock(this->mutex);
+		if (meshIndex < this->priorities.size())
+		{
+			this->priorities[meshIndex] = priority;
+		}
+		else
+		{
+			this->earlyPriorities[meshIndex] = priority;
+		}
+	}
+	void cancelMesh(size_t meshIndex)
+	{
+		std::lock_guard<std::mutex> lock(this->mutex);
+		if (meshIndex >= this->claimed.size())
+		{
+			this->earlyCancels.insert(meshIndex);
+			this->meshesCancelled = true;
+		}
+		else if (!this->claimed[meshIndex])
+		{
+			this->claimed[meshIndex] = 1;
+			this->meshesCancelled = true;
+		}
+	}
+	/*
+	* Take the highest priority mesh nobody has started, false when none is left
+	*/
+	bool claimNext(size_t& meshIndex)
+	{
+		std::lock_guard<std::mutex> lock(this->mutex);
+		float best = -std::numeric_limits<float>::infinity();
+		bool found = false;
+		for (size_t i = 0; i < this->claimed.size(); ++i)
+		{
+			if (!this->claimed[i] && (!found || this->priorities[i] > best))
+			{
+				best = this->priorities[i];
+				meshIndex = i;
+				found = true;
+			}
+		}
+		if (found)
+		{
+			this->claimed[meshIndex] = 1;
+		}
+		return found;
+	}
+	/*
+	* True for the first caller per path, which then decodes it
+	*/
+	bool claimTexture(const std::string& path)
+	{
+		std::lock_guard<std::mutex> lock(this->mutex);
+		return this->claimedTextures.insert(path).second;
+	}
+	/*
+	* Meshes in the source file, known before the first mesh is queued
+	*/
+	size_t getMeshCount()
+	{
+		std::lock_guard<std::mutex> lock(this->mutex);
+		return this->meshCount;
+	}
+	bool anyMeshCancelled()
+	{
+		std::lock_guard<std::mutex> lock(this->mutex);
+		return this->meshesCancelled;
+	}
+	/*
+	* Called by the load thread for a mesh that could not be processed, its slot stays empty
+	*/
+	void failMesh()
+	{
+		std::lock_guard<std::mutex> lock(this->mutex);
+		this->meshesFailed = true;
+	}
+	bool anyMeshFailed()
+	{
+		std::lock_guard<std::mutex> lock(this->mutex);
+		return this->meshesFailed;
+	}
+	/*
+	* Queue an item, sleeping while the GL thread catches up. Frees the item on cancel.
+	*/
+	bool push(ModelLoadItem* item)
+	{
+		if (this->queue.tryPush(item))
+		{
+			return true;
+		}
+		std::unique_lock<std::mutex> lock(this->spaceMutex);
+		while (!this->queue.tryPush(item))
+		{
+			if (this->cancelled.load())
+			{
+				delete item;
+				return false;
+			}
+			this->spaceFreed.wait(lock);
+		}
+		return true;
+	}
+	/*
+	* Wake pushes waiting for room, called by the GL thread after popping and on cancel
+	*/
+	void signalSpace()
+	{
+		// Taking the lock orders this after a pusher's failed tryPush, so the wake is not lost
+		std::lock_guard<std::mutex> lock(this->spaceMutex);
+		this->spaceFreed.notify_all();
+	}
+private:
+	std::mutex mutex; // Guards the members below
+	size_t meshCount;
+	std::vector<float> priorities; // Per mesh in source order
+	std::vector<char> claimed; // Started or cancelled
+	std::map<size_t, float> earlyPriorities; // Set before the mesh list was known
+	std::set<size_t> earlyCancels;
+	std::set<std::string> claimedTextures;
+	bool meshesCancelled;
+	bool meshesFailed;
+	std::mutex spaceMutex; // Held by pushers between a full queue and sleeping
+	std::condition_variable spaceFreed;
+};
 
 /*
 * Represents a model which can contain one or more meshes
 */
 class Model
 {
+	friend class Diagnostics; // Times the load stages one by one
 public:
-	void draw(const Shader& shader) const
+	Model() :residencyPending(false) {}
+	// Meshes and textures own GL objects, a model can be moved but not copied
+	Model(const Model&) = delete;
+	Model& operator=(const Model&) = delete;
+	Model(Model&& other) :residencyPending(false)
+	{
+		*this = std::move(other);
+	}
+	Model& operator=(Model&& other)
+	{
+		if (this == &other)
+		{
+			return *this;
+		}
+		// A load in flight holds a pointer to its model, it does not follow the move
+		other.cancelLoad();
+		other.waitForCacheWrite();
+		this->cancelLoad();
+		this->waitForCacheWrite();
+		this->meshes.clear(); // Before their pool can go away
+		this->meshes = std::move(other.meshes);
+		this->modelFileDir = std::move(other.modelFileDir);
+		this->options = other.options;
+		this->bufferPool = std::move(other.bufferPool);
+		this->drawBatches = std::move(other.drawBatches);
+		this->releaseTextures();
+		this->texturePaths = std::move(other.texturePaths);
+		this->textureHandles = std::move(other.textureHandles);
+		this->textureSourceIds = std::move(other.textureSourceIds);
+		this->textureArrays = std::move(other.textureArrays);
+		this->arrayBatches = std::move(other.arrayBatches);
+		other.texturePaths.clear();
+		other.textureHandles.clear();
+		other.textureSourceIds.clear();
+		return *this;
+	}
+	/*
+	* Overrides replace the model's own textures for this draw only, see ModelInstance
+	*/
+	void draw(const Shader& shader, const std::vector<TextureOverride>* overrides = NULL) const
+	{
+		this->drawMeshes(shader, NULL, NULL, overrides);
+	}
+	/*
+	* Draw with meshlet culling, only visible cluster ranges are submitted
+	*/
+	void draw(const Shader& shader, MeshletCuller& culler,
+		const std::vector<TextureOverride>* overrides = NULL) const
+	{
+		this->drawMeshes(shader, &culler, NULL, overrides);
+	}
+	/*
+	* Draw with meshlet culling and a level of detail picked per mesh from its projected error
+	*/
+	void draw(const Shader& shader, MeshletCuller& culler, const LodSelector& lodSelector,
+		const std::vector<TextureOverride>* overrides = NULL) const
+	{
+		this->drawMeshes(shader, &culler, &lodSelector, overrides);
+	}
+	/*
+	* Report every mesh's texture demand to TextureResidency, see Mesh::requestTextures
+	*/
+	void requestTextures(const TextureDemand& demand) const
+	{
+		for (std::vector<Mesh>::const_iterator it = this->meshes.begin(); this->meshes.end() != it; ++it)
+		{
+			it->requestTextures(demand);
+		}
+	}
+	/*
+	* Share one buffer pool between models, set before loadModel. The pool's vertex format
+	* must match ModelOptions::compactVertices, meshes that do not fit get their own buffers.
+	*/
+	void setBufferPool(const std::shared_ptr<MeshBufferPool>& pool)
+	{
+		this->bufferPool = pool;
+	}
+	bool loadModel(const std::string& filePath, const ModelOptions& options = ModelOptions())
+	{
+		this->cancelLoad();
+		this->waitForCacheWrite();
+		this->clearModel();
+		if (filePath.empty())
+		{
+			std::cerr << "Error:Model::loadModel, empty model file path." << std::endl;
+			return false;
+		}
+		this->modelFileDir = filePath.substr(0, filePath.find_last_of('/'));
+		this->options = options;
+		if (this->options.sharedBuffers && !this->bufferPool)
+		{
+			this->bufferPool = std::make_shared<MeshBufferPool>(this->options.vertexFormat());
+		}
+		// Hash the source file, the cache is only used while it is unchanged
+		uint64_t sourceHash = 0;
+		if (!hashSourceFile(filePath, sourceHash))
+		{
+			return false;
+		}
+		const std::string cachePath = MeshCache::cachePath(filePath);
+		if (this->loadFromCache(cachePath, sourceHash))
+		{
+			this->buildDrawBatches();
+			this->settleLoad();
+			return true;
+		}
+		ModelSource source;
+		if (!this->readSource(filePath, source))
+		{
+			return false;
+		}
+		// CPU side of every mesh runs on worker threads
+		std::vector<MeshData> meshData(source.meshCount());
+		ParallelHelper::parallelFor(meshData.size(), [&](size_t i)
+		{
+			MonotonicArena arena;
+			meshData[i].valid = this->processSourceMesh(source, i, meshData[i], arena);
+		});
+		// GL objects are only created on this thread, in node order
+		this->uploadMeshes(meshData);
+		this->buildDrawBatches();
+		if (!MeshCache::write(cachePath, sourceHash, this->options.cacheKey(), this->meshes,
+			this->modelFileDir, this->texturePaths))
+		{
+			std::cerr << "Warning:Model::loadModel, could not write mesh cache: " << cachePath << std::endl;
+		}
+		this->settleLoad();
+		return true;
+	}
+	/*
+	* Import and process on a background thread while the caller keeps rendering.
+	* Meshes become resident through pumpUploads, highest priority first (default:
+	* triangle count), each into its source file slot; slots not uploaded yet are empty
+	* and draw nothing. The future is set by pumpUploads once every mesh is resident,
+	* so never wait on it from the GL thread.
+	*/
+	std::future<bool> loadModelAsync(const std::string& filePath, const ModelOptions& options = ModelOptions())
+	{
+		this->cancelLoad();
+		this->waitForCacheWrite();
+		this->clearModel();
+		std::shared_ptr<ModelLoadState> state = std::make_shared<ModelLoadState>();
+		std::future<bool> result = state->finished.get_future();
+		if (filePath.empty())
+		{
+			std::cerr << "Error:Model::loadModelAsync, empty model file path." << std::endl;
+			state->finished.set_value(false);
+			return result;
+		}
+		this->modelFileDir = filePath.substr(0, filePath.find_last_of('/'));
+		this->options = options;
+		if (this->options.sharedBuffers && !this->bufferPool)
+		{
+			this->bufferPool = std::make_shared<MeshBufferPool>(this->options.vertexFormat());
+		}
+		this->loadState = state;
+		this->loadFilePath = filePath;
+		this->loadThread = std::thread(&Model::loadWorker, this, filePath, state);
+		return result;
+	}
+	/*
+	* Upload finished work from loadModelAsync, call once per frame on the GL thread.
+	* At most maxUploads textures and meshes are created, returns the meshes added.
+	*/
+	size_t pumpUploads(size_t maxUploads = 8)
+	{
+		if (this->residencyPending
+			&& this->cacheWrite.wait_for(std::chrono::seconds(0)) == std::future_status::ready)
+		{
+			this->waitForCacheWrite();
+		}
+		if (!this->loadState)
+		{
+			return 0;
+		}
+		ModelLoadState& state = *this->loadState;
+		// Read before draining so everything the worker queued is visible
+		const bool workerDone = state.workerDone.load(std::memory_order_acquire);
+		size_t uploads = 0, added = 0;
+		bool drained = false, popped = false;
+		while (uploads < maxUploads)
+		{
+			ModelLoadItem* item = NULL;
+			if (!state.queue.tryPop(item))
+			{
+				drained = true;
+				break;
+			}
+			popped = true;
+			if (item->isTexture)
+			{
+				this->pendingTextures.push_back(item);
+			}
+			else
+			{
+				// Every mesh gets its source slot, so the order and the mesh cache match the file
+				if (this->meshes.size() < state.getMeshCount())
+				{
+					this->meshes.resize(state.getMeshCount());
+				}
+				this->parkedMeshes.push_back(item);
+			}
+		}
+		if (popped)
+		{
+			state.signalSpace();
+		}
+		// Textures decode on the streamer's threads and count as uploads once their copy is done
+		if (!this->pendingTextures.empty())
+		{
+			uploads += TextureStreamer::instance().pump(maxUploads - std::min(uploads, maxUploads));
+		}
+		for (size_t i = 0; i < this->pendingTextures.size();)
+		{
+			ModelLoadItem* item = this->pendingTextures[i];
+			if (!item->texture->isDone())
+			{
+				++i;
+				continue;
+			}
+			this->addStreamedTexture(item->texturePath, *item->texture);
+			delete item;
+			this->pendingTextures.erase(this->pendingTextures.begin() + i);
+		}
+		// A mesh waits until every texture it uses is resident
+		for (size_t i = 0; i < this->parkedMeshes.size() && uploads < maxUploads;)
+		{
+			if (!this->texturesResident(this->parkedMeshes[i]->mesh))
+			{
+				++i;
+				continue;
+			}
+			this->addMesh(this->parkedMeshes[i]->mesh, this->parkedMeshes[i]->meshIndex);
+			delete this->parkedMeshes[i];
+			this->parkedMeshes.erase(this->parkedMeshes.begin() + i);
+			++uploads;
+			++added;
+		}
+		if (added > 0)
+		{
+			this->buildDrawBatches();
+		}
+		if (workerDone && drained && this->pendingTextures.empty() && this->parkedMeshes.empty())
+		{
+			this->finishLoad();
+		}
+		return added;
+	}
+	/*
+	* Change the order meshes are processed in, meshIndex is the mesh's position in the source file
+	*/
+	void setMeshPriority(size_t meshIndex, float priority)
+	{
+		if (this->loadState)
+		{
+			this->loadState->setPriority(meshIndex, priority);
+		}
+	}
+	/*
+	* Skip a mesh that has not started processing yet, the load then completes without it
+	*/
+	void cancelMesh(size_t meshIndex)
+	{
+		if (this->loadState)
+		{
+			this->loadState->cancelMesh(meshIndex);
+		}
+	}
+	/*
+	* Stop an asynchronous load, meshes already resident stay
+	*/
+	void cancelLoad()
+	{
+		if (!this->loadState)
+		{
+			return;
+		}
+		this->loadState->cancelled = true;
+		this->loadState->signalSpace();
+		if (this->loadThread.joinable())
+		{
+			this->loadThread.join();
+		}
+		ModelLoadItem* item = NULL;
+		while (this->loadState->queue.tryPop(item))
+		{
+			this->parkedMeshes.push_back(item);
+		}
+		for (size_t i = 0; i < this->parkedMeshes.size(); ++i)
+		{
+			delete this->parkedMeshes[i];
+		}
+		this->parkedMeshes.clear();
+		// Requests still in flight finish in the streamer, their references go with them
+		for (size_t i = 0; i < this->pendingTextures.size(); ++i)
+		{
+			delete this->pendingTextures[i];
+		}
+		this->pendingTextures.clear();
+		this->loadState->finished.set_value(false);
+		this->loadState.reset();
+	}
+	bool isLoading() const { return this->loadState != NULL; }
+	~Model()
+	{
+		this->cancelLoad();
+		if (this->cacheWrite.valid())
+		{
+			this->cacheWrite.wait();
+		}
+		this->meshes.clear(); // Pooled meshes release their ranges before the pool is destroyed
+		this->releaseTextures();
+	}
+	const std::vector<Mesh>& getMeshes() const { return this->meshes; }
+private:
+	static bool hashSourceFile(const std::string& filePath, uint64_t& sourceHash)
+	{
+		MappedFile sourceFile;
+		if (!sourceFile.open(filePath))
+		{
+			std::cerr << "Error:Model::loadModel, could not open model file: " << filePath << std::endl;
+			return false;
+		}
+		sourceHash = HashHelper::hash64(sourceFile.data(), sourceFile.size());
+		// Material libraries decide the texture paths stored in the mesh cache
+		if (ObjParser::isObjFile(filePath))
+		{
+			const std::string modelDir = filePath.substr(0, filePath.find_last_of('/'));
+			std::vector<std::string> libraries;
+			ObjParser::materialLibraries((const char*)sourceFile.data(), sourceFile.size(), libraries);
+			for (std::vector<std::string>::const_iterator it = libraries.begin(); libraries.end() != it; ++it)
+			{
+				MappedFile library;
+				sourceHash = HashHelper::combine(sourceHash, library.open(modelDir + "/" + *it)
+					? HashHelper::hash64(library.data(), library.size()) : 0);
+			}
+		}
+		return true;
+	}
+	/*
+	* Load thread of loadModelAsync, reads the cache or imports, then processes meshes in priority order
+	*/
+	void loadWorker(const std::string filePath, std::shared_ptr<ModelLoadState> state)
+	{
+		uint64_t sourceHash = 0;
+		if (!hashSourceFile(filePath, sourceHash))
+		{
+			state->workerDone.store(true, std::memory_order_release);
+			return;
+		}
+		state->sourceHash = sourceHash;
+		MeshCache cache;
+		const bool fromCache = cache.open(MeshCache::cachePath(filePath), sourceHash, this->options.cacheKey());
+		ModelSource source;
+		std::vector<float> priorities;
+		if (fromCache)
+		{
+			CachedMesh cached;
+			for (size_t i = 0; i < cache.meshCount(); ++i)
+			{
+				cache.getMesh(i, cached);
+				priorities.push_back((float)(cached.indexCount / 3));
+			}
+		}
+		else
+		{
+			if (!this->readSource(filePath, source))
+			{
+				state->workerDone.store(true, std::memory_order_release);
+				return;
+			}
+			for (size_t i = 0; i < source.meshCount(); ++i)
+			{
+				priorities.push_back((float)source.triangleCount(i));
+			}
+		}
+		state->initMeshes(priorities);
+		ParallelHelper::parallelFor(priorities.size(), [&](size_t)
+		{
+			size_t meshIndex = 0;
+			if (state->cancelled.load() || !state->claimNext(meshIndex))
+			{
+				return;
+			}
+			ModelLoadItem* item = new ModelLoadItem();
+			item->meshIndex = meshIndex;
+			if (fromCache)
+			{
+				this->copyCachedMesh(cache, meshIndex, item->mesh);
+			}
+			else
+			{
+				MonotonicArena arena;
+				item->mesh.valid = this->processSourceMesh(source, meshIndex, item->mesh, arena);
+			}
+			if (!item->mesh.valid)
+			{
+				state->failMesh();
+				delete item;
+				return;
+			}
+			// Decode the textures this mesh is the first to need
+			for (size_t i = 0; i < item->mesh.textures.size(); ++i)
+			{
+				const std::string& path = item->mesh.textures[i].path;
+				if (state->claimTexture(path))
+				{
+					ModelLoadItem* textureItem = new ModelLoadItem();
+					textureItem->isTexture = true;
+					textureItem->texturePath = path;
+					textureItem->texture = TextureStreamer::instance().request(path,
+						textureParams(item->mesh.textures[i].type));
+					state->push(textureItem);
+				}
+			}
+			state->push(item);
+		});
+		state->fromCache = fromCache;
+		state->succeeded = !state->cancelled.load();
+		state->workerDone.store(true, std::memory_order_release);
+	}
+	/*
+	* Copy one cached mesh into MeshData, texture paths become absolute
+	*/
+	void copyCachedMesh(const MeshCache& cache, size_t meshIndex, MeshData& meshData) const
+	{
+		CachedMesh cached;
+		cache.getMesh(meshIndex, cached);
+		meshData.vertices.assign(cached.vertices, cached.vertices + cached.vertexCount);
+		meshData.indices.assign(cached.indices, cached.indices + cached.indexCount);
+		meshData.meshlets.assign(cached.meshlets, cached.meshlets + cached.meshletCount);
+		meshData.lods.assign(cached.lods, cached.lods + cached.lodCount);
+		for (size_t i = 0; i < cached.textures.size(); ++i)
+		{
+			TextureSource text;
+			text.type = cached.textures[i].first;
+			text.path = this->modelFileDir + "/" + cached.textures[i].second;
+			meshData.textures.push_back(text);
+		}
+		meshData.valid = true;
+	}
+	bool texturesResident(const MeshData& meshData) const
+	{
+		for (size_t i = 0; i < meshData.textures.size(); ++i)
+		{
+			if (this->textureSourceIds.find(meshData.textures[i].path) == this->textureSourceIds.end())
+			{
+				return false;
+			}
+		}
+		return true;
+	}
+	/*
+	* Everything from loadModelAsync is resident, write the cache off-thread for a fresh import
+	*/
+	void finishLoad()
+	{
+		if (this->loadThread.joinable())
+		{
+			this->loadThread.join();
+		}
+		const bool succeeded = this->loadState->succeeded.load();
+		// A cache missing cancelled or failed meshes would be taken for the whole model
+		if (succeeded && !this->loadState->fromCache.load() && !this->loadState->anyMeshCancelled()
+			&& !this->loadState->anyMeshFailed())
+		{
+			// Meshes are only read while the write runs, drawing them meanwhile is fine
+			const std::string cachePath = MeshCache::cachePath(this->loadFilePath);
+			const uint64_t sourceHash = this->loadState->sourceHash;
+			const uint64_t importKey = this->options.cacheKey();
+			this->cacheWrite = std::async(std::launch::async, [this, cachePath, sourceHash, importKey]()
+			{
+				if (!MeshCache::write(cachePath, sourceHash, importKey, this->meshes,
+					this->modelFileDir, this->texturePaths))
+				{
+					std::cerr << "Warning:Model::loadModelAsync, could not write mesh cache: " << cachePath << std::endl;
+				}
+			});
+			// The write reads the meshes' system memory copies, residency waits for it
+			this->residencyPending = true;
+		}
+		else
+		{
+			this->settleLoad();
+		}
+		this->loadState->finished.set_value(succeeded);
+		this->loadState.reset();
+	}
+	void waitForCacheWrite()
 	{
-		for (std::vector<Mesh>::const_iterator it = this->meshes.begin(); this->meshes.end() != it; ++it)
+		if (this->cacheWrite.valid())
+		{
+			this->cacheWrite.get();
+		}
+		if (this->residencyPending)
 		{
-			it->draw(shader);
+			this->residencyPending = false;
+			this->settleLoad();
 		}
 	}
-	bool loadModel(const std::string& filePath)
+	/*
+	* Apply the residency policy, texture arrays and virtual textures once a load is complete
+	* and report memory use
+	*/
+	void settleLoad()
 	{
-		Assimp::Importer importer;
-		if (filePath.empty())
+		if (this->options.textureArrays)
 		{
-			std::cerr << "Error:Model::loadModel, empty model file path." << std::endl;
-			return false;
+			this->packTextureArrays();
 		}
-		const aiScene* sceneObjPtr = importer.ReadFile(filePath, 
-			aiProcess_Triangulate 
-			| aiProcess_FlipUVs 
-			| aiProcess_GenSmoothNormals
-			| aiProcess_CalcTangentSpace);
-		if (!sceneObjPtr
-			|| sceneObjPtr->mFlags == AI_SCENE_FLAGS_INCOMPLETE
-			|| !sceneObjPtr->mRootNode)
+		if (this->options.virtualTextures)
 		{
-			std::cerr << "Error:Model::loadModel, description: " 
-				<< importer.GetErrorString() << std::endl;
-			return false;
+			this->addVirtualTextures();
 		}
-		this->modelFileDir = filePath.substr(0, filePath.find_last_of('/'));
-		if (!this->processNode(sceneObjPtr->mRootNode, sceneObjPtr))
+		size_t cpuBytes = 0;
+		for (std::vector<Mesh>::iterator it = this->meshes.begin(); this->meshes.end() != it; ++it)
+		{
+			it->applyResidency(this->options.residency);
+			cpuBytes += it->getCpuBytes();
+		}
+		const double megabyte = 1024.0 * 1024.0;
+		std::cout << "Info:Model::loadModel, " << this->meshes.size() << " meshes, "
+			<< cpuBytes / megabyte << " MB mesh data in system memory, process resident "
+			<< MemoryStats::residentBytes() / megabyte << " MB, peak "
+			<< MemoryStats::peakResidentBytes() / megabyte << " MB" << std::endl;
+	}
+	/*
+	* Build meshes from a valid mesh cache, skipping Assimp entirely
+	*/
+	bool loadFromCache(const std::string& cachePath, uint64_t sourceHash)
+	{
+		MeshCache cache;
+		if (!cache.open(cachePath, sourceHash, this->options.cacheKey()))
 		{
-			std::cerr << "Error:Model::loadModel, process node failed."<< std::endl;
 			return false;
 		}
+		this->meshes.resize(cache.meshCount());
+		CachedMesh cached;
+		std::vector<TextureSource> textureSources;
+		for (size_t i = 0; i < cache.meshCount(); ++i)
+		{
+			cache.getMesh(i, cached);
+			for (size_t j = 0; j < cached.textures.size(); ++j)
+			{
+				TextureSource source;
+				source.type = cached.textures[j].first;
+				source.path = this->modelFileDir + "/" + cached.textures[j].second;
+				textureSources.push_back(source);
+			}
+		}
+		this->prefetchTextures(textureSources);
+		std::vector<Texture> textures;
+		for (size_t i = 0; i < cache.meshCount(); ++i)
+		{
+			cache.getMesh(i, cached);
+			textures.clear();
+			for (size_t j = 0; j < cached.textures.size(); ++j)
+			{
+				Texture text;
+				this->loadTexture(this->modelFileDir + "/" + cached.textures[j].second,
+					cached.textures[j].first, text);
+				textures.push_back(text);
+			}
+			this->meshes[i].setVertexFormat(this->options.vertexFormat());
+			this->meshes[i].setMeshlets(cached.meshlets, cached.meshletCount);
+			this->meshes[i].setLods(cached.lods, cached.lodCount);
+			this->meshes[i].setBufferPool(this->options.sharedBuffers ? this->bufferPool.get() : NULL);
+			this->meshes[i].setData(cached.vertices, cached.vertexCount,
+				cached.indices, cached.indexCount, textures, cached.boundsMin, cached.boundsMax,
+				this->options.residency);
+		}
 		return true;
 	}
-	~Model()
+	void drawMeshes(const Shader& shader, MeshletCuller* culler, const LodSelector* lodSelector,
+		const std::vector<TextureOverride>* overrides) const
 	{
+		// Overrides replace single textures, only the per-material batches can apply them
+		const std::vector<DrawBatch>& batches = this->arrayBatches.empty() || overrides
+			? this->drawBatches : this->arrayBatches;
+		if (!batches.empty())
+		{
+			// One indirect draw per material or array set, no VAO changes in between
+			this->bufferPool->bind(shader);
+			for (std::vector<DrawBatch>::const_iterator it = batches.begin(); batches.end() != it; ++it)
+			{
+				const std::vector<DrawElementsIndirectCommand>* commands = &it->commands;
+				if (culler)
+				{
+					this->frameCommands.clear();
+					for (size_t i = 0; i < it->meshIndices.size(); ++i)
+					{
+						const Mesh& mesh = this->meshes[it->meshIndices[i]];
+						mesh.appendVisibleRanges(*culler, lodSelector ? mesh.selectLod(*lodSelector) : 0,
+							this->frameCommands);
+					}
+					commands = &this->frameCommands;
+				}
+				if (commands->empty())
+				{
+					continue;
+				}
+				const Mesh& material = this->meshes[it->meshIndices[0]];
+				if (it->packed)
+				{
+					// Layers come from the per-draw data, the virtual path does not apply
+					VirtualTextureSystem::bindSamplers(shader, false);
+					this->textureArrays.bind(shader, material.getTextureArrays());
+					this->bufferPool->draw(&(*commands)[0], commands->size());
+					this->textureArrays.unbind();
+					continue;
+				}
+				int texUnitCnt = material.bindTextures(shader, overrides);
+				this->bufferPool->draw(&(*commands)[0], commands->size());
+				material.unBindTextures(texUnitCnt);
+			}
+			this->bufferPool->unbind(shader);
+		}
 		for (std::vector<Mesh>::const_iterator it = this->meshes.begin(); this->meshes.end() != it; ++it)
 		{
-			it->final();
+			if (it->getBufferPool())
+			{
+				continue;
+			}
+			if (culler)
+			{
+				it->draw(shader, *culler, lodSelector ? it->selectLod(*lodSelector) : 0, overrides);
+			}
+			else
+			{
+				it->draw(shader, overrides);
+			}
+		}
+	}
+	/*
+	* Group pooled meshes by texture set, each group becomes one indirect draw. Once textures
+	* are packed, a second grouping puts packed meshes together by array set.
+	*/
+	void buildDrawBatches()
+	{
+		this->drawBatches.clear();
+		this->arrayBatches.clear();
+		for (size_t i = 0; i < this->meshes.size(); ++i)
+		{
+			const Mesh& mesh = this->meshes[i];
+			if (!mesh.getBufferPool())
+			{
+				continue;
+			}
+			this->addToBatch(this->drawBatches, i, false);
+			if (!this->textureArrays.empty())
+			{
+				this->addToBatch(this->arrayBatches, i, mesh.hasArraySlots());
+			}
 		}
 	}
-	const std::vector<Mesh>& getMeshes() const { return this->meshes; }
-private:
+	static bool sameTextures(const std::vector<Texture>& a, const std::vector<Texture>& b)
+	{
+		if (a.size() != b.size())
+		{
+			return false;
+		}
+		for (size_t i = 0; i < a.size(); ++i)
+		{
+			if (a[i].handle != b[i].handle || a[i].type != b[i].type)
+			{
+				return false;
+			}
+		}
+		return true;
+	}
 	/*
-	* Recursive processing of model nodes
+	* Recursive processing of model nodes, collects meshes in a deterministic order
 	*/
-	bool processNode(const aiNode* node, const aiScene* sceneObjPtr)
+	bool processNode(const aiNode* node, const aiScene* sceneObjPtr,
+		std::vector<const aiMesh*>& meshPtrs) const
 	{
 		if (!node || !sceneObjPtr)
 		{
@@ -74,110 +977,219 @@ private:
 			const aiMesh* meshPtr = sceneObjPtr->mMeshes[node->mMeshes[i]]; 
 			if (meshPtr)
 			{
-				Mesh meshObj;
-				if (this->processMesh(meshPtr, sceneObjPtr, meshObj))
-				{
-					this->meshes.push_back(meshObj);
-				}
+				meshPtrs.push_back(meshPtr);
 			}
 		}
 		// Handles child nodes
 		for (size_t i = 0; i < node->mNumChildren; ++i)
 		{
-			this->processNode(node->mChildren[i], sceneObjPtr);
+			this->processNode(node->mChildren[i], sceneObjPtr, meshPtrs);
 		}
 		return true;
 	}
-	bool processMesh(const aiMesh* meshPtr, const aiScene* sceneObjPtr, Mesh& meshObj)
+	/*
+	* Load textures and create GL buffers for processed meshes, GL thread only
+	*/
+	void uploadMeshes(std::vector<MeshData>& meshData)
 	{
-		if (!meshPtr || !sceneObjPtr)
-		{
-			return false;
-		}
-		// Obtain vertex data, normal vector, and texture data from mesh
-		std::vector<Vertex> vertData;
-		std::vector<Texture> textures;
-		std::vector<GLuint> indices;
-
-		// Itterates through the number of verticies
-		for (size_t i = 0; i < meshPtr->mNumVertices; ++i)
+		std::vector<TextureSource> textureSources;
+		for (std::vector<MeshData>::const_iterator it = meshData.begin(); meshData.end() != it; ++it)
 		{
-			Vertex vertex;
-			// Get vertex position
-			if (meshPtr->HasPositions())
-			{
-				vertex.position.x = meshPtr->mVertices[i].x;
-				vertex.position.y = meshPtr->mVertices[i].y;
-				vertex.position.z = meshPtr->mVertices[i].z;
-			}
-			// Get texture data - currently only texture 0 processed
-			if (meshPtr->HasTextureCoords(0))
-			{
-				vertex.texCoords.x = meshPtr->mTextureCoords[0][i].x;
-				vertex.texCoords.y = meshPtr->mTextureCoords[0][i].y;
-			}
-			else
+			if (it->valid)
 			{
-				vertex.texCoords = glm::vec2(0.0f, 0.0f);
+				textureSources.insert(textureSources.end(), it->textures.begin(), it->textures.end());
 			}
-			// Get normal vector data
-			if (meshPtr->HasNormals())
+		}
+		this->prefetchTextures(textureSources);
+		this->meshes.reserve(this->meshes.size() + meshData.size());
+		for (std::vector<MeshData>::iterator it = meshData.begin(); meshData.end() != it; ++it)
+		{
+			if (it->valid)
 			{
-				vertex.normal.x = meshPtr->mNormals[i].x;
-				vertex.normal.y = meshPtr->mNormals[i].y;
-				vertex.normal.z = meshPtr->mNormals[i].z;
+				this->meshes.emplace_back();
+				this->addMesh(*it, this->meshes.size() - 1);
 			}
-			// Get tangent vector
-			if (meshPtr->HasTangentsAndBitangents())
+		}
+	}
+	/*
+	* Create the GL side of one processed mesh in an existing slot of meshes, loading
+	* textures not yet resident
+	*/
+	void addMesh(MeshData& meshData, size_t meshIndex)
+	{
+		if (!meshData.report.empty())
+		{
+			std::cout << "Info:Model::loadModel, mesh " << meshIndex << ": " << meshData.report;
+		}
+		std::vector<Texture> textures(meshData.textures.size());
+		for (size_t i = 0; i < meshData.textures.size(); ++i)
+		{
+			this->loadTexture(meshData.textures[i].path, meshData.textures[i].type, textures[i]);
+		}
+		meshData.textures.clear();
+		// The parsed vectors are handed over, not copied
+		Mesh& meshObj = this->meshes[meshIndex];
+		meshObj.setVertexFormat(this->options.vertexFormat());
+		meshObj.setMeshlets(std::move(meshData.meshlets));
+		meshObj.setLods(std::move(meshData.lods));
+		meshObj.setBufferPool(this->options.sharedBuffers ? this->bufferPool.get() : NULL);
+		meshObj.setData(std::move(meshData.vertices), std::move(textures), std::move(meshData.indices));
+	}
+	/*
+	* Read the model file, with ObjParser when enabled and possible, otherwise Assimp
+	*/
+	bool readSource(const std::string& filePath, ModelSource& source) const
+	{
+		if (this->options.fastObjParser && ObjParser::isObjFile(filePath))
+		{
+			if (ObjParser::parse(filePath, source.objMeshes))
 			{
-				glm::vec3 tangent;
-				tangent.x = meshPtr->mTangents[i].x;
-				tangent.y = meshPtr->mTangents[i].y;
-				tangent.z = meshPtr->mTangents[i].z;
-				vertex.tangent = tangent;
+				return true;
 			}
+			std::cerr << "Warning:Model::loadModel, falling back to Assimp for: " << filePath << std::endl;
+		}
+		source.sceneObjPtr = source.importer.ReadFile(filePath, MODEL_IMPORT_FLAGS);
+		if (!source.sceneObjPtr
+			|| source.sceneObjPtr->mFlags == AI_SCENE_FLAGS_INCOMPLETE
+			|| !source.sceneObjPtr->mRootNode)
+		{
+			std::cerr << "Error:Model::loadModel, description: " 
+				<< source.importer.GetErrorString() << std::endl;
+			return false;
+		}
+		if (!this->processNode(source.sceneObjPtr->mRootNode, source.sceneObjPtr, source.meshPtrs))
+		{
+			std::cerr << "Error:Model::loadModel, process node failed."<< std::endl;
+			return false;
+		}
+		return true;
+	}
+	/*
+	* processMesh for either source, parsed OBJ meshes only need the optimization passes.
+	* Scratch buffers of every pass come from arena, one per worker task.
+	*/
+	bool processSourceMesh(ModelSource& source, size_t meshIndex, MeshData& meshData, MonotonicArena& arena) const
+	{
+		if (source.objMeshes.empty())
+		{
+			return this->processMesh(source.meshPtrs[meshIndex], source.sceneObjPtr, meshData, arena);
+		}
+		meshData = std::move(source.objMeshes[meshIndex]);
+		this->optimizeMesh(meshData, arena);
+		return meshData.valid;
+	}
+	/*
+	* Convert one mesh to CPU side data, safe to run on any thread
+	*/
+	bool processMesh(const aiMesh* meshPtr, const aiScene* sceneObjPtr, MeshData& meshData, MonotonicArena& arena) const
+	{
+		if (!meshPtr || !sceneObjPtr)
+		{
+			return false;
+		}
+		// Obtain vertex data, normal vector, and texture data from mesh
+		std::vector<Vertex>& vertData = meshData.vertices;
+		std::vector<TextureSource>& textures = meshData.textures;
+		std::vector<GLuint>& indices = meshData.indices;
 
-			vertData.push_back(vertex);
+		// Get vertex and index data in bulk
+		MeshConvert::convertVertices(meshPtr, vertData);
+		if (!MeshConvert::convertIndices(meshPtr, indices))
+		{
+			std::cerr << "Error:Model::processMesh, mesh not transformed to triangle mesh." << std::endl;
+			return false;
 		}
-		// Get index data
-		for (size_t i = 0; i < meshPtr->mNumFaces; ++i)
+		// Smooth normals where the file has none, MikkTSpace tangents where it has UVs
+		if (!meshPtr->HasNormals())
 		{
-			aiFace face = meshPtr->mFaces[i];
-			if (face.mNumIndices != 3)
-			{
-				std::cerr << "Error:Model::processMesh, mesh not transformed to triangle mesh." << std::endl;
-				return false;
-			}
-			for (size_t j = 0; j < face.mNumIndices; ++j)
-			{
-				indices.push_back(face.mIndices[j]);
-			}
+			ArenaVector<GLuint> positionIds((ArenaAllocator<GLuint>(arena)));
+			TangentGenerator::positionIds(vertData, positionIds);
+			TangentGenerator::generateNormals(vertData, indices, positionIds.data(), arena);
+		}
+		if (meshPtr->HasTextureCoords(0))
+		{
+			TangentGenerator::generateTangents(vertData, indices, arena);
 		}
 		// Get texture data
 		if (meshPtr->mMaterialIndex >= 0)
 		{
 			const aiMaterial* materialPtr = sceneObjPtr->mMaterials[meshPtr->mMaterialIndex];
 			// Get diffuse type
-			std::vector<Texture> diffuseTexture;
+			std::vector<TextureSource> diffuseTexture;
 			this->processMaterial(materialPtr, sceneObjPtr, aiTextureType_DIFFUSE, diffuseTexture);
 			textures.insert(textures.end(), diffuseTexture.begin(), diffuseTexture.end());
 			// Get specular type
-			std::vector<Texture> specularTexture;
+			std::vector<TextureSource> specularTexture;
 			this->processMaterial(materialPtr, sceneObjPtr, aiTextureType_SPECULAR, specularTexture);
 			textures.insert(textures.end(), specularTexture.begin(), specularTexture.end());
 			// Get normal mapping data
-			std::vector<Texture> normalTexture;
+			std::vector<TextureSource> normalTexture;
 			this->processMaterial(materialPtr, sceneObjPtr, aiTextureType_HEIGHT, normalTexture);
 			textures.insert(textures.end(), normalTexture.begin(), normalTexture.end());
 		}
-		meshObj.setData(vertData, textures, indices);
+		this->optimizeMesh(meshData, arena);
 		return true;
 	}
 	/*
-	* Get texture in material
+	* Optional optimization passes, run between processMesh and Mesh::setData
+	*/
+	void optimizeMesh(MeshData& meshData, MonotonicArena& arena) const
+	{
+		std::ostringstream report;
+		if (this->options.weldVertices)
+		{
+			const WeldStats weld = MeshOptimizer::weldVertices(meshData.vertices, meshData.indices,
+				arena, this->options.weldEpsilons);
+			report << "welded " << weld.verticesBefore << " -> " << weld.verticesAfter
+				<< " vertices, saved " << weld.bytesSaved / 1024 << " KB" << std::endl;
+		}
+		if ((this->options.optimizeVertexCache || this->options.optimizeOverdraw) && !meshData.indices.empty())
+		{
+			const VertexCacheStats before = MeshOptimizer::analyzeVertexCache(meshData.indices, meshData.vertices.size(), arena);
+			OverdrawStats overdrawBefore;
+			if (this->options.optimizeOverdraw)
+			{
+				overdrawBefore = MeshOptimizer::analyzeOverdraw(meshData.indices, meshData.vertices, arena);
+			}
+			MeshOptimizer::optimizeVertexCache(meshData.indices, meshData.vertices.size(), arena);
+			if (this->options.optimizeOverdraw)
+			{
+				MeshOptimizer::optimizeOverdraw(meshData.indices, meshData.vertices, arena, this->options.overdrawThreshold);
+			}
+			MeshOptimizer::optimizeVertexFetch(meshData.vertices, meshData.indices, arena);
+			const VertexCacheStats after = MeshOptimizer::analyzeVertexCache(meshData.indices, meshData.vertices.size(), arena);
+			report << "vertex cache ACMR " << before.acmr << " -> " << after.acmr
+				<< ", ATVR " << before.atvr << " -> " << after.atvr << std::endl;
+			if (this->options.optimizeOverdraw)
+			{
+				const OverdrawStats overdrawAfter = MeshOptimizer::analyzeOverdraw(meshData.indices, meshData.vertices, arena);
+				report << "  overdraw " << overdrawBefore.overdraw << " -> " << overdrawAfter.overdraw << std::endl;
+			}
+		}
+		if (this->options.buildMeshlets)
+		{
+			MeshletBuilder::build(meshData.vertices, meshData.indices, meshData.meshlets, arena);
+			report << "  " << meshData.meshlets.size() << " meshlets" << std::endl;
+		}
+		// Last, LOD 0 keeps the index order every pass above produced
+		if (this->options.lodLevels > 1 && !meshData.indices.empty())
+		{
+			MeshSimplifier::buildLodChain(meshData.vertices, meshData.indices,
+				this->options.lodLevels, this->options.lodReduction, meshData.lods, arena);
+			report << "  LOD triangles";
+			for (size_t i = 0; i < meshData.lods.size(); ++i)
+			{
+				report << " " << meshData.lods[i].indexCount / 3;
+			}
+			report << ", error " << meshData.lods.back().error << std::endl;
+		}
+		meshData.report = report.str();
+	}
+	/*
+	* Get texture paths in material, the textures are loaded later on the GL thread
 	*/
 	bool processMaterial(const aiMaterial* matPtr, const aiScene* sceneObjPtr, 
-		const aiTextureType textureType, std::vector<Texture>& textures)
+		const aiTextureType textureType, std::vector<TextureSource>& textures) const
 	{
 		textures.clear();
 
@@ -192,7 +1204,7 @@ private:
 		}
 		for (size_t i = 0; i < matPtr->GetTextureCount(textureType); ++i)
 		{
-			Texture text;
+			TextureSource text;
 			aiString textPath;
 			aiReturn retStatus = matPtr->GetTexture(textureType, i, &textPath);
 			if (retStatus != aiReturn_SUCCESS 
@@ -203,29 +1215,280 @@ private:
 					<< retStatus << std::endl;
 				continue;
 			}
-			std::string absolutePath = this->modelFileDir + "/" + textPath.C_Str();
-			LoadedTextMapType::const_iterator it = this->loadedTextureMap.find(absolutePath);
-			if (it == this->loadedTextureMap.end()) // Check its been loaded
+			text.path = this->modelFileDir + "/" + textPath.C_Str();
+			text.type = textureType;
+			textures.push_back(text);
+		}
+		return true;
+	}
+	/*
+	* Resolve a texture file through the registry, once per model and path
+	*/
+	void loadTexture(const std::string& absolutePath, const aiTextureType textureType, Texture& text)
+	{
+		uint32_t source;
+		std::map<std::string, uint32_t>::const_iterator it = this->textureSourceIds.find(absolutePath);
+		if (it == this->textureSourceIds.end()) // Check its been loaded
+		{
+			source = this->addTextureSource(absolutePath,
+				TextureRegistry::instance().acquire(absolutePath, textureParams(textureType)));
+		}
+		else
+		{
+			source = it->second;
+		}
+		text.source = source;
+		text.virtualId = 0;
+		text.arraySlot = TextureArraySlot();
+		text.handle = this->textureHandles[source];
+		text.id = TextureRegistry::instance().getId(text.handle);
+		text.type = textureType; // The same image may serve several texture types
+	}
+	/*
+	* Load settings of a material texture. Normal maps arrive as height textures (see
+	* processMaterial) and are stored as two channels, colour maps are filtered in linear
+	* light. Block compression and on-demand streaming follow ModelOptions, both are off
+	* by default so textures upload complete and uncompressed.
+	*/
+	TextureParams textureParams(aiTextureType type) const
+	{
+		TextureParams params(MIP_MODE_LINEAR);
+		switch (type)
+		{
+			case aiTextureType_DIFFUSE:
+				params = TextureParams(MIP_MODE_SRGB, BlockCompressor::preferredColorFormat(false));
+				break;
+			case aiTextureType_SPECULAR:
+				params = TextureParams(MIP_MODE_LINEAR, BlockCompressor::preferredColorFormat(false));
+				break;
+			case aiTextureType_HEIGHT:
+				params = TextureParams::normalMap();
+				break;
+			default:
+				break;
+		}
+		if (!this->options.compressTextures)
+		{
+			params.compression = TEXTURE_COMPRESSION_NONE;
+		}
+		params.streamed = this->options.streamTextures;
+		return params;
+	}
+	/*
+	* Record a path and the registry reference taken for it, a failed load keeps handle 0
+	*/
+	uint32_t addTextureSource(const std::string& absolutePath, TextureHandle handle)
+	{
+		const uint32_t source = (uint32_t)this->texturePaths.size();
+		this->texturePaths.push_back(absolutePath);
+		this->textureHandles.push_back(handle);
+		this->textureSourceIds[absolutePath] = source;
+		return source;
+	}
+	/*
+	* Record a finished streamer request, the model takes its own reference. A failed
+	* request still gets its source, meshes using it draw without the texture.
+	*/
+	uint32_t addStreamedTexture(const std::string& absolutePath, const PendingTexture& texture)
+	{
+		if (texture.isFailed())
+		{
+			std::cerr << "Error:Model::addStreamedTexture, could not load texture: " << absolutePath << std::endl;
+			return this->addTextureSource(absolutePath, INVALID_TEXTURE_HANDLE);
+		}
+		const TextureHandle handle = texture.getHandle();
+		TextureRegistry::instance().addRef(handle);
+		return this->addTextureSource(absolutePath, handle);
+	}
+	/*
+	* Decode every texture not yet resident in parallel before the meshes ask for them one at a time
+	*/
+	void prefetchTextures(const std::vector<TextureSource>& sources)
+	{
+		TextureStreamer& streamer = TextureStreamer::instance();
+		std::vector<std::shared_ptr<PendingTexture> > requests;
+		std::set<std::string> requested;
+		for (std::vector<TextureSource>::const_iterator it = sources.begin(); sources.end() != it; ++it)
+		{
+			if (this->textureSourceIds.count(it->path) == 0 && requested.insert(it->path).second)
+			{
+				requests.push_back(streamer.request(it->path, textureParams(it->type)));
+			}
+		}
+		for (size_t i = 0; i < requests.size(); ++i)
+		{
+			streamer.wait(*requests[i]);
+			this->addStreamedTexture(requests[i]->getPath(), *requests[i]);
+		}
+	}
+	/*
+	* Copy the textures of pooled meshes into texture arrays and regroup the batches, so
+	* meshes of different materials share one indirect draw
+	*/
+	void packTextureArrays()
+	{
+		if (!this->bufferPool)
+		{
+			return;
+		}
+		// One layer per path and role, the same image may serve several roles
+		std::vector<int32_t> sourceIndices(this->texturePaths.size() * TEXTURE_ARRAY_ROLES, -1);
+		std::vector<TextureArraySource> sources;
+		for (std::vector<Mesh>::const_iterator it = this->meshes.begin(); this->meshes.end() != it; ++it)
+		{
+			if (!it->getBufferPool())
+			{
+				continue;
+			}
+			const std::vector<Texture>& textures = it->getTextures();
+			for (std::vector<Texture>::const_iterator text = textures.begin(); textures.end() != text; ++text)
 			{
-				GLuint textId = TextureHelper::load2DTexture(absolutePath.c_str());
-				text.id = textId;
-				text.path = absolutePath;
-				text.type = textureType;
-				textures.push_back(text);
-				loadedTextureMap[absolutePath] = text;
+				const int role = Mesh::textureArrayRole(text->type);
+				const size_t slot = (size_t)text->source * TEXTURE_ARRAY_ROLES + role;
+				if (role == TEXTURE_ARRAY_ROLES || text->handle == INVALID_TEXTURE_HANDLE
+					|| slot >= sourceIndices.size() || sourceIndices[slot] >= 0)
+				{
+					continue;
+				}
+				TextureArraySource source;
+				source.path = this->texturePaths[text->source];
+				source.role = role;
+				source.params = textureParams(text->type);
+				sourceIndices[slot] = (int32_t)sources.size();
+				sources.push_back(source);
 			}
-			else
+		}
+		std::vector<TextureArraySlot> packed;
+		this->textureArrays.pack(sources, packed);
+		std::vector<TextureArraySlot> slots(sourceIndices.size());
+		for (size_t i = 0; i < sourceIndices.size(); ++i)
+		{
+			if (sourceIndices[i] >= 0)
 			{
-				textures.push_back(it->second);
+				slots[i] = packed[sourceIndices[i]];
 			}
 		}
-		return true;
+		for (std::vector<Mesh>::iterator it = this->meshes.begin(); this->meshes.end() != it; ++it)
+		{
+			if (it->getBufferPool())
+			{
+				it->setArraySlots(slots);
+			}
+		}
+		this->buildDrawBatches();
+		std::cout << "Info:Model::loadModel, " << sources.size() << " textures packed into "
+			<< this->textureArrays.getArrayCount() << " texture arrays, "
+			<< this->textureArrays.getBytes() / (1024.0 * 1024.0) << " MB, batches "
+			<< this->drawBatches.size() << " -> " << this->arrayBatches.size() << std::endl;
+	}
+	/*
+	* Make every diffuse texture virtual, the ordinary textures stay as the fallback
+	*/
+	void addVirtualTextures()
+	{
+		std::vector<bool> diffuse(this->texturePaths.size(), false);
+		for (std::vector<Mesh>::const_iterator it = this->meshes.begin(); this->meshes.end() != it; ++it)
+		{
+			const std::vector<Texture>& textures = it->getTextures();
+			for (std::vector<Texture>::const_iterator text = textures.begin(); textures.end() != text; ++text)
+			{
+				// Packed textures are drawn from their array instead
+				if (text->type == aiTextureType_DIFFUSE && text->source < diffuse.size() && text->arraySlot.array < 0)
+				{
+					diffuse[text->source] = true;
+				}
+			}
+		}
+		std::vector<uint32_t> virtualIds(this->texturePaths.size(), 0);
+		for (size_t i = 0; i < this->texturePaths.size(); ++i)
+		{
+			if (diffuse[i])
+			{
+				virtualIds[i] = VirtualTextureSystem::instance().addTexture(this->texturePaths[i]);
+			}
+		}
+		for (std::vector<Mesh>::iterator it = this->meshes.begin(); this->meshes.end() != it; ++it)
+		{
+			it->setVirtualTextures(virtualIds);
+		}
+	}
+	/*
+	* Drop what a previous load left, the buffer pool is kept for the next one
+	*/
+	void clearModel()
+	{
+		this->meshes.clear();
+		this->drawBatches.clear();
+		this->releaseTextures();
+	}
+	void releaseTextures()
+	{
+		TextureRegistry& registry = TextureRegistry::instance();
+		for (size_t i = 0; i < this->textureHandles.size(); ++i)
+		{
+			registry.release(this->textureHandles[i]);
+		}
+		this->texturePaths.clear();
+		this->textureHandles.clear();
+		this->textureSourceIds.clear();
+		this->textureArrays.clear();
+		this->arrayBatches.clear();
 	}
 private:
 	std::vector<Mesh> meshes; // Holds mesh
 	std::string modelFileDir; // Folder path to save model path
-	typedef std::map<std::string, Texture> LoadedTextMapType; // key = texture file path
-	LoadedTextMapType loadedTextureMap; // Holds the loaded texture
+	ModelOptions options; // Processing options used by the last load
+	// Meshes sharing a texture set, or once packed an array set, drawn together from the buffer pool
+	struct DrawBatch
+	{
+		std::vector<size_t> meshIndices; // The first mesh's textures or arrays are bound for the batch
+		std::vector<DrawElementsIndirectCommand> commands; // LOD 0 of each mesh, used without culling
+		bool packed; // Textures come from textureArrays, layers from the per-draw data
+		DrawBatch() :packed(false) {}
+	};
+	std::shared_ptr<MeshBufferPool> bufferPool;
+	std::vector<DrawBatch> drawBatches;
+	std::vector<DrawBatch> arrayBatches; // Used in place of drawBatches while textures are packed
+	TextureArraySet textureArrays; // Filled by packTextureArrays
+	mutable std::vector<DrawElementsIndirectCommand> frameCommands; // Scratch for culled draws
+	// Textures are shared process-wide through TextureRegistry, the model holds one reference per path
+	std::vector<std::string> texturePaths; // Indexed by Texture::source
+	std::vector<TextureHandle> textureHandles; // Same indices, 0 where the file failed to load
+	std::map<std::string, uint32_t> textureSourceIds; // key = texture file path
+	// Asynchronous loading, see loadModelAsync
+	std::shared_ptr<ModelLoadState> loadState;
+	std::thread loadThread;
+	std::string loadFilePath;
+	std::vector<ModelLoadItem*> pendingTextures; // Requested from TextureStreamer, not done yet
+	std::vector<ModelLoadItem*> parkedMeshes; // Received but waiting for their textures
+	std::future<void> cacheWrite;
+	bool residencyPending; // settleLoad runs once cacheWrite has finished
+
+	/*
+	* Add a pooled mesh to the batch it matches, or a new one
+	*/
+	void addToBatch(std::vector<DrawBatch>& batches, size_t meshIndex, bool packed) const
+	{
+		const Mesh& mesh = this->meshes[meshIndex];
+		std::vector<DrawBatch>::iterator batch = batches.begin();
+		while (batches.end() != batch)
+		{
+			const Mesh& material = this->meshes[batch->meshIndices[0]];
+			if (batch->packed == packed && (packed ? material.getTextureArrays() == mesh.getTextureArrays()
+				: sameTextures(material.getTextures(), mesh.getTextures())))
+			{
+				break;
+			}
+			++batch;
+		}
+		if (batches.end() == batch)
+		{
+			batch = batches.insert(batches.end(), DrawBatch());
+			batch->packed = packed;
+		}
+		batch->meshIndices.push_back(meshIndex);
+		batch->commands.push_back(mesh.lodCommand(0));
+	}
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,248 @@
+#ifndef _MODEL_INSTANCE_H_
+#define _MODEL_INSTANCE_H_
+
+#include <GLEW/glew.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/type_ptr.hpp>
+#include <chrono>
+#include <future>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+#include "hashHelper.h"
+#include "model.h"
+#include "textureRegistry.h"
+
+/*
+* Process-wide table of loaded models. Every request for the same file and options
+* gets the same Model, so a scene with many copies imports, uploads and keeps one set
+* of buffers. Models are held weakly and destroyed with their last ModelInstance.
+* GL thread only.
+*/
+class ModelAssets
+{
+public:
+	static ModelAssets& instance()
+	{
+		static ModelAssets assets;
+		return assets;
+	}
+	/*
+	* Shared model for a file, loaded now unless a live one matches. A match still loading
+	* asynchronously is finished first. NULL if loading fails.
+	*/
+	std::shared_ptr<const Model> acquire(const std::string& filePath, const ModelOptions& options = ModelOptions())
+	{
+		const AssetKey key(filePath, assetKey(options));
+		std::shared_ptr<Model> model = this->find(key);
+		if (model)
+		{
+			// Only pumpUploads sets the future, waiting on it alone would never return
+			const std::shared_future<bool> loaded = this->entries[key].loaded;
+			while (loaded.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+			{
+				if (model->pumpUploads(FINISH_UPLOADS) == 0)
+				{
+					std::this_thread::yield();
+				}
+			}
+			if (loaded.get())
+			{
+				return model;
+			}
+			this->entries.erase(key); // Failed, load it again like find() would
+		}
+		model = std::make_shared<Model>();
+		if (!model->loadModel(filePath, options))
+		{
+			return std::shared_ptr<const Model>();
+		}
+		std::promise<bool> done;
+		done.set_value(true);
+		Entry& entry = this->entries[key];
+		entry.model = model;
+		entry.loaded = done.get_future().share();
+		return model;
+	}
+	/*
+	* Shared model that fills in through pumpUploads. loaded is set once it is complete,
+	* a caller that joins a load already in flight gets the same result.
+	*/
+	std::shared_ptr<const Model> acquireAsync(const std::string& filePath, const ModelOptions& options,
+		std::shared_future<bool>& loaded)
+	{
+		const AssetKey key(filePath, assetKey(options));
+		std::shared_ptr<Model> model = this->find(key);
+		if (model)
+		{
+			loaded = this->entries[key].loaded;
+			return model;
+		}
+		model = std::make_shared<Model>();
+		Entry& entry = this->entries[key];
+		entry.model = model;
+		entry.loaded = model->loadModelAsync(filePath, options).share();
+		loaded = entry.loaded;
+		return model;
+	}
+	/*
+	* Upload finished work of every asynchronous load, call once per frame
+	*/
+	size_t pumpUploads(size_t maxUploads = 8)
+	{
+		size_t added = 0;
+		for (std::map<AssetKey, Entry>::iterator it = this->entries.begin(); this->entries.end() != it;)
+		{
+			std::shared_ptr<Model> model = it->second.model.lock();
+			if (!model)
+			{
+				it = this->entries.erase(it);
+				continue;
+			}
+			added += model->pumpUploads(maxUploads);
+			++it;
+		}
+		return added;
+	}
+	size_t getModelCount() const
+	{
+		size_t count = 0;
+		for (std::map<AssetKey, Entry>::const_iterator it = this->entries.begin(); this->entries.end() != it; ++it)
+		{
+			if (!it->second.model.expired())
+			{
+				++count;
+			}
+		}
+		return count;
+	}
+private:
+	static const size_t FINISH_UPLOADS = 64; // Uploads per pump while acquire finishes a load
+	typedef std::pair<std::string, uint64_t> AssetKey; // File path and assetKey(options)
+	struct Entry
+	{
+		std::weak_ptr<Model> model;
+		std::shared_future<bool> loaded;
+	};
+	std::map<AssetKey, Entry> entries;
+
+	ModelAssets() {}
+	ModelAssets(const ModelAssets&) = delete;
+	ModelAssets& operator=(const ModelAssets&) = delete;
+	/*
+	* Options that change the GPU side as well as the processed meshes
+	*/
+	static uint64_t assetKey(const ModelOptions& options)
+	{
+		uint64_t key = HashHelper::combine(options.cacheKey(), options.compactVertices ? 1 : 0);
+		key = HashHelper::combine(key, options.sharedBuffers ? 1 : 0);
+		key = HashHelper::combine(key, options.virtualTextures ? 1 : 0);
+		key = HashHelper::combine(key, options.textureArrays ? 1 : 0);
+		return HashHelper::combine(key, (uint64_t)options.residency);
+	}
+	std::shared_ptr<Model> find(const AssetKey& key)
+	{
+		std::map<AssetKey, Entry>::iterator it = this->entries.find(key);
+		if (it == this->entries.end())
+		{
+			return std::shared_ptr<Model>();
+		}
+		std::shared_ptr<Model> model = it->second.model.lock();
+		const std::shared_future<bool>& loaded = it->second.loaded;
+		// A failed load is retried rather than shared
+		if (model && loaded.wait_for(std::chrono::seconds(0)) == std::future_status::ready && !loaded.get())
+		{
+			model.reset();
+		}
+		if (!model)
+		{
+			this->entries.erase(it);
+		}
+		return model;
+	}
+};
+
+/*
+* One placement of a shared model, only a transform and optional texture overrides.
+* Copies are cheap: they share the model and take their own texture references.
+*/
+class ModelInstance
+{
+public:
+	ModelInstance() {}
+	explicit ModelInstance(const std::shared_ptr<const Model>& asset, const glm::mat4& transform = glm::mat4())
+		:asset(asset), transform(transform) {}
+	void setTransform(const glm::mat4& transform) { this->transform = transform; }
+	const glm::mat4& getTransform() const { return this->transform; }
+	const std::shared_ptr<const Model>& getAsset() const { return this->asset; }
+	/*
+	* Bind a registry texture in place of the model's textures of a type, or only in
+	* place of original when one is given. The instance keeps its own reference.
+	*/
+	bool overrideTexture(aiTextureType type, TextureHandle texture,
+		TextureHandle original = INVALID_TEXTURE_HANDLE)
+	{
+		const GLuint id = TextureRegistry::instance().getId(texture);
+		if (id == 0)
+		{
+			std::cerr << "Error:ModelInstance::overrideTexture, texture handle " << texture
+				<< " is not resident." << std::endl;
+			return false;
+		}
+		TextureOverride textureOverride;
+		textureOverride.type = type;
+		textureOverride.original = original;
+		textureOverride.id = id;
+		this->overrides.push_back(textureOverride);
+		this->overrideReferences.push_back(TextureReference(texture));
+		return true;
+	}
+	void clearOverrides()
+	{
+		this->overrides.clear();
+		this->overrideReferences.clear();
+	}
+	void draw(const Shader& shader) const
+	{
+		if (!this->asset)
+		{
+			return;
+		}
+		this->setModelMatrix(shader);
+		this->asset->draw(shader, this->overrides.empty() ? NULL : &this->overrides);
+	}
+	/*
+	* Draw with meshlet culling and a level of detail per mesh, both set up for this transform.
+	* Also requests the texture levels this view needs, see TextureResidency.
+	*/
+	void draw(const Shader& shader, const glm::mat4& projection, const glm::mat4& view,
+		const glm::vec3& cameraPosition, float viewportHeight, bool cullBackfaces) const
+	{
+		if (!this->asset)
+		{
+			return;
+		}
+		this->setModelMatrix(shader);
+		MeshletCuller culler(projection, view, this->transform, cameraPosition, cullBackfaces);
+		LodSelector lodSelector(projection, viewportHeight, this->transform, cameraPosition);
+		this->asset->requestTextures(TextureDemand(projection, viewportHeight, this->transform, cameraPosition));
+		this->asset->draw(shader, culler, lodSelector, this->overrides.empty() ? NULL : &this->overrides);
+	}
+private:
+	std::shared_ptr<const Model> asset;
+	glm::mat4 transform;
+	std::vector<TextureOverride> overrides;
+	std::vector<TextureReference> overrideReferences; // Keep the override textures resident
+
+	void setModelMatrix(const Shader& shader) const
+	{
+		glUniformMatrix4fv(glGetUniformLocation(shader.programId, "model"),
+			1, GL_FALSE, glm::value_ptr(this->transform));
+	}
+};
+
+#endif
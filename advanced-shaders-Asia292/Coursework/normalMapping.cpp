@@ -6,13 +6,20 @@
 #include <GLM/gtc/matrix_transform.hpp>
 #include <GLM/gtc/type_ptr.hpp>
 
+#include <chrono>
+#include <future>
 #include <iostream>
+#include <memory>
 #include <vector>
 
 #include "shader.h"
 #include "camera.h"
 #include "texture.h"
 #include "model.h"
+#include "modelInstance.h"
+#include "textureStreamer.h"
+#include "virtualTextureSystem.h"
+#include "diagnostics.h"
 
 // Keyboard callback
 void key_callback(GLFWwindow* window, int key, int scancode, int action, int mods);
@@ -36,14 +43,27 @@ Camera camera(glm::vec3(0.0f, 1.8f, 4.0f));
 glm::vec3 lampPos(0.5f, 1.5f, 0.8f);
 bool bNormalMapping = true;
 bool bParallaxMapping = false;
-Model objModel;
+bool bBackfaceCulling = false;
+ModelInstance objModel;
 GLfloat heightScale = 0.1f;
 
 GLuint quadVAOId, quadVBOId;
 void setupQuadVAO();
+void uploadWhenReady(std::shared_ptr<PendingTexture>& pending, GLuint& textId);
 
 int main(int argc, char** argv)
 {
+	// Developer benchmarks run without opening a window
+	if (Diagnostics::run(argc, argv))
+	{
+		return 0;
+	}
+	// -optimized turns on the load and render features, without it the baseline path runs
+	bool optimized = false;
+	for (int i = 1; i < argc; ++i)
+	{
+		optimized = optimized || std::string(argv[i]) == "-optimized";
+	}
 
 	if (!glfwInit())	// Init GLFW
 	{
@@ -104,24 +124,58 @@ int main(int argc, char** argv)
 	}
 	std::string modelFilePath;
 	std::getline(modelPath, modelFilePath);
-	if (!objModel.loadModel(modelFilePath))
+	ModelOptions modelOptions;
+	if (optimized)
 	{
-		glfwTerminate();
-		std::system("pause");
-		return -1;
+		std::cout << "Info:main, optimized load and render path" << std::endl;
+		modelOptions.optimizeVertexCache = true;
+		modelOptions.weldVertices = true;
+		modelOptions.optimizeOverdraw = true;
+		modelOptions.compactVertices = true;
+		modelOptions.sharedBuffers = true;
+		modelOptions.buildMeshlets = true;
+		modelOptions.lodLevels = 4;
+		modelOptions.fastObjParser = true;
+		modelOptions.residency = MESH_RESIDENCY_DROP;
+		modelOptions.virtualTextures = true;
+		modelOptions.streamTextures = true;
+		modelOptions.compressTextures = true;
 	}
+	// Meshes appear as they finish loading while the scene keeps rendering
+	// The model is shared through ModelAssets, more instances of it would cost no further upload
+	std::shared_future<bool> modelLoaded;
+	objModel = ModelInstance(ModelAssets::instance().acquireAsync(modelFilePath, modelOptions, modelLoaded));
 
 	setupQuadVAO();
 
-	// Load textures
-	GLuint diffuseMap = TextureHelper::load2DTexture("assets/textures/bricks2.jpg");
-	GLuint normalMap = TextureHelper::load2DTexture("assets/textures/bricks2_normal.jpg");
-	GLuint heightMap = TextureHelper::load2DTexture("assets/textures/bricks2_disp.jpg");
+	TextureStreamer& textureStreamer = TextureStreamer::instance();
+	std::shared_ptr<PendingTexture> pendingDiffuse, pendingNormal, pendingHeight;
+	GLuint diffuseMap = 0, normalMap = 0, heightMap = 0;
+	if (optimized)
+	{
+		// Decode textures off-thread, they are streamed in once ready and their finer levels
+		// follow as the camera nears the wall
+		TextureParams diffuseParams(MIP_MODE_SRGB, BlockCompressor::preferredColorFormat(false));
+		TextureParams normalParams = TextureParams::normalMap();
+		TextureParams heightParams(MIP_MODE_LINEAR);
+		diffuseParams.streamed = normalParams.streamed = heightParams.streamed = true;
+		pendingDiffuse = textureStreamer.request("assets/textures/bricks2.jpg", diffuseParams);
+		pendingNormal = textureStreamer.request("assets/textures/bricks2_normal.jpg", normalParams);
+		pendingHeight = textureStreamer.request("assets/textures/bricks2_disp.jpg", heightParams);
+	}
+	else
+	{
+		diffuseMap = TextureHelper::load2DTexture("assets/textures/bricks2.jpg");
+		normalMap = TextureHelper::load2DTexture("assets/textures/bricks2_normal.jpg");
+		heightMap = TextureHelper::load2DTexture("assets/textures/bricks2_disp.jpg");
+	}
 
 
 	// Build and compile shaders
 	Shader shader("assets/shaders/scene.vertex", "assets/shaders/scene.frag");
 	Shader parallaxShader("assets/shaders/parallax.vertex", "assets/shaders/parallax.frag");
+	Shader feedbackShader("assets/shaders/scene.vertex", "assets/shaders/feedback.frag");
+	VirtualTextureSystem& virtualTextures = VirtualTextureSystem::instance();
 
 	glEnable(GL_DEPTH_TEST);
 	// While window is open
@@ -132,6 +186,20 @@ int main(int argc, char** argv)
 		lastFrame = currentFrame;
 		glfwPollEvents(); // Handle events
 		do_movement(); // Update camera properties according to user operation
+		ModelAssets::instance().pumpUploads();
+		textureStreamer.pump();
+		uploadWhenReady(pendingDiffuse, diffuseMap);
+		uploadWhenReady(pendingNormal, normalMap);
+		uploadWhenReady(pendingHeight, heightMap);
+		if (modelLoaded.valid()
+			&& modelLoaded.wait_for(std::chrono::seconds(0)) == std::future_status::ready)
+		{
+			if (!modelLoaded.get())
+			{
+				std::cerr << "Error:main, could not load model: " << modelFilePath << std::endl;
+			}
+			modelLoaded = std::shared_future<bool>();
+		}
 
 		// Clear colour buffer and reset to specified color
 		glClearColor(0.18f, 0.04f, 0.14f, 1.0f);
@@ -141,7 +209,25 @@ int main(int argc, char** argv)
 			(GLfloat)(WINDOW_WIDTH) / WINDOW_HEIGHT, 1.0f, 100.0f); // ͶӰ
 		glm::mat4 view = camera.getViewMatrix(); // ӱ任
 
-		
+		///// VIRTUAL TEXTURE FEEDBACK /////
+		// Record which pages of the virtual textures the view samples, at a fraction of the resolution
+		if (modelOptions.virtualTextures)
+		{
+			virtualTextures.beginFeedback();
+			feedbackShader.use();
+			glUniformMatrix4fv(glGetUniformLocation(feedbackShader.programId, "projection"),
+				1, GL_FALSE, glm::value_ptr(projection));
+			glUniformMatrix4fv(glGetUniformLocation(feedbackShader.programId, "view"),
+				1, GL_FALSE, glm::value_ptr(view));
+			if (bBackfaceCulling)
+			{
+				glEnable(GL_CULL_FACE);
+			}
+			objModel.draw(feedbackShader, projection, view, camera.position, (float)WINDOW_HEIGHT, bBackfaceCulling);
+			glDisable(GL_CULL_FACE);
+			virtualTextures.endFeedback();
+		}
+
 		///// CAT MODEL /////
 		shader.use();
 		// Light source properties
@@ -164,13 +250,16 @@ int main(int argc, char** argv)
 			1, GL_FALSE, glm::value_ptr(projection));
 		glUniformMatrix4fv(glGetUniformLocation(shader.programId, "view"),
 			1, GL_FALSE, glm::value_ptr(view));
-		glm::mat4 model;
-		glUniformMatrix4fv(glGetUniformLocation(shader.programId, "model"),
-			1, GL_FALSE, glm::value_ptr(model));
 		glUniform1i(glGetUniformLocation(shader.programId, "normalMapping"), bNormalMapping);
 		
-		// Draw the model
-		objModel.draw(shader);
+		// Draw the model, meshlets outside the view or facing away are skipped
+		// and distant meshes use a coarser level of detail
+		if (bBackfaceCulling)
+		{
+			glEnable(GL_CULL_FACE);
+		}
+		objModel.draw(shader, projection, view, camera.position, (float)WINDOW_HEIGHT, bBackfaceCulling);
+		glDisable(GL_CULL_FACE);
 
 		///// BRICK WALL /////
 		parallaxShader.use();
@@ -199,6 +288,21 @@ int main(int argc, char** argv)
 			1, GL_FALSE, glm::value_ptr(model2));
 		glUniform1f(glGetUniformLocation(parallaxShader.programId, "heightScale"), heightScale);
 		glUniform1i(glGetUniformLocation(parallaxShader.programId, "bParallaxMapping"), bParallaxMapping);
+		TextureResidency& textureResidency = TextureResidency::instance();
+		if (optimized)
+		{
+			// The wall is a 2x2 quad at z = -2 spanning the whole texture
+			const float wallUvPerPixel = TextureDemand(projection, (float)WINDOW_HEIGHT, model2, camera.position)
+				.uvPerPixel(glm::vec3(-1.0f, -1.0f, -2.0f), glm::vec3(1.0f, 1.0f, -2.0f), 0.5f);
+			const std::shared_ptr<PendingTexture>* wallTextures[] = { &pendingDiffuse, &pendingNormal, &pendingHeight };
+			for (size_t i = 0; i < 3; ++i)
+			{
+				if (*wallTextures[i]) // Reset once it failed
+				{
+					textureResidency.request((*wallTextures[i])->getHandle(), wallUvPerPixel);
+				}
+			}
+		}
 		// Draw the wall
 		glBindVertexArray(quadVAOId);
 		glActiveTexture(GL_TEXTURE0);
@@ -214,11 +318,20 @@ int main(int argc, char** argv)
 		
 		glBindVertexArray(0);
 		glUseProgram(0);
+		textureResidency.update(); // Upload the levels this frame's draws asked for
+		virtualTextures.update(); // And the virtual texture pages earlier feedback asked for
 		glfwSwapBuffers(window); // Swap the buffers
 	}
 	// Close window
 	glDeleteVertexArrays(1, &quadVAOId);
 	glDeleteBuffers(1, &quadVBOId);
+	objModel = ModelInstance(); // The shared model and its textures go while the context exists
+	pendingDiffuse.reset();
+	pendingNormal.reset();
+	pendingHeight.reset();
+	TextureResidency::instance().clear();
+	virtualTextures.shutdown();
+	textureStreamer.shutdown();
 	glfwTerminate();
 	return 0;
 }
@@ -240,6 +353,11 @@ void key_callback(GLFWwindow* window, int key, int scancode, int action, int mod
 		bNormalMapping = !bNormalMapping;
 		std::cout << "using normal mapping " << (bNormalMapping ? "true" : "false") << std::endl;
 	}
+	if (key == GLFW_KEY_B && action == GLFW_PRESS)
+	{
+		bBackfaceCulling = !bBackfaceCulling;
+		std::cout << "using backface culling " << (bBackfaceCulling ? "true" : "false") << std::endl;
+	}
 	if (key == GLFW_KEY_P && action == GLFW_PRESS)
 	{
 		bParallaxMapping = !bParallaxMapping;
@@ -292,6 +410,28 @@ void do_movement()
 		camera.handleKeyPress(RIGHT, deltaTime);
 }
 
+/*
+* Use a streamed texture once its upload has finished, the request keeps it alive.
+* A failed request falls back to the baseline loader.
+*/
+void uploadWhenReady(std::shared_ptr<PendingTexture>& pending, GLuint& textId)
+{
+	if (textId != 0 || !pending)
+	{
+		return;
+	}
+	if (pending->isReady())
+	{
+		textId = pending->getId();
+	}
+	else if (pending->isFailed())
+	{
+		std::cerr << "Error:main, could not stream texture: " << pending->getPath() << std::endl;
+		textId = TextureHelper::load2DTexture(pending->getPath().c_str());
+		pending.reset();
+	}
+}
+
 void setupQuadVAO()
 {
 	// Vertex position
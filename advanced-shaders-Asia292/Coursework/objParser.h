@@ -0,0 +1,835 @@
+#ifndef _OBJ_PARSER_H_
+#define _OBJ_PARSER_H_
+
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "arena.h"
+#include "hashHelper.h"
+#include "mappedFile.h"
+#include "mesh.h"
+#include "meshTangents.h"
+#include "parallel.h"
+
+#if defined(_M_X64) || defined(__SSE2__) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define OBJ_PARSER_SSE2 1
+#include <emmintrin.h>
+#endif
+// Digits are read eight at a time from a 64-bit word, which needs the first byte in its low bits
+#if defined(_M_IX86) || defined(_M_X64) || defined(__i386__) || defined(__x86_64__) \
+	|| (defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+#define OBJ_PARSER_SWAR 1
+#endif
+
+// Bytes of OBJ text per parallel parse task, chunks are extended to the end of their last line
+const size_t OBJ_PARSER_CHUNK_SIZE = 1 << 20;
+
+/*
+* Memory-mapped, multithreaded Wavefront OBJ/MTL reader, the fast path beside Assimp.
+* Output matches what Assimp with MODEL_IMPORT_FLAGS followed by Model::processMesh
+* produces: triangles, flipped UVs, smooth normals where the file has none, tangents,
+* and diffuse/specular/height texture paths.
+*/
+class ObjParser
+{
+public:
+	static bool isObjFile(const std::string& filePath)
+	{
+		const size_t dot = filePath.find_last_of('.');
+		if (dot == std::string::npos)
+		{
+			return false;
+		}
+		std::string extension = filePath.substr(dot + 1);
+		std::transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
+		return extension == "obj";
+	}
+	/*
+	* Material library names an OBJ file references, relative to its folder
+	*/
+	static void materialLibraries(const char* data, size_t size, std::vector<std::string>& libraries)
+	{
+		libraries.clear();
+		const char* end = data + size;
+		for (const char* p = data; p < end;)
+		{
+			const char* lineEnd = findNewline(p, end);
+			const char* next = lineEnd < end ? lineEnd + 1 : end;
+			if (lineEnd > p && lineEnd[-1] == '\r')
+			{
+				--lineEnd;
+			}
+			p = skipSpaces(p, lineEnd);
+			if (hasKeyword(p, lineEnd, "mtllib"))
+			{
+				libraries.push_back(restOfLine(p + 6, lineEnd));
+			}
+			p = next;
+		}
+	}
+	/*
+	* One mesh per material in order of first use. Returns false for anything the parser
+	* does not handle, the caller should then import with Assimp.
+	*/
+	static bool parse(const std::string& filePath, std::vector<MeshData>& meshes)
+	{
+		meshes.clear();
+		MappedFile file;
+		if (!file.open(filePath))
+		{
+			return false;
+		}
+		const char* data = (const char*)file.data();
+		const size_t size = file.size();
+
+		// Split at line starts and parse the chunks independently
+		std::vector<size_t> bounds(1, 0);
+		while (bounds.back() < size)
+		{
+			size_t end = bounds.back() + OBJ_PARSER_CHUNK_SIZE;
+			if (end < size)
+			{
+				end = findNewline(data + end, data + size) - data;
+				end = std::min(end + 1, size);
+			}
+			bounds.push_back(std::min(end, size));
+		}
+		std::vector<Chunk> chunks(bounds.size() - 1);
+		ParallelHelper::parallelFor(chunks.size(), [&](size_t i)
+		{
+			parseChunk(data + bounds[i], data + bounds[i + 1], chunks[i]);
+		});
+
+		// Stitch: attribute arrays are concatenated, index bases come from the chunks before
+		size_t positionCount = 0, texCoordCount = 0, normalCount = 0;
+		for (size_t i = 0; i < chunks.size(); ++i)
+		{
+			if (!chunks[i].valid)
+			{
+				return false;
+			}
+			chunks[i].positionBase = positionCount;
+			chunks[i].texCoordBase = texCoordCount;
+			chunks[i].normalBase = normalCount;
+			positionCount += chunks[i].positions.size();
+			texCoordCount += chunks[i].texCoords.size();
+			normalCount += chunks[i].normals.size();
+		}
+		// Load-time temporaries come from arenas freed together when parse returns
+		MonotonicArena attributeArena(OBJ_PARSER_CHUNK_SIZE);
+		Attributes attributes(attributeArena);
+		attributes.positions.reserve(positionCount);
+		attributes.texCoords.reserve(texCoordCount);
+		attributes.normals.reserve(normalCount);
+		for (size_t i = 0; i < chunks.size(); ++i)
+		{
+			attributes.positions.insert(attributes.positions.end(), chunks[i].positions.begin(), chunks[i].positions.end());
+			attributes.texCoords.insert(attributes.texCoords.end(), chunks[i].texCoords.begin(), chunks[i].texCoords.end());
+			attributes.normals.insert(attributes.normals.end(), chunks[i].normals.begin(), chunks[i].normals.end());
+			chunks[i].releaseAttributes();
+		}
+
+		// Triangle ranges per material, a chunk without usemtl continues the previous material
+		std::vector<std::string> materialNames;
+		std::vector<std::vector<TriangleRange> > materialRanges;
+		std::map<std::string, size_t> materialIds;
+		std::string current;
+		for (size_t i = 0; i < chunks.size(); ++i)
+		{
+			const Chunk& chunk = chunks[i];
+			const size_t triangleCount = chunk.corners.size() / 3;
+			size_t first = 0;
+			for (size_t run = 0; run <= chunk.materialRuns.size(); ++run)
+			{
+				const size_t end = run < chunk.materialRuns.size() ? chunk.materialRuns[run].firstTriangle : triangleCount;
+				if (end > first)
+				{
+					std::map<std::string, size_t>::iterator it = materialIds.find(current);
+					if (it == materialIds.end())
+					{
+						it = materialIds.insert(std::make_pair(current, materialNames.size())).first;
+						materialNames.push_back(current);
+						materialRanges.push_back(std::vector<TriangleRange>());
+					}
+					TriangleRange range = { i, first, end };
+					materialRanges[it->second].push_back(range);
+				}
+				if (run < chunk.materialRuns.size())
+				{
+					current = chunk.materialRuns[run].name;
+					first = end;
+				}
+			}
+		}
+
+		// Material libraries are small, read them serially
+		const size_t slash = filePath.find_last_of('/');
+		const std::string modelDir = slash == std::string::npos ? "." : filePath.substr(0, slash);
+		std::map<std::string, Material> materials;
+		for (size_t i = 0; i < chunks.size(); ++i)
+		{
+			for (size_t lib = 0; lib < chunks[i].materialLibs.size(); ++lib)
+			{
+				if (!parseMaterialLibrary(modelDir + "/" + chunks[i].materialLibs[lib], materials))
+				{
+					std::cerr << "Warning:ObjParser::parse, could not read material library: "
+						<< chunks[i].materialLibs[lib] << std::endl;
+				}
+			}
+		}
+
+		meshes.resize(materialNames.size());
+		std::vector<char> built(meshes.size(), 0);
+		ParallelHelper::parallelFor(meshes.size(), [&](size_t m)
+		{
+			built[m] = buildMesh(chunks, attributes, materialRanges[m], meshes[m]) ? 1 : 0;
+			std::map<std::string, Material>::const_iterator it = materials.find(materialNames[m]);
+			if (it == materials.end())
+			{
+				return;
+			}
+			// Same order as processMesh: diffuse, specular, height
+			const aiTextureType types[3] = { aiTextureType_DIFFUSE, aiTextureType_SPECULAR, aiTextureType_HEIGHT };
+			for (int k = 0; k < 3; ++k)
+			{
+				if (!it->second.textures[k].empty())
+				{
+					TextureSource text;
+					text.type = types[k];
+					text.path = modelDir + "/" + it->second.textures[k];
+					meshes[m].textures.push_back(text);
+				}
+			}
+		});
+		for (size_t m = 0; m < meshes.size(); ++m)
+		{
+			if (!built[m])
+			{
+				meshes.clear();
+				return false;
+			}
+			meshes[m].valid = true;
+		}
+		return !meshes.empty();
+	}
+private:
+	// Relative (negative) indices are stored with this bias until the chunk's base is known
+	static const int64_t RELATIVE_BIAS = (int64_t)1 << 48;
+
+	struct Corner
+	{
+		int64_t position, texCoord, normal; // 0-based, -1 when missing
+	};
+	struct MaterialRun
+	{
+		size_t firstTriangle;
+		std::string name;
+	};
+	// Parse output of one chunk. Attributes and faces use separate arenas so the
+	// attributes can be dropped as soon as they are stitched.
+	struct Chunk
+	{
+		MonotonicArena arena; // Faces
+		MonotonicArena attributeArena;
+		ArenaVector<glm::vec3> positions;
+		ArenaVector<glm::vec2> texCoords;
+		ArenaVector<glm::vec3> normals;
+		ArenaVector<Corner> corners; // Three per triangle
+		std::vector<MaterialRun> materialRuns; // Triangles before the first run keep the previous material
+		std::vector<std::string> materialLibs;
+		size_t positionBase, texCoordBase, normalBase;
+		bool valid;
+		Chunk() :arena(OBJ_PARSER_CHUNK_SIZE), attributeArena(OBJ_PARSER_CHUNK_SIZE),
+			positions(ArenaAllocator<glm::vec3>(attributeArena)), texCoords(ArenaAllocator<glm::vec2>(attributeArena)),
+			normals(ArenaAllocator<glm::vec3>(attributeArena)), corners(ArenaAllocator<Corner>(arena)),
+			positionBase(0), texCoordBase(0), normalBase(0), valid(true) {}
+		void releaseAttributes()
+		{
+			ArenaVector<glm::vec3>(this->positions.get_allocator()).swap(this->positions);
+			ArenaVector<glm::vec2>(this->texCoords.get_allocator()).swap(this->texCoords);
+			ArenaVector<glm::vec3>(this->normals.get_allocator()).swap(this->normals);
+			this->attributeArena.release();
+		}
+	};
+	struct Attributes
+	{
+		ArenaVector<glm::vec3> positions;
+		ArenaVector<glm::vec2> texCoords;
+		ArenaVector<glm::vec3> normals;
+		explicit Attributes(MonotonicArena& arena) :positions(ArenaAllocator<glm::vec3>(arena)),
+			texCoords(ArenaAllocator<glm::vec2>(arena)), normals(ArenaAllocator<glm::vec3>(arena)) {}
+	};
+	struct TriangleRange
+	{
+		size_t chunk, first, end;
+	};
+	struct Material
+	{
+		std::string textures[3]; // Diffuse, specular, height
+	};
+	struct CornerKey
+	{
+		int64_t position, texCoord, normal;
+		bool operator==(const CornerKey& other) const
+		{
+			return this->position == other.position && this->texCoord == other.texCoord && this->normal == other.normal;
+		}
+	};
+	struct CornerKeyHash
+	{
+		size_t operator()(const CornerKey& key) const
+		{
+			return (size_t)HashHelper::combine(HashHelper::combine((uint64_t)key.position, (uint64_t)key.texCoord),
+				(uint64_t)key.normal);
+		}
+	};
+
+	/*
+	* First '\n' in [p, end), or end
+	*/
+	static const char* findNewline(const char* p, const char* end)
+	{
+#ifdef OBJ_PARSER_SSE2
+		const __m128i newline = _mm_set1_epi8('\n');
+		for (; p + 16 <= end; p += 16)
+		{
+			const int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)p), newline));
+			if (mask != 0)
+			{
+				return p + countTrailingZeros(mask);
+			}
+		}
+#endif
+		for (; p < end; ++p)
+		{
+			if (*p == '\n')
+			{
+				return p;
+			}
+		}
+		return end;
+	}
+	static int countTrailingZeros(int mask)
+	{
+		int count = 0;
+		while (!(mask & 1))
+		{
+			mask >>= 1;
+			++count;
+		}
+		return count;
+	}
+	static const char* skipSpaces(const char* p, const char* end)
+	{
+		while (p < end && (*p == ' ' || *p == '\t'))
+		{
+			++p;
+		}
+		return p;
+	}
+	static bool isDigit(char c)
+	{
+		return c >= '0' && c <= '9';
+	}
+	/*
+	* Append the digits at p to mantissa until it reaches 10^17, later digits are only
+	* counted in dropped. Returns the end of the digits.
+	*/
+	static const char* appendDigits(const char* p, const char* end, uint64_t& mantissa, int& accepted, int& dropped)
+	{
+		accepted = 0;
+		dropped = 0;
+#ifdef OBJ_PARSER_SWAR
+		static const uint64_t powers[] = { 1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000 };
+		// Below 10^9 eight more digits cannot pass the limit, so none are dropped
+		while (end - p >= 8 && mantissa < 1000000000ULL)
+		{
+			uint64_t word;
+			memcpy(&word, p, 8);
+			const int count = leadingDigits(word);
+			if (count == 0)
+			{
+				return p;
+			}
+			mantissa = mantissa * powers[count] + swarDigits(word, count);
+			accepted += count;
+			p += count;
+			if (count < 8)
+			{
+				return p;
+			}
+		}
+#endif
+		for (; p < end && isDigit(*p); ++p)
+		{
+			if (mantissa < 100000000000000000ULL)
+			{
+				mantissa = mantissa * 10 + (uint64_t)(*p - '0');
+				++accepted;
+			}
+			else
+			{
+				++dropped;
+			}
+		}
+		return p;
+	}
+#ifdef OBJ_PARSER_SWAR
+	/*
+	* Number of bytes of word, from the first, that are ASCII digits
+	*/
+	static int leadingDigits(uint64_t word)
+	{
+		// A byte is a digit when x = byte ^ '0' is below 10, adding 0x76 to its low 7 bits
+		// sets the top bit otherwise and cannot carry into the next byte
+		const uint64_t x = word ^ 0x3030303030303030ULL;
+		const uint64_t nonDigits = (((x & 0x7F7F7F7F7F7F7F7FULL) + 0x7676767676767676ULL) | x) & 0x8080808080808080ULL;
+		if (nonDigits == 0)
+		{
+			return 8;
+		}
+		int count = 0;
+		for (uint64_t mask = 0x80; !(nonDigits & mask); mask <<= 8)
+		{
+			++count;
+		}
+		return count;
+	}
+	/*
+	* Value of the first count (1 to 8) digits of word, combined pairwise in three multiplies
+	*/
+	static uint64_t swarDigits(uint64_t word, int count)
+	{
+		// Shift the digits to the top, the zero bytes left below act as leading zeros
+		word = (word & 0x0F0F0F0F0F0F0F0FULL) << (8 * (8 - count));
+		word = (word * 10 + (word >> 8)) & 0x00FF00FF00FF00FFULL;
+		word = (word * 100 + (word >> 16)) & 0x0000FFFF0000FFFFULL;
+		return (word * 10000 + (word >> 32)) & 0xFFFFFFFFULL;
+	}
+#endif
+	/*
+	* Decimal float with optional sign, fraction and exponent, NULL if there is no number
+	*/
+	static const char* parseFloat(const char* p, const char* end, float& value)
+	{
+		static const double powers[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10,
+			1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+		p = skipSpaces(p, end);
+		bool negative = false;
+		if (p < end && (*p == '-' || *p == '+'))
+		{
+			negative = *p == '-';
+			++p;
+		}
+		uint64_t mantissa = 0;
+		int accepted = 0, dropped = 0;
+		p = appendDigits(p, end, mantissa, accepted, dropped);
+		int exponent = dropped, digits = accepted + dropped;
+		if (p < end && *p == '.')
+		{
+			p = appendDigits(p + 1, end, mantissa, accepted, dropped);
+			exponent -= accepted;
+			digits += accepted + dropped;
+		}
+		if (digits == 0)
+		{
+			return NULL;
+		}
+		if (p < end && (*p == 'e' || *p == 'E'))
+		{
+			const char* q = p + 1;
+			bool negativeExponent = false;
+			if (q < end && (*q == '-' || *q == '+'))
+			{
+				negativeExponent = *q == '-';
+				++q;
+			}
+			if (q < end && isDigit(*q))
+			{
+				int e = 0;
+				for (; q < end && isDigit(*q); ++q)
+				{
+					e = std::min(e * 10 + (*q - '0'), 1000);
+				}
+				exponent += negativeExponent ? -e : e;
+				p = q;
+			}
+		}
+		double result = (double)mantissa;
+		if (exponent < 0)
+		{
+			result = -exponent <= 22 ? result / powers[-exponent] : result * std::pow(10.0, exponent);
+		}
+		else if (exponent > 0)
+		{
+			result = exponent <= 22 ? result * powers[exponent] : result * std::pow(10.0, exponent);
+		}
+		value = (float)(negative ? -result : result);
+		return p;
+	}
+	static const char* parseInt(const char* p, const char* end, int64_t& value)
+	{
+		bool negative = false;
+		if (p < end && (*p == '-' || *p == '+'))
+		{
+			negative = *p == '-';
+			++p;
+		}
+		if (p >= end || !isDigit(*p))
+		{
+			return NULL;
+		}
+		uint64_t result = 0;
+		int accepted = 0, dropped = 0;
+		p = appendDigits(p, end, result, accepted, dropped);
+		value = negative ? -(int64_t)result : (int64_t)result;
+		return p;
+	}
+	/*
+	* 1-based or negative relative OBJ index to a 0-based index (biased while relative)
+	*/
+	static bool resolveIndex(int64_t index, size_t localCount, int64_t& resolved)
+	{
+		if (index > 0)
+		{
+			resolved = index - 1;
+		}
+		else if (index < 0)
+		{
+			resolved = RELATIVE_BIAS + (int64_t)localCount + index;
+		}
+		else
+		{
+			return false;
+		}
+		return true;
+	}
+	/*
+	* Line text after the keyword with surrounding whitespace removed
+	*/
+	static std::string restOfLine(const char* p, const char* end)
+	{
+		p = skipSpaces(p, end);
+		while (end > p && (end[-1] == ' ' || end[-1] == '\t'))
+		{
+			--end;
+		}
+		return std::string(p, end);
+	}
+	static bool hasKeyword(const char* p, const char* end, const char* keyword)
+	{
+		const size_t length = strlen(keyword);
+		return (size_t)(end - p) > length && memcmp(p, keyword, length) == 0
+			&& (p[length] == ' ' || p[length] == '\t');
+	}
+	static void parseChunk(const char* p, const char* end, Chunk& chunk)
+	{
+		ArenaVector<Corner> polygon((ArenaAllocator<Corner>(chunk.arena)));
+		polygon.reserve(16);
+		while (p < end)
+		{
+			const char* lineEnd = findNewline(p, end);
+			const char* next = lineEnd + 1;
+			if (lineEnd > p && lineEnd[-1] == '\r')
+			{
+				--lineEnd;
+			}
+			p = skipSpaces(p, lineEnd);
+			if (lineEnd - p >= 2 && p[0] == 'v')
+			{
+				if (p[1] == ' ' || p[1] == '\t')
+				{
+					glm::vec3 position;
+					const char* q = p + 1;
+					for (int k = 0; k < 3 && q; ++k)
+					{
+						q = parseFloat(q, lineEnd, position[k]);
+					}
+					chunk.valid = chunk.valid && q != NULL;
+					chunk.positions.push_back(position);
+				}
+				else if (p[1] == 't')
+				{
+					glm::vec2 texCoords(0.0f);
+					const char* q = parseFloat(p + 2, lineEnd, texCoords.x);
+					if (q && !parseFloat(q, lineEnd, texCoords.y))
+					{
+						texCoords.y = 0.0f;
+					}
+					chunk.valid = chunk.valid && q != NULL;
+					texCoords.y = 1.0f - texCoords.y; // aiProcess_FlipUVs
+					chunk.texCoords.push_back(texCoords);
+				}
+				else if (p[1] == 'n')
+				{
+					glm::vec3 normal;
+					const char* q = p + 2;
+					for (int k = 0; k < 3 && q; ++k)
+					{
+						q = parseFloat(q, lineEnd, normal[k]);
+					}
+					chunk.valid = chunk.valid && q != NULL;
+					chunk.normals.push_back(normal);
+				}
+			}
+			else if (lineEnd - p >= 2 && p[0] == 'f' && (p[1] == ' ' || p[1] == '\t'))
+			{
+				// Corners are v, v/vt, v//vn or v/vt/vn
+				polygon.clear();
+				const char* q = skipSpaces(p + 1, lineEnd);
+				while (q < lineEnd)
+				{
+					Corner corner = { -1, -1, -1 };
+					int64_t index = 0;
+					q = parseInt(q, lineEnd, index);
+					if (!q || !resolveIndex(index, chunk.positions.size(), corner.position))
+					{
+						chunk.valid = false;
+						break;
+					}
+					if (q < lineEnd && *q == '/')
+					{
+						++q;
+						if (q < lineEnd && *q != '/')
+						{
+							q = parseInt(q, lineEnd, index);
+							if (!q || !resolveIndex(index, chunk.texCoords.size(), corner.texCoord))
+							{
+								chunk.valid = false;
+								break;
+							}
+						}
+						if (q < lineEnd && *q == '/')
+						{
+							q = parseInt(q + 1, lineEnd, index);
+							if (!q || !resolveIndex(index, chunk.normals.size(), corner.normal))
+							{
+								chunk.valid = false;
+								break;
+							}
+						}
+					}
+					polygon.push_back(corner);
+					q = skipSpaces(q, lineEnd);
+				}
+				if (polygon.size() < 3)
+				{
+					chunk.valid = false;
+				}
+				// aiProcess_Triangulate, as a fan
+				for (size_t k = 2; k < polygon.size(); ++k)
+				{
+					chunk.corners.push_back(polygon[0]);
+					chunk.corners.push_back(polygon[k - 1]);
+					chunk.corners.push_back(polygon[k]);
+				}
+			}
+			else if (hasKeyword(p, lineEnd, "usemtl"))
+			{
+				MaterialRun run;
+				run.firstTriangle = chunk.corners.size() / 3;
+				run.name = restOfLine(p + 6, lineEnd);
+				chunk.materialRuns.push_back(run);
+			}
+			else if (hasKeyword(p, lineEnd, "mtllib"))
+			{
+				chunk.materialLibs.push_back(restOfLine(p + 6, lineEnd));
+			}
+			// Comments, groups, smoothing groups, lines and points are ignored
+			p = next;
+		}
+	}
+	static bool resolveCorner(const Corner& corner, const Chunk& chunk, const Attributes& attributes, CornerKey& key)
+	{
+		key.position = corner.position >= RELATIVE_BIAS / 2
+			? corner.position - RELATIVE_BIAS + (int64_t)chunk.positionBase : corner.position;
+		key.texCoord = corner.texCoord >= RELATIVE_BIAS / 2
+			? corner.texCoord - RELATIVE_BIAS + (int64_t)chunk.texCoordBase : corner.texCoord;
+		key.normal = corner.normal >= RELATIVE_BIAS / 2
+			? corner.normal - RELATIVE_BIAS + (int64_t)chunk.normalBase : corner.normal;
+		return key.position >= 0 && key.position < (int64_t)attributes.positions.size()
+			&& key.texCoord >= -1 && key.texCoord < (int64_t)attributes.texCoords.size()
+			&& key.normal >= -1 && key.normal < (int64_t)attributes.normals.size();
+	}
+	/*
+	* Unique position/texcoord/normal combinations become vertices
+	*/
+	static bool buildMesh(const std::vector<Chunk>& chunks, const Attributes& attributes,
+		const std::vector<TriangleRange>& ranges, MeshData& meshData)
+	{
+		size_t triangleCount = 0;
+		for (size_t r = 0; r < ranges.size(); ++r)
+		{
+			triangleCount += ranges[r].end - ranges[r].first;
+		}
+		std::vector<Vertex>& vertices = meshData.vertices;
+		std::vector<GLuint>& indices = meshData.indices;
+		indices.reserve(triangleCount * 3);
+		// Dedup tables are dropped in one shot with the arena
+		MonotonicArena arena(OBJ_PARSER_CHUNK_SIZE);
+		typedef std::pair<const CornerKey, GLuint> VertexIdEntry;
+		typedef std::pair<const int64_t, GLuint> PositionIdEntry;
+		typedef std::unordered_map<CornerKey, GLuint, CornerKeyHash, std::equal_to<CornerKey>,
+			ArenaAllocator<VertexIdEntry> > VertexIdMap;
+		VertexIdMap vertexIds(triangleCount * 2, CornerKeyHash(), std::equal_to<CornerKey>(),
+			ArenaAllocator<VertexIdEntry>(arena));
+		std::unordered_map<int64_t, GLuint, std::hash<int64_t>, std::equal_to<int64_t>, ArenaAllocator<PositionIdEntry> >
+			positionIdMap(triangleCount, std::hash<int64_t>(), std::equal_to<int64_t>(), ArenaAllocator<PositionIdEntry>(arena));
+		ArenaVector<GLuint> positionIds((ArenaAllocator<GLuint>(arena)));
+		positionIds.reserve(triangleCount);
+		bool hasTexCoords = false, missingNormals = false;
+		for (size_t r = 0; r < ranges.size(); ++r)
+		{
+			const Chunk& chunk = chunks[ranges[r].chunk];
+			for (size_t c = ranges[r].first * 3; c < ranges[r].end * 3; ++c)
+			{
+				CornerKey key;
+				if (!resolveCorner(chunk.corners[c], chunk, attributes, key))
+				{
+					std::cerr << "Error:ObjParser::parse, face index out of range." << std::endl;
+					return false;
+				}
+				VertexIdMap::const_iterator it = vertexIds.find(key);
+				if (it != vertexIds.end())
+				{
+					indices.push_back(it->second);
+					continue;
+				}
+				const GLuint id = (GLuint)vertices.size();
+				vertexIds.insert(std::make_pair(key, id));
+				indices.push_back(id);
+				Vertex vertex;
+				vertex.position = attributes.positions[(size_t)key.position];
+				vertex.texCoords = key.texCoord >= 0 ? attributes.texCoords[(size_t)key.texCoord] : glm::vec2(0.0f);
+				vertex.normal = key.normal >= 0 ? attributes.normals[(size_t)key.normal] : glm::vec3(0.0f);
+				vertex.tangent = glm::vec4(0.0f);
+				vertices.push_back(vertex);
+				hasTexCoords = hasTexCoords || key.texCoord >= 0;
+				missingNormals = missingNormals || key.normal < 0;
+				positionIds.push_back(positionIdMap.insert(
+					std::make_pair(key.position, (GLuint)positionIdMap.size())).first->second);
+			}
+		}
+		// Same generation as the Assimp path in Model::processMesh
+		if (missingNormals)
+		{
+			TangentGenerator::generateNormals(vertices, indices, positionIds.data(), arena);
+		}
+		if (hasTexCoords)
+		{
+			TangentGenerator::generateTangents(vertices, indices, arena);
+		}
+		return true;
+	}
+	/*
+	* Texture maps per material, texture options such as -bm 1 are skipped
+	*/
+	static bool parseMaterialLibrary(const std::string& path, std::map<std::string, Material>& materials)
+	{
+		MappedFile file;
+		if (!file.open(path))
+		{
+			return false;
+		}
+		const char* p = (const char*)file.data();
+		const char* end = p + file.size();
+		Material* current = NULL;
+		while (p < end)
+		{
+			const char* lineEnd = findNewline(p, end);
+			const char* next = lineEnd + 1;
+			if (lineEnd > p && lineEnd[-1] == '\r')
+			{
+				--lineEnd;
+			}
+			p = skipSpaces(p, lineEnd);
+			const char* keywordEnd = p;
+			while (keywordEnd < lineEnd && *keywordEnd != ' ' && *keywordEnd != '\t')
+			{
+				++keywordEnd;
+			}
+			std::string keyword(p, keywordEnd);
+			std::transform(keyword.begin(), keyword.end(), keyword.begin(), ::tolower);
+			if (keyword == "newmtl")
+			{
+				current = &materials[restOfLine(keywordEnd, lineEnd)];
+			}
+			else if (current != NULL)
+			{
+				int slot = -1;
+				if (keyword == "map_kd")
+				{
+					slot = 0;
+				}
+				else if (keyword == "map_ks")
+				{
+					slot = 1;
+				}
+				else if (keyword == "map_bump" || keyword == "bump")
+				{
+					slot = 2;
+				}
+				if (slot >= 0)
+				{
+					current->textures[slot] = textureName(keywordEnd, lineEnd);
+				}
+			}
+			p = next;
+		}
+		return true;
+	}
+	/*
+	* File name after any -option arguments, names may contain spaces
+	*/
+	static std::string textureName(const char* p, const char* end)
+	{
+		p = skipSpaces(p, end);
+		while (p < end && *p == '-')
+		{
+			const char* optionEnd = p;
+			while (optionEnd < end && *optionEnd != ' ' && *optionEnd != '\t')
+			{
+				++optionEnd;
+			}
+			const std::string option(p, optionEnd);
+			p = skipSpaces(optionEnd, end);
+			// -imfchan and -type take a word, every other option takes numbers or on/off
+			if (option == "-imfchan" || option == "-type")
+			{
+				while (p < end && *p != ' ' && *p != '\t')
+				{
+					++p;
+				}
+				p = skipSpaces(p, end);
+				continue;
+			}
+			for (;;)
+			{
+				const char* wordEnd = p;
+				while (wordEnd < end && *wordEnd != ' ' && *wordEnd != '\t')
+				{
+					++wordEnd;
+				}
+				const std::string word(p, wordEnd);
+				float number = 0.0f;
+				if (wordEnd == end || word.empty()
+					|| (parseFloat(p, wordEnd, number) != wordEnd && word != "on" && word != "off"))
+				{
+					break;
+				}
+				p = skipSpaces(wordEnd, end);
+			}
+		}
+		return restOfLine(p, end);
+	}
+};
+
+#endif
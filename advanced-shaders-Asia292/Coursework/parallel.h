@@ -0,0 +1,234 @@
+#ifndef _PARALLEL_H_
+#define _PARALLEL_H_
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class ParallelHelper
+{
+public:
+	/*
+	* Number of threads used for CPU work, including the calling thread
+	*/
+	static unsigned int workerCount()
+	{
+		unsigned int count = std::thread::hardware_concurrency();
+		return count == 0 ? 1 : count;
+	}
+	/*
+	* Run func(i) for every i in [0, count), items are handed out one at a time
+	* so uneven items (e.g. meshes of very different size) balance across threads.
+	* The threads come from a pool started on first use and kept for the whole run.
+	* An exception from func stops the loop and is rethrown on the calling thread.
+	*/
+	template <typename Func>
+	static void parallelFor(size_t count, const Func& func)
+	{
+		// Nested calls from inside a worker run inline instead of oversubscribing the cores
+		const size_t threadCount = insideWorker() ? 1 : std::min<size_t>(workerCount(), count);
+		if (threadCount <= 1)
+		{
+			for (size_t i = 0; i < count; ++i)
+			{
+				func(i);
+			}
+			return;
+		}
+		WorkerPool& pool = WorkerPool::instance();
+		// The pool runs one loop at a time, a loop started meanwhile on another thread runs inline
+		std::unique_lock<std::mutex> busy(pool.submitMutex, std::try_to_lock);
+		if (!busy.owns_lock())
+		{
+			for (size_t i = 0; i < count; ++i)
+			{
+				func(i);
+			}
+			return;
+		}
+		WorkerScope scope;
+		pool.run(count, threadCount - 1, &invoke<Func>, &func);
+	}
+	/*
+	* Run func(begin, end) over contiguous ranges of at least grainSize items
+	*/
+	template <typename Func>
+	static void parallelRanges(size_t count, size_t grainSize, const Func& func)
+	{
+		grainSize = std::max<size_t>(grainSize, 1);
+		const size_t rangeCount = (count + grainSize - 1) / grainSize;
+		parallelFor(rangeCount, [&](size_t r)
+		{
+			func(r * grainSize, std::min(count, (r + 1) * grainSize));
+		});
+	}
+	/*
+	* Mark the calling thread as a background worker for its whole lifetime, parallel
+	* loops it starts then run inline instead of spawning threads of their own
+	*/
+	static void markWorkerThread()
+	{
+		insideWorker() = true;
+	}
+private:
+	static bool& insideWorker()
+	{
+		static thread_local bool inside = false;
+		return inside;
+	}
+	/*
+	* Marks the calling thread as inside a loop until the scope ends, also when func throws
+	*/
+	class WorkerScope
+	{
+	public:
+		WorkerScope() :previous(insideWorker())
+		{
+			insideWorker() = true;
+		}
+		~WorkerScope()
+		{
+			insideWorker() = this->previous;
+		}
+	private:
+		bool previous;
+		WorkerScope(const WorkerScope&) = delete;
+		WorkerScope& operator=(const WorkerScope&) = delete;
+	};
+	template <typename Func>
+	static void invoke(const void* func, size_t i)
+	{
+		(*static_cast<const Func*>(func))(i);
+	}
+
+	/*
+	* workerCount() - 1 threads that sleep between loops. Each loop bumps the job
+	* counter to wake them, at most helperCount of them join it, and run() returns
+	* once every thread that joined has run out of items.
+	*/
+	class WorkerPool
+	{
+	public:
+		std::mutex submitMutex; // Held by the thread whose loop owns the pool
+
+		static WorkerPool& instance()
+		{
+			static WorkerPool pool;
+			return pool;
+		}
+		void run(size_t count, size_t helperCount, void(*call)(const void*, size_t), const void* func)
+		{
+			{
+				std::lock_guard<std::mutex> lock(this->mutex);
+				this->call = call;
+				this->func = func;
+				this->count = count;
+				this->next = 0;
+				this->seats = helperCount;
+				++this->job;
+			}
+			this->wake.notify_all();
+			this->work(); // The calling thread works too
+			// Close the job to late wakers, then wait for the helpers still inside
+			std::unique_lock<std::mutex> lock(this->mutex);
+			this->seats = 0;
+			this->finished.wait(lock, [this]() { return this->active == 0; });
+			if (this->error)
+			{
+				const std::exception_ptr error = this->error;
+				this->error = std::exception_ptr();
+				lock.unlock();
+				std::rethrow_exception(error);
+			}
+		}
+		~WorkerPool()
+		{
+			{
+				std::lock_guard<std::mutex> lock(this->mutex);
+				this->stopping = true;
+			}
+			this->wake.notify_all();
+			for (size_t t = 0; t < this->threads.size(); ++t)
+			{
+				this->threads[t].join();
+			}
+		}
+	private:
+		std::mutex mutex;
+		std::condition_variable wake;
+		std::condition_variable finished;
+		std::vector<std::thread> threads;
+		void(*call)(const void*, size_t);
+		const void* func;
+		size_t count;
+		std::atomic<size_t> next;
+		size_t job;
+		size_t seats;
+		size_t active;
+		bool stopping;
+		std::exception_ptr error; // First exception thrown by the current loop
+
+		WorkerPool() :call(NULL), func(NULL), count(0), next(0), job(0), seats(0), active(0), stopping(false)
+		{
+			const unsigned int helpers = workerCount() - 1;
+			this->threads.reserve(helpers);
+			for (unsigned int t = 0; t < helpers; ++t)
+			{
+				this->threads.push_back(std::thread(&WorkerPool::threadLoop, this));
+			}
+		}
+		WorkerPool(const WorkerPool&) = delete;
+		WorkerPool& operator=(const WorkerPool&) = delete;
+
+		void work()
+		{
+			try
+			{
+				for (size_t i = this->next++; i < this->count; i = this->next++)
+				{
+					this->call(this->func, i);
+				}
+			}
+			catch (...)
+			{
+				std::lock_guard<std::mutex> lock(this->mutex);
+				if (!this->error)
+				{
+					this->error = std::current_exception();
+				}
+				this->next = this->count; // Hand out no more items
+			}
+		}
+		void threadLoop()
+		{
+			ParallelHelper::markWorkerThread();
+			size_t seen = 0;
+			std::unique_lock<std::mutex> lock(this->mutex);
+			for (;;)
+			{
+				this->wake.wait(lock, [&]() { return this->stopping || (this->job != seen && this->seats > 0); });
+				if (this->stopping)
+				{
+					return;
+				}
+				seen = this->job;
+				--this->seats;
+				++this->active;
+				lock.unlock();
+				this->work();
+				lock.lock();
+				if (--this->active == 0)
+				{
+					this->finished.notify_all();
+				}
+			}
+		}
+	};
+};
+
+#endif
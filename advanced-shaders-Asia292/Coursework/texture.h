@@ -4,6 +4,25 @@
 #include <GLEW/glew.h>
 #include <iostream>
 #include <fstream>
+#include <string>
+#include <vector>
+
+// Decoded pixels waiting for upload, owned until release() or upload2DTexture
+struct TextureImage
+{
+	GLubyte* pixels;
+	int width, height;
+	int channels; // Bytes per pixel in pixels
+	TextureImage() :pixels(NULL), width(0), height(0), channels(0) {}
+	void release()
+	{
+		if (this->pixels)
+		{
+			SOIL_free_image_data(this->pixels);
+			this->pixels = NULL;
+		}
+	}
+};
 
 class TextureHelper
 {
@@ -14,37 +33,134 @@ public:
 	static  GLuint load2DTexture(const char* filename, GLint internalFormat = GL_RGB,
 		GLenum picFormat = GL_RGB, int loadChannels = SOIL_LOAD_RGB, GLboolean alpha=false)
 	{
-		// Create and bind texture objects
-		GLuint textureId = 0;
-		glGenTextures(1, &textureId);
-		glBindTexture(GL_TEXTURE_2D, textureId);
-		// Set wrap parameters
-		// The edge part is semi-transparent because of the interpolation using the next repeated texture
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, alpha ? GL_CLAMP_TO_EDGE : GL_REPEAT);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, alpha ? GL_CLAMP_TO_EDGE : GL_REPEAT);
-		// Set filter parameters
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, 
-			GL_LINEAR_MIPMAP_LINEAR); // Filter method for MipMap
-		// Load texture
-		GLubyte *imageData = NULL;
-		int picWidth, picHeight;
+		TextureImage image;
+		if (!decode2DImage(filename, image, loadChannels))
+		{
+			return 0;
+		}
+		return upload2DTexture(image, internalFormat, picFormat, alpha);
+	}
+	/*
+	* Decode an image file, safe to call on any thread
+	*/
+	static bool decode2DImage(const char* filename, TextureImage& image, int loadChannels = SOIL_LOAD_RGB)
+	{
 		int channels = 0;
-		imageData = SOIL_load_image(filename, &picWidth, &picHeight, &channels, loadChannels);
-		if (imageData == NULL)
+		image.pixels = SOIL_load_image(filename, &image.width, &image.height, &channels, loadChannels);
+		if (image.pixels == NULL)
 		{
 			std::cerr << "Error::Texture could not load texture file:" << filename << std::endl;
+			return false;
+		}
+		image.channels = loadChannels != SOIL_LOAD_AUTO ? loadChannels : channels;
+		return true;
+	}
+	/*
+	* Create a mipmapped texture from a decoded image and free the pixels, GL thread only
+	*/
+	static GLuint upload2DTexture(TextureImage& image, GLint internalFormat = GL_RGB,
+		GLenum picFormat = GL_RGB, GLboolean alpha = false)
+	{
+		if (image.pixels == NULL)
+		{
 			return 0;
 		}
-		glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, picWidth, picHeight, 
-			0, picFormat, GL_UNSIGNED_BYTE, imageData);
-		glGenerateMipmap(GL_TEXTURE_2D);
+		const GLuint textureId = create2DTexture(image.width, image.height, image.pixels,
+			internalFormat, picFormat, alpha);
 		// Release texture image resources
-		SOIL_free_image_data(imageData);
+		image.release();
+		return textureId;
+	}
+	/*
+	* Create a mipmapped texture from tightly packed pixels. With a GL_PIXEL_UNPACK_BUFFER
+	* bound, pixels is an offset into that buffer and the copy does not stall. GL thread only.
+	*/
+	static GLuint create2DTexture(GLsizei width, GLsizei height, const GLvoid* pixels,
+		GLint internalFormat = GL_RGB, GLenum picFormat = GL_RGB, GLboolean alpha = false)
+	{
+		const GLuint textureId = createMipmapped2DTexture(alpha);
+		// Decoded rows are not padded, RGB widths need not be a multiple of 4 bytes
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+		glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, width, height, 
+			0, picFormat, GL_UNSIGNED_BYTE, pixels);
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+		glGenerateMipmap(GL_TEXTURE_2D);
+		glBindTexture(GL_TEXTURE_2D, 0);
+		return textureId;
+	}
+	/*
+	* Create a texture from a mip chain built on the CPU, one tightly packed pointer per level
+	* from width x height down. Pointers may be offsets into a bound GL_PIXEL_UNPACK_BUFFER.
+	* Nothing is generated on the GPU. GL thread only.
+	*/
+	static GLuint create2DTextureLevels(GLsizei width, GLsizei height, const std::vector<const GLvoid*>& levels,
+		GLint internalFormat = GL_RGB, GLenum picFormat = GL_RGB, GLboolean alpha = false,
+		GLenum type = GL_UNSIGNED_BYTE)
+	{
+		if (levels.empty())
+		{
+			return 0;
+		}
+		const GLuint textureId = createMipmapped2DTexture(alpha);
+		const bool immutable = allocateStorage(internalFormat, width, height, levels.size());
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+		for (size_t level = 0; level < levels.size(); ++level)
+		{
+			if (immutable)
+			{
+				glTexSubImage2D(GL_TEXTURE_2D, (GLint)level, 0, 0, width, height, picFormat, type, levels[level]);
+			}
+			else
+			{
+				glTexImage2D(GL_TEXTURE_2D, (GLint)level, internalFormat, width, height,
+					0, picFormat, type, levels[level]);
+			}
+			width = width > 1 ? width / 2 : 1;
+			height = height > 1 ? height / 2 : 1;
+		}
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+		glBindTexture(GL_TEXTURE_2D, 0);
+		return textureId;
+	}
+	/*
+	* Create a texture from a block compressed mip chain, one pointer and byte size per
+	* level. Pointers may be offsets into a bound GL_PIXEL_UNPACK_BUFFER. GL thread only.
+	*/
+	static GLuint createCompressed2DTextureLevels(GLsizei width, GLsizei height, GLenum format,
+		const std::vector<const GLvoid*>& levels, const std::vector<GLsizei>& sizes, GLboolean alpha = false)
+	{
+		if (levels.empty() || levels.size() != sizes.size())
+		{
+			return 0;
+		}
+		const GLuint textureId = createMipmapped2DTexture(alpha);
+		const bool immutable = allocateStorage(format, width, height, levels.size());
+		for (size_t level = 0; level < levels.size(); ++level)
+		{
+			if (immutable)
+			{
+				glCompressedTexSubImage2D(GL_TEXTURE_2D, (GLint)level, 0, 0, width, height, format,
+					sizes[level], levels[level]);
+			}
+			else
+			{
+				glCompressedTexImage2D(GL_TEXTURE_2D, (GLint)level, format, width, height, 0, sizes[level], levels[level]);
+			}
+			width = width > 1 ? width / 2 : 1;
+			height = height > 1 ? height / 2 : 1;
+		}
 		glBindTexture(GL_TEXTURE_2D, 0);
 		return textureId;
 	}
 	/*
+	* Create a texture with material sampling state and no levels yet, left bound to
+	* GL_TEXTURE_2D for the caller to fill. GL thread only.
+	*/
+	static GLuint createEmpty2DTexture(GLboolean alpha = false)
+	{
+		return createMipmapped2DTexture(alpha);
+	}
+	/*
 	* Create framebuffer-attachable texture
 	*/
 	static GLuint makeAttachmentTexture(GLint level = 0, GLint internalFormat = GL_DEPTH24_STENCIL8,
@@ -77,100 +193,51 @@ public:
 
 		return textId;
 	}
-#define FOURCC_DXT1 0x31545844 // Equivalent to "DXT1" in ASCII
-#define FOURCC_DXT3 0x33545844 // Equivalent to "DXT3" in ASCII
-#define FOURCC_DXT5 0x35545844 // Equivalent to "DXT5" in ASCII
-
-	static GLuint loadDDS(const char * filename){
-
-		
-		/* try to open the file */
-		std::ifstream file(filename, std::ios::in | std::ios::binary);
-		if (!file){
-			std::cout << "Error::loadDDs, could not open:" 
-				<< filename << "for read." << std::endl;
-			return 0;
-		}
-
-		/* verify the type of file */
-		char filecode[4];
-		file.read(filecode, 4);
-		if (strncmp(filecode, "DDS ", 4) != 0) {
-			std::cout << "Error::loadDDs, format is not dds :"
-				<< filename  << std::endl;
-			file.close();
-			return 0;
-		}
-
-		/* get the surface properties */
-		char header[124];
-		file.read(header, 124);
-
-		unsigned int height = *(unsigned int*)&(header[8]);
-		unsigned int width = *(unsigned int*)&(header[12]);
-		unsigned int linearSize = *(unsigned int*)&(header[16]);
-		unsigned int mipMapCount = *(unsigned int*)&(header[24]);
-		unsigned int fourCC = *(unsigned int*)&(header[80]);
-
-
-		char * buffer = NULL;
-		unsigned int bufsize;
-		/* how big is it going to be including all mipmaps? */
-		bufsize = mipMapCount > 1 ? linearSize * 2 : linearSize;
-		buffer = new char[bufsize];
-		file.read(buffer, bufsize);
-		/* close the file pointer */
-		file.close();
-
-		unsigned int components = (fourCC == FOURCC_DXT1) ? 3 : 4;
-		unsigned int format;
-		switch (fourCC)
+private:
+	/*
+	* Generate and bind a texture with the sampling state of mipmapped material textures
+	*/
+	static GLuint createMipmapped2DTexture(GLboolean alpha)
+	{
+		// Create and bind texture objects
+		GLuint textureId = 0;
+		glGenTextures(1, &textureId);
+		glBindTexture(GL_TEXTURE_2D, textureId);
+		// Set wrap parameters
+		// The edge part is semi-transparent because of the interpolation using the next repeated texture
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, alpha ? GL_CLAMP_TO_EDGE : GL_REPEAT);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, alpha ? GL_CLAMP_TO_EDGE : GL_REPEAT);
+		// Set filter parameters
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, 
+			GL_LINEAR_MIPMAP_LINEAR); // Filter method for MipMap
+		return textureId;
+	}
+	/*
+	* Limit the bound texture to levelCount levels and, with ARB_texture_storage and a sized
+	* format, allocate them all as immutable storage. False leaves them to glTexImage2D.
+	*/
+	static bool allocateStorage(GLint internalFormat, GLsizei width, GLsizei height, size_t levelCount)
+	{
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, (GLint)levelCount - 1);
+		switch (internalFormat)
 		{
-		case FOURCC_DXT1:
-			format = GL_COMPRESSED_RGBA_S3TC_DXT1_EXT;
-			break;
-		case FOURCC_DXT3:
-			format = GL_COMPRESSED_RGBA_S3TC_DXT3_EXT;
-			break;
-		case FOURCC_DXT5:
-			format = GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
-			break;
-		default:
-			delete[] buffer;
-			return 0;
+			case GL_RED:
+			case GL_RG:
+			case GL_RGB:
+			case GL_RGBA:
+			case GL_SRGB:
+			case GL_SRGB_ALPHA:
+				return false;
+			default:
+				break;
 		}
-
-		// Create one OpenGL texture
-		GLuint textureID;
-		glGenTextures(1, &textureID);
-
-		// "Bind" the newly created texture : all future texture functions will modify this texture
-		glBindTexture(GL_TEXTURE_2D, textureID);
-		glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
-
-		unsigned int blockSize = (format == GL_COMPRESSED_RGBA_S3TC_DXT1_EXT) ? 8 : 16;
-		unsigned int offset = 0;
-
-		/* load the mipmaps */
-		for (unsigned int level = 0; level < mipMapCount && (width || height); ++level)
+		if (!GLEW_ARB_texture_storage)
 		{
-			unsigned int size = ((width + 3) / 4)*((height + 3) / 4)*blockSize;
-			glCompressedTexImage2D(GL_TEXTURE_2D, level, format, width, height,
-				0, size, buffer + offset);
-
-			offset += size;
-			width /= 2;
-			height /= 2;
-
-			// Deal with Non-Power-Of-Two textures. This code is not included in the webpage to reduce clutter.
-			if (width < 1) width = 1;
-			if (height < 1) height = 1;
-
+			return false;
 		}
-
-		delete[] buffer;
-
-		return textureID;
+		glTexStorage2D(GL_TEXTURE_2D, (GLsizei)levelCount, (GLenum)internalFormat, width, height);
+		return true;
 	}
 };
 
@@ -0,0 +1,317 @@
+#ifndef _TEXTURE_ARRAY_H_
+#define _TEXTURE_ARRAY_H_
+
+#include <GLEW/glew.h>
+#include <glm/glm.hpp>
+#include <algorithm>
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "glHandle.h"
+#include "parallel.h"
+#include "shader.h"
+#include "textureMips.h"
+#include "textureRegistry.h"
+
+// Material roles that get their own arrays, in the order of the shader's layer vector
+enum TextureArrayRole
+{
+	TEXTURE_ARRAY_DIFFUSE,
+	TEXTURE_ARRAY_SPECULAR,
+	TEXTURE_ARRAY_NORMAL,
+	TEXTURE_ARRAY_ROLES
+};
+
+// Unit of the first role's array, one per role after it, clear of the material,
+// virtual texture and draw data units
+const GLint TEXTURE_ARRAY_FIRST_UNIT = 10;
+
+// Largest layer size, larger textures are packed from a smaller mip level
+const uint32_t TEXTURE_ARRAY_MAX_SIZE = 2048;
+
+// Sampler uniform of each role in scene.frag
+const char* const TEXTURE_ARRAY_SAMPLERS[TEXTURE_ARRAY_ROLES] = { "diffuseArray", "specularArray", "normalArray" };
+
+// Array and layer holding a packed texture
+struct TextureArraySlot
+{
+	int32_t array; // Index into the TextureArraySet, -1 when the texture is not packed
+	int32_t layer;
+	TextureArraySlot() :array(-1), layer(-1) {}
+};
+
+// Texture to pack, by everything two layers of one array must share
+struct TextureArrayEntry
+{
+	int role;
+	GLenum format; // Block format, or the internal format of uncompressed texels
+	uint32_t width, height; // Size class, see TextureArrayPacker::sizeClass
+	TextureArraySlot slot; // Set by TextureArrayPacker::plan
+};
+
+// Texture file to pack and the settings it is loaded with
+struct TextureArraySource
+{
+	std::string path;
+	int role;
+	TextureParams params;
+};
+
+/*
+* Groups textures of the same role, format and size class into arrays, GL-free
+*/
+class TextureArrayPacker
+{
+public:
+	/*
+	* Nearest power of two at most maxSize, halfway sizes round up
+	*/
+	static uint32_t sizeClass(uint32_t size, uint32_t maxSize = TEXTURE_ARRAY_MAX_SIZE)
+	{
+		uint32_t lower = 1;
+		while (lower * 2 <= size && lower * 2 <= maxSize)
+		{
+			lower *= 2;
+		}
+		if (lower * 2 <= maxSize && (uint64_t)size * 2 >= (uint64_t)lower * 3)
+		{
+			return lower * 2;
+		}
+		return lower;
+	}
+	/*
+	* Give every entry an array and a layer in it, an array that reaches maxLayers starts
+	* another one. Returns the number of arrays.
+	*/
+	static size_t plan(std::vector<TextureArrayEntry>& entries, size_t maxLayers)
+	{
+		std::vector<size_t> firstEntries; // The entry each array was started for
+		std::vector<int32_t> layerCounts;
+		for (size_t i = 0; i < entries.size(); ++i)
+		{
+			size_t array = 0;
+			while (array < firstEntries.size()
+				&& !(sameClass(entries[firstEntries[array]], entries[i]) && (size_t)layerCounts[array] < maxLayers))
+			{
+				++array;
+			}
+			if (array == firstEntries.size())
+			{
+				firstEntries.push_back(i);
+				layerCounts.push_back(0);
+			}
+			entries[i].slot.array = (int32_t)array;
+			entries[i].slot.layer = layerCounts[array]++;
+		}
+		return firstEntries.size();
+	}
+	static bool sameClass(const TextureArrayEntry& a, const TextureArrayEntry& b)
+	{
+		return a.role == b.role && a.format == b.format && a.width == b.width && a.height == b.height;
+	}
+};
+
+/*
+* Material textures packed into GL_TEXTURE_2D_ARRAYs, one per role, format and size class.
+* Meshes keep a layer per role instead of texture names, so every draw over the same
+* arrays runs without texture changes. Textures are resampled to their size class: a
+* power-of-two texture uses the matching level of its chain, other sizes get a
+* resampled chain, cached next to the ordinary ones. The ordinary textures stay in
+* TextureRegistry for overrides and unpacked draws. GL thread only.
+*/
+class TextureArraySet
+{
+public:
+	TextureArraySet() :bytes(0) {}
+	/*
+	* Pack every source, replacing earlier arrays. slots has one entry per source,
+	* array -1 where it could not be loaded. Chains load in parallel.
+	*/
+	void pack(const std::vector<TextureArraySource>& sources, std::vector<TextureArraySlot>& slots)
+	{
+		this->clear();
+		slots.assign(sources.size(), TextureArraySlot());
+		std::vector<MipChain> chains(sources.size());
+		std::vector<TextureArrayEntry> entries(sources.size());
+		std::vector<size_t> firstLevels(sources.size(), 0);
+		std::vector<char> loaded(sources.size(), 0);
+		ParallelHelper::parallelFor(sources.size(), [&](size_t i)
+		{
+			loaded[i] = loadLayer(sources[i], chains[i], entries[i], firstLevels[i]);
+		});
+		std::vector<size_t> packedSources;
+		std::vector<TextureArrayEntry> packedEntries;
+		for (size_t i = 0; i < sources.size(); ++i)
+		{
+			if (loaded[i])
+			{
+				packedSources.push_back(i);
+				packedEntries.push_back(entries[i]);
+			}
+			else
+			{
+				std::cerr << "Warning:TextureArraySet::pack, could not load: " << sources[i].path
+					<< ", drawn from its own texture" << std::endl;
+			}
+		}
+		GLint maxLayers = 256;
+		glGetIntegerv(GL_MAX_ARRAY_TEXTURE_LAYERS, &maxLayers);
+		const size_t arrayCount = TextureArrayPacker::plan(packedEntries, (size_t)std::max(maxLayers, 1));
+		std::vector<std::vector<size_t> > members(arrayCount);
+		for (size_t i = 0; i < packedEntries.size(); ++i)
+		{
+			slots[packedSources[i]] = packedEntries[i].slot;
+			members[packedEntries[i].slot.array].push_back(packedSources[i]);
+		}
+		for (size_t array = 0; array < arrayCount; ++array)
+		{
+			this->createArray(sources, chains, firstLevels, members[array]);
+			// Mapped cache files are closed as soon as their layers are on the GPU
+			for (std::vector<size_t>::const_iterator it = members[array].begin(); members[array].end() != it; ++it)
+			{
+				chains[*it].release();
+			}
+		}
+	}
+	/*
+	* Bind the arrays a draw samples, array -1 leaves a role unbound, and switch scene.frag
+	* to them
+	*/
+	void bind(const Shader& shader, const glm::ivec3& arrays) const
+	{
+		for (int role = 0; role < TEXTURE_ARRAY_ROLES; ++role)
+		{
+			const int32_t array = arrays[role];
+			glActiveTexture(GL_TEXTURE0 + TEXTURE_ARRAY_FIRST_UNIT + role);
+			glBindTexture(GL_TEXTURE_2D_ARRAY, array >= 0 && (size_t)array < this->arrays.size()
+				? this->arrays[array].get() : 0);
+		}
+		bindSamplers(shader, true);
+	}
+	void unbind() const
+	{
+		for (int role = 0; role < TEXTURE_ARRAY_ROLES; ++role)
+		{
+			glActiveTexture(GL_TEXTURE0 + TEXTURE_ARRAY_FIRST_UNIT + role);
+			glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+		}
+	}
+	/*
+	* Point the array samplers at their own units and switch the array path on or off.
+	* Needed for every draw with these shaders, like VirtualTextureSystem::bindSamplers.
+	*/
+	static void bindSamplers(const Shader& shader, bool enabled)
+	{
+		for (int role = 0; role < TEXTURE_ARRAY_ROLES; ++role)
+		{
+			glUniform1i(glGetUniformLocation(shader.programId, TEXTURE_ARRAY_SAMPLERS[role]),
+				TEXTURE_ARRAY_FIRST_UNIT + role);
+		}
+		glUniform1i(glGetUniformLocation(shader.programId, "textureArrays"), enabled);
+	}
+	void clear()
+	{
+		this->arrays.clear();
+		this->bytes = 0;
+	}
+	bool empty() const { return this->arrays.empty(); }
+	size_t getArrayCount() const { return this->arrays.size(); }
+	size_t getBytes() const { return this->bytes; }
+private:
+	std::vector<GLTexture> arrays;
+	size_t bytes; // Video memory of every array, all levels
+
+	/*
+	* Chain of one source at its size class, firstLevel is the level that has that size
+	*/
+	static bool loadLayer(const TextureArraySource& source, MipChain& chain, TextureArrayEntry& entry,
+		size_t& firstLevel)
+	{
+		uint64_t fileHash = 0, pixelHash = 0;
+		if (!TextureRegistry::hashFile(source.path, fileHash)
+			|| !TextureRegistry::loadMips(source.path, fileHash, source.params, chain, pixelHash))
+		{
+			return false;
+		}
+		const MipLevel& top = chain.getLevels()[0];
+		entry.role = source.role;
+		entry.format = chain.isCompressed() ? chain.getFormat() : (GLenum)source.params.internalFormat;
+		entry.width = TextureArrayPacker::sizeClass(top.width);
+		entry.height = TextureArrayPacker::sizeClass(top.height);
+		for (firstLevel = 0; firstLevel < chain.getLevels().size(); ++firstLevel)
+		{
+			const MipLevel& level = chain.getLevels()[firstLevel];
+			if (level.width == entry.width && level.height == entry.height)
+			{
+				return true;
+			}
+		}
+		// No level has the class size, resample the image to it
+		firstLevel = 0;
+		return TextureRegistry::loadMips(source.path, fileHash, source.params, chain, pixelHash,
+			entry.width, entry.height);
+	}
+	/*
+	* One array holding the given sources in layer order, levels shared by all of them
+	*/
+	void createArray(const std::vector<TextureArraySource>& sources, const std::vector<MipChain>& chains,
+		const std::vector<size_t>& firstLevels, const std::vector<size_t>& members)
+	{
+		const TextureArraySource& first = sources[members[0]];
+		const MipChain& firstChain = chains[members[0]];
+		size_t levelCount = firstChain.getLevels().size() - firstLevels[members[0]];
+		for (std::vector<size_t>::const_iterator it = members.begin(); members.end() != it; ++it)
+		{
+			levelCount = std::min(levelCount, chains[*it].getLevels().size() - firstLevels[*it]);
+		}
+		const GLsizei layers = (GLsizei)members.size();
+		const bool compressed = firstChain.isCompressed();
+		GLTexture texture;
+		texture.create();
+		glBindTexture(GL_TEXTURE_2D_ARRAY, texture.get());
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, first.params.alpha ? GL_CLAMP_TO_EDGE : GL_REPEAT);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, first.params.alpha ? GL_CLAMP_TO_EDGE : GL_REPEAT);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, (GLint)levelCount - 1);
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+		for (size_t level = 0; level < levelCount; ++level)
+		{
+			const MipLevel& size = firstChain.getLevels()[firstLevels[members[0]] + level];
+			const GLsizei width = (GLsizei)size.width, height = (GLsizei)size.height;
+			if (compressed)
+			{
+				glCompressedTexImage3D(GL_TEXTURE_2D_ARRAY, (GLint)level, firstChain.getFormat(), width, height,
+					layers, 0, (GLsizei)(size.size * layers), NULL);
+			}
+			else
+			{
+				glTexImage3D(GL_TEXTURE_2D_ARRAY, (GLint)level, first.params.internalFormat, width, height,
+					layers, 0, first.params.picFormat, GL_UNSIGNED_BYTE, NULL);
+			}
+			this->bytes += (size_t)size.size * layers;
+			for (GLsizei layer = 0; layer < layers; ++layer)
+			{
+				const MipChain& chain = chains[members[layer]];
+				const MipLevel& data = chain.getLevels()[firstLevels[members[layer]] + level];
+				const GLvoid* pixels = chain.data() + data.offset;
+				if (compressed)
+				{
+					glCompressedTexSubImage3D(GL_TEXTURE_2D_ARRAY, (GLint)level, 0, 0, layer, width, height, 1,
+						firstChain.getFormat(), (GLsizei)data.size, pixels);
+				}
+				else
+				{
+					glTexSubImage3D(GL_TEXTURE_2D_ARRAY, (GLint)level, 0, 0, layer, width, height, 1,
+						first.params.picFormat, GL_UNSIGNED_BYTE, pixels);
+				}
+			}
+		}
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+		glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+		this->arrays.push_back(std::move(texture));
+	}
+};
+
+#endif
@@ -0,0 +1,616 @@
+#ifndef _TEXTURE_COMPRESS_H_
+#define _TEXTURE_COMPRESS_H_
+
+#include <GLEW/glew.h>
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#if defined(_M_X64) || defined(__SSE2__) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define TEXTURE_COMPRESS_SSE2 1
+#include <emmintrin.h>
+#endif
+#include "parallel.h"
+#include "textureMips.h"
+
+// Block compression applied to a texture's mip chain
+enum TextureCompression
+{
+	TEXTURE_COMPRESSION_NONE,
+	TEXTURE_COMPRESSION_BC1, // DXT1, RGB in 4 bits per texel
+	TEXTURE_COMPRESSION_BC3, // DXT5, RGBA in 8 bits per texel
+	TEXTURE_COMPRESSION_BC7, // RGBA in 8 bits per texel with finer gradients, needs ARB_texture_compression_bptc
+	TEXTURE_COMPRESSION_BC5 // RGTC2, two independent channels in 8 bits per texel, for normal map X/Y
+};
+
+// Encoder effort, slower levels refine the endpoints more
+enum CompressionQuality
+{
+	COMPRESSION_QUALITY_FAST,
+	COMPRESSION_QUALITY_NORMAL,
+	COMPRESSION_QUALITY_HIGH
+};
+
+/*
+* CPU encoder for BC1, BC3, BC5 and BC7 blocks. Endpoints start on the block's principal axis
+* and are refined by least squares; texels pick the nearest palette entry four at a time
+* with SSE2. Block rows are spread over threads.
+* BC7 blocks use mode 6 (one subset, RGBA endpoints, 16 levels), which keeps the encoder
+* simple and still beats BC1 on gradients and noise.
+*/
+class BlockCompressor
+{
+public:
+	/*
+	* Best format the driver can sample for colour data, NONE without S3TC or BPTC
+	*/
+	static TextureCompression preferredColorFormat(bool hasAlpha)
+	{
+		if (GLEW_ARB_texture_compression_bptc)
+		{
+			return TEXTURE_COMPRESSION_BC7;
+		}
+		if (GLEW_EXT_texture_compression_s3tc)
+		{
+			return hasAlpha ? TEXTURE_COMPRESSION_BC3 : TEXTURE_COMPRESSION_BC1;
+		}
+		return TEXTURE_COMPRESSION_NONE;
+	}
+	/*
+	* Format for two-channel normal maps, NONE keeps them as RG8. RGTC is core since GL 3.0.
+	*/
+	static TextureCompression preferredNormalFormat()
+	{
+		if (GLEW_VERSION_3_0 || GLEW_ARB_texture_compression_rgtc)
+		{
+			return TEXTURE_COMPRESSION_BC5;
+		}
+		return TEXTURE_COMPRESSION_NONE;
+	}
+	static GLenum glFormat(TextureCompression compression)
+	{
+		switch (compression)
+		{
+			case TEXTURE_COMPRESSION_BC1:
+				return GL_COMPRESSED_RGBA_S3TC_DXT1_EXT;
+			case TEXTURE_COMPRESSION_BC3:
+				return GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+			case TEXTURE_COMPRESSION_BC7:
+				return GL_COMPRESSED_RGBA_BPTC_UNORM_ARB;
+			case TEXTURE_COMPRESSION_BC5:
+				return GL_COMPRESSED_RG_RGTC2;
+			default:
+				return 0;
+		}
+	}
+	/*
+	* Encode every level of an uncompressed chain, any thread
+	*/
+	static bool compress(const MipChain& source, TextureCompression compression, CompressionQuality quality,
+		MipChain& compressed)
+	{
+		compressed.release();
+		if (source.empty() || source.isCompressed() || compression == TEXTURE_COMPRESSION_NONE)
+		{
+			return false;
+		}
+		const size_t blockBytes = compression == TEXTURE_COMPRESSION_BC1 ? 8 : 16;
+		uint64_t offset = 0;
+		for (std::vector<MipLevel>::const_iterator it = source.getLevels().begin();
+			source.getLevels().end() != it; ++it)
+		{
+			MipLevel level = *it;
+			level.offset = offset;
+			level.size = (uint64_t)((level.width + 3) / 4) * ((level.height + 3) / 4) * blockBytes;
+			compressed.levels.push_back(level);
+			offset += level.size;
+		}
+		compressed.storage.resize((size_t)offset);
+		compressed.channels = source.getChannels();
+		compressed.format = glFormat(compression);
+		compressed.base = &compressed.storage[0];
+		compressed.byteCount = (size_t)offset;
+		for (size_t i = 0; i < compressed.levels.size(); ++i)
+		{
+			const MipLevel& level = compressed.levels[i];
+			const GLubyte* pixels = source.data() + source.getLevels()[i].offset;
+			GLubyte* blocks = &compressed.storage[(size_t)level.offset];
+			const uint32_t blocksWide = (level.width + 3) / 4, blocksHigh = (level.height + 3) / 4;
+			ParallelHelper::parallelRanges(blocksHigh, std::max<uint32_t>(1, BLOCK_GRAIN / blocksWide),
+				[&](size_t begin, size_t end)
+			{
+				BlockPixels block;
+				for (size_t by = begin; by < end; ++by)
+				{
+					for (uint32_t bx = 0; bx < blocksWide; ++bx)
+					{
+						loadBlock(pixels, level.width, level.height, source.getChannels(), bx, (uint32_t)by, block);
+						GLubyte* out = blocks + (by * blocksWide + bx) * blockBytes;
+						switch (compression)
+						{
+							case TEXTURE_COMPRESSION_BC1:
+								encodeBC1(block, quality, out);
+								break;
+							case TEXTURE_COMPRESSION_BC3:
+								encodeChannel(block, 3, out);
+								encodeBC1(block, quality, out + 8);
+								break;
+							case TEXTURE_COMPRESSION_BC5:
+								encodeChannel(block, 0, out);
+								encodeChannel(block, 1, out + 8);
+								break;
+							default:
+								encodeBC7(block, quality, out);
+								break;
+						}
+					}
+				}
+			});
+		}
+		return true;
+	}
+private:
+	static const uint32_t BLOCK_GRAIN = 1024; // Blocks per thread range
+
+	// The 16 texels of a block, one array per channel so four texels fill an SSE register
+	struct BlockPixels
+	{
+		float channel[4][16];
+	};
+
+	/*
+	* Gather a block, edge texels repeat where the level is not a multiple of 4
+	*/
+	static void loadBlock(const GLubyte* pixels, uint32_t width, uint32_t height, int channels,
+		uint32_t bx, uint32_t by, BlockPixels& block)
+	{
+		for (uint32_t y = 0; y < 4; ++y)
+		{
+			const uint32_t sy = std::min(by * 4 + y, height - 1);
+			for (uint32_t x = 0; x < 4; ++x)
+			{
+				const uint32_t sx = std::min(bx * 4 + x, width - 1);
+				const GLubyte* texel = pixels + ((size_t)sy * width + sx) * channels;
+				const int i = y * 4 + x;
+				const bool color = channels >= 3;
+				block.channel[0][i] = texel[0];
+				block.channel[1][i] = color ? texel[1] : texel[0];
+				block.channel[2][i] = color ? texel[2] : texel[0];
+				block.channel[3][i] = channels == 4 ? texel[3] : channels == 2 ? texel[1] : 255.0f;
+			}
+		}
+	}
+	/*
+	* Nearest palette entry of every texel over the first channels channels, returns the
+	* summed squared error
+	*/
+	static float selectIndices(const BlockPixels& block, const float (*palette)[4], int paletteSize,
+		int channels, uint8_t* indices)
+	{
+		float error = 0.0f;
+#ifdef TEXTURE_COMPRESS_SSE2
+		for (int group = 0; group < 16; group += 4)
+		{
+			__m128 best = _mm_set1_ps(FLT_MAX);
+			__m128i bestIndex = _mm_setzero_si128();
+			for (int p = 0; p < paletteSize; ++p)
+			{
+				__m128 distance = _mm_setzero_ps();
+				for (int c = 0; c < channels; ++c)
+				{
+					const __m128 d = _mm_sub_ps(_mm_loadu_ps(&block.channel[c][group]), _mm_set1_ps(palette[p][c]));
+					distance = _mm_add_ps(distance, _mm_mul_ps(d, d));
+				}
+				const __m128i closer = _mm_castps_si128(_mm_cmplt_ps(distance, best));
+				best = _mm_min_ps(distance, best);
+				bestIndex = _mm_or_si128(_mm_and_si128(closer, _mm_set1_epi32(p)), _mm_andnot_si128(closer, bestIndex));
+			}
+			int32_t lanes[4];
+			float errors[4];
+			_mm_storeu_si128((__m128i*)lanes, bestIndex);
+			_mm_storeu_ps(errors, best);
+			for (int k = 0; k < 4; ++k)
+			{
+				indices[group + k] = (uint8_t)lanes[k];
+				error += errors[k];
+			}
+		}
+#else
+		for (int i = 0; i < 16; ++i)
+		{
+			float best = FLT_MAX;
+			for (int p = 0; p < paletteSize; ++p)
+			{
+				float distance = 0.0f;
+				for (int c = 0; c < channels; ++c)
+				{
+					const float d = block.channel[c][i] - palette[p][c];
+					distance += d * d;
+				}
+				if (distance < best)
+				{
+					best = distance;
+					indices[i] = (uint8_t)p;
+				}
+			}
+			error += best;
+		}
+#endif
+		return error;
+	}
+	/*
+	* Line through the block's mean along its principal axis, clipped to the texels
+	*/
+	static void principalEndpoints(const BlockPixels& block, int channels, float* low, float* high)
+	{
+		float mean[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+		for (int c = 0; c < channels; ++c)
+		{
+			for (int i = 0; i < 16; ++i)
+			{
+				mean[c] += block.channel[c][i];
+			}
+			mean[c] /= 16.0f;
+		}
+		float covariance[4][4] = {};
+		for (int i = 0; i < 16; ++i)
+		{
+			for (int a = 0; a < channels; ++a)
+			{
+				for (int b = a; b < channels; ++b)
+				{
+					covariance[a][b] += (block.channel[a][i] - mean[a]) * (block.channel[b][i] - mean[b]);
+				}
+			}
+		}
+		// Power iteration, started on the diagonal of the bounding box
+		float axis[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+		for (int c = 0; c < channels; ++c)
+		{
+			float lo = FLT_MAX, hi = -FLT_MAX;
+			for (int i = 0; i < 16; ++i)
+			{
+				lo = std::min(lo, block.channel[c][i]);
+				hi = std::max(hi, block.channel[c][i]);
+			}
+			axis[c] = hi - lo;
+			for (int b = 0; b < c; ++b)
+			{
+				covariance[c][b] = covariance[b][c];
+			}
+		}
+		for (int iteration = 0; iteration < 8; ++iteration)
+		{
+			float next[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+			float length = 0.0f;
+			for (int a = 0; a < channels; ++a)
+			{
+				for (int b = 0; b < channels; ++b)
+				{
+					next[a] += covariance[a][b] * axis[b];
+				}
+				length = std::max(length, std::fabs(next[a]));
+			}
+			if (length == 0.0f)
+			{
+				break;
+			}
+			for (int c = 0; c < channels; ++c)
+			{
+				axis[c] = next[c] / length;
+			}
+		}
+		float lengthSquared = 0.0f;
+		for (int c = 0; c < channels; ++c)
+		{
+			lengthSquared += axis[c] * axis[c];
+		}
+		float tMin = 0.0f, tMax = 0.0f;
+		if (lengthSquared > 0.0f)
+		{
+			tMin = FLT_MAX;
+			tMax = -FLT_MAX;
+			for (int i = 0; i < 16; ++i)
+			{
+				float t = 0.0f;
+				for (int c = 0; c < channels; ++c)
+				{
+					t += (block.channel[c][i] - mean[c]) * axis[c];
+				}
+				tMin = std::min(tMin, t);
+				tMax = std::max(tMax, t);
+			}
+			tMin /= lengthSquared;
+			tMax /= lengthSquared;
+		}
+		for (int c = 0; c < channels; ++c)
+		{
+			low[c] = std::min(std::max(mean[c] + axis[c] * tMin, 0.0f), 255.0f);
+			high[c] = std::min(std::max(mean[c] + axis[c] * tMax, 0.0f), 255.0f);
+		}
+	}
+	/*
+	* Endpoints minimizing the squared error for fixed indices, weights[i] is texel i's
+	* share of the second endpoint. False if the indices do not pin both endpoints down.
+	*/
+	static bool leastSquaresEndpoints(const BlockPixels& block, int channels, const float* weights,
+		float* first, float* second)
+	{
+		float aa = 0.0f, ab = 0.0f, bb = 0.0f;
+		float ax[4] = { 0.0f, 0.0f, 0.0f, 0.0f }, bx[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+		for (int i = 0; i < 16; ++i)
+		{
+			const float b = weights[i], a = 1.0f - b;
+			aa += a * a;
+			ab += a * b;
+			bb += b * b;
+			for (int c = 0; c < channels; ++c)
+			{
+				ax[c] += a * block.channel[c][i];
+				bx[c] += b * block.channel[c][i];
+			}
+		}
+		const float determinant = aa * bb - ab * ab;
+		if (std::fabs(determinant) < 1e-6f)
+		{
+			return false;
+		}
+		for (int c = 0; c < channels; ++c)
+		{
+			first[c] = std::min(std::max((bb * ax[c] - ab * bx[c]) / determinant, 0.0f), 255.0f);
+			second[c] = std::min(std::max((aa * bx[c] - ab * ax[c]) / determinant, 0.0f), 255.0f);
+		}
+		return true;
+	}
+
+	// BC1 colour block: two RGB565 endpoints and a 2-bit index per texel
+	struct ColorBlock
+	{
+		uint16_t color0, color1;
+		uint8_t indices[16];
+		float error;
+	};
+	static uint16_t to565(const float* color)
+	{
+		const int r = (int)(color[0] * 31.0f / 255.0f + 0.5f);
+		const int g = (int)(color[1] * 63.0f / 255.0f + 0.5f);
+		const int b = (int)(color[2] * 31.0f / 255.0f + 0.5f);
+		return (uint16_t)((r << 11) | (g << 5) | b);
+	}
+	static void from565(uint16_t packed, float* color)
+	{
+		const int r = (packed >> 11) & 31, g = (packed >> 5) & 63, b = packed & 31;
+		color[0] = (float)((r << 3) | (r >> 2));
+		color[1] = (float)((g << 2) | (g >> 4));
+		color[2] = (float)((b << 3) | (b >> 2));
+		color[3] = 255.0f;
+	}
+	static void evaluateBC1(const BlockPixels& block, const float* first, const float* second, ColorBlock& result)
+	{
+		result.color0 = to565(first);
+		result.color1 = to565(second);
+		// color0 > color1 selects the four colour mode; equal endpoints only need index 0
+		if (result.color0 < result.color1)
+		{
+			std::swap(result.color0, result.color1);
+		}
+		float palette[4][4];
+		from565(result.color0, palette[0]);
+		from565(result.color1, palette[1]);
+		for (int c = 0; c < 4; ++c)
+		{
+			palette[2][c] = (2.0f * palette[0][c] + palette[1][c]) / 3.0f;
+			palette[3][c] = (palette[0][c] + 2.0f * palette[1][c]) / 3.0f;
+		}
+		result.error = selectIndices(block, palette, result.color0 == result.color1 ? 1 : 4, 3, result.indices);
+	}
+	static void encodeBC1(const BlockPixels& block, CompressionQuality quality, GLubyte* out)
+	{
+		float first[4], second[4];
+		principalEndpoints(block, 3, first, second);
+		ColorBlock best;
+		evaluateBC1(block, first, second, best);
+		const int refinements = quality == COMPRESSION_QUALITY_FAST ? 0 : quality == COMPRESSION_QUALITY_NORMAL ? 1 : 4;
+		const float shares[4] = { 0.0f, 1.0f, 1.0f / 3.0f, 2.0f / 3.0f }; // Of color1, by index
+		for (int iteration = 0; iteration < refinements && best.error > 0.0f; ++iteration)
+		{
+			float weights[16];
+			for (int i = 0; i < 16; ++i)
+			{
+				weights[i] = shares[best.indices[i]];
+			}
+			float color0[4], color1[4];
+			from565(best.color0, color0);
+			from565(best.color1, color1);
+			if (!leastSquaresEndpoints(block, 3, weights, color0, color1))
+			{
+				break;
+			}
+			ColorBlock candidate;
+			evaluateBC1(block, color0, color1, candidate);
+			if (candidate.error >= best.error)
+			{
+				break;
+			}
+			best = candidate;
+		}
+		out[0] = (GLubyte)(best.color0 & 0xff);
+		out[1] = (GLubyte)(best.color0 >> 8);
+		out[2] = (GLubyte)(best.color1 & 0xff);
+		out[3] = (GLubyte)(best.color1 >> 8);
+		uint32_t bits = 0;
+		for (int i = 0; i < 16; ++i)
+		{
+			bits |= (uint32_t)best.indices[i] << (2 * i);
+		}
+		memcpy(out + 4, &bits, 4);
+	}
+	/*
+	* BC4 block, also the alpha half of BC3 and each half of BC5: one channel's range in
+	* eight steps, 3-bit indices
+	*/
+	static void encodeChannel(const BlockPixels& block, int channel, GLubyte* out)
+	{
+		float lo = 255.0f, hi = 0.0f;
+		for (int i = 0; i < 16; ++i)
+		{
+			lo = std::min(lo, block.channel[channel][i]);
+			hi = std::max(hi, block.channel[channel][i]);
+		}
+		const int high = (int)(hi + 0.5f), low = (int)(lo + 0.5f);
+		out[0] = (GLubyte)high;
+		out[1] = (GLubyte)low;
+		uint64_t bits = 0;
+		for (int i = 0; i < 16 && high > low; ++i)
+		{
+			// Step 0 is high and step 7 low, stored as indices 0, 2..7, 1
+			const int step = (int)((high - block.channel[channel][i]) * 7.0f / (high - low) + 0.5f);
+			const int index = step == 0 ? 0 : step == 7 ? 1 : step + 1;
+			bits |= (uint64_t)index << (3 * i);
+		}
+		for (int k = 0; k < 6; ++k)
+		{
+			out[2 + k] = (GLubyte)(bits >> (8 * k));
+		}
+	}
+
+	// BC7 mode 6 block: RGBA endpoints of 7 bits plus a shared low bit each, 4-bit indices
+	struct Mode6Block
+	{
+		int endpoints[2][4]; // 7-bit values
+		int pBits[2];
+		uint8_t indices[16];
+		float error;
+	};
+	/*
+	* Nearest 7-bit value for an endpoint channel given its low bit
+	*/
+	static int quantize7(float value, int pBit)
+	{
+		return std::min(std::max((int)std::floor((value - pBit) / 2.0f + 0.5f), 0), 127);
+	}
+	/*
+	* Low bit that quantizes an endpoint closest over all channels
+	*/
+	static int bestPBit(const float* endpoint)
+	{
+		float errors[2] = { 0.0f, 0.0f };
+		for (int p = 0; p < 2; ++p)
+		{
+			for (int c = 0; c < 4; ++c)
+			{
+				const float d = (float)((quantize7(endpoint[c], p) << 1) | p) - endpoint[c];
+				errors[p] += d * d;
+			}
+		}
+		return errors[1] < errors[0] ? 1 : 0;
+	}
+	static void evaluateMode6(const BlockPixels& block, const float* first, const float* second,
+		int pBit0, int pBit1, Mode6Block& result)
+	{
+		static const int weights[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+		result.pBits[0] = pBit0;
+		result.pBits[1] = pBit1;
+		int expanded[2][4];
+		for (int c = 0; c < 4; ++c)
+		{
+			result.endpoints[0][c] = quantize7(first[c], pBit0);
+			result.endpoints[1][c] = quantize7(second[c], pBit1);
+			expanded[0][c] = (result.endpoints[0][c] << 1) | pBit0;
+			expanded[1][c] = (result.endpoints[1][c] << 1) | pBit1;
+		}
+		float palette[16][4];
+		for (int p = 0; p < 16; ++p)
+		{
+			for (int c = 0; c < 4; ++c)
+			{
+				palette[p][c] = (float)(((64 - weights[p]) * expanded[0][c] + weights[p] * expanded[1][c] + 32) >> 6);
+			}
+		}
+		result.error = selectIndices(block, palette, 16, 4, result.indices);
+	}
+	static void encodeBC7(const BlockPixels& block, CompressionQuality quality, GLubyte* out)
+	{
+		float first[4], second[4];
+		principalEndpoints(block, 4, first, second);
+		Mode6Block best;
+		evaluateMode6(block, first, second, bestPBit(first), bestPBit(second), best);
+		if (quality == COMPRESSION_QUALITY_HIGH)
+		{
+			for (int p = 0; p < 4; ++p)
+			{
+				Mode6Block candidate;
+				evaluateMode6(block, first, second, p & 1, p >> 1, candidate);
+				if (candidate.error < best.error)
+				{
+					best = candidate;
+				}
+			}
+		}
+		const int refinements = quality == COMPRESSION_QUALITY_FAST ? 0 : quality == COMPRESSION_QUALITY_NORMAL ? 1 : 3;
+		for (int iteration = 0; iteration < refinements && best.error > 0.0f; ++iteration)
+		{
+			static const float shares[16] = { 0.0f / 64, 4.0f / 64, 9.0f / 64, 13.0f / 64, 17.0f / 64, 21.0f / 64,
+				26.0f / 64, 30.0f / 64, 34.0f / 64, 38.0f / 64, 43.0f / 64, 47.0f / 64, 51.0f / 64, 55.0f / 64,
+				60.0f / 64, 64.0f / 64 };
+			float weights[16];
+			for (int i = 0; i < 16; ++i)
+			{
+				weights[i] = shares[best.indices[i]];
+			}
+			if (!leastSquaresEndpoints(block, 4, weights, first, second))
+			{
+				break;
+			}
+			Mode6Block candidate;
+			evaluateMode6(block, first, second, bestPBit(first), bestPBit(second), candidate);
+			if (candidate.error >= best.error)
+			{
+				break;
+			}
+			best = candidate;
+		}
+		// Texel 0 stores only three index bits, its top bit must be clear
+		if (best.indices[0] & 8)
+		{
+			for (int c = 0; c < 4; ++c)
+			{
+				std::swap(best.endpoints[0][c], best.endpoints[1][c]);
+			}
+			std::swap(best.pBits[0], best.pBits[1]);
+			for (int i = 0; i < 16; ++i)
+			{
+				best.indices[i] = (uint8_t)(15 - best.indices[i]);
+			}
+		}
+		memset(out, 0, 16);
+		int position = 0;
+		writeBits(out, position, 1 << 6, 7); // Mode 6: six zero bits then a one
+		for (int c = 0; c < 4; ++c)
+		{
+			writeBits(out, position, best.endpoints[0][c], 7);
+			writeBits(out, position, best.endpoints[1][c], 7);
+		}
+		writeBits(out, position, best.pBits[0], 1);
+		writeBits(out, position, best.pBits[1], 1);
+		writeBits(out, position, best.indices[0], 3);
+		for (int i = 1; i < 16; ++i)
+		{
+			writeBits(out, position, best.indices[i], 4);
+		}
+	}
+	static void writeBits(GLubyte* out, int& position, int value, int count)
+	{
+		for (int i = 0; i < count; ++i, ++position)
+		{
+			if ((value >> i) & 1)
+			{
+				out[position >> 3] |= (GLubyte)(1 << (position & 7));
+			}
+		}
+	}
+};
+
+#endif
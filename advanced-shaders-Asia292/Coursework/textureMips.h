@@ -0,0 +1,669 @@
+#ifndef _TEXTURE_MIPS_H_
+#define _TEXTURE_MIPS_H_
+
+#include <GLEW/glew.h>
+#include <SOIL/SOIL.h>
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#ifdef _WIN32
+#include <direct.h>
+#else
+#include <sys/stat.h>
+#endif
+#if defined(_M_X64) || defined(__SSE2__) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define TEXTURE_MIPS_SSE2 1
+#include <emmintrin.h>
+#endif
+#include "mappedFile.h"
+#include "parallel.h"
+#include "texture.h"
+
+// How texels are averaged into the smaller mip levels
+enum MipMode
+{
+	MIP_MODE_LINEAR, // Data such as height maps, averaged as stored
+	MIP_MODE_SRGB, // Colour maps, averaged in linear light so distant surfaces do not darken
+	MIP_MODE_NORMAL // Tangent space normal maps, averaged as vectors and renormalized
+};
+
+// Reconstruction filter used for every level
+enum MipFilter
+{
+	MIP_FILTER_BOX, // Area average, the footprint glGenerateMipmap uses
+	MIP_FILTER_KAISER // Kaiser windowed sinc, keeps more detail with less aliasing
+};
+
+// Kaiser windowed sinc: half width in destination texels and window shape
+const float MIP_KAISER_HALF_WIDTH = 2.0f;
+const float MIP_KAISER_ALPHA = 4.0f;
+
+// Size and place of one level within a mip chain
+struct MipLevel
+{
+	uint32_t width, height;
+	uint64_t offset; // Bytes from MipChain::data()
+	uint64_t size;
+};
+
+/*
+* Every level of a texture, tightly packed from the largest to the 1x1 level. The pixels
+* are either generated in memory or mapped straight from a MipCache or DDS file. Levels
+* are plain texels, or blocks of a compressed format (see BlockCompressor).
+*/
+class MipChain
+{
+public:
+	MipChain() :channels(0), format(0), base(NULL), byteCount(0) {}
+	MipChain(const MipChain&) = delete;
+	MipChain& operator=(const MipChain&) = delete;
+	int getChannels() const { return this->channels; }
+	GLenum getFormat() const { return this->format; } // Compressed internal format, 0 for texels
+	bool isCompressed() const { return this->format != 0; }
+	const std::vector<MipLevel>& getLevels() const { return this->levels; }
+	const GLubyte* data() const { return this->base; }
+	size_t size() const { return this->byteCount; }
+	bool empty() const { return this->levels.empty(); }
+	void release()
+	{
+		std::vector<GLubyte>().swap(this->storage);
+		this->file.reset();
+		this->levels.clear();
+		this->channels = 0;
+		this->format = 0;
+		this->base = NULL;
+		this->byteCount = 0;
+	}
+	void swap(MipChain& other)
+	{
+		std::swap(this->channels, other.channels);
+		std::swap(this->format, other.format);
+		this->levels.swap(other.levels);
+		this->storage.swap(other.storage);
+		this->file.swap(other.file);
+		std::swap(this->base, other.base);
+		std::swap(this->byteCount, other.byteCount);
+	}
+private:
+	friend class MipGenerator;
+	friend class MipCache;
+	friend class BlockCompressor;
+	friend class DdsFile;
+	int channels; // Bytes per texel of the source image
+	GLenum format;
+	std::vector<MipLevel> levels;
+	std::vector<GLubyte> storage; // Generated pixels
+	std::unique_ptr<MappedFile> file; // Or the cache file they were read from
+	const GLubyte* base;
+	size_t byteCount;
+};
+
+/*
+* CPU mip chain generation, replacing glGenerateMipmap so chains can be cached and filtered
+* properly. Each level is filtered from the one above it with a separable filter: the
+* vertical pass runs on whole rows with SSE2, the horizontal pass on the smaller result.
+* Rows are spread over threads.
+*/
+class MipGenerator
+{
+public:
+	/*
+	* Build every level from a decoded image, level 0 is the image unchanged except for
+	* normal maps, which are renormalized. A nonzero baseWidth and baseHeight resample level 0
+	* to that size first. wrap matches a GL_REPEAT texture, the filter then reads across the
+	* opposite edge. Any thread.
+	*/
+	static bool generate(const TextureImage& image, MipMode mode, MipFilter filter, bool wrap, MipChain& chain,
+		uint32_t baseWidth = 0, uint32_t baseHeight = 0)
+	{
+		chain.release();
+		if (image.pixels == NULL || image.width <= 0 || image.height <= 0
+			|| image.channels <= 0 || image.channels > 4)
+		{
+			return false;
+		}
+		const int channels = image.channels;
+		if (mode == MIP_MODE_NORMAL && channels < 3)
+		{
+			mode = MIP_MODE_LINEAR;
+		}
+		const bool resample = baseWidth > 0 && baseHeight > 0
+			&& (baseWidth != (uint32_t)image.width || baseHeight != (uint32_t)image.height);
+		// Level sizes follow GL: halved and rounded down, never below 1
+		uint32_t width = resample ? baseWidth : (uint32_t)image.width;
+		uint32_t height = resample ? baseHeight : (uint32_t)image.height;
+		uint64_t offset = 0;
+		for (;;)
+		{
+			MipLevel level;
+			level.width = width;
+			level.height = height;
+			level.offset = offset;
+			level.size = (uint64_t)width * height * channels;
+			chain.levels.push_back(level);
+			offset += level.size;
+			if (width == 1 && height == 1)
+			{
+				break;
+			}
+			width = std::max(1u, width / 2);
+			height = std::max(1u, height / 2);
+		}
+		chain.storage.resize((size_t)offset);
+		chain.channels = channels;
+		chain.base = &chain.storage[0];
+		chain.byteCount = (size_t)offset;
+
+		std::vector<float> current, next, columns;
+		toFloat(image.pixels, (size_t)image.width * image.height * channels, channels, mode, current);
+		if (resample)
+		{
+			downsample(current, (uint32_t)image.width, (uint32_t)image.height, chain.levels[0].width,
+				chain.levels[0].height, channels, filter, wrap, columns, next);
+			current.swap(next);
+		}
+		if (mode == MIP_MODE_NORMAL || resample)
+		{
+			// Authored normals are rarely unit length, shaders rebuilding Z from X/Y need them to be
+			if (mode == MIP_MODE_NORMAL)
+			{
+				renormalize(current, channels);
+			}
+			toBytes(current, channels, mode, &chain.storage[0]);
+		}
+		else
+		{
+			memcpy(&chain.storage[0], image.pixels, (size_t)chain.levels[0].size);
+		}
+		for (size_t i = 1; i < chain.levels.size(); ++i)
+		{
+			const MipLevel& source = chain.levels[i - 1];
+			const MipLevel& target = chain.levels[i];
+			downsample(current, source.width, source.height, target.width, target.height,
+				channels, filter, wrap, columns, next);
+			if (mode == MIP_MODE_NORMAL)
+			{
+				renormalize(next, channels);
+			}
+			toBytes(next, channels, mode, &chain.storage[(size_t)target.offset]);
+			current.swap(next);
+		}
+		return true;
+	}
+	/*
+	* Copy the first channels channels of every texel of an uncompressed chain, e.g. the
+	* X/Y of a normal map. Any thread.
+	*/
+	static bool selectChannels(const MipChain& source, int channels, MipChain& result)
+	{
+		result.release();
+		if (source.empty() || source.isCompressed() || channels <= 0 || channels > source.getChannels())
+		{
+			return false;
+		}
+		const int stride = source.getChannels();
+		uint64_t offset = 0;
+		for (std::vector<MipLevel>::const_iterator it = source.getLevels().begin();
+			source.getLevels().end() != it; ++it)
+		{
+			MipLevel level = *it;
+			level.offset = offset;
+			level.size = (uint64_t)level.width * level.height * channels;
+			result.levels.push_back(level);
+			offset += level.size;
+		}
+		result.storage.resize((size_t)offset);
+		result.channels = channels;
+		result.base = &result.storage[0];
+		result.byteCount = (size_t)offset;
+		const size_t texels = (size_t)(offset / channels);
+		const GLubyte* in = source.data();
+		GLubyte* out = &result.storage[0];
+		for (size_t i = 0; i < texels; ++i)
+		{
+			for (int c = 0; c < channels; ++c)
+			{
+				out[i * channels + c] = in[i * stride + c];
+			}
+		}
+		return true;
+	}
+	/*
+	* Per level pointers for glTexImage2D. base is the chain's data, or NULL when the chain
+	* was copied to the start of a bound GL_PIXEL_UNPACK_BUFFER.
+	*/
+	static void levelPointers(const MipChain& chain, const GLubyte* base, std::vector<const GLvoid*>& pointers)
+	{
+		pointers.clear();
+		for (std::vector<MipLevel>::const_iterator it = chain.getLevels().begin();
+			chain.getLevels().end() != it; ++it)
+		{
+			pointers.push_back((const GLvoid*)((uintptr_t)base + (uintptr_t)it->offset));
+		}
+	}
+private:
+	static const int SRGB_ENCODE_SIZE = 16384; // Linear steps in the sRGB encode table
+	static const size_t GRAIN_FLOATS = 65536; // Work per thread range
+
+	// Byte to float and float to sRGB byte conversions, built once
+	struct Tables
+	{
+		float linear[256];
+		float srgb[256];
+		float normal[256];
+		GLubyte toSrgb[SRGB_ENCODE_SIZE];
+		Tables()
+		{
+			for (int i = 0; i < 256; ++i)
+			{
+				const float v = i / 255.0f;
+				this->linear[i] = v;
+				this->srgb[i] = v <= 0.04045f ? v / 12.92f : std::pow((v + 0.055f) / 1.055f, 2.4f);
+				this->normal[i] = v * 2.0f - 1.0f;
+			}
+			for (int i = 0; i < SRGB_ENCODE_SIZE; ++i)
+			{
+				const float v = i / (float)(SRGB_ENCODE_SIZE - 1);
+				const float encoded = v <= 0.0031308f ? v * 12.92f : 1.055f * std::pow(v, 1.0f / 2.4f) - 0.055f;
+				this->toSrgb[i] = (GLubyte)(encoded * 255.0f + 0.5f);
+			}
+		}
+	};
+	// Source texels and weights of each destination texel along one axis
+	struct FilterTaps
+	{
+		std::vector<size_t> offsets; // Taps of texel d are [offsets[d], offsets[d + 1])
+		std::vector<uint32_t> indices;
+		std::vector<float> weights;
+	};
+
+	static const Tables& tables()
+	{
+		static const Tables conversions;
+		return conversions;
+	}
+	/*
+	* Alpha is never gamma encoded or part of a normal
+	*/
+	static bool isAlpha(int channel, int channels)
+	{
+		return (channels == 4 && channel == 3) || (channels == 2 && channel == 1);
+	}
+	static void toFloat(const GLubyte* pixels, size_t count, int channels, MipMode mode, std::vector<float>& out)
+	{
+		const Tables& conversions = tables();
+		const float* lookup[4];
+		for (int c = 0; c < 4; ++c)
+		{
+			lookup[c] = isAlpha(c, channels) || mode == MIP_MODE_LINEAR ? conversions.linear
+				: mode == MIP_MODE_SRGB ? conversions.srgb : conversions.normal;
+		}
+		out.resize(count);
+		for (size_t i = 0; i < count; i += channels)
+		{
+			for (int c = 0; c < channels; ++c)
+			{
+				out[i + c] = lookup[c][pixels[i + c]];
+			}
+		}
+	}
+	static void toBytes(const std::vector<float>& values, int channels, MipMode mode, GLubyte* out)
+	{
+		const Tables& conversions = tables();
+		for (size_t i = 0; i < values.size(); i += channels)
+		{
+			for (int c = 0; c < channels; ++c)
+			{
+				float v = values[i + c];
+				if (mode == MIP_MODE_NORMAL && !isAlpha(c, channels))
+				{
+					v = v * 0.5f + 0.5f;
+				}
+				v = std::min(std::max(v, 0.0f), 1.0f);
+				out[i + c] = mode == MIP_MODE_SRGB && !isAlpha(c, channels)
+					? conversions.toSrgb[(int)(v * (SRGB_ENCODE_SIZE - 1) + 0.5f)]
+					: (GLubyte)(v * 255.0f + 0.5f);
+			}
+		}
+	}
+	static void renormalize(std::vector<float>& values, int channels)
+	{
+		for (size_t i = 0; i < values.size(); i += channels)
+		{
+			float* n = &values[i];
+			const float length = std::sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+			if (length > 0.0f)
+			{
+				n[0] /= length;
+				n[1] /= length;
+				n[2] /= length;
+			}
+			else
+			{
+				n[0] = 0.0f;
+				n[1] = 0.0f;
+				n[2] = 1.0f;
+			}
+		}
+	}
+	static float besselI0(float x)
+	{
+		float sum = 1.0f, term = 1.0f;
+		for (int k = 1; k < 32 && term > sum * 1e-7f; ++k)
+		{
+			const float half = x / (2.0f * k);
+			term *= half * half;
+			sum += term;
+		}
+		return sum;
+	}
+	/*
+	* Filter weight at t destination texels from the texel's centre
+	*/
+	static float kaiser(float t)
+	{
+		if (std::fabs(t) >= MIP_KAISER_HALF_WIDTH)
+		{
+			return 0.0f;
+		}
+		const float x = t / MIP_KAISER_HALF_WIDTH;
+		const float window = besselI0(MIP_KAISER_ALPHA * std::sqrt(1.0f - x * x)) / besselI0(MIP_KAISER_ALPHA);
+		const float pi = 3.14159265f;
+		const float sinc = t == 0.0f ? 1.0f : std::sin(pi * t) / (pi * t);
+		return sinc * window;
+	}
+	/*
+	* Weights for one axis, normalized so flat areas keep their value. Odd source sizes get
+	* three-texel footprints rather than dropping the last row or column.
+	*/
+	static void buildTaps(uint32_t sourceSize, uint32_t targetSize, MipFilter filter, bool wrap, FilterTaps& taps)
+	{
+		taps.offsets.assign(1, 0);
+		taps.indices.clear();
+		taps.weights.clear();
+		const float scale = (float)sourceSize / targetSize; // Source texels per destination texel
+		const float support = (filter == MIP_FILTER_BOX ? 0.5f : MIP_KAISER_HALF_WIDTH) * scale;
+		for (uint32_t d = 0; d < targetSize; ++d)
+		{
+			const float center = (d + 0.5f) * scale;
+			const int first = (int)std::floor(center - support);
+			const int last = (int)std::ceil(center + support);
+			const size_t begin = taps.weights.size();
+			float sum = 0.0f;
+			for (int s = first; s < last; ++s)
+			{
+				// Source texel s covers [s, s + 1]
+				const float weight = filter == MIP_FILTER_BOX
+					? std::max(0.0f, std::min(s + 1.0f, center + support) - std::max((float)s, center - support))
+					: kaiser((s + 0.5f - center) / scale);
+				if (weight == 0.0f)
+				{
+					continue;
+				}
+				const int size = (int)sourceSize;
+				const int index = wrap ? ((s % size) + size) % size : std::min(std::max(s, 0), size - 1);
+				taps.indices.push_back((uint32_t)index);
+				taps.weights.push_back(weight);
+				sum += weight;
+			}
+			for (size_t k = begin; k < taps.weights.size(); ++k)
+			{
+				taps.weights[k] /= sum;
+			}
+			taps.offsets.push_back(taps.weights.size());
+		}
+	}
+	/*
+	* out[i] = sum of weights[k] * inputs[k][i], the same order with and without SSE2
+	*/
+	static void weightedRowSum(const float* const* inputs, const float* weights, size_t tapCount,
+		size_t count, float* out)
+	{
+		size_t i = 0;
+#ifdef TEXTURE_MIPS_SSE2
+		for (; i + 4 <= count; i += 4)
+		{
+			__m128 sum = _mm_setzero_ps();
+			for (size_t k = 0; k < tapCount; ++k)
+			{
+				sum = _mm_add_ps(sum, _mm_mul_ps(_mm_set1_ps(weights[k]), _mm_loadu_ps(inputs[k] + i)));
+			}
+			_mm_storeu_ps(out + i, sum);
+		}
+#endif
+		for (; i < count; ++i)
+		{
+			float sum = 0.0f;
+			for (size_t k = 0; k < tapCount; ++k)
+			{
+				sum += weights[k] * inputs[k][i];
+			}
+			out[i] = sum;
+		}
+	}
+	/*
+	* One level from the level above: rows are combined first, then texels along each row
+	*/
+	static void downsample(const std::vector<float>& source, uint32_t sourceWidth, uint32_t sourceHeight,
+		uint32_t targetWidth, uint32_t targetHeight, int channels, MipFilter filter, bool wrap,
+		std::vector<float>& columns, std::vector<float>& target)
+	{
+		FilterTaps vertical, horizontal;
+		buildTaps(sourceHeight, targetHeight, filter, wrap, vertical);
+		buildTaps(sourceWidth, targetWidth, filter, wrap, horizontal);
+		const size_t sourceRow = (size_t)sourceWidth * channels;
+		const size_t targetRow = (size_t)targetWidth * channels;
+		columns.resize(sourceRow * targetHeight);
+		target.resize(targetRow * targetHeight);
+		ParallelHelper::parallelRanges(targetHeight, std::max<size_t>(1, GRAIN_FLOATS / sourceRow),
+			[&](size_t begin, size_t end)
+		{
+			std::vector<const float*> rows;
+			for (size_t y = begin; y < end; ++y)
+			{
+				rows.clear();
+				for (size_t k = vertical.offsets[y]; k < vertical.offsets[y + 1]; ++k)
+				{
+					rows.push_back(&source[vertical.indices[k] * sourceRow]);
+				}
+				weightedRowSum(rows.data(), &vertical.weights[vertical.offsets[y]], rows.size(),
+					sourceRow, &columns[y * sourceRow]);
+			}
+		});
+		ParallelHelper::parallelRanges(targetHeight, std::max<size_t>(1, GRAIN_FLOATS / sourceRow),
+			[&](size_t begin, size_t end)
+		{
+			for (size_t y = begin; y < end; ++y)
+			{
+				const float* in = &columns[y * sourceRow];
+				float* out = &target[y * targetRow];
+				for (uint32_t x = 0; x < targetWidth; ++x)
+				{
+					float sum[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+					for (size_t k = horizontal.offsets[x]; k < horizontal.offsets[x + 1]; ++k)
+					{
+						const float weight = horizontal.weights[k];
+						const float* texel = in + (size_t)horizontal.indices[k] * channels;
+						for (int c = 0; c < channels; ++c)
+						{
+							sum[c] += weight * texel[c];
+						}
+					}
+					for (int c = 0; c < channels; ++c)
+					{
+						out[(size_t)x * channels + c] = sum[c];
+					}
+				}
+			}
+		});
+	}
+};
+
+// Bump whenever generated levels or the file layout below change
+const uint32_t MIP_CACHE_VERSION = 2;
+
+// Folder, relative to the working directory, that holds the cache files
+const char* const MIP_CACHE_DIRECTORY = "texturecache";
+
+// File header, followed by one MipLevel per level and then the pixels
+struct MipCacheHeader
+{
+	char magic[4];
+	uint32_t version;
+	uint64_t contentKey; // Source file hash and load settings, also the file name
+	uint64_t pixelHash; // Of the decoded image, so warm loads still share textures by pixels
+	uint32_t channels;
+	uint32_t levelCount;
+	uint64_t dataOffset; // 16-byte aligned, level offsets count from here
+};
+
+/*
+* Content-addressed cache of generated mip chains, one file per source image and settings.
+* Warm loads map the file and upload every level from it, nothing is decoded or filtered.
+*/
+class MipCache
+{
+public:
+	static std::string cachePath(uint64_t contentKey, const char* extension = ".mips")
+	{
+		char name[32];
+		snprintf(name, sizeof(name), "%016llx", (unsigned long long)contentKey);
+		return std::string(MIP_CACHE_DIRECTORY) + "/" + name + extension;
+	}
+	/*
+	* Map a cached chain, false on a miss or a file that does not check out. Any thread.
+	*/
+	static bool open(uint64_t contentKey, MipChain& chain, uint64_t& pixelHash)
+	{
+		chain.release();
+		const std::string path = cachePath(contentKey);
+		std::unique_ptr<MappedFile> file(new MappedFile());
+		if (!file->open(path))
+		{
+			return false;
+		}
+		const unsigned char* base = file->data();
+		const uint64_t fileSize = file->size();
+		if (fileSize < sizeof(MipCacheHeader))
+		{
+			return reject(path, "truncated header");
+		}
+		const MipCacheHeader* header = (const MipCacheHeader*)base;
+		if (memcmp(header->magic, "MIPC", 4) != 0 || header->version != MIP_CACHE_VERSION)
+		{
+			return reject(path, "unknown format version");
+		}
+		if (header->contentKey != contentKey || header->channels == 0 || header->channels > 4
+			|| header->levelCount == 0 || header->levelCount > 32)
+		{
+			return reject(path, "bad header");
+		}
+		const uint64_t tableEnd = sizeof(MipCacheHeader) + (uint64_t)header->levelCount * sizeof(MipLevel);
+		if (header->dataOffset < tableEnd || header->dataOffset % 16 != 0 || header->dataOffset > fileSize)
+		{
+			return reject(path, "truncated level table");
+		}
+		const MipLevel* table = (const MipLevel*)(base + sizeof(MipCacheHeader));
+		const uint64_t dataSize = fileSize - header->dataOffset;
+		// Every level must have the size GL expects, so uploads never read past the mapping
+		for (uint32_t i = 0; i < header->levelCount; ++i)
+		{
+			const MipLevel& level = table[i];
+			const bool sizeOk = i == 0 ? level.width > 0 && level.height > 0
+				: level.width == std::max(1u, table[i - 1].width / 2)
+					&& level.height == std::max(1u, table[i - 1].height / 2);
+			if (!sizeOk || level.size != (uint64_t)level.width * level.height * header->channels
+				|| level.offset > dataSize || level.size > dataSize - level.offset)
+			{
+				return reject(path, "level out of range");
+			}
+		}
+		const MipLevel& last = table[header->levelCount - 1];
+		if (last.width != 1 || last.height != 1)
+		{
+			return reject(path, "incomplete chain");
+		}
+		chain.levels.assign(table, table + header->levelCount);
+		chain.channels = (int)header->channels;
+		chain.base = base + header->dataOffset;
+		chain.byteCount = (size_t)(last.offset + last.size);
+		chain.file = std::move(file);
+		pixelHash = header->pixelHash;
+		return true;
+	}
+	/*
+	* Store a generated chain, any thread. Written to a temporary file first so readers
+	* never see half a chain.
+	*/
+	static bool write(uint64_t contentKey, const MipChain& chain, uint64_t pixelHash)
+	{
+		if (chain.empty() || chain.isCompressed() || !makeDirectory(MIP_CACHE_DIRECTORY))
+		{
+			return false;
+		}
+		const std::string path = cachePath(contentKey);
+		const std::string tempPath = temporaryPath(path);
+		std::ofstream out(tempPath.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+		if (!out)
+		{
+			return false;
+		}
+		MipCacheHeader header;
+		memset(&header, 0, sizeof(header));
+		memcpy(header.magic, "MIPC", 4);
+		header.version = MIP_CACHE_VERSION;
+		header.contentKey = contentKey;
+		header.pixelHash = pixelHash;
+		header.channels = (uint32_t)chain.getChannels();
+		header.levelCount = (uint32_t)chain.getLevels().size();
+		header.dataOffset = (sizeof(MipCacheHeader) + chain.getLevels().size() * sizeof(MipLevel) + 15) & ~(uint64_t)15;
+		out.write((const char*)&header, sizeof(header));
+		out.write((const char*)&chain.getLevels()[0], chain.getLevels().size() * sizeof(MipLevel));
+		const char zeros[16] = { 0 };
+		out.write(zeros, (std::streamsize)(header.dataOffset - (uint64_t)out.tellp()));
+		out.write((const char*)chain.data(), (std::streamsize)chain.size());
+		out.close();
+		if (!out)
+		{
+			std::remove(tempPath.c_str());
+			return false;
+		}
+		std::remove(path.c_str());
+		return std::rename(tempPath.c_str(), path.c_str()) == 0;
+	}
+	/*
+	* Two threads may store the same file at once, each writes its own temporary file
+	*/
+	static std::string temporaryPath(const std::string& path)
+	{
+		char suffix[32];
+		snprintf(suffix, sizeof(suffix), ".%zx.tmp", std::hash<std::thread::id>()(std::this_thread::get_id()));
+		return path + suffix;
+	}
+	static bool makeDirectory(const char* path)
+	{
+#ifdef _WIN32
+		return _mkdir(path) == 0 || errno == EEXIST;
+#else
+		return mkdir(path, 0755) == 0 || errno == EEXIST;
+#endif
+	}
+private:
+	static bool reject(const std::string& path, const char* reason)
+	{
+		std::cout << "Info:MipCache::open, regenerating " << path << ": " << reason << std::endl;
+		return false;
+	}
+};
+
+#endif
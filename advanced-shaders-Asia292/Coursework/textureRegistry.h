@@ -0,0 +1,464 @@
+#ifndef _TEXTURE_REGISTRY_H_
+#define _TEXTURE_REGISTRY_H_
+
+#include <GLEW/glew.h>
+#include <SOIL/SOIL.h>
+#include <cstdint>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "ddsFile.h"
+#include "glHandle.h"
+#include "hashHelper.h"
+#include "mappedFile.h"
+#include "texture.h"
+#include "textureCompress.h"
+#include "textureMips.h"
+
+// Small integer naming a registry texture, 0 is no texture
+typedef uint32_t TextureHandle;
+const TextureHandle INVALID_TEXTURE_HANDLE = 0;
+
+// Load and upload settings that change the resulting texture, part of the registry key
+struct TextureParams
+{
+	GLint internalFormat;
+	GLenum picFormat;
+	int loadChannels;
+	GLboolean alpha; // Clamp instead of repeat
+	MipMode mipMode;
+	MipFilter mipFilter;
+	TextureCompression compression; // Blocks replace internalFormat unless NONE
+	CompressionQuality compressionQuality;
+	bool streamed; // Through TextureStreamer only the mip tail is uploaded, see TextureResidency
+	TextureParams() :internalFormat(GL_RGB), picFormat(GL_RGB), loadChannels(SOIL_LOAD_RGB), alpha(GL_FALSE),
+		mipMode(MIP_MODE_LINEAR), mipFilter(MIP_FILTER_KAISER), compression(TEXTURE_COMPRESSION_NONE),
+		compressionQuality(COMPRESSION_QUALITY_NORMAL), streamed(false) {}
+	explicit TextureParams(MipMode mipMode, TextureCompression compression = TEXTURE_COMPRESSION_NONE)
+		:internalFormat(GL_RGB), picFormat(GL_RGB), loadChannels(SOIL_LOAD_RGB), alpha(GL_FALSE),
+		mipMode(mipMode), mipFilter(MIP_FILTER_KAISER), compression(compression),
+		compressionQuality(COMPRESSION_QUALITY_NORMAL), streamed(false) {}
+	/*
+	* Tangent space normal map: decoded as RGB to renormalize, stored as X/Y only (BC5 or
+	* RG8), shaders rebuild Z
+	*/
+	static TextureParams normalMap()
+	{
+		TextureParams params(MIP_MODE_NORMAL, BlockCompressor::preferredNormalFormat());
+		params.internalFormat = GL_RG8;
+		params.picFormat = GL_RG;
+		return params;
+	}
+	uint64_t hash() const
+	{
+		uint64_t h = HashHelper::combine(0, (uint64_t)this->internalFormat);
+		h = HashHelper::combine(h, (uint64_t)this->picFormat);
+		h = HashHelper::combine(h, (uint64_t)this->loadChannels);
+		h = HashHelper::combine(h, (uint64_t)this->alpha);
+		h = HashHelper::combine(h, (uint64_t)this->mipMode);
+		h = HashHelper::combine(h, (uint64_t)this->mipFilter);
+		if (this->streamed)
+		{
+			h = HashHelper::combine(h, 1);
+		}
+		if (this->compression == TEXTURE_COMPRESSION_NONE)
+		{
+			return h;
+		}
+		h = HashHelper::combine(h, (uint64_t)this->compression);
+		return HashHelper::combine(h, (uint64_t)this->compressionQuality);
+	}
+};
+
+/*
+* Process-wide texture cache shared by every Model. Entries are keyed by the hash of
+* the file bytes and, after decoding, of the pixels, so a second model using the same
+* image, or the same pixels under another name, shares one GL texture. Entries are
+* reference counted and deleted when the last user releases them.
+* Lookups may run on any thread, everything that touches GL runs on the GL thread.
+*/
+class TextureRegistry
+{
+public:
+	static TextureRegistry& instance()
+	{
+		// Never destroyed, models released during static destruction still find it
+		static TextureRegistry* registry = new TextureRegistry();
+		return *registry;
+	}
+	/*
+	* Hash of a file's bytes, any thread
+	*/
+	static bool hashFile(const std::string& path, uint64_t& fileHash)
+	{
+		MappedFile file;
+		if (!file.open(path))
+		{
+			return false;
+		}
+		fileHash = HashHelper::hash64(file.data(), file.size());
+		return true;
+	}
+	/*
+	* Resident entry for a file's bytes without taking a reference, any thread
+	*/
+	TextureHandle find(uint64_t fileHash, const TextureParams& params = TextureParams()) const
+	{
+		std::lock_guard<std::mutex> lock(this->mutex);
+		std::unordered_map<uint64_t, TextureHandle>::const_iterator it =
+			this->fileKeys.find(HashHelper::combine(fileHash, params.hash()));
+		return it == this->fileKeys.end() ? INVALID_TEXTURE_HANDLE : it->second;
+	}
+	/*
+	* Referenced handle for an image file, loading it only if no entry matches. GL thread.
+	*/
+	TextureHandle acquire(const std::string& path, const TextureParams& params = TextureParams())
+	{
+		uint64_t fileHash = 0;
+		if (!hashFile(path, fileHash))
+		{
+			std::cerr << "Error:TextureRegistry::acquire, could not open texture file: " << path << std::endl;
+			return INVALID_TEXTURE_HANDLE;
+		}
+		TextureHandle handle = this->acquireExisting(fileHash, 0, params);
+		if (handle != INVALID_TEXTURE_HANDLE)
+		{
+			return handle;
+		}
+		if (DdsFile::isDdsFile(path))
+		{
+			// Already a finished chain, uploaded as stored whatever params ask for
+			int width = 0, height = 0;
+			GLTexture texture(DdsFile::loadTexture(path, params.alpha, width, height));
+			return this->insert(path, fileHash, 0, std::move(texture), width, height, params);
+		}
+		MipChain mips;
+		uint64_t pixelHash = 0;
+		if (!loadMips(path, fileHash, params, mips, pixelHash))
+		{
+			return INVALID_TEXTURE_HANDLE;
+		}
+		handle = this->acquireExisting(fileHash, pixelHash, params);
+		if (handle != INVALID_TEXTURE_HANDLE)
+		{
+			return handle;
+		}
+		const MipLevel& top = mips.getLevels()[0];
+		GLTexture texture(createTexture(mips, mips.data(), params));
+		return this->insert(path, fileHash, pixelHash, std::move(texture), top.width, top.height, params);
+	}
+	/*
+	* Create a texture from every level of a chain, base as for MipGenerator::levelPointers. GL thread.
+	*/
+	static GLuint createTexture(const MipChain& mips, const GLubyte* base, const TextureParams& params)
+	{
+		std::vector<const GLvoid*> levels;
+		MipGenerator::levelPointers(mips, base, levels);
+		const MipLevel& top = mips.getLevels()[0];
+		if (!mips.isCompressed())
+		{
+			return TextureHelper::create2DTextureLevels(top.width, top.height, levels,
+				params.internalFormat, params.picFormat, params.alpha);
+		}
+		std::vector<GLsizei> sizes;
+		for (std::vector<MipLevel>::const_iterator it = mips.getLevels().begin(); mips.getLevels().end() != it; ++it)
+		{
+			sizes.push_back((GLsizei)it->size);
+		}
+		return TextureHelper::createCompressed2DTextureLevels(top.width, top.height, mips.getFormat(),
+			levels, sizes, params.alpha);
+	}
+	/*
+	* Every mip level of an image file: mapped from the MipCache (a DDS file when compressed)
+	* when a chain for these bytes and settings exists, otherwise decoded, generated,
+	* compressed and stored there. A nonzero baseWidth and baseHeight resample the image to
+	* that size, cached separately. Any thread.
+	*/
+	static bool loadMips(const std::string& path, uint64_t fileHash, const TextureParams& params,
+		MipChain& mips, uint64_t& pixelHash, uint32_t baseWidth = 0, uint32_t baseHeight = 0)
+	{
+		// Streaming changes how a chain is uploaded, not the chain
+		TextureParams chainParams = params;
+		chainParams.streamed = false;
+		uint64_t contentKey = HashHelper::combine(fileHash, chainParams.hash());
+		if (baseWidth > 0 && baseHeight > 0)
+		{
+			contentKey = HashHelper::combine(contentKey, ((uint64_t)baseWidth << 32) | baseHeight);
+		}
+		const bool compressed = params.compression != TEXTURE_COMPRESSION_NONE;
+		if (compressed ? DdsFile::openCached(contentKey, mips, pixelHash) : MipCache::open(contentKey, mips, pixelHash))
+		{
+			return true;
+		}
+		TextureImage image;
+		if (!TextureHelper::decode2DImage(path.c_str(), image, params.loadChannels))
+		{
+			return false;
+		}
+		pixelHash = hashPixels(image);
+		const bool generated = MipGenerator::generate(image, params.mipMode, params.mipFilter,
+			params.alpha == GL_FALSE, mips, baseWidth, baseHeight);
+		image.release();
+		if (!generated)
+		{
+			return false;
+		}
+		if (compressed)
+		{
+			MipChain blocks;
+			BlockCompressor::compress(mips, params.compression, params.compressionQuality, blocks);
+			mips.swap(blocks);
+		}
+		else if (params.picFormat == GL_RG && mips.getChannels() > 2)
+		{
+			MipChain xy;
+			MipGenerator::selectChannels(mips, 2, xy);
+			mips.swap(xy);
+		}
+		if (compressed ? !DdsFile::writeCached(contentKey, mips, pixelHash) : !MipCache::write(contentKey, mips, pixelHash))
+		{
+			std::cerr << "Warning:TextureRegistry::loadMips, could not write mip cache: "
+				<< MipCache::cachePath(contentKey, compressed ? ".dds" : ".mips") << std::endl;
+		}
+		return true;
+	}
+	/*
+	* Hash of decoded pixels and their size, any thread
+	*/
+	static uint64_t hashPixels(const TextureImage& image)
+	{
+		const uint64_t h = HashHelper::hash64(image.pixels, (size_t)image.width * image.height * image.channels);
+		return HashHelper::combine(h, ((uint64_t)image.width << 32) | (uint64_t)image.height);
+	}
+	/*
+	* Reference an entry matching the file, or else the pixels (pixelHash 0 skips that test).
+	* A pixel match also records the file, so its next lookup hits directly. Any thread.
+	*/
+	TextureHandle acquireExisting(uint64_t fileHash, uint64_t pixelHash, const TextureParams& params = TextureParams())
+	{
+		const uint64_t paramsHash = params.hash();
+		const uint64_t fileKey = HashHelper::combine(fileHash, paramsHash);
+		std::lock_guard<std::mutex> lock(this->mutex);
+		std::unordered_map<uint64_t, TextureHandle>::const_iterator it = this->fileKeys.find(fileKey);
+		if (it != this->fileKeys.end())
+		{
+			++this->entry(it->second).refCount;
+			return it->second;
+		}
+		if (pixelHash == 0)
+		{
+			return INVALID_TEXTURE_HANDLE;
+		}
+		// Same pixels under another file name
+		it = this->pixelKeys.find(HashHelper::combine(pixelHash, paramsHash));
+		if (it == this->pixelKeys.end())
+		{
+			return INVALID_TEXTURE_HANDLE;
+		}
+		Entry& shared = this->entry(it->second);
+		++shared.refCount;
+		shared.fileKeys.push_back(fileKey);
+		this->fileKeys[fileKey] = it->second;
+		return it->second;
+	}
+	/*
+	* Register a texture uploaded by the caller, e.g. TextureStreamer, with one reference.
+	* Call acquireExisting first, entries are not merged here.
+	*/
+	TextureHandle insert(const std::string& path, uint64_t fileHash, uint64_t pixelHash, GLTexture texture,
+		int width, int height, const TextureParams& params = TextureParams())
+	{
+		if (texture.get() == 0)
+		{
+			return INVALID_TEXTURE_HANDLE;
+		}
+		const uint64_t paramsHash = params.hash();
+		Entry created;
+		created.texture = std::move(texture);
+		created.width = width;
+		created.height = height;
+		created.path = path;
+		created.fileKeys.push_back(HashHelper::combine(fileHash, paramsHash));
+		created.pixelKey = HashHelper::combine(pixelHash, paramsHash);
+		created.refCount = 1;
+		std::lock_guard<std::mutex> lock(this->mutex);
+		TextureHandle handle;
+		if (!this->freeHandles.empty())
+		{
+			handle = this->freeHandles.back();
+			this->freeHandles.pop_back();
+			this->entry(handle) = std::move(created);
+		}
+		else
+		{
+			this->entries.push_back(std::move(created));
+			handle = (TextureHandle)this->entries.size();
+		}
+		const Entry& inserted = this->entry(handle);
+		this->fileKeys[inserted.fileKeys[0]] = handle;
+		this->pixelKeys[inserted.pixelKey] = handle;
+		return handle;
+	}
+	void addRef(TextureHandle handle)
+	{
+		std::lock_guard<std::mutex> lock(this->mutex);
+		if (this->isLive(handle))
+		{
+			++this->entry(handle).refCount;
+		}
+	}
+	/*
+	* Drop a reference, the texture is deleted with the last one. GL thread.
+	*/
+	void release(TextureHandle handle)
+	{
+		std::lock_guard<std::mutex> lock(this->mutex);
+		if (!this->isLive(handle))
+		{
+			return;
+		}
+		Entry& released = this->entry(handle);
+		if (--released.refCount > 0)
+		{
+			return;
+		}
+		// A later insert of the same file or pixels may have taken the key over, it keeps it
+		for (size_t i = 0; i < released.fileKeys.size(); ++i)
+		{
+			eraseKey(this->fileKeys, released.fileKeys[i], handle);
+		}
+		eraseKey(this->pixelKeys, released.pixelKey, handle);
+		released = Entry();
+		this->freeHandles.push_back(handle);
+	}
+	uint32_t getRefCount(TextureHandle handle) const
+	{
+		std::lock_guard<std::mutex> lock(this->mutex);
+		return this->isLive(handle) ? this->entry(handle).refCount : 0;
+	}
+	GLuint getId(TextureHandle handle) const
+	{
+		std::lock_guard<std::mutex> lock(this->mutex);
+		return this->isLive(handle) ? this->entry(handle).texture.get() : 0;
+	}
+	/*
+	* File the entry was first loaded from
+	*/
+	std::string getPath(TextureHandle handle) const
+	{
+		std::lock_guard<std::mutex> lock(this->mutex);
+		return this->isLive(handle) ? this->entry(handle).path : std::string();
+	}
+	size_t getTextureCount() const
+	{
+		std::lock_guard<std::mutex> lock(this->mutex);
+		return this->entries.size() - this->freeHandles.size();
+	}
+private:
+	static void eraseKey(std::unordered_map<uint64_t, TextureHandle>& keys, uint64_t key, TextureHandle handle)
+	{
+		std::unordered_map<uint64_t, TextureHandle>::iterator it = keys.find(key);
+		if (it != keys.end() && it->second == handle)
+		{
+			keys.erase(it);
+		}
+	}
+	struct Entry
+	{
+		GLTexture texture;
+		std::string path;
+		std::vector<uint64_t> fileKeys; // Every file that resolved to this entry
+		uint64_t pixelKey;
+		uint32_t refCount;
+		int width, height;
+		Entry() :pixelKey(0), refCount(0), width(0), height(0) {}
+	};
+	mutable std::mutex mutex; // Guards the tables, GL calls are made by the GL thread only
+	std::vector<Entry> entries; // Handle - 1 indexes this
+	std::vector<TextureHandle> freeHandles;
+	std::unordered_map<uint64_t, TextureHandle> fileKeys;
+	std::unordered_map<uint64_t, TextureHandle> pixelKeys;
+
+	TextureRegistry() {}
+	TextureRegistry(const TextureRegistry&) = delete;
+	TextureRegistry& operator=(const TextureRegistry&) = delete;
+	bool isLive(TextureHandle handle) const
+	{
+		return handle != INVALID_TEXTURE_HANDLE && handle <= this->entries.size()
+			&& this->entries[handle - 1].refCount > 0;
+	}
+	Entry& entry(TextureHandle handle) { return this->entries[handle - 1]; }
+	const Entry& entry(TextureHandle handle) const { return this->entries[handle - 1]; }
+};
+
+/*
+* Holds one registry reference, copies take their own. GL thread.
+*/
+class TextureReference
+{
+public:
+	TextureReference() :handle(INVALID_TEXTURE_HANDLE) {}
+	/*
+	* Share a handle the caller already holds
+	*/
+	explicit TextureReference(TextureHandle handle) :handle(handle)
+	{
+		TextureRegistry::instance().addRef(this->handle);
+	}
+	/*
+	* Take over a reference the caller holds, e.g. one returned by acquire or insert
+	*/
+	static TextureReference adopt(TextureHandle handle)
+	{
+		TextureReference reference;
+		reference.handle = handle;
+		return reference;
+	}
+	TextureReference(const TextureReference& other) :handle(other.handle)
+	{
+		TextureRegistry::instance().addRef(this->handle);
+	}
+	TextureReference(TextureReference&& other) noexcept :handle(other.handle)
+	{
+		other.handle = INVALID_TEXTURE_HANDLE;
+	}
+	TextureReference& operator=(const TextureReference& other)
+	{
+		if (this != &other)
+		{
+			TextureRegistry::instance().addRef(other.handle);
+			this->reset();
+			this->handle = other.handle;
+		}
+		return *this;
+	}
+	TextureReference& operator=(TextureReference&& other) noexcept
+	{
+		if (this != &other)
+		{
+			this->reset();
+			this->handle = other.handle;
+			other.handle = INVALID_TEXTURE_HANDLE;
+		}
+		return *this;
+	}
+	~TextureReference()
+	{
+		this->reset();
+	}
+	void reset()
+	{
+		if (this->handle != INVALID_TEXTURE_HANDLE)
+		{
+			TextureRegistry::instance().release(this->handle);
+			this->handle = INVALID_TEXTURE_HANDLE;
+		}
+	}
+	TextureHandle get() const { return this->handle; }
+private:
+	TextureHandle handle;
+};
+
+#endif
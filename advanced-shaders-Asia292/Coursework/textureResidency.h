@@ -0,0 +1,354 @@
+#ifndef _TEXTURE_RESIDENCY_H_
+#define _TEXTURE_RESIDENCY_H_
+
+#include <GLEW/glew.h>
+#include <glm/glm.hpp>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+#include "texture.h"
+#include "textureMips.h"
+#include "textureRegistry.h"
+
+/*
+* How finely a draw samples its textures, set up per draw like LodSelector. The result
+* is in UV units per screen pixel at the mesh's nearest point, so it holds for any
+* texture the mesh uses.
+*/
+class TextureDemand
+{
+public:
+	/*
+	* The projection's [1][1] is 1 / tan(fovy / 2), see LodSelector
+	*/
+	TextureDemand(const glm::mat4& projection, float viewportHeight, const glm::mat4& model,
+		const glm::vec3& cameraPos)
+	{
+		this->pixelScale = projection[1][1] * viewportHeight * 0.5f;
+		this->cameraPos = glm::vec3(glm::inverse(model) * glm::vec4(cameraPos, 1.0f));
+	}
+	/*
+	* uvDensity is UV units per object space unit, see Mesh::getUvDensity. 0 when the
+	* camera is inside the bounds: the finest level is needed.
+	*/
+	float uvPerPixel(const glm::vec3& boundsMin, const glm::vec3& boundsMax, float uvDensity) const
+	{
+		const glm::vec3 closest = glm::clamp(this->cameraPos, boundsMin, boundsMax);
+		return uvDensity * glm::length(this->cameraPos - closest) / this->pixelScale;
+	}
+private:
+	glm::vec3 cameraPos;
+	float pixelScale; // Pixels covered by one unit at distance 1
+};
+
+/*
+* Progressive residency for textures loaded with TextureParams::streamed. Such a texture
+* is created with only its mip tail; draws report how finely they sample it through
+* request() and update() uploads the finer levels that demand calls for, straight from
+* the texture's mapped mip chain, lowering GL_TEXTURE_BASE_LEVEL as they arrive.
+* Above the memory budget the least recently needed textures give up their top levels:
+* the base level goes back up and the dropped levels are redefined empty so the driver
+* can free them. The GL name never changes, so meshes keep the id they were given.
+* GL thread only.
+*/
+class TextureResidency
+{
+public:
+	static const uint32_t TAIL_SIZE = 64; // Levels this size and smaller are always resident
+
+	static TextureResidency& instance()
+	{
+		// Never destroyed, clear() drops the textures while the context exists
+		static TextureResidency* residency = new TextureResidency();
+		return *residency;
+	}
+	/*
+	* First level of the always resident tail
+	*/
+	static size_t tailLevel(const MipChain& mips)
+	{
+		size_t level = 0;
+		while (level + 1 < mips.getLevels().size()
+			&& std::max(mips.getLevels()[level].width, mips.getLevels()[level].height) > TAIL_SIZE)
+		{
+			++level;
+		}
+		return level;
+	}
+	/*
+	* Create a texture holding only the tail of a chain, the rest follows through track()
+	*/
+	static GLuint createTexture(const MipChain& mips, const TextureParams& params)
+	{
+		if (mips.empty())
+		{
+			return 0;
+		}
+		const GLuint textureId = TextureHelper::createEmpty2DTexture(params.alpha);
+		const size_t tail = tailLevel(mips);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, (GLint)mips.getLevels().size() - 1);
+		for (size_t level = tail; level < mips.getLevels().size(); ++level)
+		{
+			uploadLevel(mips, level, params);
+		}
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, (GLint)tail);
+		glBindTexture(GL_TEXTURE_2D, 0);
+		return textureId;
+	}
+	/*
+	* Stream a texture made by createTexture, taking over its chain and one reference
+	*/
+	void track(TextureHandle handle, MipChain& mips, const TextureParams& params)
+	{
+		const GLuint textureId = TextureRegistry::instance().getId(handle);
+		if (textureId == 0 || mips.empty() || this->textures.count(handle) != 0)
+		{
+			return;
+		}
+		std::unique_ptr<Streamed> streamed(new Streamed(handle, params));
+		streamed->id = textureId;
+		streamed->mips.swap(mips);
+		streamed->tailLevel = streamed->baseLevel = tailLevel(streamed->mips);
+		streamed->wantedLevel = streamed->tailLevel;
+		streamed->lastNeeded = this->frame;
+		streamed->residentBytes = residentSize(streamed->mips, streamed->baseLevel);
+		this->residentBytes += streamed->residentBytes;
+		this->textures[handle] = std::move(streamed);
+	}
+	/*
+	* Record that a draw samples a texture at uvPerPixel (see TextureDemand), the finest
+	* request of a frame counts. Handles that are not streamed are ignored.
+	*/
+	void request(TextureHandle handle, float uvPerPixel)
+	{
+		std::unordered_map<TextureHandle, std::unique_ptr<Streamed> >::iterator it = this->textures.find(handle);
+		if (it == this->textures.end())
+		{
+			return;
+		}
+		Streamed& streamed = *it->second;
+		if (streamed.lastNeeded != this->frame || uvPerPixel < streamed.uvPerPixel)
+		{
+			streamed.uvPerPixel = uvPerPixel;
+		}
+		streamed.lastNeeded = this->frame;
+	}
+	/*
+	* Apply this frame's requests: upload up to maxUploadBytes of needed levels, evicting
+	* least recently needed levels to stay within the budget. Call once per frame.
+	*/
+	void update(size_t maxUploadBytes = 4 * 1024 * 1024)
+	{
+		this->releaseUnused();
+		std::vector<Streamed*> needed;
+		for (std::unordered_map<TextureHandle, std::unique_ptr<Streamed> >::iterator it = this->textures.begin();
+			this->textures.end() != it; ++it)
+		{
+			Streamed& streamed = *it->second;
+			if (streamed.lastNeeded == this->frame)
+			{
+				streamed.wantedLevel = wantedLevel(streamed);
+				if (streamed.wantedLevel < streamed.baseLevel)
+				{
+					needed.push_back(&streamed);
+				}
+			}
+		}
+		// Largest shortfall first, a texture far too blurry is the most visible
+		std::sort(needed.begin(), needed.end(), [](const Streamed* a, const Streamed* b)
+		{
+			return a->baseLevel - a->wantedLevel > b->baseLevel - b->wantedLevel;
+		});
+		size_t uploaded = 0;
+		for (size_t i = 0; i < needed.size() && uploaded < maxUploadBytes; ++i)
+		{
+			Streamed& streamed = *needed[i];
+			while (streamed.baseLevel > streamed.wantedLevel && uploaded < maxUploadBytes)
+			{
+				const size_t levelBytes = (size_t)streamed.mips.getLevels()[streamed.baseLevel - 1].size;
+				if (!this->makeRoom(levelBytes, streamed))
+				{
+					break;
+				}
+				this->raise(streamed);
+				uploaded += levelBytes;
+			}
+		}
+		++this->frame;
+	}
+	void setBudget(size_t bytes)
+	{
+		this->budget = bytes;
+	}
+	size_t getBudget() const { return this->budget; }
+	size_t getResidentBytes() const { return this->residentBytes; }
+	size_t getTextureCount() const { return this->textures.size(); }
+	/*
+	* Drop every streamed texture, call before the GL context goes
+	*/
+	void clear()
+	{
+		this->textures.clear();
+		this->residentBytes = 0;
+	}
+private:
+	static const size_t DEFAULT_BUDGET = 256 * 1024 * 1024;
+
+	struct Streamed
+	{
+		TextureReference reference;
+		GLuint id;
+		MipChain mips; // Mapped from the texture cache, levels are uploaded from here
+		TextureParams params;
+		size_t baseLevel; // Finest resident level
+		size_t tailLevel;
+		size_t wantedLevel; // From the last frame it was needed
+		float uvPerPixel;
+		uint64_t lastNeeded; // Frame of the last request
+		size_t residentBytes;
+		Streamed(TextureHandle handle, const TextureParams& params) :reference(handle), id(0), params(params),
+			baseLevel(0), tailLevel(0), wantedLevel(0), uvPerPixel(0.0f), lastNeeded(0), residentBytes(0) {}
+	};
+	std::unordered_map<TextureHandle, std::unique_ptr<Streamed> > textures;
+	uint64_t frame;
+	size_t budget;
+	size_t residentBytes;
+
+	TextureResidency() :frame(1), budget(DEFAULT_BUDGET), residentBytes(0) {}
+	TextureResidency(const TextureResidency&) = delete;
+	TextureResidency& operator=(const TextureResidency&) = delete;
+
+	static size_t residentSize(const MipChain& mips, size_t baseLevel)
+	{
+		size_t bytes = 0;
+		for (size_t level = baseLevel; level < mips.getLevels().size(); ++level)
+		{
+			bytes += (size_t)mips.getLevels()[level].size;
+		}
+		return bytes;
+	}
+	/*
+	* Finest level worth having: the one whose texels are about a pixel apart on screen
+	*/
+	static size_t wantedLevel(const Streamed& streamed)
+	{
+		const float texelsPerPixel = streamed.uvPerPixel * (float)streamed.mips.getLevels()[0].width;
+		if (texelsPerPixel <= 1.0f)
+		{
+			return 0;
+		}
+		return std::min(streamed.tailLevel, (size_t)std::floor(std::log2(texelsPerPixel)));
+	}
+	/*
+	* Specify one level of the bound texture from the chain's memory
+	*/
+	static void uploadLevel(const MipChain& mips, size_t level, const TextureParams& params)
+	{
+		const MipLevel& source = mips.getLevels()[level];
+		const GLvoid* pixels = mips.data() + source.offset;
+		if (mips.isCompressed())
+		{
+			glCompressedTexImage2D(GL_TEXTURE_2D, (GLint)level, mips.getFormat(), source.width, source.height,
+				0, (GLsizei)source.size, pixels);
+			return;
+		}
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+		glTexImage2D(GL_TEXTURE_2D, (GLint)level, params.internalFormat, source.width, source.height,
+			0, params.picFormat, GL_UNSIGNED_BYTE, pixels);
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	}
+	/*
+	* Free budget for bytes more by dropping levels of the least recently needed textures.
+	* Levels a texture needed this frame are kept, as are those of keep.
+	*/
+	bool makeRoom(size_t bytes, const Streamed& keep)
+	{
+		while (this->residentBytes + bytes > this->budget)
+		{
+			Streamed* victim = NULL;
+			for (std::unordered_map<TextureHandle, std::unique_ptr<Streamed> >::iterator it = this->textures.begin();
+				this->textures.end() != it; ++it)
+			{
+				Streamed& candidate = *it->second;
+				const size_t keepLevel = candidate.lastNeeded == this->frame ? candidate.wantedLevel : candidate.tailLevel;
+				if (&candidate == &keep || candidate.baseLevel >= keepLevel)
+				{
+					continue;
+				}
+				if (!victim || candidate.lastNeeded < victim->lastNeeded)
+				{
+					victim = &candidate;
+				}
+			}
+			if (!victim)
+			{
+				return false;
+			}
+			this->lower(*victim);
+		}
+		return true;
+	}
+	/*
+	* Upload the level above the resident ones and start sampling from it
+	*/
+	void raise(Streamed& streamed)
+	{
+		const size_t level = streamed.baseLevel - 1;
+		glBindTexture(GL_TEXTURE_2D, streamed.id);
+		uploadLevel(streamed.mips, level, streamed.params);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, (GLint)level);
+		glBindTexture(GL_TEXTURE_2D, 0);
+		streamed.baseLevel = level;
+		const size_t levelBytes = (size_t)streamed.mips.getLevels()[level].size;
+		streamed.residentBytes += levelBytes;
+		this->residentBytes += levelBytes;
+	}
+	/*
+	* Stop sampling the finest resident level and redefine it empty
+	*/
+	void lower(Streamed& streamed)
+	{
+		const size_t level = streamed.baseLevel;
+		glBindTexture(GL_TEXTURE_2D, streamed.id);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, (GLint)level + 1);
+		if (streamed.mips.isCompressed())
+		{
+			glCompressedTexImage2D(GL_TEXTURE_2D, (GLint)level, streamed.mips.getFormat(), 0, 0, 0, 0, NULL);
+		}
+		else
+		{
+			glTexImage2D(GL_TEXTURE_2D, (GLint)level, streamed.params.internalFormat, 0, 0,
+				0, streamed.params.picFormat, GL_UNSIGNED_BYTE, NULL);
+		}
+		glBindTexture(GL_TEXTURE_2D, 0);
+		streamed.baseLevel = level + 1;
+		const size_t levelBytes = (size_t)streamed.mips.getLevels()[level].size;
+		streamed.residentBytes -= levelBytes;
+		this->residentBytes -= levelBytes;
+	}
+	/*
+	* Forget textures nobody but this holds any more, which deletes them
+	*/
+	void releaseUnused()
+	{
+		TextureRegistry& registry = TextureRegistry::instance();
+		std::unordered_map<TextureHandle, std::unique_ptr<Streamed> >::iterator it = this->textures.begin();
+		while (this->textures.end() != it)
+		{
+			if (registry.getRefCount(it->first) <= 1)
+			{
+				this->residentBytes -= it->second->residentBytes;
+				it = this->textures.erase(it);
+			}
+			else
+			{
+				++it;
+			}
+		}
+	}
+};
+
+#endif
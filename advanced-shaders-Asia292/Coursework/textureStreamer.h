@@ -0,0 +1,452 @@
+#ifndef _TEXTURE_STREAMER_H_
+#define _TEXTURE_STREAMER_H_
+
+#include <GLEW/glew.h>
+#include <SOIL/SOIL.h>
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "glHandle.h"
+#include "parallel.h"
+#include "texture.h"
+#include "textureMips.h"
+#include "textureRegistry.h"
+#include "textureResidency.h"
+
+/*
+* A texture requested from TextureStreamer. The handle stays 0 until the upload's fence
+* has signalled, the request then holds one registry reference for its owner. A request
+* that could not be loaded ends failed instead, callers check isFailed().
+*/
+class PendingTexture
+{
+public:
+	PendingTexture(const std::string& path, const TextureParams& params)
+		:path(path), params(params), state(STATE_DECODING), fileHash(0), pixelHash(0),
+		resident(false), retried(false), dds(false) {}
+	bool isReady() const { return this->state.load(std::memory_order_acquire) == STATE_READY; }
+	bool isFailed() const { return this->state.load(std::memory_order_acquire) == STATE_FAILED; }
+	bool isDone() const { return this->isReady() || this->isFailed(); }
+	TextureHandle getHandle() const { return this->isReady() ? this->reference.get() : INVALID_TEXTURE_HANDLE; }
+	GLuint getId() const { return TextureRegistry::instance().getId(this->getHandle()); }
+	const std::string& getPath() const { return this->path; }
+private:
+	friend class TextureStreamer;
+	enum State { STATE_DECODING, STATE_UPLOADING, STATE_READY, STATE_FAILED };
+	const std::string path;
+	const TextureParams params;
+	std::atomic<int> state;
+	// Written by the decode thread before the request is handed to the GL thread
+	uint64_t fileHash;
+	uint64_t pixelHash;
+	bool resident; // The registry held the file, nothing was decoded
+	bool retried; // Decoded after all because the resident entry was released meanwhile
+	bool dds; // Nothing to decode, the GL thread uploads straight from the file
+	MipChain mips;
+	// GL thread
+	TextureReference reference;
+};
+
+/*
+* Texture loading off the GL thread. A pool of decode threads maps cached mip chains,
+* or decodes image files and generates their chains (see MipCache); pump() copies
+* finished chains into a ring of pixel unpack buffers, so glTexImage2D reads from
+* GPU-visible memory, and fences each upload. A request is ready once its fence has
+* signalled. Decoding, uploads and rendering all overlap.
+* Textures are shared through TextureRegistry: files and pixels it already holds are
+* not uploaded again.
+*/
+class TextureStreamer
+{
+public:
+	static TextureStreamer& instance()
+	{
+		// Never destroyed, shutdown() releases the threads and GL objects
+		static TextureStreamer* streamer = new TextureStreamer();
+		return *streamer;
+	}
+	/*
+	* Queue a texture file for decoding, any thread. The result appears through pump().
+	*/
+	std::shared_ptr<PendingTexture> request(const std::string& path, const TextureParams& params = TextureParams())
+	{
+		std::shared_ptr<PendingTexture> pending = std::make_shared<PendingTexture>(path, params);
+		{
+			std::lock_guard<std::mutex> lock(this->jobMutex);
+			if (this->workers.empty())
+			{
+				this->startWorkers();
+			}
+			this->jobs.push_back(pending);
+		}
+		this->jobReady.notify_one();
+		return pending;
+	}
+	/*
+	* Complete uploads whose fence has signalled and start up to maxUploads new ones from
+	* the loaded mip chains. Call once per frame, GL thread. Returns the requests completed.
+	*/
+	size_t pump(size_t maxUploads = 4)
+	{
+		size_t completed = this->retireUploads();
+		{
+			std::lock_guard<std::mutex> lock(this->decodedMutex);
+			this->decoded.insert(this->decoded.end(), this->decodedShared.begin(), this->decodedShared.end());
+			this->decodedShared.clear();
+		}
+		TextureRegistry& registry = TextureRegistry::instance();
+		size_t uploads = 0;
+		while (!this->decoded.empty() && uploads < maxUploads)
+		{
+			PendingTexture& pending = *this->decoded.front();
+			const TextureHandle existing = registry.acquireExisting(pending.fileHash, pending.pixelHash, pending.params);
+			if (existing != INVALID_TEXTURE_HANDLE)
+			{
+				pending.mips.release();
+				pending.reference = TextureReference::adopt(existing);
+				// A copy of the same texture still in flight, ready once its fence has signalled
+				UploadSlot* uploading = this->uploadingSlot(existing);
+				if (uploading)
+				{
+					pending.state.store(PendingTexture::STATE_UPLOADING, std::memory_order_release);
+					uploading->sharing.push_back(this->decoded.front());
+				}
+				else
+				{
+					pending.state.store(PendingTexture::STATE_READY, std::memory_order_release);
+					++completed;
+				}
+			}
+			else if (pending.resident && !pending.retried)
+			{
+				// Released after the decode thread looked, decode it after all
+				pending.retried = true;
+				{
+					std::lock_guard<std::mutex> lock(this->jobMutex);
+					this->jobs.push_back(this->decoded.front());
+				}
+				this->jobReady.notify_one();
+			}
+			else if (pending.dds)
+			{
+				pending.reference = TextureReference::adopt(registry.acquire(pending.path, pending.params));
+				pending.state.store(pending.reference.get() != INVALID_TEXTURE_HANDLE
+					? PendingTexture::STATE_READY : PendingTexture::STATE_FAILED, std::memory_order_release);
+				++completed;
+			}
+			else if (pending.mips.empty())
+			{
+				pending.state.store(PendingTexture::STATE_FAILED, std::memory_order_release);
+				++completed;
+			}
+			else
+			{
+				UploadSlot* slot = this->freeSlot();
+				if (!slot)
+				{
+					break;
+				}
+				if (this->upload(this->decoded.front(), *slot))
+				{
+					++uploads;
+				}
+				else
+				{
+					++completed;
+				}
+			}
+			this->decoded.pop_front();
+		}
+		return completed;
+	}
+	/*
+	* Pump until one request is done, for loaders that need the texture before going on.
+	* Other requests keep progressing meanwhile. GL thread.
+	*/
+	bool wait(const PendingTexture& pending)
+	{
+		while (!pending.isDone())
+		{
+			if (this->pump(UPLOAD_SLOTS) == 0)
+			{
+				std::this_thread::yield();
+			}
+		}
+		return pending.isReady();
+	}
+	/*
+	* Stop the decode threads and free the upload buffers, call before the GL context goes.
+	* Requests not finished yet fail.
+	*/
+	void shutdown()
+	{
+		{
+			std::lock_guard<std::mutex> lock(this->jobMutex);
+			this->stopping = true;
+		}
+		this->jobReady.notify_all();
+		for (size_t i = 0; i < this->workers.size(); ++i)
+		{
+			this->workers[i].join();
+		}
+		this->workers.clear();
+		std::deque<std::shared_ptr<PendingTexture> > unfinished;
+		unfinished.swap(this->jobs);
+		unfinished.insert(unfinished.end(), this->decoded.begin(), this->decoded.end());
+		unfinished.insert(unfinished.end(), this->decodedShared.begin(), this->decodedShared.end());
+		this->decoded.clear();
+		this->decodedShared.clear();
+		for (size_t i = 0; i < unfinished.size(); ++i)
+		{
+			unfinished[i]->mips.release();
+			unfinished[i]->state.store(PendingTexture::STATE_FAILED, std::memory_order_release);
+		}
+		for (size_t i = 0; i < UPLOAD_SLOTS; ++i)
+		{
+			UploadSlot& slot = this->slots[i];
+			if (slot.fence)
+			{
+				glDeleteSync(slot.fence);
+				slot.fence = NULL;
+			}
+			// Textures already created stay valid, only the wait for the copy is cut short
+			if (slot.pending)
+			{
+				slot.pending->state.store(PendingTexture::STATE_READY, std::memory_order_release);
+				slot.pending.reset();
+			}
+			for (size_t j = 0; j < slot.sharing.size(); ++j)
+			{
+				slot.sharing[j]->state.store(PendingTexture::STATE_READY, std::memory_order_release);
+			}
+			slot.sharing.clear();
+			slot.buffer.reset();
+		}
+	}
+private:
+	static const size_t UPLOAD_SLOTS = 4; // Uploads in flight at once
+	// One pixel unpack buffer and the fence of the copy it last fed
+	struct UploadSlot
+	{
+		GLBuffer buffer;
+		GLsync fence;
+		std::shared_ptr<PendingTexture> pending;
+		std::vector<std::shared_ptr<PendingTexture> > sharing; // Requests that found the texture while it copies
+		UploadSlot() :fence(NULL) {}
+	};
+	std::mutex jobMutex; // Guards jobs, workers' start and stopping
+	std::condition_variable jobReady;
+	std::deque<std::shared_ptr<PendingTexture> > jobs;
+	std::vector<std::thread> workers;
+	bool stopping;
+	std::mutex decodedMutex; // Guards decodedShared
+	std::deque<std::shared_ptr<PendingTexture> > decodedShared; // Filled by the decode threads
+	std::deque<std::shared_ptr<PendingTexture> > decoded; // GL thread, waiting for a free slot
+	UploadSlot slots[UPLOAD_SLOTS];
+
+	TextureStreamer() :stopping(false) {}
+	TextureStreamer(const TextureStreamer&) = delete;
+	TextureStreamer& operator=(const TextureStreamer&) = delete;
+	/*
+	* One thread fewer than the cores, the GL thread keeps one. Called with jobMutex held.
+	*/
+	void startWorkers()
+	{
+		this->stopping = false;
+		const unsigned int count = std::max(1u, ParallelHelper::workerCount() - 1);
+		for (unsigned int i = 0; i < count; ++i)
+		{
+			this->workers.push_back(std::thread(&TextureStreamer::decodeLoop, this));
+		}
+	}
+	void decodeLoop()
+	{
+		// Mip generation and compression stay on this thread, the decoders already fill the cores
+		ParallelHelper::markWorkerThread();
+		for (;;)
+		{
+			std::shared_ptr<PendingTexture> pending;
+			{
+				std::unique_lock<std::mutex> lock(this->jobMutex);
+				this->jobReady.wait(lock, [this]() { return this->stopping || !this->jobs.empty(); });
+				if (this->stopping)
+				{
+					return;
+				}
+				pending = this->jobs.front();
+				this->jobs.pop_front();
+			}
+			this->decode(*pending);
+			// Moved so the last reference, and with it any texture, is never dropped on this thread
+			std::lock_guard<std::mutex> lock(this->decodedMutex);
+			this->decodedShared.push_back(std::move(pending));
+		}
+	}
+	/*
+	* Decode thread: hash the file, skip loading if the registry holds it, else load its mip chain
+	*/
+	void decode(PendingTexture& pending)
+	{
+		if (!pending.retried)
+		{
+			if (!TextureRegistry::hashFile(pending.path, pending.fileHash))
+			{
+				std::cerr << "Error:TextureStreamer::decode, could not open texture file: " << pending.path << std::endl;
+				return;
+			}
+			pending.resident = TextureRegistry::instance().find(pending.fileHash, pending.params) != INVALID_TEXTURE_HANDLE;
+			if (pending.resident)
+			{
+				return;
+			}
+		}
+		// A DDS chain is mapped, not decoded, so it is cheap enough to load on the GL thread
+		pending.dds = DdsFile::isDdsFile(pending.path);
+		if (pending.dds)
+		{
+			return;
+		}
+		if (!TextureRegistry::loadMips(pending.path, pending.fileHash, pending.params, pending.mips, pending.pixelHash))
+		{
+			std::cerr << "Error:TextureStreamer::decode, could not decode texture file: " << pending.path << std::endl;
+		}
+	}
+	/*
+	* Fences poll without blocking, the first check flushes so they can signal at all
+	*/
+	size_t retireUploads()
+	{
+		size_t completed = 0;
+		for (size_t i = 0; i < UPLOAD_SLOTS; ++i)
+		{
+			UploadSlot& slot = this->slots[i];
+			if (!slot.pending)
+			{
+				continue;
+			}
+			const GLenum status = glClientWaitSync(slot.fence, GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+			if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+			{
+				continue;
+			}
+			glDeleteSync(slot.fence);
+			slot.fence = NULL;
+			slot.pending->state.store(PendingTexture::STATE_READY, std::memory_order_release);
+			slot.pending.reset();
+			for (size_t j = 0; j < slot.sharing.size(); ++j)
+			{
+				slot.sharing[j]->state.store(PendingTexture::STATE_READY, std::memory_order_release);
+			}
+			completed += 1 + slot.sharing.size();
+			slot.sharing.clear();
+		}
+		return completed;
+	}
+	/*
+	* The slot still copying the texture behind handle, or NULL
+	*/
+	UploadSlot* uploadingSlot(TextureHandle handle)
+	{
+		for (size_t i = 0; i < UPLOAD_SLOTS; ++i)
+		{
+			if (this->slots[i].pending && this->slots[i].pending->reference.get() == handle)
+			{
+				return &this->slots[i];
+			}
+		}
+		return NULL;
+	}
+	UploadSlot* freeSlot()
+	{
+		for (size_t i = 0; i < UPLOAD_SLOTS; ++i)
+		{
+			if (!this->slots[i].pending)
+			{
+				return &this->slots[i];
+			}
+		}
+		return NULL;
+	}
+	/*
+	* Copy every level into the slot's buffer and create the texture from it. Streamed
+	* textures upload their mip tail only and hand the chain to TextureResidency. False when
+	* no texture could be created, the request has failed then. GL thread.
+	*/
+	bool upload(const std::shared_ptr<PendingTexture>& pendingPtr, UploadSlot& slot)
+	{
+		PendingTexture& pending = *pendingPtr;
+		MipChain& mips = pending.mips;
+		const int width = (int)mips.getLevels()[0].width, height = (int)mips.getLevels()[0].height;
+		GLuint textureId = 0;
+		if (pending.params.streamed)
+		{
+			// A few KB, not worth a buffer
+			textureId = TextureResidency::createTexture(mips, pending.params);
+		}
+		else
+		{
+			textureId = this->uploadThroughBuffer(mips, pending.params, slot);
+		}
+		const TextureHandle handle = TextureRegistry::instance().insert(pending.path, pending.fileHash,
+			pending.pixelHash, GLTexture(textureId), width, height, pending.params);
+		if (handle == INVALID_TEXTURE_HANDLE)
+		{
+			std::cerr << "Error:TextureStreamer::upload, could not create texture: " << pending.path << std::endl;
+			mips.release();
+			pending.state.store(PendingTexture::STATE_FAILED, std::memory_order_release);
+			return false;
+		}
+		if (pending.params.streamed)
+		{
+			TextureResidency::instance().track(handle, mips, pending.params);
+		}
+		mips.release();
+		pending.reference = TextureReference::adopt(handle);
+		pending.state.store(PendingTexture::STATE_UPLOADING, std::memory_order_release);
+		slot.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		slot.pending = pendingPtr;
+		return true;
+	}
+	/*
+	* Create a texture with every level, copied through the slot's pixel unpack buffer
+	*/
+	GLuint uploadThroughBuffer(const MipChain& mips, const TextureParams& params, UploadSlot& slot)
+	{
+		const GLsizeiptr size = (GLsizeiptr)mips.size();
+		if (slot.buffer.get() == 0)
+		{
+			slot.buffer.create();
+		}
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, slot.buffer.get());
+		// New storage each time, the driver never waits for the copy still reading the old one
+		glBufferData(GL_PIXEL_UNPACK_BUFFER, size, NULL, GL_STREAM_DRAW);
+		void* mapped = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, size,
+			GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+		GLuint textureId = 0;
+		if (mapped)
+		{
+			memcpy(mapped, mips.data(), (size_t)size);
+			if (glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER))
+			{
+				textureId = TextureRegistry::createTexture(mips, NULL, params);
+			}
+		}
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+		if (textureId == 0)
+		{
+			// Mapping failed, copy straight from system memory instead
+			textureId = TextureRegistry::createTexture(mips, mips.data(), params);
+		}
+		return textureId;
+	}
+};
+
+#endif
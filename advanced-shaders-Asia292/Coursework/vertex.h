@@ -0,0 +1,110 @@
+#ifndef _VERTEX_H_
+#define _VERTEX_H_
+
+#include <GLEW/glew.h>
+#include <glm/glm.hpp>
+#include <cstddef>
+#include "vertexPacking.h"
+
+// Vertex attributes
+struct Vertex
+{
+	glm::vec3 position;
+	glm::vec2 texCoords;
+	glm::vec3 normal;
+	glm::vec4 tangent; // w is the bitangent sign, see TangentGenerator
+};
+
+// Quantized vertex attributes, 20 bytes instead of 48
+struct CompactVertex
+{
+	GLushort position[4]; // Unsigned normalized, relative to the mesh bounds, [3] is padding
+	GLuint texCoords; // Two half floats
+	GLuint normal; // Octahedral x/y in 10:10:10:2
+	GLuint tangent; // Octahedral x/y in 10:10:10:2, w is the bitangent sign
+};
+
+// GPU vertex layout of a mesh
+enum VertexFormat
+{
+	VERTEX_FORMAT_FULL, // Vertex, 32-bit indices
+	VERTEX_FORMAT_COMPACT // CompactVertex, 16-bit indices when the vertex count allows
+};
+
+/*
+* GPU side description of the vertex formats, shared by per-mesh buffers and MeshBufferPool
+*/
+class VertexLayout
+{
+public:
+	static size_t vertexSize(VertexFormat format)
+	{
+		return format == VERTEX_FORMAT_COMPACT ? sizeof(CompactVertex) : sizeof(Vertex);
+	}
+	/*
+	* Point attributes 0-3 of the bound VAO at the bound GL_ARRAY_BUFFER
+	*/
+	static void setupAttributes(VertexFormat format)
+	{
+		if (format == VERTEX_FORMAT_COMPACT)
+		{
+			// Quantized position, decoded with positionOffset/positionScale
+			glVertexAttribPointer(0, 3, GL_UNSIGNED_SHORT, GL_TRUE,
+				sizeof(CompactVertex), (GLvoid*)offsetof(CompactVertex, position));
+			glEnableVertexAttribArray(0);
+			// Half float texture coords
+			glVertexAttribPointer(1, 2, GL_HALF_FLOAT, GL_FALSE,
+				sizeof(CompactVertex), (GLvoid*)offsetof(CompactVertex, texCoords));
+			glEnableVertexAttribArray(1);
+			// Octahedral normal and tangent
+			glVertexAttribPointer(2, 4, GL_INT_2_10_10_10_REV, GL_TRUE,
+				sizeof(CompactVertex), (GLvoid*)offsetof(CompactVertex, normal));
+			glEnableVertexAttribArray(2);
+			glVertexAttribPointer(3, 4, GL_INT_2_10_10_10_REV, GL_TRUE,
+				sizeof(CompactVertex), (GLvoid*)offsetof(CompactVertex, tangent));
+			glEnableVertexAttribArray(3);
+		}
+		else
+		{
+			// Vertex position attributes
+			glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE,
+				sizeof(Vertex), (GLvoid*)0);
+			glEnableVertexAttribArray(0);
+			// Vertex texture coords
+			glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE,
+				sizeof(Vertex), (GLvoid*)(3 * sizeof(GL_FLOAT)));
+			glEnableVertexAttribArray(1);
+			// Vertex normal vector
+			glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE,
+				sizeof(Vertex), (GLvoid*)(5 * sizeof(GL_FLOAT)));
+			glEnableVertexAttribArray(2);
+			// Vertex tangent vector and bitangent sign
+			glVertexAttribPointer(3, 4, GL_FLOAT, GL_FALSE,
+				sizeof(Vertex), (GLvoid*)(8 * sizeof(GL_FLOAT)));
+			glEnableVertexAttribArray(3);
+		}
+	}
+	/*
+	* Convert to the compact layout, positions are relative to the given bounds
+	*/
+	static void packVertices(const Vertex* vertPtr, size_t vertCount,
+		const glm::vec3& boundsMin, const glm::vec3& boundsMax, CompactVertex* out)
+	{
+		const glm::vec3 extent = boundsMax - boundsMin;
+		for (size_t i = 0; i < vertCount; ++i)
+		{
+			const Vertex& vertex = vertPtr[i];
+			for (int k = 0; k < 3; ++k)
+			{
+				out[i].position[k] = VertexPacking::quantizeUnorm16(vertex.position[k],
+					boundsMin[k], extent[k]);
+			}
+			out[i].position[3] = 0;
+			out[i].texCoords = VertexPacking::packHalf2(vertex.texCoords);
+			out[i].normal = VertexPacking::packDirection(vertex.normal, 1.0f);
+			out[i].tangent = VertexPacking::packDirection(glm::vec3(vertex.tangent), vertex.tangent.w);
+		}
+	}
+};
+
+#endif
@@ -0,0 +1,82 @@
+#ifndef _VERTEX_PACKING_H_
+#define _VERTEX_PACKING_H_
+
+#include <GLEW/glew.h>
+#include <glm/glm.hpp>
+#include <cmath>
+
+/*
+* Encoders for compact vertex attributes, decoded in scene.vertex
+*/
+class VertexPacking
+{
+public:
+	/*
+	* Octahedral encoding of a unit vector into [-1, 1]^2
+	*/
+	static glm::vec2 octEncode(glm::vec3 n)
+	{
+		const float sum = std::fabs(n.x) + std::fabs(n.y) + std::fabs(n.z);
+		if (sum <= 0.0f)
+		{
+			return glm::vec2(0.0f, 0.0f);
+		}
+		n /= sum;
+		glm::vec2 e(n.x, n.y);
+		if (n.z < 0.0f)
+		{
+			e = glm::vec2((1.0f - std::fabs(n.y)) * signNotZero(n.x),
+				(1.0f - std::fabs(n.x)) * signNotZero(n.y));
+		}
+		return e;
+	}
+	/*
+	* Pack to GL_INT_2_10_10_10_REV, components are signed normalized
+	*/
+	static GLuint packSnorm1010102(float x, float y, float z, float w)
+	{
+		return (GLuint)(snorm(x, 511.0f) & 0x3FF)
+			| ((GLuint)(snorm(y, 511.0f) & 0x3FF) << 10)
+			| ((GLuint)(snorm(z, 511.0f) & 0x3FF) << 20)
+			| ((GLuint)(snorm(w, 1.0f) & 0x3) << 30);
+	}
+	/*
+	* Normal or tangent as octahedral x/y in 10:10:10:2, w holds the bitangent sign
+	*/
+	static GLuint packDirection(const glm::vec3& dir, float sign)
+	{
+		const glm::vec2 e = octEncode(dir);
+		return packSnorm1010102(e.x, e.y, 0.0f, sign < 0.0f ? -1.0f : 1.0f);
+	}
+	/*
+	* Quantize a value inside [minValue, minValue + extent] to a 16-bit unsigned normalized integer
+	*/
+	static GLushort quantizeUnorm16(float value, float minValue, float extent)
+	{
+		if (extent <= 0.0f)
+		{
+			return 0;
+		}
+		const float t = glm::clamp((value - minValue) / extent, 0.0f, 1.0f);
+		return (GLushort)(t * 65535.0f + 0.5f);
+	}
+	/*
+	* Two half floats in one 32-bit word, x in the low half
+	*/
+	static GLuint packHalf2(const glm::vec2& v)
+	{
+		return glm::packHalf2x16(v);
+	}
+private:
+	static float signNotZero(float v)
+	{
+		return v >= 0.0f ? 1.0f : -1.0f;
+	}
+	static int snorm(float v, float scale)
+	{
+		const float clamped = glm::clamp(v, -1.0f, 1.0f) * scale;
+		return (int)(clamped >= 0.0f ? clamped + 0.5f : clamped - 0.5f);
+	}
+};
+
+#endif
@@ -0,0 +1,369 @@
+#ifndef _VIRTUAL_TEXTURE_H_
+#define _VIRTUAL_TEXTURE_H_
+
+#include <GLEW/glew.h>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <unordered_map>
+#include <vector>
+#include "textureMips.h"
+
+// Shared with assets/shaders/scene.frag and feedback.frag
+const uint32_t VIRTUAL_PAGE_SIZE = 128; // Texels of one page's content per side
+const uint32_t VIRTUAL_PAGE_BORDER = 4; // Texels copied from the neighbours on each side, for filtering
+const uint32_t VIRTUAL_PHYSICAL_PAGE_SIZE = VIRTUAL_PAGE_SIZE + 2 * VIRTUAL_PAGE_BORDER;
+
+/*
+* One page of one level of a virtual texture
+*/
+struct VirtualPage
+{
+	uint32_t texture; // VirtualTextureSystem id, 0 for none
+	uint32_t level;
+	uint32_t x, y; // Page column and row within the level
+	VirtualPage() :texture(0), level(0), x(0), y(0) {}
+	VirtualPage(uint32_t texture, uint32_t level, uint32_t x, uint32_t y) :texture(texture), level(level), x(x), y(y) {}
+	uint64_t key() const
+	{
+		return ((uint64_t)this->texture << 48) | ((uint64_t)this->level << 40) | ((uint64_t)this->y << 20) | this->x;
+	}
+};
+
+/*
+* CPU copy of one virtual texture's page table. Level L of the table has one entry per
+* page of mip level L, pointing at the page's slot in the physical cache; pages not
+* resident point at their nearest resident ancestor instead, so every lookup finds
+* something to sample. The root level, the finest held by a single page, must stay
+* resident. Entries are RGBA8: slot column, slot row, level found, 255.
+* Pages are placed by level 0 coordinates scaled down, uv * size / 2^level, rather than
+* by each level's rounded size, so a page's parent is always at half its coordinates.
+*/
+class VirtualPageTable
+{
+public:
+	VirtualPageTable() :width(0), height(0), tableWidth(0), tableHeight(0), rootLevel(0), dirty(false) {}
+	/*
+	* Size of level 0 in texels, every page starts out missing
+	*/
+	void reset(uint32_t width, uint32_t height)
+	{
+		this->width = std::max(width, 1u);
+		this->height = std::max(height, 1u);
+		this->rootLevel = 0;
+		while (this->pagesX(this->rootLevel) > 1 || this->pagesY(this->rootLevel) > 1)
+		{
+			++this->rootLevel;
+		}
+		// Power of two so each table level is exactly half the one below, see getTableWidth
+		this->tableWidth = this->tableHeight = 1;
+		while (this->tableWidth < this->pagesX(0))
+		{
+			this->tableWidth <<= 1;
+		}
+		while (this->tableHeight < this->pagesY(0))
+		{
+			this->tableHeight <<= 1;
+		}
+		this->slots.assign(this->rootLevel + 1, std::vector<int32_t>());
+		this->entries.assign(this->rootLevel + 1, std::vector<GLubyte>());
+		for (uint32_t level = 0; level <= this->rootLevel; ++level)
+		{
+			this->slots[level].assign((size_t)this->pagesX(level) * this->pagesY(level), -1);
+			this->entries[level].assign((size_t)this->getTableWidth(level) * this->getTableHeight(level) * 4, 0);
+		}
+		this->dirty = true;
+	}
+	uint32_t pagesX(uint32_t level) const
+	{
+		return pageCount(this->width, level);
+	}
+	uint32_t pagesY(uint32_t level) const
+	{
+		return pageCount(this->height, level);
+	}
+	/*
+	* Table level sizes, at least the page counts of the level
+	*/
+	uint32_t getTableWidth(uint32_t level) const { return std::max(this->tableWidth >> level, 1u); }
+	uint32_t getTableHeight(uint32_t level) const { return std::max(this->tableHeight >> level, 1u); }
+	uint32_t getRootLevel() const { return this->rootLevel; }
+	uint32_t getWidth() const { return this->width; }
+	uint32_t getHeight() const { return this->height; }
+	bool contains(uint32_t level, uint32_t x, uint32_t y) const
+	{
+		return level <= this->rootLevel && x < this->pagesX(level) && y < this->pagesY(level);
+	}
+	/*
+	* Physical cache slot of a page, -1 when it is not resident
+	*/
+	int32_t getSlot(uint32_t level, uint32_t x, uint32_t y) const
+	{
+		return this->slots[level][(size_t)y * this->pagesX(level) + x];
+	}
+	void setSlot(uint32_t level, uint32_t x, uint32_t y, int32_t slot)
+	{
+		this->slots[level][(size_t)y * this->pagesX(level) + x] = slot;
+		this->dirty = true;
+	}
+	bool isDirty() const { return this->dirty; }
+	/*
+	* Resolve every entry from the root down, slotsPerRow is the physical cache's width in pages
+	*/
+	void build(uint32_t slotsPerRow)
+	{
+		for (uint32_t level = this->rootLevel + 1; level-- > 0;)
+		{
+			const uint32_t tableWidth = this->getTableWidth(level), tableHeight = this->getTableHeight(level);
+			const uint32_t pagesX = this->pagesX(level), pagesY = this->pagesY(level);
+			std::vector<GLubyte>& entries = this->entries[level];
+			for (uint32_t y = 0; y < tableHeight; ++y)
+			{
+				for (uint32_t x = 0; x < tableWidth; ++x)
+				{
+					GLubyte* entry = &entries[((size_t)y * tableWidth + x) * 4];
+					const int32_t slot = x < pagesX && y < pagesY ? this->getSlot(level, x, y) : -1;
+					if (slot >= 0)
+					{
+						entry[0] = (GLubyte)(slot % slotsPerRow);
+						entry[1] = (GLubyte)(slot / slotsPerRow);
+						entry[2] = (GLubyte)level;
+						entry[3] = 255;
+					}
+					else if (level < this->rootLevel)
+					{
+						// A page covers a quarter of its parent's, so the parent is at half the coordinates
+						const std::vector<GLubyte>& parents = this->entries[level + 1];
+						memcpy(entry, &parents[((size_t)(y >> 1) * this->getTableWidth(level + 1) + (x >> 1)) * 4], 4);
+					}
+					else
+					{
+						memset(entry, 0, 4);
+					}
+				}
+			}
+		}
+		this->dirty = false;
+	}
+	const std::vector<GLubyte>& getEntries(uint32_t level) const { return this->entries[level]; }
+	/*
+	* Copy one page and its border out of a chain's level as RGBA8. Borders wrap around
+	* the level like GL_REPEAT, texels past the level's edge in its last pages too.
+	* out holds VIRTUAL_PHYSICAL_PAGE_SIZE squared texels.
+	*/
+	static bool buildPage(const MipChain& mips, const VirtualPage& page, GLubyte* out)
+	{
+		const int channels = mips.getChannels();
+		if (mips.isCompressed() || page.level >= mips.getLevels().size() || channels < 1 || channels > 4)
+		{
+			return false;
+		}
+		const MipLevel& level = mips.getLevels()[page.level];
+		const GLubyte* pixels = mips.data() + level.offset;
+		const int64_t originX = (int64_t)page.x * VIRTUAL_PAGE_SIZE - VIRTUAL_PAGE_BORDER;
+		const int64_t originY = (int64_t)page.y * VIRTUAL_PAGE_SIZE - VIRTUAL_PAGE_BORDER;
+		for (uint32_t y = 0; y < VIRTUAL_PHYSICAL_PAGE_SIZE; ++y)
+		{
+			const int64_t sourceY = wrap(originY + y, level.height);
+			const GLubyte* row = pixels + (size_t)sourceY * level.width * channels;
+			GLubyte* target = out + (size_t)y * VIRTUAL_PHYSICAL_PAGE_SIZE * 4;
+			for (uint32_t x = 0; x < VIRTUAL_PHYSICAL_PAGE_SIZE; ++x, target += 4)
+			{
+				const GLubyte* texel = row + (size_t)wrap(originX + x, level.width) * channels;
+				switch (channels)
+				{
+					case 1:
+						target[0] = target[1] = target[2] = texel[0];
+						target[3] = 255;
+						break;
+					case 2:
+						target[0] = texel[0];
+						target[1] = texel[1];
+						target[2] = 0;
+						target[3] = 255;
+						break;
+					case 3:
+						target[0] = texel[0];
+						target[1] = texel[1];
+						target[2] = texel[2];
+						target[3] = 255;
+						break;
+					default:
+						memcpy(target, texel, 4);
+						break;
+				}
+			}
+		}
+		return true;
+	}
+private:
+	uint32_t width, height;
+	uint32_t tableWidth, tableHeight; // Level 0 of the table
+	uint32_t rootLevel;
+	std::vector<std::vector<int32_t> > slots; // Per level, pagesX * pagesY
+	std::vector<std::vector<GLubyte> > entries; // Per level, table size * 4
+	bool dirty;
+
+	static uint32_t pageCount(uint32_t size, uint32_t level)
+	{
+		const uint64_t span = (uint64_t)VIRTUAL_PAGE_SIZE << level;
+		return (uint32_t)((size + span - 1) / span);
+	}
+	static int64_t wrap(int64_t coordinate, uint32_t size)
+	{
+		const int64_t wrapped = coordinate % (int64_t)size;
+		return wrapped < 0 ? wrapped + size : wrapped;
+	}
+};
+
+/*
+* Slots of the physical page cache. Free slots go first, then the least recently used
+* page that no draw needed this frame; pinned pages (texture roots) are never evicted.
+*/
+class VirtualPageCache
+{
+public:
+	VirtualPageCache() {}
+	void reset(uint32_t slotCount)
+	{
+		this->slots.assign(slotCount, Slot());
+		this->lookup.clear();
+	}
+	uint32_t getSlotCount() const { return (uint32_t)this->slots.size(); }
+	size_t getResidentCount() const { return this->lookup.size(); }
+	/*
+	* Slot of a resident page, -1 if there is none
+	*/
+	int32_t find(const VirtualPage& page) const
+	{
+		std::unordered_map<uint64_t, int32_t>::const_iterator it = this->lookup.find(page.key());
+		return it == this->lookup.end() ? -1 : it->second;
+	}
+	void touch(int32_t slot, uint64_t frame)
+	{
+		this->slots[slot].lastUsed = frame;
+	}
+	/*
+	* Pick a slot for a new page, -1 when every slot is pinned or needed this frame. A
+	* page evicted for it is returned in evicted, its texture's table must let it go.
+	*/
+	int32_t allocate(uint64_t frame, VirtualPage& evicted)
+	{
+		evicted = VirtualPage();
+		int32_t victim = -1;
+		for (size_t i = 0; i < this->slots.size(); ++i)
+		{
+			const Slot& slot = this->slots[i];
+			if (!slot.used)
+			{
+				return (int32_t)i;
+			}
+			if (slot.pinned || slot.lastUsed >= frame)
+			{
+				continue;
+			}
+			if (victim < 0 || slot.lastUsed < this->slots[victim].lastUsed)
+			{
+				victim = (int32_t)i;
+			}
+		}
+		if (victim >= 0)
+		{
+			evicted = this->slots[victim].page;
+			this->release(victim);
+		}
+		return victim;
+	}
+	void assign(int32_t slot, const VirtualPage& page, uint64_t frame, bool pinned)
+	{
+		Slot& target = this->slots[slot];
+		target.page = page;
+		target.lastUsed = frame;
+		target.used = true;
+		target.pinned = pinned;
+		this->lookup[page.key()] = slot;
+	}
+	void release(int32_t slot)
+	{
+		this->lookup.erase(this->slots[slot].page.key());
+		this->slots[slot] = Slot();
+	}
+	/*
+	* Free every slot of one texture
+	*/
+	void releaseTexture(uint32_t texture)
+	{
+		for (size_t i = 0; i < this->slots.size(); ++i)
+		{
+			if (this->slots[i].used && this->slots[i].page.texture == texture)
+			{
+				this->release((int32_t)i);
+			}
+		}
+	}
+private:
+	struct Slot
+	{
+		VirtualPage page;
+		uint64_t lastUsed;
+		bool used;
+		bool pinned;
+		Slot() :lastUsed(0), used(false), pinned(false) {}
+	};
+	std::vector<Slot> slots;
+	std::unordered_map<uint64_t, int32_t> lookup; // VirtualPage::key to slot
+};
+
+/*
+* Pages asked for by one feedback frame. Each feedback texel is RGBA8: page column,
+* page row, level and texture id, 0 where nothing virtual was drawn.
+*/
+struct VirtualPageRequest
+{
+	VirtualPage page;
+	uint32_t texels; // Feedback texels that asked for it
+};
+
+class VirtualFeedback
+{
+public:
+	/*
+	* Collect the distinct pages of a feedback readback, coarsest level first so missing
+	* fallbacks fill in before detail, then by how much of the screen wants them
+	*/
+	static void parse(const GLubyte* texels, size_t texelCount, std::vector<VirtualPageRequest>& requests)
+	{
+		requests.clear();
+		std::unordered_map<uint64_t, size_t> found;
+		for (size_t i = 0; i < texelCount; ++i)
+		{
+			const GLubyte* texel = texels + i * 4;
+			if (texel[3] == 0)
+			{
+				continue;
+			}
+			const VirtualPage page(texel[3], texel[2], texel[0], texel[1]);
+			std::unordered_map<uint64_t, size_t>::iterator it = found.find(page.key());
+			if (it != found.end())
+			{
+				++requests[it->second].texels;
+				continue;
+			}
+			found[page.key()] = requests.size();
+			VirtualPageRequest request;
+			request.page = page;
+			request.texels = 1;
+			requests.push_back(request);
+		}
+		std::sort(requests.begin(), requests.end(), [](const VirtualPageRequest& a, const VirtualPageRequest& b)
+		{
+			if (a.page.level != b.page.level)
+			{
+				return a.page.level > b.page.level;
+			}
+			return a.texels > b.texels;
+		});
+	}
+};
+
+#endif
@@ -0,0 +1,626 @@
+#ifndef _VIRTUAL_TEXTURE_SYSTEM_H_
+#define _VIRTUAL_TEXTURE_SYSTEM_H_
+
+#include <GLEW/glew.h>
+#include <algorithm>
+#include <cmath>
+#include <condition_variable>
+#include <deque>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+#include "glHandle.h"
+#include "parallel.h"
+#include "shader.h"
+#include "textureMips.h"
+#include "textureRegistry.h"
+#include "virtualTexture.h"
+
+// Fixed units, clear of the material textures Mesh::bindTextures counts up from 0
+const GLint VIRTUAL_PAGE_TABLE_UNIT = 13;
+const GLint VIRTUAL_PAGE_CACHE_UNIT = 14;
+
+/*
+* Sparse virtual texturing for colour maps too large to keep resident together. Each
+* texture is cut into pages of its mip levels; only the pages the view needs live in
+* one shared physical cache texture, and a per-texture page table (an RGBA8UI texture,
+* see VirtualPageTable) tells scene.frag where each page is. A low resolution feedback
+* render (feedback.frag, between beginFeedback and endFeedback) records the pages the
+* view samples; update() reads it back a frame or more later, a background thread
+* copies the missing pages out of the textures' mapped mip chains, widening them to
+* RGBA8 with filter borders, and update() uploads them coarsest level first.
+* Textures not added here keep using TextureHelper and TextureRegistry as before, and
+* a virtual texture falls back to its caller's ordinary texture until it is ready.
+* GL thread only, apart from the worker.
+*/
+class VirtualTextureSystem
+{
+public:
+	static const uint32_t FEEDBACK_DIVISOR = 8; // Feedback renders at this fraction of the viewport per side
+	static const uint32_t MAX_TEXTURES = 255; // Ids have 8 bits in the feedback
+	static const uint32_t MAX_TEXTURE_SIZE = 255 * VIRTUAL_PAGE_SIZE; // Texels per side, page x and y have 8 bits too
+	static const uint32_t MAX_QUEUED_PAGES = 64; // Page builds queued per feedback frame
+
+	static VirtualTextureSystem& instance()
+	{
+		// Never destroyed, shutdown() releases the thread and GL objects
+		static VirtualTextureSystem* system = new VirtualTextureSystem();
+		return *system;
+	}
+	/*
+	* Physical cache size in pages per side, before the first texture is ready. The default
+	* 30 pages make a 4080 texel square, 64MB.
+	*/
+	void setCacheSize(uint32_t pagesPerSide)
+	{
+		if (this->cacheTexture.get() != 0)
+		{
+			std::cerr << "Error:VirtualTextureSystem::setCacheSize, the cache already exists" << std::endl;
+			return;
+		}
+		this->slotsPerRow = std::min(std::max(pagesPerSide, 1u), 255u);
+	}
+	/*
+	* Make a colour map virtual, its chain loads on the worker. Returns its id, the same
+	* for the same path, or 0 when there are MAX_TEXTURES already. A texture larger than
+	* MAX_TEXTURE_SIZE is rejected once loaded and never becomes ready.
+	*/
+	uint32_t addTexture(const std::string& path)
+	{
+		std::map<std::string, uint32_t>::const_iterator it = this->textureIds.find(path);
+		if (it != this->textureIds.end())
+		{
+			return it->second;
+		}
+		if (this->textures.size() >= MAX_TEXTURES)
+		{
+			std::cerr << "Error:VirtualTextureSystem::addTexture, too many virtual textures: " << path << std::endl;
+			return 0;
+		}
+		const uint32_t id = (uint32_t)this->textures.size() + 1;
+		this->textures.push_back(std::unique_ptr<VirtualTexture>(new VirtualTexture(id, path)));
+		this->textureIds[path] = id;
+		{
+			std::lock_guard<std::mutex> lock(this->jobMutex);
+			if (!this->worker.joinable())
+			{
+				this->stopping = false;
+				this->worker = std::thread(&VirtualTextureSystem::workerLoop, this);
+			}
+			this->loadJobs.push_back(this->textures.back().get());
+		}
+		this->jobReady.notify_one();
+		return id;
+	}
+	bool isReady(uint32_t id) const
+	{
+		return id != 0 && id <= this->textures.size() && this->textures[id - 1]->ready;
+	}
+	/*
+	* Set the virtual uniforms of scene.frag or feedback.frag for one texture. False while
+	* the texture is not ready, the caller samples its ordinary texture then.
+	*/
+	bool bind(const Shader& shader, uint32_t id) const
+	{
+		if (!this->isReady(id))
+		{
+			return false;
+		}
+		const VirtualTexture& texture = *this->textures[id - 1];
+		glActiveTexture(GL_TEXTURE0 + VIRTUAL_PAGE_TABLE_UNIT);
+		glBindTexture(GL_TEXTURE_2D, texture.pageTable.get());
+		glActiveTexture(GL_TEXTURE0 + VIRTUAL_PAGE_CACHE_UNIT);
+		glBindTexture(GL_TEXTURE_2D, this->cacheTexture.get());
+		const float cacheSize = (float)(this->slotsPerRow * VIRTUAL_PHYSICAL_PAGE_SIZE);
+		glUniform2f(glGetUniformLocation(shader.programId, "virtualSize"),
+			(float)texture.table.getWidth(), (float)texture.table.getHeight());
+		glUniform1i(glGetUniformLocation(shader.programId, "virtualMaxLevel"), (GLint)texture.table.getRootLevel());
+		glUniform1i(glGetUniformLocation(shader.programId, "virtualTextureId"), (GLint)id);
+		glUniform1f(glGetUniformLocation(shader.programId, "pageCacheScale"), 1.0f / cacheSize);
+		// Feedback texels are FEEDBACK_DIVISOR times larger, so their derivatives are too
+		glUniform1f(glGetUniformLocation(shader.programId, "feedbackLodBias"),
+			this->inFeedback ? -std::log2((float)FEEDBACK_DIVISOR) : 0.0f);
+		return true;
+	}
+	/*
+	* Point the virtual samplers at their own units and switch the virtual path on or off.
+	* Needed for every draw with these shaders: sampler types may not share a unit even
+	* when one of them goes unused.
+	*/
+	static void bindSamplers(const Shader& shader, bool enabled)
+	{
+		glUniform1i(glGetUniformLocation(shader.programId, "pageTable"), VIRTUAL_PAGE_TABLE_UNIT);
+		glUniform1i(glGetUniformLocation(shader.programId, "pageCache"), VIRTUAL_PAGE_CACHE_UNIT);
+		glUniform1i(glGetUniformLocation(shader.programId, "virtualDiffuse"), enabled);
+	}
+	/*
+	* Render the feedback pass into the low resolution target until endFeedback. Draw the
+	* scene with a feedback.frag program as usual.
+	*/
+	void beginFeedback()
+	{
+		glGetIntegerv(GL_VIEWPORT, this->savedViewport);
+		glGetFloatv(GL_COLOR_CLEAR_VALUE, this->savedClearColor);
+		const GLsizei width = std::max<GLsizei>(this->savedViewport[2] / (GLsizei)FEEDBACK_DIVISOR, 1);
+		const GLsizei height = std::max<GLsizei>(this->savedViewport[3] / (GLsizei)FEEDBACK_DIVISOR, 1);
+		if (width != this->feedbackWidth || height != this->feedbackHeight)
+		{
+			this->createFeedbackTarget(width, height);
+		}
+		glBindFramebuffer(GL_FRAMEBUFFER, this->feedbackFramebuffer.get());
+		glViewport(0, 0, width, height);
+		// Alpha 0 is no texture
+		glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+		this->inFeedback = true;
+	}
+	/*
+	* Start reading the feedback back and return to the default framebuffer. The read
+	* goes into a pixel pack buffer mapped by a later update(), so it never stalls.
+	*/
+	void endFeedback()
+	{
+		FeedbackReadback& readback = this->readbacks[this->nextReadback];
+		// Every buffer still in flight, skip this frame's feedback
+		if (!readback.fence)
+		{
+			if (readback.buffer.get() == 0)
+			{
+				readback.buffer.create();
+			}
+			readback.texelCount = (size_t)this->feedbackWidth * this->feedbackHeight;
+			glBindBuffer(GL_PIXEL_PACK_BUFFER, readback.buffer.get());
+			glBufferData(GL_PIXEL_PACK_BUFFER, (GLsizeiptr)(readback.texelCount * 4), NULL, GL_STREAM_READ);
+			glReadPixels(0, 0, this->feedbackWidth, this->feedbackHeight, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+			glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+			readback.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+			this->nextReadback = (this->nextReadback + 1) % FEEDBACK_READBACKS;
+		}
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+		glViewport(this->savedViewport[0], this->savedViewport[1], this->savedViewport[2], this->savedViewport[3]);
+		glClearColor(this->savedClearColor[0], this->savedClearColor[1], this->savedClearColor[2], this->savedClearColor[3]);
+		this->inFeedback = false;
+	}
+	/*
+	* Finish texture loads, turn feedback that has arrived into page requests and upload
+	* up to maxUploads built pages. Call once per frame. Returns the pages uploaded.
+	*/
+	size_t update(size_t maxUploads = 16)
+	{
+		this->finishLoads();
+		this->readFeedback();
+		const size_t uploaded = this->uploadPages(maxUploads);
+		for (size_t i = 0; i < this->textures.size(); ++i)
+		{
+			VirtualTexture& texture = *this->textures[i];
+			if (texture.ready && texture.table.isDirty())
+			{
+				this->uploadTable(texture);
+			}
+		}
+		++this->frame;
+		return uploaded;
+	}
+	size_t getTextureCount() const { return this->textures.size(); }
+	size_t getResidentPages() const { return this->pageCache.getResidentCount(); }
+	uint32_t getCacheSlots() const { return this->pageCache.getSlotCount(); }
+	/*
+	* Stop the worker and free every GL object, call before the GL context goes
+	*/
+	void shutdown()
+	{
+		{
+			std::lock_guard<std::mutex> lock(this->jobMutex);
+			this->stopping = true;
+		}
+		this->jobReady.notify_all();
+		if (this->worker.joinable())
+		{
+			this->worker.join();
+		}
+		this->loadJobs.clear();
+		this->pageJobs.clear();
+		this->inFlight.clear();
+		this->loaded.clear();
+		this->built.clear();
+		this->pendingPages.clear();
+		for (size_t i = 0; i < FEEDBACK_READBACKS; ++i)
+		{
+			if (this->readbacks[i].fence)
+			{
+				glDeleteSync(this->readbacks[i].fence);
+				this->readbacks[i].fence = NULL;
+			}
+			this->readbacks[i].buffer.reset();
+		}
+		this->feedbackFramebuffer.reset();
+		this->feedbackColor.reset();
+		this->feedbackDepth.reset();
+		this->feedbackWidth = this->feedbackHeight = 0;
+		this->textures.clear();
+		this->textureIds.clear();
+		this->cacheTexture.reset();
+		this->pageCache.reset(0);
+	}
+private:
+	static const size_t FEEDBACK_READBACKS = 3; // Readbacks in flight at once
+	static const uint32_t DEFAULT_CACHE_PAGES = 30;
+
+	struct VirtualTexture
+	{
+		const uint32_t id;
+		const std::string path;
+		MipChain mips; // Written by the worker's load, then only read
+		// GL thread
+		VirtualPageTable table;
+		GLTexture pageTable;
+		bool ready;
+		VirtualTexture(uint32_t id, const std::string& path) :id(id), path(path), ready(false) {}
+	};
+	struct PageJob
+	{
+		VirtualTexture* texture;
+		VirtualPage page;
+	};
+	// A page copied out of its chain by the worker
+	struct BuiltPage
+	{
+		VirtualTexture* texture;
+		VirtualPage page;
+		std::vector<GLubyte> texels; // Empty when the copy failed
+	};
+	struct FeedbackReadback
+	{
+		GLBuffer buffer;
+		GLsync fence;
+		size_t texelCount;
+		FeedbackReadback() :fence(NULL), texelCount(0) {}
+	};
+	std::vector<std::unique_ptr<VirtualTexture> > textures; // Index id - 1
+	std::map<std::string, uint32_t> textureIds;
+	GLTexture cacheTexture;
+	VirtualPageCache pageCache;
+	uint32_t slotsPerRow;
+	uint64_t frame;
+	// Feedback pass
+	GLFramebuffer feedbackFramebuffer;
+	GLRenderbuffer feedbackColor, feedbackDepth;
+	GLsizei feedbackWidth, feedbackHeight;
+	GLint savedViewport[4];
+	GLfloat savedClearColor[4];
+	bool inFeedback;
+	FeedbackReadback readbacks[FEEDBACK_READBACKS];
+	size_t nextReadback;
+	std::vector<VirtualPageRequest> requests; // Scratch for readFeedback
+	// Worker
+	std::thread worker;
+	std::mutex jobMutex; // Guards the jobs, inFlight and stopping
+	std::condition_variable jobReady;
+	std::deque<VirtualTexture*> loadJobs;
+	std::deque<PageJob> pageJobs; // Replaced by each feedback, most wanted first
+	std::unordered_set<uint64_t> inFlight; // Pages taken by the worker and not uploaded yet
+	bool stopping;
+	std::mutex doneMutex; // Guards loaded and built
+	std::vector<VirtualTexture*> loaded;
+	std::vector<BuiltPage> built;
+	std::deque<BuiltPage> pendingPages; // GL thread, waiting for an upload
+
+	VirtualTextureSystem() :slotsPerRow(DEFAULT_CACHE_PAGES), frame(1), feedbackWidth(0), feedbackHeight(0),
+		inFeedback(false), nextReadback(0), stopping(false) {}
+	VirtualTextureSystem(const VirtualTextureSystem&) = delete;
+	VirtualTextureSystem& operator=(const VirtualTextureSystem&) = delete;
+
+	/*
+	* Load settings of the chains pages are cut from: plain texels, filtered like any colour map
+	*/
+	static TextureParams chainParams()
+	{
+		return TextureParams(MIP_MODE_SRGB);
+	}
+	void workerLoop()
+	{
+		// Mip generation stays on this thread so loading never competes with the frame for every core
+		ParallelHelper::markWorkerThread();
+		for (;;)
+		{
+			VirtualTexture* loadTexture = NULL;
+			PageJob job;
+			{
+				std::unique_lock<std::mutex> lock(this->jobMutex);
+				this->jobReady.wait(lock, [this]()
+				{
+					return this->stopping || !this->loadJobs.empty() || !this->pageJobs.empty();
+				});
+				if (this->stopping)
+				{
+					return;
+				}
+				// A texture's first pages wait on its chain, so loads go first
+				if (!this->loadJobs.empty())
+				{
+					loadTexture = this->loadJobs.front();
+					this->loadJobs.pop_front();
+				}
+				else
+				{
+					job = this->pageJobs.front();
+					this->pageJobs.pop_front();
+					this->inFlight.insert(job.page.key());
+				}
+			}
+			if (loadTexture)
+			{
+				uint64_t fileHash = 0, pixelHash = 0;
+				if (!TextureRegistry::hashFile(loadTexture->path, fileHash)
+					|| !TextureRegistry::loadMips(loadTexture->path, fileHash, chainParams(), loadTexture->mips, pixelHash))
+				{
+					loadTexture->mips.release();
+				}
+				std::lock_guard<std::mutex> lock(this->doneMutex);
+				this->loaded.push_back(loadTexture);
+				continue;
+			}
+			BuiltPage page;
+			page.texture = job.texture;
+			page.page = job.page;
+			page.texels.resize((size_t)VIRTUAL_PHYSICAL_PAGE_SIZE * VIRTUAL_PHYSICAL_PAGE_SIZE * 4);
+			if (!VirtualPageTable::buildPage(job.texture->mips, job.page, &page.texels[0]))
+			{
+				page.texels.clear();
+			}
+			std::lock_guard<std::mutex> lock(this->doneMutex);
+			this->built.push_back(std::move(page));
+		}
+	}
+	/*
+	* Give loaded textures their page table and resident root page
+	*/
+	void finishLoads()
+	{
+		std::vector<VirtualTexture*> finished;
+		{
+			std::lock_guard<std::mutex> lock(this->doneMutex);
+			finished.swap(this->loaded);
+		}
+		for (size_t i = 0; i < finished.size(); ++i)
+		{
+			VirtualTexture& texture = *finished[i];
+			if (texture.mips.empty() || texture.mips.isCompressed())
+			{
+				std::cerr << "Error:VirtualTextureSystem::finishLoads, could not load texture: " << texture.path << std::endl;
+				continue;
+			}
+			if (this->cacheTexture.get() == 0 && !this->createCache())
+			{
+				continue;
+			}
+			const MipLevel& top = texture.mips.getLevels()[0];
+			if (top.width > MAX_TEXTURE_SIZE || top.height > MAX_TEXTURE_SIZE)
+			{
+				std::cerr << "Error:VirtualTextureSystem::finishLoads, texture larger than " << MAX_TEXTURE_SIZE
+					<< " texels per side: " << texture.path << std::endl;
+				texture.mips.release();
+				continue;
+			}
+			texture.table.reset(top.width, top.height);
+			const VirtualPage root(texture.id, texture.table.getRootLevel(), 0, 0);
+			std::vector<GLubyte> texels((size_t)VIRTUAL_PHYSICAL_PAGE_SIZE * VIRTUAL_PHYSICAL_PAGE_SIZE * 4);
+			if (!VirtualPageTable::buildPage(texture.mips, root, &texels[0]) || !this->residePage(texture, root, texels, true))
+			{
+				std::cerr << "Error:VirtualTextureSystem::finishLoads, no cache slot for the root of: "
+					<< texture.path << std::endl;
+				continue;
+			}
+			texture.pageTable.create();
+			glBindTexture(GL_TEXTURE_2D, texture.pageTable.get());
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, (GLint)texture.table.getRootLevel());
+			for (uint32_t level = 0; level <= texture.table.getRootLevel(); ++level)
+			{
+				glTexImage2D(GL_TEXTURE_2D, (GLint)level, GL_RGBA8UI, texture.table.getTableWidth(level),
+					texture.table.getTableHeight(level), 0, GL_RGBA_INTEGER, GL_UNSIGNED_BYTE, NULL);
+			}
+			glBindTexture(GL_TEXTURE_2D, 0);
+			texture.ready = true;
+		}
+	}
+	/*
+	* The physical cache, shrunk to the largest texture the implementation allows
+	*/
+	bool createCache()
+	{
+		GLint maxSize = 0;
+		glGetIntegerv(GL_MAX_TEXTURE_SIZE, &maxSize);
+		this->slotsPerRow = std::min(this->slotsPerRow, (uint32_t)maxSize / VIRTUAL_PHYSICAL_PAGE_SIZE);
+		if (this->slotsPerRow == 0)
+		{
+			std::cerr << "Error:VirtualTextureSystem::createCache, textures are too small for a page" << std::endl;
+			return false;
+		}
+		const GLsizei size = (GLsizei)(this->slotsPerRow * VIRTUAL_PHYSICAL_PAGE_SIZE);
+		this->cacheTexture.create();
+		glBindTexture(GL_TEXTURE_2D, this->cacheTexture.get());
+		// Pages come from MIP_MODE_SRGB chains stored like TextureHelper's colour maps, without decoding
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, size, size, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+		glBindTexture(GL_TEXTURE_2D, 0);
+		this->pageCache.reset(this->slotsPerRow * this->slotsPerRow);
+		return true;
+	}
+	void createFeedbackTarget(GLsizei width, GLsizei height)
+	{
+		this->feedbackColor.create();
+		glBindRenderbuffer(GL_RENDERBUFFER, this->feedbackColor.get());
+		glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+		this->feedbackDepth.create();
+		glBindRenderbuffer(GL_RENDERBUFFER, this->feedbackDepth.get());
+		glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+		glBindRenderbuffer(GL_RENDERBUFFER, 0);
+		this->feedbackFramebuffer.create();
+		glBindFramebuffer(GL_FRAMEBUFFER, this->feedbackFramebuffer.get());
+		glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, this->feedbackColor.get());
+		glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, this->feedbackDepth.get());
+		if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+		{
+			std::cerr << "Error:VirtualTextureSystem::createFeedbackTarget, framebuffer incomplete" << std::endl;
+		}
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+		this->feedbackWidth = width;
+		this->feedbackHeight = height;
+	}
+	/*
+	* Map every readback that has arrived and queue the pages it asks for
+	*/
+	void readFeedback()
+	{
+		for (size_t i = 0; i < FEEDBACK_READBACKS; ++i)
+		{
+			FeedbackReadback& readback = this->readbacks[i];
+			if (!readback.fence)
+			{
+				continue;
+			}
+			const GLenum status = glClientWaitSync(readback.fence, GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+			if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+			{
+				continue;
+			}
+			glDeleteSync(readback.fence);
+			readback.fence = NULL;
+			glBindBuffer(GL_PIXEL_PACK_BUFFER, readback.buffer.get());
+			const GLubyte* texels = (const GLubyte*)glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0,
+				(GLsizeiptr)(readback.texelCount * 4), GL_MAP_READ_BIT);
+			if (texels)
+			{
+				VirtualFeedback::parse(texels, readback.texelCount, this->requests);
+				glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+				this->queuePages(this->requests);
+			}
+			glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+		}
+	}
+	/*
+	* Mark requested resident pages used and hand the missing ones to the worker in
+	* place of the last feedback's
+	*/
+	void queuePages(const std::vector<VirtualPageRequest>& pageRequests)
+	{
+		std::deque<PageJob> jobs;
+		for (std::vector<VirtualPageRequest>::const_iterator it = pageRequests.begin(); pageRequests.end() != it; ++it)
+		{
+			const VirtualPage& page = it->page;
+			if (!this->isReady(page.texture))
+			{
+				continue;
+			}
+			VirtualTexture& texture = *this->textures[page.texture - 1];
+			if (!texture.table.contains(page.level, page.x, page.y))
+			{
+				continue;
+			}
+			const int32_t slot = texture.table.getSlot(page.level, page.x, page.y);
+			if (slot >= 0)
+			{
+				this->pageCache.touch(slot, this->frame);
+			}
+			else if (jobs.size() < MAX_QUEUED_PAGES)
+			{
+				PageJob job;
+				job.texture = &texture;
+				job.page = page;
+				jobs.push_back(job);
+			}
+		}
+		{
+			std::lock_guard<std::mutex> lock(this->jobMutex);
+			this->pageJobs.clear();
+			for (std::deque<PageJob>::const_iterator it = jobs.begin(); jobs.end() != it; ++it)
+			{
+				if (this->inFlight.count(it->page.key()) == 0)
+				{
+					this->pageJobs.push_back(*it);
+				}
+			}
+		}
+		this->jobReady.notify_one();
+	}
+	size_t uploadPages(size_t maxUploads)
+	{
+		{
+			std::lock_guard<std::mutex> lock(this->doneMutex);
+			for (size_t i = 0; i < this->built.size(); ++i)
+			{
+				this->pendingPages.push_back(std::move(this->built[i]));
+			}
+			this->built.clear();
+		}
+		size_t uploaded = 0;
+		while (!this->pendingPages.empty() && uploaded < maxUploads)
+		{
+			BuiltPage& page = this->pendingPages.front();
+			VirtualTexture& texture = *page.texture;
+			if (!page.texels.empty() && texture.table.getSlot(page.page.level, page.page.x, page.page.y) < 0)
+			{
+				// Dropped when the cache is full of pages this frame needs, a later feedback asks again
+				if (this->residePage(texture, page.page, page.texels, false))
+				{
+					++uploaded;
+				}
+			}
+			{
+				std::lock_guard<std::mutex> lock(this->jobMutex);
+				this->inFlight.erase(page.page.key());
+			}
+			this->pendingPages.pop_front();
+		}
+		return uploaded;
+	}
+	/*
+	* Put one page in a cache slot, evicting the least recently used page if need be
+	*/
+	bool residePage(VirtualTexture& texture, const VirtualPage& page, const std::vector<GLubyte>& texels, bool pinned)
+	{
+		VirtualPage evicted;
+		const int32_t slot = this->pageCache.allocate(this->frame, evicted);
+		if (slot < 0)
+		{
+			return false;
+		}
+		if (evicted.texture != 0)
+		{
+			this->textures[evicted.texture - 1]->table.setSlot(evicted.level, evicted.x, evicted.y, -1);
+		}
+		glBindTexture(GL_TEXTURE_2D, this->cacheTexture.get());
+		glTexSubImage2D(GL_TEXTURE_2D, 0, (GLint)((slot % this->slotsPerRow) * VIRTUAL_PHYSICAL_PAGE_SIZE),
+			(GLint)((slot / this->slotsPerRow) * VIRTUAL_PHYSICAL_PAGE_SIZE), VIRTUAL_PHYSICAL_PAGE_SIZE,
+			VIRTUAL_PHYSICAL_PAGE_SIZE, GL_RGBA, GL_UNSIGNED_BYTE, &texels[0]);
+		glBindTexture(GL_TEXTURE_2D, 0);
+		this->pageCache.assign(slot, page, this->frame, pinned);
+		texture.table.setSlot(page.level, page.x, page.y, slot);
+		return true;
+	}
+	void uploadTable(VirtualTexture& texture)
+	{
+		texture.table.build(this->slotsPerRow);
+		glBindTexture(GL_TEXTURE_2D, texture.pageTable.get());
+		for (uint32_t level = 0; level <= texture.table.getRootLevel(); ++level)
+		{
+			glTexSubImage2D(GL_TEXTURE_2D, (GLint)level, 0, 0, texture.table.getTableWidth(level),
+				texture.table.getTableHeight(level), GL_RGBA_INTEGER, GL_UNSIGNED_BYTE,
+				&texture.table.getEntries(level)[0]);
+		}
+		glBindTexture(GL_TEXTURE_2D, 0);
+	}
+};
+
+#endif